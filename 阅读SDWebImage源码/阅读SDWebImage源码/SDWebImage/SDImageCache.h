@@ -9,6 +9,12 @@
 #import <Foundation/Foundation.h>
 #import "SDWebImageCompat.h"
 #import "SDImageCacheConfig.h"
+#import "SDImageCacheMemoryStore.h"
+#import "SDImageCacheMemoryGovernor.h"
+
+@class SDImageCacheValidators;
+@class SDImageCacheGroup;
+@class SDImageCacheStatistics;
 
 typedef NS_ENUM(NSInteger, SDImageCacheType) {
     /**
@@ -25,12 +31,44 @@ typedef NS_ENUM(NSInteger, SDImageCacheType) {
     SDImageCacheTypeMemory
 };
 
+/**
+ * 磁盘缓存查询的优先级，在读取队列中优先级高的查询会先执行
+ */
+typedef NS_ENUM(NSInteger, SDImageCacheQueryPriority) {
+    /**
+     * 默认的优先级
+     */
+    SDImageCacheQueryPriorityNormal = 0,
+    /**
+     * 正在显示的图片（比如可见的cell），排在所有普通查询和预取查询的前面
+     */
+    SDImageCacheQueryPriorityUserVisible,
+    /**
+     * 预取、预热这类投机性的查询，只在没有其它查询时执行
+     */
+    SDImageCacheQueryPriorityPrefetch
+};
+
 typedef void(^SDCacheQueryCompletedBlock)(UIImage * _Nullable image, NSData * _Nullable data, SDImageCacheType cacheType);
 
+/**
+ * 批量查询时每找到一张图片调用一次，内存命中时data为nil
+ */
+typedef void(^SDCacheBatchQueryProgressBlock)(UIImage * _Nonnull image, NSData * _Nullable data, SDImageCacheType cacheType, NSString * _Nonnull key);
+
+/**
+ * 批量查询完成时调用一次，images中只包含找到的图片
+ */
+typedef void(^SDCacheBatchQueryCompletedBlock)(NSDictionary<NSString *, UIImage *> * _Nonnull images);
+
 typedef void(^SDWebImageCheckCacheCompletionBlock)(BOOL isInCache);
 
 typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger totalSize);
 
+/**
+ * 开启config.shouldShareDiskCacheAcrossProcesses时，其它进程修改了磁盘缓存之后在主线程发出，object为对应的SDImageCache
+ */
+extern NSString * _Nonnull const SDImageCacheDiskCacheDidChangeNotification;
 
 /**
  * SDImageCache maintains a memory cache and an optional disk cache. Disk cache write operations are performed
@@ -43,7 +81,10 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
 /** 通过SDImageCacheConfig这个类来管理缓存的配置信息 */
 @property (nonatomic, nonnull, readonly) SDImageCacheConfig *config;
 
-/** 可以通过maxMemoryCost来设置内存的最大缓存是多少，这个是以像素为单位的 */
+/** 所在的缓存组，通过SDImageCacheGroup的addCache:weight:minimumSize:加入，不属于任何组时为nil */
+@property (weak, nonatomic, nullable, readonly) SDImageCacheGroup *group;
+
+/** 可以通过maxMemoryCost来设置内存的最大缓存是多少，以图片解码后实际占用的字节数为单位（见SDImageCacheMemoryCostForImage） */
 @property (assign, nonatomic) NSUInteger maxMemoryCost;
 
 /** 可以通过maxMemoryCountLimit来设置内存的最大缓存数量是多少 */
@@ -59,7 +100,15 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
 
 /** 通过指定的namespace和directory来 */
 - (nonnull instancetype)initWithNamespace:(nonnull NSString *)ns
-                       diskCacheDirectory:(nonnull NSString *)directory NS_DESIGNATED_INITIALIZER;
+                       diskCacheDirectory:(nonnull NSString *)directory;
+
+/**
+ * 通过指定的namespace、directory和配置来初始化，config会被copy一份
+ * 磁盘布局相关的配置（比如diskCacheShardWidth）只在这里读取一次，之后修改不会生效
+ */
+- (nonnull instancetype)initWithNamespace:(nonnull NSString *)ns
+                       diskCacheDirectory:(nonnull NSString *)directory
+                                   config:(nullable SDImageCacheConfig *)config NS_DESIGNATED_INITIALIZER;
 // 注意：如果想设置某个方法为指定的初始化方法，通过NS_DESIGNATED_INITIALIZER来实现
 
 #pragma mark - Cache paths
@@ -76,6 +125,23 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
  */
 - (void)addReadOnlyCachePath:(nonnull NSString *)path;
 
+/**
+ * 添加一个只读缓存包（由SDImageCacheBundleBuilder生成），磁盘缓存未命中时会在所有缓存包中查找，
+ * 每个缓存包只需要一次哈希查找，不访问文件系统，比addReadOnlyCachePath:更适合随App发布大量预置图片
+ *
+ * @param path 缓存包文件的路径
+ *
+ * @return 缓存包不存在或者格式不正确时返回NO
+ */
+- (BOOL)addReadOnlyCacheBundleAtPath:(nonnull NSString *)path;
+
+/**
+ * 按照磁盘索引同步遍历磁盘缓存中记录了key的图片，用来生成缓存包（见SDImageCacheBundleBuilder），不要在主线程调用
+ * 单独存成文件的图片给出filePath，保存在pack segment中的图片给出读取到的data，别名给出它指向的内容；
+ * 旧版本写入的、重建索引之后的文件没有记录key，不会被遍历到
+ */
+- (void)enumerateDiskCacheKeysUsingBlock:(nonnull void(^)(NSString * _Nonnull key, NSString * _Nullable filePath, NSData * _Nullable data))block;
+
 #pragma mark - Store Ops
 
 /**
@@ -119,6 +185,19 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
             toDisk:(BOOL)toDisk
         completion:(nullable SDWebImageNoParamsBlock)completionBlock;
 
+/**
+ * 异步存储图片到内存和磁盘中，同时给图片打上tag，之后可以用removeImagesWithTag:completion:一起删除
+ * 写到磁盘的图片还会记录key，可以用removeImagesWithKeyPrefix:completion:按前缀删除
+ *
+ * @param tags 图片的tag，比如租户或者活动的标识，再次写入同一个key时会替换掉之前的tag
+ */
+- (void)storeImage:(nullable UIImage *)image
+         imageData:(nullable NSData *)imageData
+            forKey:(nullable NSString *)key
+              tags:(nullable NSSet<NSString *> *)tags
+            toDisk:(BOOL)toDisk
+        completion:(nullable SDWebImageNoParamsBlock)completionBlock;
+
 /**
  * 同步存储图片到磁盘中
  *
@@ -129,6 +208,36 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
  */
 - (void)storeImageDataToDisk:(nullable NSData *)imageData forKey:(nullable NSString *)key;
 
+/**
+ * 异步把写入缓冲中还没写到磁盘的数据全部写入，之前排队的写入都完成后在主线程调用completion
+ * 可以用作写入的屏障，比如在需要确保图片已经落盘的时候调用
+ */
+- (void)flushDiskWritesWithCompletion:(nullable SDWebImageNoParamsBlock)completion;
+
+#pragma mark - HTTP validators
+
+/**
+ * 同步获取某个key在磁盘缓存中保存的HTTP验证信息（ETag、Last-Modified）和新鲜期，只查询内存中的索引
+ *
+ * @return 磁盘中没有这个key，或者下载时没有保存验证信息时返回nil
+ */
+- (nullable SDImageCacheValidators *)validatorsForKey:(nullable NSString *)key;
+
+/**
+ * 异步保存某个key的HTTP验证信息，比如下载完成之后，或者服务器返回304重新验证之后
+ * 只更新磁盘索引中已经存在的记录，磁盘中没有这个key时什么都不做；图片还在写入缓冲中时，等它写到磁盘时一起保存
+ */
+- (void)storeValidators:(nullable SDImageCacheValidators *)validators forKey:(nullable NSString *)key;
+
+#pragma mark - Warm start
+
+/**
+ * 在后台把上次记录的热点图片从磁盘读取、解码并放到内存缓存中，完成后在主线程调用completion
+ * 以最低的优先级在读取队列中执行，总开销和时间分别受config.maxHotImagePreloadCost和maxHotImagePreloadDuration限制，
+ * 已经在内存中的图片会被跳过。config.maxHotImageCount为0或者shouldCacheImagesInMemory为NO时什么都不做
+ */
+- (void)preloadHotImagesWithCompletion:(nullable SDWebImageNoParamsBlock)completion;
+
 #pragma mark - Query and Retrieve Ops
 
 /**
@@ -137,6 +246,7 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
  *  @param key             the key describing the url
  *  @param completionBlock the block to be executed when the check is done.
  *  @note the completion block will be always executed on the main queue
+ *  @note 和磁盘查询一样在读取队列中并发执行，不会排在其它key的写入和清理之后
  */
 - (void)diskImageExistsWithKey:(nullable NSString *)key completion:(nullable SDWebImageCheckCacheCompletionBlock)completionBlock;
 
@@ -147,9 +257,54 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
  * @param doneBlock The completion block. Will not get called if the operation is cancelled
  *
  * @return a NSOperation instance containing the cache op
+ * @note 磁盘查询在一个有并发上限的读取队列中执行（见SDImageCacheConfig的maxConcurrentDiskReads），
+ *       同一个key还有没完成的写入或删除时，查询会排到ioQueue中，保证读到的是最新的数据
  */
 - (nullable NSOperation *)queryCacheOperationForKey:(nullable NSString *)key done:(nullable SDCacheQueryCompletedBlock)doneBlock;
 
+/**
+ * 按照指定的优先级异步查询图片
+ *
+ * @param key       The unique key used to store the wanted image
+ * @param priority  查询的优先级
+ * @param doneBlock The completion block. Will not get called if the operation is cancelled
+ *
+ * @return a NSOperation instance containing the cache op
+ * @note 查询还在排队时可以修改返回的operation的queuePriority来调整顺序（比如cell滑出屏幕后降为预取）；
+ *       读取完成后、解码完成后都会检查是否已经被取消，取消后不会再解码，也不会调用doneBlock
+ */
+- (nullable NSOperation *)queryCacheOperationForKey:(nullable NSString *)key
+                                           priority:(SDImageCacheQueryPriority)priority
+                                               done:(nullable SDCacheQueryCompletedBlock)doneBlock;
+
+/**
+ * 批量查询一组key，适合列表、网格一次要显示很多图片的场景
+ * 内存命中的直接同步返回，其余的key放在一个operation中按照磁盘上的位置依次读取和解码，
+ * 只需要一次排队和一次最终回调，而不是每个key各自一个operation和一次主线程回调
+ *
+ * @param keys           要查询的key，重复的key只查一次
+ * @param completedBlock 全部查询完成后调用一次，images中只包含找到的图片
+ *
+ * @return 有磁盘查询时返回对应的operation，可以用来取消；全部内存命中时返回nil
+ */
+- (nullable NSOperation *)queryCacheForKeys:(nonnull NSArray<NSString *> *)keys
+                                  completed:(nullable SDCacheBatchQueryCompletedBlock)completedBlock;
+
+/**
+ * 按照指定的优先级批量查询一组key，可以通过progressBlock流式地拿到每一张图片
+ *
+ * @param keys           要查询的key，重复的key只查一次
+ * @param priority       磁盘查询的优先级
+ * @param progressBlock  每找到一张图片调用一次，内存命中时同步调用，磁盘命中时在主线程调用
+ * @param completedBlock 全部查询完成后调用一次，全部内存命中时同步调用，否则在主线程调用。取消之后不会再调用
+ *
+ * @return 有磁盘查询时返回对应的operation，可以用来取消；全部内存命中时返回nil
+ */
+- (nullable NSOperation *)queryCacheForKeys:(nonnull NSArray<NSString *> *)keys
+                                   priority:(SDImageCacheQueryPriority)priority
+                                   progress:(nullable SDCacheBatchQueryProgressBlock)progressBlock
+                                  completed:(nullable SDCacheBatchQueryCompletedBlock)completedBlock;
+
 /**
  * 同步在内存中查询图片
  *
@@ -157,6 +312,23 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
  */
 - (nullable UIImage *)imageFromMemoryCacheForKey:(nullable NSString *)key;
 
+/**
+ * 设置key在内存缓存中的优先级，比如把头像和界面元素设为高优先级或者固定在内存中，列表快速滑动时不会被挤出去
+ * 对象还不在内存缓存中时也会记住，之后写入这个key时使用这个优先级，设置为SDImageCacheMemoryPriorityNormal时清除
+ *
+ * @param key The unique key used to store the image
+ */
+- (void)setMemoryCachePriority:(SDImageCacheMemoryPriority)priority forKey:(nullable NSString *)key;
+
+/**
+ * 同步获取磁盘缓存中保存的预览图（见SDImageCacheConfig的previewImageMaxPixelSize），只查询内存中的磁盘索引，
+ * 不访问文件系统也不解码，可以在主线程调用，完整的图片读取和解码完成之前先显示预览图
+ *
+ * @param key The unique key used to store the image
+ * @return 磁盘中没有这个key，或者写入时没有生成预览图时返回nil
+ */
+- (nullable UIImage *)previewImageForKey:(nullable NSString *)key;
+
 /**
  * 同步在磁盘中查询图片
  *
@@ -195,6 +367,18 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
 /** 清空内存 */
 - (void)clearMemory;
 
+/**
+ * 异步删除带有某个tag的所有图片（内存、写入缓冲和磁盘），完成之后在主线程调用completion
+ * 通过磁盘索引只访问带有这个tag的记录，不需要遍历整个缓存
+ */
+- (void)removeImagesWithTag:(nonnull NSString *)tag completion:(nullable SDWebImageNoParamsBlock)completion;
+
+/**
+ * 异步删除key以prefix开头的所有图片，完成之后在主线程调用completion
+ * @note 磁盘索引升级之前写入的图片没有记录key，不会被删除；只保存在内存中的图片只有带tag时才能按前缀找到
+ */
+- (void)removeImagesWithKeyPrefix:(nonnull NSString *)prefix completion:(nullable SDWebImageNoParamsBlock)completion;
+
 /** 异步清空磁盘 */
 - (void)clearDiskOnCompletion:(nullable SDWebImageNoParamsBlock)completion;
 
@@ -212,6 +396,17 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
 /** 异步获取disk使用size */
 - (void)calculateSizeWithCompletionBlock:(nullable SDWebImageCalculateSizeBlock)completionBlock;
 
+#pragma mark - Statistics
+
+/**
+ * 当前统计信息的快照：内存、磁盘和只读路径的命中数，未命中数，读写的字节数，淘汰和过期清理的文件数，
+ * 以及磁盘读取和解码时间的分布。所有计数都是原子操作，不加锁，开销可以忽略
+ */
+- (nonnull SDImageCacheStatistics *)statistics;
+
+/** 清空统计信息，比如每次上报之后调用 */
+- (void)resetStatistics;
+
 #pragma mark - Cache Paths
 
 /**
@@ -225,7 +420,7 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
 - (nullable NSString *)cachePathForKey:(nullable NSString *)key inPath:(nonnull NSString *)path;
 
 /**
- *  获取默认的缓存路径
+ *  获取默认的缓存路径，开启分片后返回的是分片子目录下的路径
  *
  *  @param key the key (can be obtained from url using cacheKeyForURL)
  *
@@ -13,47 +13,213 @@
 #import "UIImage+GIF.h"
 #import "NSData+ImageContentType.h"
 #import "NSImage+WebCache.h"
+#import "SDImageCacheIndex.h"
+#import "SDImageCachePackStore.h"
+#import "SDImageCacheBloomFilter.h"
+#import "SDImageCacheBundle.h"
+#import "SDImageCacheHotSet.h"
+#import "SDImageCacheKey.h"
+#import "SDImageCacheEvictionPolicy.h"
+#import "SDImageCacheValidators.h"
+#import "SDImageCacheBitmapStore.h"
+#import "SDImageCacheIOBackend.h"
+#import "SDImageCacheProcessCoordinator.h"
+#import "SDImageCacheGroup.h"
+#import "SDImageCachePreview.h"
+#import "SDImageCacheStatistics.h"
+#import "SDImageCacheMemoryStore.h"
+
+#define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+#define UNLOCK(lock) dispatch_semaphore_signal(lock);
+
+NSString *const SDImageCacheDiskCacheDidChangeNotification = @"SDImageCacheDiskCacheDidChangeNotification";
+
+// 写入缓冲中还没有写到磁盘的一次写入，同一个key的多次写入会合并成一个，只写最后一次的数据
+@interface SDImageCachePendingWrite : NSObject
+
+@property (strong, nonatomic, nullable) UIImage *image;
+@property (strong, nonatomic, nullable) NSData *imageData;
+// 写入时指定的tag，写到磁盘之后记录到磁盘索引中
+@property (copy, nonatomic, nullable) NSSet<NSString *> *tags;
+// 写入之后通过storeValidators:forKey:保存的验证信息，写到磁盘时一起记录到磁盘索引中
+@property (copy, nonatomic, nullable) SDImageCacheValidators *validators;
+// 在写入缓冲中占用的字节数，没有imageData时按照图片解码后的字节数估算
+@property (assign, nonatomic) NSUInteger cost;
+@property (strong, nonatomic, nonnull) NSMutableArray<SDWebImageNoParamsBlock> *completionBlocks;
 
-// See https://github.com/rs/SDWebImage/pull/1141 for discussion
-@interface AutoPurgeCache : NSCache
 @end
 
-@implementation AutoPurgeCache
+@implementation SDImageCachePendingWrite
 
 - (nonnull instancetype)init {
-    self = [super init];
-    if (self) {
-#if SD_UIKIT
-        // 设计AutoPurgeCache的目的是在收到警告时，释放缓存的所有资源。
-        [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(removeAllObjects) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
-#endif
+    if ((self = [super init])) {
+        _completionBlocks = [NSMutableArray new];
     }
     return self;
 }
 
-- (void)dealloc {
-#if SD_UIKIT
-    [[NSNotificationCenter defaultCenter] removeObserver:self name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
-#endif
+@end
+
+// 读取队列中异步完成的operation：block提交读取之后就返回，调用finish之后operation才结束，
+// 这样读取队列的并发数和优先级限制的是整批读取（包括IO后端回调中的解码），而不只是提交
+@interface SDImageCacheAsyncReadOperation : NSOperation
+
+@property (assign, nonatomic, getter = isExecuting) BOOL executing;
+@property (assign, nonatomic, getter = isFinished) BOOL finished;
+
+- (nonnull instancetype)initWithBlock:(nonnull void(^)(SDImageCacheAsyncReadOperation * _Nonnull operation))block;
+
+// 可以在任意线程中调用，只有第一次调用有效
+- (void)finish;
+
+@end
+
+@implementation SDImageCacheAsyncReadOperation {
+    void(^_block)(SDImageCacheAsyncReadOperation *operation);
+    dispatch_semaphore_t _lock;
+}
+
+@synthesize executing = _executing;
+@synthesize finished = _finished;
+
+- (nonnull instancetype)initWithBlock:(nonnull void(^)(SDImageCacheAsyncReadOperation * _Nonnull operation))block {
+    if ((self = [super init])) {
+        _block = [block copy];
+        _lock = dispatch_semaphore_create(1);
+    }
+    return self;
+}
+
+- (void)start {
+    LOCK(_lock);
+    if (self.isFinished || self.isExecuting) {
+        UNLOCK(_lock);
+        return;
+    }
+    if (self.isCancelled) {
+        self.finished = YES;
+        _block = nil;
+        UNLOCK(_lock);
+        return;
+    }
+    self.executing = YES;
+    UNLOCK(_lock);
+    _block(self);
+}
+
+- (void)finish {
+    LOCK(_lock);
+    if (self.isExecuting) {
+        self.executing = NO;
+        self.finished = YES;
+        _block = nil;
+    }
+    UNLOCK(_lock);
+}
+
+- (void)setFinished:(BOOL)finished {
+    [self willChangeValueForKey:@"isFinished"];
+    _finished = finished;
+    [self didChangeValueForKey:@"isFinished"];
+}
+
+- (void)setExecuting:(BOOL)executing {
+    [self willChangeValueForKey:@"isExecuting"];
+    _executing = executing;
+    [self didChangeValueForKey:@"isExecuting"];
+}
+
+- (BOOL)isAsynchronous {
+    return YES;
 }
 
 @end
 
-// FOUNDATION_STATIC_INLINE 表示该函数是一个具有文件内部访问权限的内联函数，所谓的内联函数就是建议编译器在调用时将函数展开。建议的意思就是说编译器不一定会按照你的建议做
-// 图片在该缓存中的大小是通过像素来衡量的
-FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
-#if SD_MAC
-    return image.size.height * image.size.width;
-#elif SD_UIKIT || SD_WATCH
-    return image.size.height * image.size.width * image.scale * image.scale;
-#endif
+// 查询优先级对应到读取队列中operation的优先级
+FOUNDATION_STATIC_INLINE NSOperationQueuePriority SDOperationQueuePriorityForQueryPriority(SDImageCacheQueryPriority priority) {
+    switch (priority) {
+        case SDImageCacheQueryPriorityUserVisible:
+            return NSOperationQueuePriorityVeryHigh;
+        case SDImageCacheQueryPriorityPrefetch:
+            return NSOperationQueuePriorityVeryLow;
+        default:
+            return NSOperationQueuePriorityNormal;
+    }
+}
+
+// 分片宽度的上限，4位十六进制字符就已经是65536个子目录了
+static const NSUInteger kMaxDiskCacheShardWidth = 4;
+// 后台迁移旧的平铺文件时，每次在ioQueue中处理的文件个数，保证读写操作可以穿插执行
+static const NSUInteger kShardMigrationBatchSize = 64;
+// 磁盘索引所在的目录名，以点开头，遍历缓存目录时会被当做隐藏文件跳过
+static NSString * const kDiskIndexDirectoryName = @".index";
+// pack segment文件所在的目录名，同样以点开头
+static NSString * const kPackDirectoryName = @".packs";
+// 单个pack segment文件的最大尺寸
+static const NSUInteger kMaxPackSegmentSize = 4 * 1024 * 1024;
+// 写入缓冲没有写满时，第一次写入之后等待这么久再批量写到磁盘，期间同一个key的写入会被合并
+static const NSTimeInterval kDiskWriteCoalescingInterval = 0.25;
+// 增量淘汰每一步最多删除的文件个数和最长的执行时间，每一步之间ioQueue中排队的读写可以穿插执行
+static const NSUInteger kEvictionStepMaxFileCount = 32;
+static const CFTimeInterval kEvictionStepMaxDuration = 0.005;
+// 缓存已满时，淘汰策略用来和新文件比较的候选记录个数
+static const NSUInteger kAdmissionCandidateCount = 16;
+// 内容去重时，保存图片数据的文件的扩展名，文件名是内容的哈希值
+static NSString * const kContentFileExtension = @"content";
+// 热点key保存的文件名，以点开头，遍历缓存目录时会被跳过
+static NSString * const kHotSetFileName = @".hotset";
+// 解码后的像素数据保存在这个子目录中
+static NSString * const kBitmapDirectoryName = @".bitmaps";
+// 除了进入后台和退出，每隔这么久也保存一次热点key
+static const NSTimeInterval kHotSetSaveInterval = 5 * 60;
+// 多个进程共享磁盘缓存时，任意一个进程清理过之后这么久之内，其它进程不再重复清理
+static const NSTimeInterval kSharedCleanupInterval = 60;
+// 缓存文件名中摘要的字节数（128位），key的文件名和内容文件名都是这个长度
+static const NSUInteger kContentDigestLength = 16;
+
+// 判断一个文件名是不是SDImageCache生成的缓存文件名（32位十六进制的摘要，后面可能跟着扩展名）
+// 现在的128位摘要和旧版本的MD5长度相同，两种文件名都能识别
+static BOOL SDIsCacheFileName(NSString *fileName) {
+    if (fileName.length < kContentDigestLength * 2) {
+        return NO;
+    }
+    for (NSUInteger i = 0; i < kContentDigestLength * 2; i++) {
+        unichar c = [fileName characterAtIndex:i];
+        BOOL isHex = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+        if (!isHex) {
+            return NO;
+        }
+    }
+    return fileName.length == kContentDigestLength * 2 || [fileName characterAtIndex:kContentDigestLength * 2] == '.';
+}
+
+// 内容去重时保存图片数据的文件名：SHA-256的前128位，长度和key的文件名一致，重建索引时也能被识别为缓存文件
+// 用加密哈希是因为图片内容来自网络，不能让别人构造出和其它图片哈希相同的数据
+static NSString *SDContentFileNameForData(NSData *data) {
+    unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256(data.bytes, (CC_LONG)data.length, digest);
+    NSMutableString *fileName = [NSMutableString stringWithCapacity:kContentDigestLength * 2 + 1 + kContentFileExtension.length];
+    for (NSUInteger i = 0; i < kContentDigestLength; i++) {
+        [fileName appendFormat:@"%02x", digest[i]];
+    }
+    [fileName appendFormat:@".%@", kContentFileExtension];
+    return fileName;
 }
 
+// 磁盘数据的来源，用于统计命中
+typedef NS_ENUM(NSInteger, SDImageCacheDataSource) {
+    SDImageCacheDataSourceNone = 0,
+    // 自己的磁盘缓存，包括pack segment、旧文件名和保存的像素数据
+    SDImageCacheDataSourceDisk,
+    // 只读缓存包和只读路径
+    SDImageCacheDataSourceReadOnly
+};
+
 @interface SDImageCache ()
 
 #pragma mark - Properties
 // 内存容器
-@property (strong, nonatomic, nonnull) NSCache *memCache;
+@property (strong, nonatomic, nonnull) SDImageCacheMemoryStore *memCache;
 // 硬盘缓存路径
 @property (strong, nonatomic, nonnull) NSString *diskCachePath;
 // 自定义的读取路径，这是一个数组，我们可以通过addReadOnlyCachePath:这个方法往里边添加路径。当我们读取图片的时候，这个数组的路径也会作为数据源
@@ -61,6 +227,32 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 // Create IO serial queue   创建一个IO串行队列, 称作输入输出队列，队列往往可以当做一种“锁”来使用，我们把某些任务按照顺利一步一步的进行，必须考虑线程是否安全
 //_ioQueue = dispatch_queue_create("com.hackemist.SDWebImageCache", DISPATCH_QUEUE_SERIAL);
 @property (SDDispatchQueueSetterSementics, nonatomic, nullable) dispatch_queue_t ioQueue;
+// 磁盘读取队列，查询和判断是否存在都在这里并发执行，并发数由config.maxConcurrentDiskReads控制
+// 写入、删除、清理仍然在串行的ioQueue中执行
+@property (strong, nonatomic, nonnull) NSOperationQueue *readQueue;
+// 是否正在把旧的平铺文件迁移到分片子目录中，迁移期间读取和删除需要兼顾旧路径
+@property (assign, atomic) BOOL migratingFlatLayout;
+// 磁盘中可能还有旧版本用MD5命名的文件，没有的话未命中时不再计算MD5文件名和查找
+// 新的写入都会在索引中记录key，索引中没有key的记录（去重的内容文件除外）才可能是旧文件
+@property (assign, atomic) BOOL mayContainLegacyFiles;
+// 磁盘索引，统计大小、数量以及清理过期文件时不再需要遍历整个缓存目录
+@property (strong, nonatomic, nonnull) SDImageCacheIndex *diskIndex;
+// 保存小图片的pack segment文件，每条记录的位置保存在磁盘索引中
+@property (strong, nonatomic, nonnull) SDImageCachePackStore *packStore;
+// 磁盘缓存的淘汰策略，由config.diskCacheEvictionPolicy决定
+@property (strong, nonatomic, nonnull) id<SDImageCacheEvictionPolicy> evictionPolicy;
+// 统计命中最多的key，用于下次启动时预加载，config.maxHotImageCount为0时为nil
+@property (strong, nonatomic, nullable) SDImageCacheHotSet *hotSet;
+// 保存解码后的像素数据，磁盘命中时不需要再解码，config.maxDecodedDiskCacheSize为0时为nil
+@property (strong, nonatomic, nullable) SDImageCacheBitmapStore *bitmapStore;
+// 读写单独的缓存文件使用的IO后端，批量读写时一批文件一起提交
+@property (strong, nonatomic, nonnull) id<SDImageCacheIOBackend> ioBackend;
+// 和其它进程共享磁盘缓存时的协调者，config.shouldShareDiskCacheAcrossProcesses为NO时为nil
+@property (strong, nonatomic, nullable) SDImageCacheProcessCoordinator *coordinator;
+// 所在的缓存组，由SDImageCacheGroup设置
+@property (weak, nonatomic, nullable, readwrite) SDImageCacheGroup *group;
+// 命中、读写字节数、淘汰数以及读取和解码时间的统计
+@property (strong, nonatomic, nonnull) SDImageCacheStatisticsRecorder *statisticsRecorder;
 
 @end
 
@@ -68,6 +260,39 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 @implementation SDImageCache {
     // 文件管理者
     NSFileManager *_fileManager;
+    // 分片宽度，初始化时从config中读取，之后不再改变
+    NSUInteger _shardWidth;
+    // 已经创建过的分片子目录，只在ioQueue中访问，避免每次写入都去检查目录是否存在
+    NSMutableSet<NSString *> *_createdShardDirectories;
+    // pack目录是否已经设置过禁用iCloud备份，只在ioQueue中访问
+    BOOL _packDirectoryExcludedFromBackup;
+    // 每个key还没完成的磁盘写入（包括删除）的个数，有写入时这个key的读取要排到ioQueue中
+    NSMutableDictionary<NSString *, NSNumber *> *_pendingDiskWrites;
+    dispatch_semaphore_t _pendingDiskWritesLock;
+    // IO后端正在写入的文件名对应的那一批写入，这一批写完并记录到索引之后离开对应的dispatch group
+    NSMutableDictionary<NSString *, dispatch_group_t> *_inFlightWriteGroups;
+    dispatch_semaphore_t _inFlightWritesLock;
+    // 每个只读路径中文件名的布隆过滤器，路径扫描完成之前没有对应的过滤器
+    NSMutableDictionary<NSString *, SDImageCacheBloomFilter *> *_customPathFilters;
+    dispatch_semaphore_t _customPathFiltersLock;
+    // 通过addReadOnlyCacheBundleAtPath:添加的只读缓存包，添加时整体替换，用_customPathFiltersLock保护
+    NSArray<SDImageCacheBundle *> *_readOnlyBundles;
+    // 增量淘汰的候选记录（按照淘汰顺序排列）和下一个要处理的位置，只在ioQueue中访问
+    NSArray<SDImageCacheIndexEntry *> *_evictionCandidates;
+    NSUInteger _evictionCursor;
+    BOOL _evictionScheduled;
+    // 写入缓冲：key -> 还没写到磁盘的写入，按照第一次写入的顺序排列
+    NSMutableDictionary<NSString *, SDImageCachePendingWrite *> *_bufferedWrites;
+    NSMutableOrderedSet<NSString *> *_bufferedWriteOrder;
+    NSUInteger _bufferedWriteBytes;
+    // 是否已经安排了一次延迟的批量写入
+    BOOL _bufferFlushScheduled;
+    dispatch_semaphore_t _bufferedWritesLock;
+    // 定期保存热点key的定时器，在ioQueue中触发
+    dispatch_source_t _hotSetSaveTimer;
+    // 只保存在内存中（toDisk为NO）的图片的tag：tag -> key，磁盘上的图片的tag记录在磁盘索引中
+    NSMutableDictionary<NSString *, NSMutableSet<NSString *> *> *_memoryTaggedKeys;
+    dispatch_semaphore_t _memoryTagsLock;
 }
 
 #pragma mark - Singleton, init, dealloc
@@ -92,6 +317,12 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 
 - (nonnull instancetype)initWithNamespace:(nonnull NSString *)ns
                        diskCacheDirectory:(nonnull NSString *)directory {
+    return [self initWithNamespace:ns diskCacheDirectory:directory config:nil];
+}
+
+- (nonnull instancetype)initWithNamespace:(nonnull NSString *)ns
+                       diskCacheDirectory:(nonnull NSString *)directory
+                                   config:(nullable SDImageCacheConfig *)config {
     if ((self = [super init])) {
         NSString *fullNamespace = [@"com.hackemist.SDWebImageCache." stringByAppendingString:ns];
         
@@ -99,11 +330,37 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
         _ioQueue = dispatch_queue_create("com.hackemist.SDWebImageCache", DISPATCH_QUEUE_SERIAL);
         
         // 创建图片缓存配置
-        _config = [[SDImageCacheConfig alloc] init];
+        _config = config ? [config copy] : [[SDImageCacheConfig alloc] init];
+        _shardWidth = MIN(_config.diskCacheShardWidth, kMaxDiskCacheShardWidth);
+        _createdShardDirectories = [NSMutableSet new];
+        _pendingDiskWrites = [NSMutableDictionary new];
+        _pendingDiskWritesLock = dispatch_semaphore_create(1);
+        _inFlightWriteGroups = [NSMutableDictionary new];
+        _inFlightWritesLock = dispatch_semaphore_create(1);
+        _customPathFilters = [NSMutableDictionary new];
+        _customPathFiltersLock = dispatch_semaphore_create(1);
+        _bufferedWrites = [NSMutableDictionary new];
+        _bufferedWriteOrder = [NSMutableOrderedSet new];
+        _bufferedWritesLock = dispatch_semaphore_create(1);
+        // 加载索引之后再确定
+        _mayContainLegacyFiles = YES;
+        _statisticsRecorder = [SDImageCacheStatisticsRecorder new];
+        _memoryTaggedKeys = [NSMutableDictionary new];
+        _memoryTagsLock = dispatch_semaphore_create(1);
+        
+        // 创建读取队列，磁盘索引恢复之前先挂起，避免读取时找不到pack中的图片
+        _readQueue = [NSOperationQueue new];
+        _readQueue.name = [fullNamespace stringByAppendingString:@".read"];
+        _readQueue.maxConcurrentOperationCount = _config.maxConcurrentDiskReads > 0 ? _config.maxConcurrentDiskReads : 4;
+        _readQueue.suspended = YES;
         
         // 创建内存容器
-        _memCache = [[AutoPurgeCache alloc] init];
+        _memCache = [[SDImageCacheMemoryStore alloc] initWithShardCount:0];
         _memCache.name = fullNamespace;
+        SDImageCacheStatisticsRecorder *statisticsRecorder = _statisticsRecorder;
+        _memCache.evictionHandler = ^(NSUInteger count, NSUInteger cost) {
+            [statisticsRecorder incrementCounter:SDImageCacheStatisticsCounterMemoryEvictions by:count];
+        };
 
         // 拼接磁盘缓存路径
         if (directory != nil) {
@@ -118,12 +375,85 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
             _fileManager = [NSFileManager new];
         });
 
+        // 在io队列中恢复磁盘索引，之后排队的磁盘操作都能用上索引
+        _diskIndex = [[SDImageCacheIndex alloc] initWithDirectory:[_diskCachePath stringByAppendingPathComponent:kDiskIndexDirectoryName]];
+        _packStore = [[SDImageCachePackStore alloc] initWithDirectory:[_diskCachePath stringByAppendingPathComponent:kPackDirectoryName]
+                                                       maxSegmentSize:kMaxPackSegmentSize];
+        _evictionPolicy = [self evictionPolicyForType:_config.diskCacheEvictionPolicy];
+        if (_config.shouldShareDiskCacheAcrossProcesses) {
+            // pack segment的追加写入没法在进程之间协调，共享时小图片也单独存成文件
+            _config.maxPackedFileSize = 0;
+            _diskIndex.shared = YES;
+            _coordinator = [[SDImageCacheProcessCoordinator alloc] initWithDirectory:_diskCachePath];
+            __weak __typeof(self) wself = self;
+            _coordinator.changeHandler = ^{
+                __strong __typeof(wself) sself = wself;
+                if (sself) {
+                    dispatch_async(sself.ioQueue, ^{
+                        [sself reloadSharedDiskChanges];
+                    });
+                }
+            };
+        }
+        _ioBackend = _config.diskCacheIOBackend;
+        if (!_ioBackend) {
+            // 需要映射文件的话只能阻塞地读取
+            _ioBackend = _config.diskCacheReadingOptions != 0 ? [[SDImageCacheBlockingIOBackend alloc] initWithReadingOptions:_config.diskCacheReadingOptions]
+                                                              : [SDImageCacheDispatchIOBackend new];
+        }
+        if (_config.maxDecodedDiskCacheSize > 0) {
+            _bitmapStore = [[SDImageCacheBitmapStore alloc] initWithDirectory:[_diskCachePath stringByAppendingPathComponent:kBitmapDirectoryName]
+                                                                      maxSize:_config.maxDecodedDiskCacheSize
+                                                                   compressed:_config.shouldCompressDecodedDiskCache];
+        }
+        dispatch_async(_ioQueue, ^{
+            // 共享时同一时间只有一个进程重建索引，其它进程等它完成之后直接读取
+            if (self.coordinator) {
+                [self.coordinator performExclusively:^{
+                    [self loadDiskIndex];
+                }];
+            } else {
+                [self loadDiskIndex];
+            }
+            [self updateLegacyFileState];
+            [self.bitmapStore load];
+            if ([self.evictionPolicy respondsToSelector:@selector(prepareForEntryCount:)]) {
+                [self.evictionPolicy prepareForEntryCount:self.diskIndex.count];
+            }
+            self.readQueue.suspended = NO;
+        });
+
+        // 开启了分片的话，在后台把旧版本留下来的平铺文件迁移到分片子目录中
+        [self migrateFlatLayoutIfNeeded];
+
+        // 记录热点key，需要的话在启动时预加载上次的热点图片
+        if (_config.maxHotImageCount > 0) {
+            _hotSet = [[SDImageCacheHotSet alloc] initWithPath:[_diskCachePath stringByAppendingPathComponent:kHotSetFileName]
+                                                      capacity:_config.maxHotImageCount];
+            [self startHotSetSaveTimer];
+            if (_config.shouldPreloadHotImages) {
+                [self preloadHotImagesWithCompletion:nil];
+            }
+        }
+
+        if (_config.shouldUseMemoryGovernor) {
+            // 内存压力下按比例缩减内存缓存，不再整个清空
+            SDImageCacheMemoryGovernor *governor = [SDImageCacheMemoryGovernor sharedGovernor];
+            [governor addMemoryTier:_memCache];
+            [[NSNotificationCenter defaultCenter] addObserver:self
+                                                     selector:@selector(memoryPressureDidChange:)
+                                                         name:SDImageCacheMemoryPressureDidChangeNotification
+                                                       object:governor];
+        }
+
 #if SD_UIKIT
         // 监听app事件
-        [[NSNotificationCenter defaultCenter] addObserver:self
-                                                 selector:@selector(clearMemory)
-                                                     name:UIApplicationDidReceiveMemoryWarningNotification
-                                                   object:nil];
+        if (!_config.shouldUseMemoryGovernor) {
+            [[NSNotificationCenter defaultCenter] addObserver:self
+                                                     selector:@selector(clearMemory)
+                                                         name:UIApplicationDidReceiveMemoryWarningNotification
+                                                       object:nil];
+        }
 
         [[NSNotificationCenter defaultCenter] addObserver:self
                                                  selector:@selector(deleteOldFiles)
@@ -142,9 +472,122 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 
 - (void)dealloc {
     [[NSNotificationCenter defaultCenter] removeObserver:self];
+    if (_config.shouldUseMemoryGovernor) {
+        [[SDImageCacheMemoryGovernor sharedGovernor] removeMemoryTier:_memCache];
+    }
+    if (_hotSetSaveTimer) {
+        dispatch_source_cancel(_hotSetSaveTimer);
+    }
     SDDispatchQueueRelease(_ioQueue);
 }
 
+#pragma mark - Disk read scheduling
+
+// 记录key有一个磁盘写入（或删除）开始排队，在dispatch到ioQueue之前调用
+- (void)beginDiskWriteForKey:(nonnull NSString *)key {
+    LOCK(_pendingDiskWritesLock);
+    _pendingDiskWrites[key] = @(_pendingDiskWrites[key].unsignedIntegerValue + 1);
+    UNLOCK(_pendingDiskWritesLock);
+}
+
+// 在ioQueue中写入完成后调用
+- (void)endDiskWriteForKey:(nonnull NSString *)key {
+    LOCK(_pendingDiskWritesLock);
+    NSUInteger count = _pendingDiskWrites[key].unsignedIntegerValue;
+    if (count > 1) {
+        _pendingDiskWrites[key] = @(count - 1);
+    } else {
+        [_pendingDiskWrites removeObjectForKey:key];
+    }
+    UNLOCK(_pendingDiskWritesLock);
+}
+
+// 这些文件（为nil时是所有文件）正在IO后端中进行的写入
+- (nonnull NSArray<dispatch_group_t> *)inFlightWriteGroupsForFileNames:(nullable NSArray<NSString *> *)fileNames {
+    NSMutableSet<dispatch_group_t> *groups = [NSMutableSet set];
+    LOCK(_inFlightWritesLock);
+    if (fileNames) {
+        for (NSString *fileName in fileNames) {
+            dispatch_group_t group = _inFlightWriteGroups[fileName];
+            if (group) {
+                [groups addObject:group];
+            }
+        }
+    } else {
+        [groups addObjectsFromArray:_inFlightWriteGroups.allValues];
+    }
+    UNLOCK(_inFlightWritesLock);
+    return groups.allObjects;
+}
+
+// 在ioQueue中执行，修改一个正在写入的文件之前等待这次写入完成，避免先提交的写入后完成，覆盖掉之后的修改
+// 写入完成时的回调不会用到ioQueue，这里等待不会死锁
+- (void)waitForInFlightWritesToFileNames:(nullable NSArray<NSString *> *)fileNames {
+    for (dispatch_group_t group in [self inFlightWriteGroupsForFileNames:fileNames]) {
+        dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    }
+}
+
+// 这些文件（为nil时是所有文件）正在进行的写入都完成之后在queue中执行block，没有正在进行的写入时直接提交block
+- (void)notifyQueue:(nonnull dispatch_queue_t)queue afterInFlightWritesToFileNames:(nullable NSArray<NSString *> *)fileNames block:(nonnull dispatch_block_t)block {
+    dispatch_group_t inFlightWrites = dispatch_group_create();
+    for (dispatch_group_t group in [self inFlightWriteGroupsForFileNames:fileNames]) {
+        dispatch_group_enter(inFlightWrites);
+        dispatch_group_notify(group, queue, ^{
+            dispatch_group_leave(inFlightWrites);
+        });
+    }
+    dispatch_group_notify(inFlightWrites, queue, block);
+}
+
+// 安排一次磁盘读取：key没有正在排队的写入时放到并发的读取队列中，
+// 否则排到ioQueue中那些写入的后面，等IO后端写完之后再读取，保证同一个key的读取不会越过之前的写入
+- (void)scheduleDiskReadOperation:(nonnull NSOperation *)operation forKey:(nullable NSString *)key {
+    [self scheduleDiskReadOperation:operation forKeys:key ? @[key] : @[]];
+}
+
+// 同上，其中任何一个key有正在排队的写入时，整个读取都排到ioQueue中
+- (void)scheduleDiskReadOperation:(nonnull NSOperation *)operation forKeys:(nonnull NSArray<NSString *> *)keys {
+    BOOL hasPendingWrite = NO;
+    if (keys.count > 0) {
+        LOCK(_pendingDiskWritesLock);
+        for (NSString *key in keys) {
+            if (_pendingDiskWrites[key] != nil) {
+                hasPendingWrite = YES;
+                break;
+            }
+        }
+        UNLOCK(_pendingDiskWritesLock);
+    }
+
+    if (hasPendingWrite) {
+        dispatch_async(self.ioQueue, ^{
+            // 这个key的写入可能还在写入缓冲中，先提交写入，IO后端写完之后再读取
+            [self flushBufferedWrites];
+            NSMutableArray<NSString *> *fileNames = [NSMutableArray arrayWithCapacity:keys.count];
+            for (NSString *key in keys) {
+                [fileNames addObject:[self cachedFileNameForKey:key]];
+            }
+            [self notifyQueue:self.ioQueue afterInFlightWritesToFileNames:fileNames block:^{
+                [operation start];
+            }];
+        });
+    } else {
+        [self.readQueue addOperation:operation];
+    }
+}
+
+- (nonnull id<SDImageCacheEvictionPolicy>)evictionPolicyForType:(SDImageCacheEvictionPolicyType)type {
+    switch (type) {
+        case SDImageCacheEvictionPolicyTypeLRU:
+            return [SDImageCacheLRUEvictionPolicy new];
+        case SDImageCacheEvictionPolicyTypeTinyLFU:
+            return [SDImageCacheTinyLFUEvictionPolicy new];
+        default:
+            return [SDImageCacheFIFOEvictionPolicy new];
+    }
+}
+
 - (void)checkIfQueueIsIOQueue {
     const char *currentQueueLabel = dispatch_queue_get_label(DISPATCH_CURRENT_QUEUE_LABEL);
     const char *ioQueueLabel = dispatch_queue_get_label(self.ioQueue);
@@ -162,33 +605,177 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 
     if (![self.customPaths containsObject:path]) {
         [self.customPaths addObject:path];
+        [self scanReadOnlyCachePath:path];
+    }
+}
+
+// 打开一个只读缓存包，已经添加过的直接返回YES
+- (BOOL)addReadOnlyCacheBundleAtPath:(nonnull NSString *)path {
+    LOCK(_customPathFiltersLock);
+    NSArray<SDImageCacheBundle *> *bundles = _readOnlyBundles;
+    UNLOCK(_customPathFiltersLock);
+    for (SDImageCacheBundle *bundle in bundles) {
+        if ([bundle.path isEqualToString:path]) {
+            return YES;
+        }
+    }
+
+    SDImageCacheBundle *bundle = [SDImageCacheBundle bundleWithContentsOfFile:path];
+    if (!bundle) {
+        return NO;
+    }
+    LOCK(_customPathFiltersLock);
+    _readOnlyBundles = _readOnlyBundles ? [_readOnlyBundles arrayByAddingObject:bundle] : @[bundle];
+    UNLOCK(_customPathFiltersLock);
+    return YES;
+}
+
+// 在只读缓存包中查找，每个缓存包只需要一次完美哈希查找，不访问文件系统
+- (nullable NSData *)readOnlyBundleDataForKey:(nonnull NSString *)key {
+    LOCK(_customPathFiltersLock);
+    NSArray<SDImageCacheBundle *> *bundles = _readOnlyBundles;
+    UNLOCK(_customPathFiltersLock);
+    if (bundles.count == 0) {
+        return nil;
+    }
+    SDImageCacheKeyDigest digest = [key isKindOfClass:[SDImageCacheKey class]] ? ((SDImageCacheKey *)key).digest : SDImageCacheKeyDigestForString(key);
+    for (SDImageCacheBundle *bundle in bundles) {
+        NSData *data = [bundle dataForDigest:digest];
+        if (data) {
+            return data;
+        }
+    }
+    return nil;
+}
+
+- (void)enumerateDiskCacheKeysUsingBlock:(nonnull void(^)(NSString * _Nonnull key, NSString * _Nullable filePath, NSData * _Nullable data))block {
+    // 写入缓冲中和IO后端正在写入的数据先落到磁盘上
+    dispatch_sync(self.ioQueue, ^{
+        [self flushBufferedWrites];
+        [self waitForInFlightWritesToFileNames:nil];
+    });
+    NSFileManager *fileManager = [NSFileManager new];
+    for (SDImageCacheIndexEntry *entry in [self.diskIndex allEntries]) {
+        if (!entry.key) {
+            continue;
+        }
+        @autoreleasepool {
+            // 别名从它指向的内容中读取
+            SDImageCacheIndexEntry *contentEntry = entry.contentFileName ? [self.diskIndex entryForFileName:entry.contentFileName] : entry;
+            if (!contentEntry) {
+                continue;
+            }
+            if (contentEntry.segment != 0) {
+                NSData *data = [self.packStore dataForFileName:contentEntry.fileName
+                                                       segment:contentEntry.segment
+                                                        offset:contentEntry.offset
+                                                        length:contentEntry.size];
+                if (data) {
+                    block(entry.key, nil, data);
+                }
+                continue;
+            }
+            // 分片迁移期间文件可能还在旧路径
+            NSString *filePath = [[self shardDirectoryForFileName:contentEntry.fileName] stringByAppendingPathComponent:contentEntry.fileName];
+            if (![fileManager fileExistsAtPath:filePath]) {
+                filePath = [self.diskCachePath stringByAppendingPathComponent:contentEntry.fileName];
+                if (![fileManager fileExistsAtPath:filePath]) {
+                    continue;
+                }
+            }
+            block(entry.key, filePath, nil);
+        }
     }
 }
 
+// 只读路径中的文件不会改变，在后台扫描一次，建立文件名的布隆过滤器，之后未命中时不再需要访问这个路径
+- (void)scanReadOnlyCachePath:(nonnull NSString *)path {
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+        NSArray<NSString *> *fileNames = [[NSFileManager new] contentsOfDirectoryAtPath:path error:nil];
+        if (!fileNames) {
+            return;
+        }
+        SDImageCacheBloomFilter *filter = [[SDImageCacheBloomFilter alloc] initWithCapacity:fileNames.count];
+        for (NSString *fileName in fileNames) {
+            [filter addString:fileName.stringByDeletingPathExtension];
+        }
+        LOCK(_customPathFiltersLock);
+        _customPathFilters[path] = filter;
+        UNLOCK(_customPathFiltersLock);
+    });
+}
+
+// 只读路径中是否可能有这个文件，路径还没有扫描完成时返回YES
+- (BOOL)readOnlyCachePath:(nonnull NSString *)path mayContainFileName:(nonnull NSString *)fileName {
+    LOCK(_customPathFiltersLock);
+    SDImageCacheBloomFilter *filter = _customPathFilters[path];
+    BOOL contains = !filter || [filter containsString:fileName.stringByDeletingPathExtension];
+    UNLOCK(_customPathFiltersLock);
+    return contains;
+}
+
 // 根据名称和路径拼接路径
 - (nullable NSString *)cachePathForKey:(nullable NSString *)key inPath:(nonnull NSString *)path {
     NSString *filename = [self cachedFileNameForKey:key];
     return [path stringByAppendingPathComponent:filename];
 }
 
-// 默认的某个图片的路径
+// 默认的某个图片的路径，开启分片后位于文件名前几位字符命名的子目录中
 - (nullable NSString *)defaultCachePathForKey:(nullable NSString *)key {
-    return [self cachePathForKey:key inPath:self.diskCachePath];
+    NSString *filename = [self cachedFileNameForKey:key];
+    return [[self shardDirectoryForFileName:filename] stringByAppendingPathComponent:filename];
+}
+
+// 某个缓存文件所在的分片子目录
+- (nonnull NSString *)shardDirectoryForFileName:(nonnull NSString *)fileName {
+    if (_shardWidth == 0 || fileName.length < _shardWidth) {
+        return self.diskCachePath;
+    }
+    return [self.diskCachePath stringByAppendingPathComponent:[fileName substringToIndex:_shardWidth]];
 }
 
-// 根据key获取文件名（MD5）
+// 根据key获取文件名（128位摘要），key是SDImageCacheKey时直接使用它计算好的文件名
 - (nullable NSString *)cachedFileNameForKey:(nullable NSString *)key {
+    return SDImageCacheFileNameForKey(key);
+}
+
+// 旧版本用MD5生成的文件名，兼容旧的缓存时使用
+- (nonnull NSString *)legacyCachedFileNameForKey:(nullable NSString *)key {
     const char *str = key.UTF8String;
     if (str == NULL) {
         str = "";
     }
     unsigned char r[CC_MD5_DIGEST_LENGTH];
     CC_MD5(str, (CC_LONG)strlen(str), r);
-    NSString *filename = [NSString stringWithFormat:@"%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%@",
-                          r[0], r[1], r[2], r[3], r[4], r[5], r[6], r[7], r[8], r[9], r[10],
-                          r[11], r[12], r[13], r[14], r[15], [key.pathExtension isEqualToString:@""] ? @"" : [NSString stringWithFormat:@".%@", key.pathExtension]];
+    static const char hexDigits[] = "0123456789abcdef";
+    char hex[CC_MD5_DIGEST_LENGTH * 2];
+    for (NSUInteger i = 0; i < CC_MD5_DIGEST_LENGTH; i++) {
+        hex[i * 2] = hexDigits[r[i] >> 4];
+        hex[i * 2 + 1] = hexDigits[r[i] & 0x0F];
+    }
+    NSString *filename = [[NSString alloc] initWithBytes:hex length:sizeof(hex) encoding:NSASCIIStringEncoding];
+    NSString *extension = key.pathExtension;
+    return extension.length > 0 ? [filename stringByAppendingFormat:@".%@", extension] : filename;
+}
+
+// 是否需要按照旧的MD5文件名查找
+- (BOOL)shouldSearchLegacyFileNames {
+    return self.config.shouldReadLegacyFileNames && self.mayContainLegacyFiles;
+}
 
-    return filename;
+// 在ioQueue中执行，检查索引中还有没有可能是旧文件的记录，加载索引和每次清理之后更新
+- (void)updateLegacyFileState {
+    if (!self.config.shouldReadLegacyFileNames) {
+        return;
+    }
+    BOOL mayContainLegacyFiles = NO;
+    for (SDImageCacheIndexEntry *entry in [self.diskIndex allEntries]) {
+        if (!entry.key && ![entry.fileName.pathExtension isEqualToString:kContentFileExtension]) {
+            mayContainLegacyFiles = YES;
+            break;
+        }
+    }
+    self.mayContainLegacyFiles = mayContainLegacyFiles;
 }
 
 // 根据namespace获取磁盘缓存路径
@@ -218,6 +805,16 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
             forKey:(nullable NSString *)key
             toDisk:(BOOL)toDisk
         completion:(nullable SDWebImageNoParamsBlock)completionBlock
+{
+    [self storeImage:image imageData:imageData forKey:key tags:nil toDisk:toDisk completion:completionBlock];
+}
+
+- (void)storeImage:(nullable UIImage *)image
+         imageData:(nullable NSData *)imageData
+            forKey:(nullable NSString *)key
+              tags:(nullable NSSet<NSString *> *)tags
+            toDisk:(BOOL)toDisk
+        completion:(nullable SDWebImageNoParamsBlock)completionBlock
 {
     // 检查image或者key是否为nil
     if (!image || !key) {
@@ -229,12 +826,20 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     
     // 根据配置文件中是否设置了缓存到内存，保存image到缓存中，这个过程是非常快的，因此不用考虑线程
     if (self.config.shouldCacheImagesInMemory) {
-        NSUInteger cost = SDCacheCostForImage(image);
+        NSUInteger cost = SDImageCacheMemoryCostForImage(image);
         [self.memCache setObject:image forKey:key cost:cost];
+        // 只保存在内存中的图片不会记录到磁盘索引，单独记下它的tag
+        if (!toDisk && tags.count > 0) {
+            [self addMemoryTags:tags forKey:key];
+        }
     }
     
     // 如果保存到Disk，创建异步串行队列 我们把数据保存到Disk，其实保存的应该是数据的二进制文件
-    if (toDisk) {
+    if (toDisk && self.config.maxDiskWriteBufferSize > 0) {
+        // 先放到写入缓冲中，合并同一个key的多次写入，再批量写到磁盘
+        [self bufferDiskWriteForImage:image imageData:imageData key:key tags:tags completion:completionBlock];
+    } else if (toDisk) {
+        [self beginDiskWriteForKey:key];
         dispatch_async(self.ioQueue, ^{
             @autoreleasepool {
                 // 保存二进制数据到Disk，如果不存在，需要把image转换成NSData
@@ -243,8 +848,9 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
                     SDImageFormat imageFormatFromData = [NSData sd_imageFormatForImageData:data];
                     data = [image sd_imageDataAsFormat:imageFormatFromData];
                 }                
-                [self storeImageDataToDisk:data forKey:key];
+                [self writeImageDataToDisk:data image:image forKey:key tags:tags];
             }
+            [self endDiskWriteForKey:key];
             
             if (completionBlock) {
                 dispatch_async(dispatch_get_main_queue(), ^{
@@ -259,133 +865,1080 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     }
 }
 
-// 同步存储图片到磁盘中
-- (void)storeImageDataToDisk:(nullable NSData *)imageData forKey:(nullable NSString *)key
-{
-    // 检查imageData或者key是否为nil
-    if (!imageData || !key) {
-        return;
+#pragma mark - Write buffer
+
+// 把一次磁盘写入放到写入缓冲中，已经有同一个key的写入时直接替换数据
+// 缓冲超过config.maxDiskWriteBufferSize时立即批量写入，否则等待kDiskWriteCoalescingInterval
+- (void)bufferDiskWriteForImage:(nonnull UIImage *)image
+                      imageData:(nullable NSData *)imageData
+                            key:(nonnull NSString *)key
+                           tags:(nullable NSSet<NSString *> *)tags
+                     completion:(nullable SDWebImageNoParamsBlock)completionBlock {
+    NSUInteger cost = imageData ? imageData.length : SDImageCacheMemoryCostForImage(image);
+    BOOL flushNow = NO;
+    BOOL scheduleFlush = NO;
+
+    LOCK(_bufferedWritesLock);
+    SDImageCachePendingWrite *pendingWrite = _bufferedWrites[key];
+    if (pendingWrite) {
+        _bufferedWriteBytes -= MIN(_bufferedWriteBytes, pendingWrite.cost);
+    } else {
+        pendingWrite = [SDImageCachePendingWrite new];
+        _bufferedWrites[key] = pendingWrite;
+        [_bufferedWriteOrder addObject:key];
+        // 写到磁盘之前，这个key的读取都要排到ioQueue中
+        [self beginDiskWriteForKey:key];
     }
-    
-    // 检查是否在自身的队列(io队列)中进行的操作
-    [self checkIfQueueIsIOQueue];
-    
-    // 创建Disk缓存文件夹
-    if (![_fileManager fileExistsAtPath:_diskCachePath]) {
-        [_fileManager createDirectoryAtPath:_diskCachePath withIntermediateDirectories:YES attributes:nil error:NULL];
+    pendingWrite.image = image;
+    pendingWrite.imageData = imageData;
+    pendingWrite.tags = tags;
+    // 数据被替换了，之前的验证信息不再对应
+    pendingWrite.validators = nil;
+    pendingWrite.cost = cost;
+    if (completionBlock) {
+        [pendingWrite.completionBlocks addObject:[completionBlock copy]];
     }
-    
-    // 根据key获取默认的缓存路径
-    NSString *cachePathForKey = [self defaultCachePathForKey:key];
-    // transform to NSUrl
-    NSURL *fileURL = [NSURL fileURLWithPath:cachePathForKey];
-    
-    // 将数据写入到上边获取的路径中
-    [_fileManager createFileAtPath:cachePathForKey contents:imageData attributes:nil];
-    
-    // 根据配置文件设置是否禁用iCloud的备份功能
-    if (self.config.shouldDisableiCloud) {
-        [fileURL setResourceValue:@YES forKey:NSURLIsExcludedFromBackupKey error:nil];
+    _bufferedWriteBytes += cost;
+
+    if (_bufferedWriteBytes >= self.config.maxDiskWriteBufferSize) {
+        flushNow = YES;
+    } else if (!_bufferFlushScheduled) {
+        _bufferFlushScheduled = YES;
+        scheduleFlush = YES;
+    }
+    UNLOCK(_bufferedWritesLock);
+
+    if (flushNow) {
+        dispatch_async(self.ioQueue, ^{
+            [self flushBufferedWrites];
+        });
+    } else if (scheduleFlush) {
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kDiskWriteCoalescingInterval * NSEC_PER_SEC)), self.ioQueue, ^{
+            [self flushBufferedWrites];
+        });
     }
 }
 
-#pragma mark - Query and Retrieve Ops
-// 异步判断图片是否被缓存到disk (does not load the image)
-- (void)diskImageExistsWithKey:(nullable NSString *)key completion:(nullable SDWebImageCheckCacheCompletionBlock)completionBlock
-{
-    dispatch_async(_ioQueue, ^{
-        BOOL exists = [_fileManager fileExistsAtPath:[self defaultCachePathForKey:key]];
+// 从写入缓冲中取出某个key的写入，不再写到磁盘
+- (nullable SDImageCachePendingWrite *)takeBufferedWriteForKey:(nonnull NSString *)key {
+    LOCK(_bufferedWritesLock);
+    SDImageCachePendingWrite *pendingWrite = _bufferedWrites[key];
+    if (pendingWrite) {
+        _bufferedWriteBytes -= MIN(_bufferedWriteBytes, pendingWrite.cost);
+        [_bufferedWrites removeObjectForKey:key];
+        [_bufferedWriteOrder removeObject:key];
+    }
+    UNLOCK(_bufferedWritesLock);
+    return pendingWrite;
+}
 
-        // fallback because of https://github.com/rs/SDWebImage/pull/976 that added the extension to the disk file name
-        // checking the key with and without the extension
-        if (!exists) {
-            exists = [_fileManager fileExistsAtPath:[self defaultCachePathForKey:key].stringByDeletingPathExtension];
-        }
+// 取出写入缓冲中的所有写入，按照第一次写入的顺序排列
+- (nonnull NSArray<NSString *> *)takeAllBufferedWrites:(NSDictionary<NSString *, SDImageCachePendingWrite *> * __autoreleasing *)pendingWrites {
+    LOCK(_bufferedWritesLock);
+    NSArray<NSString *> *keys = _bufferedWriteOrder.array;
+    *pendingWrites = [_bufferedWrites copy];
+    [_bufferedWrites removeAllObjects];
+    [_bufferedWriteOrder removeAllObjects];
+    _bufferedWriteBytes = 0;
+    _bufferFlushScheduled = NO;
+    UNLOCK(_bufferedWritesLock);
+    return keys;
+}
 
-        if (completionBlock) {
-            dispatch_async(dispatch_get_main_queue(), ^{
-                completionBlock(exists);
-            });
-        }
-    });
+// 写入缓冲中的写入已经完成（或者被删除、清空操作取消）之后，结束这个key的写入并在主线程回调
+- (void)finishBufferedWrites:(nonnull NSArray<SDImageCachePendingWrite *> *)pendingWrites forKeys:(nonnull NSArray<NSString *> *)keys {
+    NSMutableArray<SDWebImageNoParamsBlock> *completionBlocks = [NSMutableArray array];
+    for (NSUInteger i = 0; i < keys.count; i++) {
+        [self endDiskWriteForKey:keys[i]];
+        [completionBlocks addObjectsFromArray:pendingWrites[i].completionBlocks];
+    }
+    if (completionBlocks.count > 0) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            for (SDWebImageNoParamsBlock completionBlock in completionBlocks) {
+                completionBlock();
+            }
+        });
+    }
 }
 
-// 同步在内存中查询图片
-- (nullable UIImage *)imageFromMemoryCacheForKey:(nullable NSString *)key {
-    return [self.memCache objectForKey:key];
+// 在ioQueue中执行，把写入缓冲中的所有写入批量写到磁盘
+- (void)flushBufferedWrites {
+    NSDictionary<NSString *, SDImageCachePendingWrite *> *pendingWrites = nil;
+    NSArray<NSString *> *keys = [self takeAllBufferedWrites:&pendingWrites];
+    if (keys.count == 0) {
+        return;
+    }
+
+    // 要单独存成文件的写入一起提交给IO后端，其它的（去重、pack segment）逐个写入
+    NSMutableArray<NSData *> *batchData = [NSMutableArray array];
+    NSMutableArray<NSString *> *batchKeys = [NSMutableArray array];
+    NSMutableArray<SDImageCachePendingWrite *> *batchWrites = [NSMutableArray array];
+    NSMutableArray<NSString *> *finishedKeys = [NSMutableArray arrayWithCapacity:keys.count];
+    NSMutableArray<SDImageCachePendingWrite *> *finishedWrites = [NSMutableArray arrayWithCapacity:keys.count];
+    NSUInteger maxPackedFileSize = self.config.maxPackedFileSize;
+    for (NSString *key in keys) {
+        SDImageCachePendingWrite *pendingWrite = pendingWrites[key];
+        @autoreleasepool {
+            // 保存二进制数据到Disk，如果不存在，需要把image转换成NSData
+            NSData *data = pendingWrite.imageData;
+            if (!data && pendingWrite.image) {
+                data = [pendingWrite.image sd_imageDataAsFormat:SDImageFormatUndefined];
+            }
+            if (data && [self shouldAdmitImageData:data forKey:key]) {
+                if (!self.config.shouldDeduplicateDiskContent && (maxPackedFileSize == 0 || data.length > maxPackedFileSize)) {
+                    [batchData addObject:data];
+                    [batchKeys addObject:key];
+                    [batchWrites addObject:pendingWrite];
+                    continue;
+                }
+                [self writeAdmittedImageData:data forKey:key];
+                [self didWriteBufferedWrite:pendingWrite forKey:key];
+            }
+        }
+        [finishedKeys addObject:key];
+        [finishedWrites addObject:pendingWrite];
+    }
+    [self finishBufferedWrites:finishedWrites forKeys:finishedKeys];
+
+    // 不等待IO后端写完，写完之后在它的线程中补充索引中的信息并回调，这期间读取这些key会等待写入完成
+    [self writeAdmittedImageDataInBatch:batchData forKeys:batchKeys completion:^(NSIndexSet *writtenIndexes) {
+        [writtenIndexes enumerateIndexesUsingBlock:^(NSUInteger index, BOOL *stop) {
+            [self didWriteBufferedWrite:batchWrites[index] forKey:batchKeys[index]];
+        }];
+        [self finishBufferedWrites:batchWrites forKeys:batchKeys];
+    }];
 }
 
-// 同步在磁盘中查询图片
-- (nullable UIImage *)imageFromDiskCacheForKey:(nullable NSString *)key {
-    UIImage *diskImage = [self diskImageForKey:key];
-    if (diskImage && self.config.shouldCacheImagesInMemory) {
-        NSUInteger cost = SDCacheCostForImage(diskImage);
-        // 缓存到内存中
-        [self.memCache setObject:diskImage forKey:key cost:cost];
+// 写入缓冲中的数据写到磁盘之后，记录key、tag和验证信息，并生成预览图
+- (void)didWriteBufferedWrite:(nonnull SDImageCachePendingWrite *)pendingWrite forKey:(nonnull NSString *)key {
+    [self.diskIndex labelEntryForFileName:[self cachedFileNameForKey:key] key:key tags:pendingWrite.tags];
+    [self updateIndexWithValidators:pendingWrite.validators forKey:key];
+    @autoreleasepool {
+        [self storePreviewForImage:pendingWrite.image key:key];
     }
+}
 
-    return diskImage;
+- (void)flushDiskWritesWithCompletion:(nullable SDWebImageNoParamsBlock)completion {
+    dispatch_async(self.ioQueue, ^{
+        [self flushBufferedWrites];
+        if (completion) {
+            // 等IO后端把提交的写入都写完再回调
+            [self notifyQueue:dispatch_get_main_queue() afterInFlightWritesToFileNames:nil block:completion];
+        }
+    });
 }
 
-// 同步查询图片，先从内存中找，如果没找到再去磁盘中找
-- (nullable UIImage *)imageFromCacheForKey:(nullable NSString *)key {
-    // First check the in-memory cache...
-    UIImage *image = [self imageFromMemoryCacheForKey:key];
-    if (image) {
-        return image;
+// 同步存储图片到磁盘中，写入缓冲中同一个key还没写入的旧数据会被丢弃
+- (void)storeImageDataToDisk:(nullable NSData *)imageData forKey:(nullable NSString *)key
+{
+    // 检查imageData或者key是否为nil
+    if (!imageData || !key) {
+        return;
     }
     
-    // Second check the disk cache...
-    image = [self imageFromDiskCacheForKey:key];
-    return image;
+    // 检查是否在自身的队列(io队列)中进行的操作
+    [self checkIfQueueIsIOQueue];
+
+    SDImageCachePendingWrite *staleWrite = [self takeBufferedWriteForKey:key];
+    [self writeImageDataToDisk:imageData image:nil forKey:key tags:nil];
+    if (staleWrite) {
+        [self finishBufferedWrites:@[staleWrite] forKeys:@[key]];
+    }
 }
 
-// 在Disk中获取数据跟在内存中获取不一样，内存中直接保存的是UIImage，而Disk中保存的是NSData，因此肯定需要一个NSData -> UIImage 的转换过程。接下来我们看看这个转换过程：
-- (nullable NSData *)diskImageDataBySearchingAllPathsForKey:(nullable NSString *)key
+// 在ioQueue中执行，实际把数据写到磁盘（pack segment或者单独的文件）
+// image不为nil时同时生成预览图
+- (void)writeImageDataToDisk:(nullable NSData *)imageData
+                       image:(nullable UIImage *)image
+                      forKey:(nonnull NSString *)key
+                        tags:(nullable NSSet<NSString *> *)tags
 {
-    // 先从默认的路径获取
-    NSString *defaultPath = [self defaultCachePathForKey:key];
-    NSData *data = [NSData dataWithContentsOfFile:defaultPath];
-    if (data) {
-        return data;
+    if (!imageData) {
+        return;
     }
-
-    // fallback because of https://github.com/rs/SDWebImage/pull/976 that added the extension to the disk file name
-    // 要考虑没有pathExtention的情况
-    data = [NSData dataWithContentsOfFile:defaultPath.stringByDeletingPathExtension];
-    if (data) {
-        return data;
+    
+    // 磁盘缓存已满时，由淘汰策略决定这个文件是否值得写入（替换掉将被淘汰的文件）
+    if (![self shouldAdmitImageData:imageData forKey:key]) {
+        return;
+    }
+    [self writeAdmittedImageData:imageData forKey:key];
+    // 记录key和tag，之后可以按前缀或者tag批量删除
+    [self.diskIndex labelEntryForFileName:[self cachedFileNameForKey:key] key:key tags:tags];
+    [self storePreviewForImage:image key:key];
+}
+
+// 在ioQueue或者IO后端写入完成的回调中执行，生成预览图并保存到磁盘索引中对应的记录上，需要在记录写入之后调用
+- (void)storePreviewForImage:(nullable UIImage *)image key:(nonnull NSString *)key {
+    NSUInteger maxPixelSize = self.config.previewImageMaxPixelSize;
+    if (!image || maxPixelSize == 0) {
+        return;
+    }
+    NSData *previewData = [SDImageCachePreview previewDataForImage:image maxPixelSize:maxPixelSize];
+    if (previewData) {
+        [self.diskIndex setPreviewData:previewData forFileName:[self cachedFileNameForKey:key]];
+    }
+}
+
+// 在ioQueue中执行，写入已经被淘汰策略接受的数据
+- (void)writeAdmittedImageData:(nonnull NSData *)imageData forKey:(nonnull NSString *)key {
+    NSString *fileName = [self cachedFileNameForKey:key];
+    NSString *previousContentFileName = [self.diskIndex entryForFileName:fileName].contentFileName;
+    // 之前保存的像素数据已经过时
+    [self.bitmapStore removeImagesForFileName:fileName];
+    if (self.config.shouldDeduplicateDiskContent) {
+        [self writeImageData:imageData asAliasForFileName:fileName];
+    } else {
+        [self writeImageData:imageData toFileName:fileName];
+    }
+    // 这个key之前指向的内容没有别的引用了就删除
+    if (previousContentFileName && [self.diskIndex aliasFileNamesForContentFileName:previousContentFileName].count == 0) {
+        [self removeDiskFileForFileName:previousContentFileName];
+    }
+
+    [self.coordinator setNeedsNotifyChange];
+    [self scheduleEvictionIfNeeded];
+}
+
+// 在ioQueue中执行，一批单独存成文件的写入一起提交给IO后端，不等待写入完成
+// 全部写完并记录到索引之后在IO后端的线程中调用completion，参数为写入成功的位置，之后再回到ioQueue中删除旧内容和淘汰
+- (void)writeAdmittedImageDataInBatch:(nonnull NSArray<NSData *> *)imageData
+                              forKeys:(nonnull NSArray<NSString *> *)keys
+                           completion:(nonnull void(^)(NSIndexSet * _Nonnull writtenIndexes))completion {
+    if (keys.count == 0) {
+        completion([NSIndexSet indexSet]);
+        return;
+    }
+    NSMutableArray<NSString *> *fileNames = [NSMutableArray arrayWithCapacity:keys.count];
+    NSMutableArray *previousContentFileNames = [NSMutableArray arrayWithCapacity:keys.count];
+    for (NSString *key in keys) {
+        NSString *fileName = [self cachedFileNameForKey:key];
+        [fileNames addObject:fileName];
+        [previousContentFileNames addObject:[self.diskIndex entryForFileName:fileName].contentFileName ?: [NSNull null]];
+        [self.bitmapStore removeImagesForFileName:fileName];
+    }
+    [self writeImageData:imageData toFileNames:fileNames completion:^(NSIndexSet *writtenIndexes) {
+        completion(writtenIndexes);
+        dispatch_async(self.ioQueue, ^{
+            for (id previousContentFileName in previousContentFileNames) {
+                if (previousContentFileName != [NSNull null] && [self.diskIndex aliasFileNamesForContentFileName:previousContentFileName].count == 0) {
+                    [self removeDiskFileForFileName:previousContentFileName];
+                }
+            }
+            [self.coordinator setNeedsNotifyChange];
+            [self scheduleEvictionIfNeeded];
+        });
+    }];
+}
+
+// 在ioQueue中执行，开启内容去重时，数据按照内容的哈希值只写一份，key的文件名只是索引中指向它的别名
+- (void)writeImageData:(nonnull NSData *)imageData asAliasForFileName:(nonnull NSString *)fileName {
+    [self waitForInFlightWritesToFileNames:@[fileName]];
+    NSString *contentFileName = SDContentFileNameForData(imageData);
+    SDImageCacheIndexEntry *contentEntry = [self.diskIndex entryForFileName:contentFileName];
+    if (contentEntry && contentEntry.size == imageData.length) {
+        // 已经有相同的内容，不需要再写一次，更新写入时间，保证内容不会比引用它的别名先过期
+        [self.diskIndex renewEntryForFileName:contentFileName];
+    } else if (contentEntry || ![self writeImageData:imageData toFileName:contentFileName]) {
+        // 哈希相同但是长度不同（几乎不可能）的话，不去覆盖别的key引用的内容，退回到单独保存
+        if (contentEntry) {
+            [self writeImageData:imageData toFileName:fileName];
+        }
+        return;
+    }
+
+    SDImageCacheIndexEntry *previousEntry = [self.diskIndex entryForFileName:fileName];
+    if (previousEntry && !previousEntry.contentFileName) {
+        // 之前单独保存的文件已经没用了
+        [self removeDiskFileForFileName:fileName];
+    }
+    [self.diskIndex storeAliasEntryForFileName:fileName
+                               contentFileName:contentFileName
+                                        format:[NSData sd_imageFormatForImageData:imageData]];
+}
+
+// 在ioQueue中执行，把数据写到fileName对应的pack segment或者单独的文件中，并记录到磁盘索引
+- (BOOL)writeImageData:(nonnull NSData *)imageData toFileName:(nonnull NSString *)fileName {
+    // 小图片追加写入到pack segment中
+    NSUInteger maxPackedFileSize = self.config.maxPackedFileSize;
+    if (maxPackedFileSize > 0 && imageData.length <= maxPackedFileSize && [self storeImageDataToPack:imageData forFileName:fileName]) {
+        return YES;
+    }
+    
+    // 去重时要根据写入的结果决定怎样记录别名，单个文件的写入在这里等待完成
+    __block BOOL written = NO;
+    dispatch_semaphore_t finished = dispatch_semaphore_create(0);
+    [self writeImageData:@[imageData] toFileNames:@[fileName] completion:^(NSIndexSet *writtenIndexes) {
+        written = writtenIndexes.count > 0;
+        dispatch_semaphore_signal(finished);
+    }];
+    dispatch_semaphore_wait(finished, DISPATCH_TIME_FOREVER);
+    return written;
+}
+
+// 在ioQueue中执行，通过IO后端把一批数据分别写成单独的文件，不等待写入完成
+// 写完之后在IO后端的线程中记录到磁盘索引，然后调用completion，参数为写入成功的位置
+// 写入期间这些文件记录为正在写入，ioQueue中之后修改它们的操作会先等待这次写入完成
+- (void)writeImageData:(nonnull NSArray<NSData *> *)imageData
+           toFileNames:(nonnull NSArray<NSString *> *)fileNames
+            completion:(nonnull void(^)(NSIndexSet * _Nonnull writtenIndexes))completion {
+    // 同一个文件之前的写入还没完成的话先等它完成，否则旧数据可能在新数据之后写完
+    [self waitForInFlightWritesToFileNames:fileNames];
+    NSMutableArray<NSString *> *paths = [NSMutableArray arrayWithCapacity:fileNames.count];
+    for (NSString *fileName in fileNames) {
+        // 根据文件名获取默认的缓存路径
+        NSString *cachePathForKey = [[self shardDirectoryForFileName:fileName] stringByAppendingPathComponent:fileName];
+
+        // 创建Disk缓存文件夹（开启分片时是对应的分片子目录）
+        NSString *directory = cachePathForKey.stringByDeletingLastPathComponent;
+        if (![_createdShardDirectories containsObject:directory]) {
+            if (![_fileManager fileExistsAtPath:directory]) {
+                [_fileManager createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:NULL];
+            }
+            [_createdShardDirectories addObject:directory];
+        }
+        [paths addObject:cachePathForKey];
+    }
+
+    // 将数据原子地写入到上边获取的路径中（先写临时文件再rename），正在被映射读取的旧文件不会被截断
+    // 每个文件写入的结果在不同的字节中，并发的回调不会互相影响
+    BOOL *succeeded = calloc(MAX(fileNames.count, 1), sizeof(BOOL));
+    if (!succeeded) {
+        completion([NSIndexSet indexSet]);
+        return;
+    }
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_group_enter(group);
+    LOCK(_inFlightWritesLock);
+    for (NSString *fileName in fileNames) {
+        _inFlightWriteGroups[fileName] = group;
+    }
+    UNLOCK(_inFlightWritesLock);
+
+    [self.ioBackend writeData:imageData toPaths:paths handler:^(NSUInteger index, BOOL success) {
+        succeeded[index] = success;
+    } completion:^{
+        // 写入成功后记录到磁盘索引中
+        NSMutableIndexSet *writtenIndexes = [NSMutableIndexSet indexSet];
+        for (NSUInteger i = 0; i < fileNames.count; i++) {
+            if (!succeeded[i]) {
+                continue;
+            }
+            [self.diskIndex storeEntryForFileName:fileNames[i]
+                                             size:imageData[i].length
+                                           format:[NSData sd_imageFormatForImageData:imageData[i]]];
+            [self.statisticsRecorder incrementCounter:SDImageCacheStatisticsCounterBytesWritten by:imageData[i].length];
+
+            // 根据配置文件设置是否禁用iCloud的备份功能
+            if (self.config.shouldDisableiCloud) {
+                [[NSURL fileURLWithPath:paths[i]] setResourceValue:@YES forKey:NSURLIsExcludedFromBackupKey error:nil];
+            }
+            [writtenIndexes addIndex:i];
+        }
+        free(succeeded);
+        completion(writtenIndexes);
+
+        LOCK(self->_inFlightWritesLock);
+        for (NSString *fileName in fileNames) {
+            if (self->_inFlightWriteGroups[fileName] == group) {
+                [self->_inFlightWriteGroups removeObjectForKey:fileName];
+            }
+        }
+        UNLOCK(self->_inFlightWritesLock);
+        dispatch_group_leave(group);
+    }];
+}
+
+#pragma mark - HTTP validators
+
+- (nullable SDImageCacheValidators *)validatorsForKey:(nullable NSString *)key {
+    if (!key) {
+        return nil;
+    }
+    SDImageCacheIndexEntry *entry = [self.diskIndex entryForFileName:[self cachedFileNameForKey:key]];
+    if (!entry || (!entry.entityTag && !entry.lastModified && entry.expirationDate == 0)) {
+        return nil;
+    }
+    SDImageCacheValidators *validators = [SDImageCacheValidators new];
+    validators.entityTag = entry.entityTag;
+    validators.lastModified = entry.lastModified;
+    if (entry.expirationDate > 0) {
+        validators.expirationDate = [NSDate dateWithTimeIntervalSinceReferenceDate:entry.expirationDate];
+    }
+    return validators;
+}
+
+- (void)storeValidators:(nullable SDImageCacheValidators *)validators forKey:(nullable NSString *)key {
+    if (!validators || !key) {
+        return;
+    }
+    validators = [validators copy];
+    // 图片还在写入缓冲中时挂在这次写入上，批量写到磁盘时一起记录，不打断写入缓冲的合并
+    LOCK(_bufferedWritesLock);
+    SDImageCachePendingWrite *pendingWrite = _bufferedWrites[key];
+    pendingWrite.validators = validators;
+    UNLOCK(_bufferedWritesLock);
+    if (pendingWrite) {
+        return;
+    }
+    // 不在写入缓冲中的话，之前的写入已经在ioQueue中排在前面了
+    [self beginDiskWriteForKey:key];
+    dispatch_async(self.ioQueue, ^{
+        // 图片可能还在IO后端中写入，写完才有索引记录
+        [self waitForInFlightWritesToFileNames:@[[self cachedFileNameForKey:key]]];
+        [self updateIndexWithValidators:validators forKey:key];
+        [self endDiskWriteForKey:key];
+    });
+}
+
+// 在ioQueue或者IO后端写入完成的回调中执行，记录写入之后才能保存验证信息
+- (void)updateIndexWithValidators:(nullable SDImageCacheValidators *)validators forKey:(nonnull NSString *)key {
+    if (!validators) {
+        return;
+    }
+    [self.diskIndex updateValidatorsForFileName:[self cachedFileNameForKey:key]
+                                      entityTag:validators.entityTag
+                                   lastModified:validators.lastModified
+                                 expirationDate:validators.expirationDate.timeIntervalSinceReferenceDate];
+    [self.coordinator setNeedsNotifyChange];
+}
+
+#pragma mark - Incremental eviction
+
+// 高水位和低水位对应的字节数，低水位不会高于高水位
+- (void)getHighWatermarkSize:(NSUInteger *)highWatermarkSize lowWatermarkSize:(NSUInteger *)lowWatermarkSize {
+    double maxCacheSize = self.config.maxCacheSize;
+    double high = MAX(self.config.diskCacheHighWatermark, 0);
+    double low = MIN(MAX(self.config.diskCacheLowWatermark, 0), high);
+    *highWatermarkSize = (NSUInteger)(maxCacheSize * high);
+    *lowWatermarkSize = (NSUInteger)(maxCacheSize * low);
+}
+
+// 在ioQueue中执行，写入之后磁盘缓存超过高水位时，安排增量淘汰
+- (void)scheduleEvictionIfNeeded {
+    // 所在的缓存组也检查一次总预算
+    [self.group setNeedsEnforceBudget];
+    if (self.config.maxCacheSize == 0 || _evictionScheduled) {
+        return;
+    }
+    NSUInteger highWatermarkSize, lowWatermarkSize;
+    [self getHighWatermarkSize:&highWatermarkSize lowWatermarkSize:&lowWatermarkSize];
+    if (self.diskIndex.totalSize <= highWatermarkSize) {
+        return;
+    }
+    _evictionScheduled = YES;
+    _evictionCandidates = nil;
+    dispatch_async(self.ioQueue, ^{
+        [self performEvictionStep];
+    });
+}
+
+// 在ioQueue中执行，共享磁盘缓存时同一时间只有一个进程淘汰，其它进程正在淘汰的话这一轮交给它
+// 它每删除一个文件都会先回放其它进程的写入，看到的总大小包括了所有进程的写入
+- (void)performEvictionStep {
+    if (self.coordinator && ![self.coordinator tryBeginEviction]) {
+        _evictionCandidates = nil;
+        _evictionScheduled = NO;
+        return;
+    }
+    // 先看到其它进程的写入和删除，否则可能按照过时的记录删除刚被其它进程重新写入的文件
+    [self.diskIndex reloadChanges];
+    [self runEvictionStep];
+    [self.coordinator endEviction];
+}
+
+// 在ioQueue中执行，按照淘汰策略的顺序删除一小批文件，还没降到低水位的话把下一步重新排到ioQueue的末尾
+- (void)runEvictionStep {
+    NSUInteger highWatermarkSize, lowWatermarkSize;
+    [self getHighWatermarkSize:&highWatermarkSize lowWatermarkSize:&lowWatermarkSize];
+    if (self.config.maxCacheSize == 0 || self.diskIndex.totalSize <= lowWatermarkSize) {
+        _evictionCandidates = nil;
+        _evictionScheduled = NO;
+        return;
+    }
+
+    // 每一轮淘汰开始时排一次序，之后的每一步都沿用
+    if (!_evictionCandidates) {
+        _evictionCandidates = [self.evictionPolicy entriesInEvictionOrder:[self.diskIndex allEntries]];
+        _evictionCursor = 0;
+    }
+
+    CFAbsoluteTime deadline = CFAbsoluteTimeGetCurrent() + kEvictionStepMaxDuration;
+    NSUInteger removedCount = 0;
+    while (self.diskIndex.totalSize > lowWatermarkSize && _evictionCursor < _evictionCandidates.count) {
+        SDImageCacheIndexEntry *entry = _evictionCandidates[_evictionCursor++];
+        // 排序之后记录可能已经被删除或者重新写入了
+        SDImageCacheIndexEntry *currentEntry = [self.diskIndex entryForFileName:entry.fileName];
+        if (!currentEntry || currentEntry.storeDate != entry.storeDate) {
+            continue;
+        }
+        [self removeDiskFileForFileName:entry.fileName];
+        [self.statisticsRecorder incrementCounter:SDImageCacheStatisticsCounterDiskEvictions by:1];
+        removedCount += 1;
+        if (removedCount >= kEvictionStepMaxFileCount || CFAbsoluteTimeGetCurrent() >= deadline) {
+            break;
+        }
+    }
+
+    if (self.diskIndex.totalSize > lowWatermarkSize) {
+        // 候选记录用完了还没降到低水位，说明排序之后又写入了新文件，下一步重新排序
+        if (_evictionCursor >= _evictionCandidates.count) {
+            _evictionCandidates = nil;
+        }
+        dispatch_async(self.ioQueue, ^{
+            [self performEvictionStep];
+        });
+        return;
+    }
+    _evictionCandidates = nil;
+    _evictionScheduled = NO;
+}
+
+// 在ioQueue中执行，写入之后会超过maxCacheSize时询问淘汰策略，覆盖已经存在的文件总是允许
+- (BOOL)shouldAdmitImageData:(nonnull NSData *)imageData forKey:(nonnull NSString *)key {
+    NSUInteger maxCacheSize = self.config.maxCacheSize;
+    if (maxCacheSize == 0 || self.diskIndex.totalSize + imageData.length <= maxCacheSize) {
+        return YES;
+    }
+    NSString *fileName = [self cachedFileNameForKey:key];
+    if ([self.diskIndex entryForFileName:fileName]) {
+        return YES;
+    }
+    NSArray<SDImageCacheIndexEntry *> *candidates = [self.diskIndex oldestEntriesWithLimit:kAdmissionCandidateCount];
+    return [self.evictionPolicy shouldAdmitFileName:fileName evicting:candidates];
+}
+
+// 在ioQueue中执行，把图片数据追加写入到pack segment中
+- (BOOL)storeImageDataToPack:(nonnull NSData *)imageData forFileName:(nonnull NSString *)fileName {
+    [self waitForInFlightWritesToFileNames:@[fileName]];
+    uint32_t segment = 0;
+    uint64_t offset = 0;
+    if (![self.packStore appendData:imageData forFileName:fileName segment:&segment offset:&offset]) {
+        return NO;
+    }
+    [self.statisticsRecorder incrementCounter:SDImageCacheStatisticsCounterBytesWritten by:imageData.length];
+
+    SDImageCacheIndexEntry *previousEntry = [self.diskIndex entryForFileName:fileName];
+    [self.diskIndex storeEntryForFileName:fileName
+                                     size:imageData.length
+                                   format:[NSData sd_imageFormatForImageData:imageData]
+                                  segment:segment
+                                   offset:offset];
+    // 之前是单独存成文件的话，旧文件已经没用了
+    if (previousEntry && previousEntry.segment == 0) {
+        [_fileManager removeItemAtPath:[[self shardDirectoryForFileName:fileName] stringByAppendingPathComponent:fileName] error:nil];
+    }
+
+    if (self.config.shouldDisableiCloud && !_packDirectoryExcludedFromBackup) {
+        NSURL *packURL = [NSURL fileURLWithPath:[self.diskCachePath stringByAppendingPathComponent:kPackDirectoryName] isDirectory:YES];
+        _packDirectoryExcludedFromBackup = [packURL setResourceValue:@YES forKey:NSURLIsExcludedFromBackupKey error:nil];
+    }
+    return YES;
+}
+
+#pragma mark - Query and Retrieve Ops
+// 异步判断图片是否被缓存到disk (does not load the image)
+- (void)diskImageExistsWithKey:(nullable NSString *)key completion:(nullable SDWebImageCheckCacheCompletionBlock)completionBlock
+{
+    NSBlockOperation *operation = [NSBlockOperation blockOperationWithBlock:^{
+        BOOL exists = [self diskCacheFileExistsForFileName:[self cachedFileNameForKey:key]];
+        // 兼容旧版本用MD5命名的缓存文件
+        if (!exists && [self shouldSearchLegacyFileNames]) {
+            exists = [self diskCacheFileExistsForFileName:[self legacyCachedFileNameForKey:key]];
+        }
+
+        if (completionBlock) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                completionBlock(exists);
+            });
+        }
+    }];
+    [self scheduleDiskReadOperation:operation forKey:key];
+}
+
+// 判断磁盘缓存中是否有这个文件，布隆过滤器判断一定不存在的话，不需要再访问文件系统
+- (BOOL)diskCacheFileExistsForFileName:(nonnull NSString *)fileName {
+    if (![self.diskIndex mayContainFileName:fileName]) {
+        return NO;
+    }
+
+    // 保存在pack segment中的图片只存在于磁盘索引中，别名要看它指向的内容是否存在
+    SDImageCacheIndexEntry *entry = [self.diskIndex entryForFileName:fileName];
+    if (entry.contentFileName) {
+        return [self diskCacheFileExistsForFileName:entry.contentFileName];
+    }
+    NSString *defaultPath = [[self shardDirectoryForFileName:fileName] stringByAppendingPathComponent:fileName];
+    BOOL exists = (entry != nil && entry.segment != 0) || [_fileManager fileExistsAtPath:defaultPath];
+
+    // fallback because of https://github.com/rs/SDWebImage/pull/976 that added the extension to the disk file name
+    // checking the key with and without the extension
+    if (!exists) {
+        exists = [_fileManager fileExistsAtPath:defaultPath.stringByDeletingPathExtension];
+    }
+
+    // 分片迁移还没完成的话，文件可能还在旧的平铺路径下
+    if (!exists && self.migratingFlatLayout) {
+        NSString *flatPath = [self.diskCachePath stringByAppendingPathComponent:fileName];
+        exists = [_fileManager fileExistsAtPath:flatPath] || [_fileManager fileExistsAtPath:flatPath.stringByDeletingPathExtension];
+    }
+    return exists;
+}
+
+#pragma mark - Warm start
+
+- (void)startHotSetSaveTimer {
+    _hotSetSaveTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.ioQueue);
+    uint64_t interval = (uint64_t)(kHotSetSaveInterval * NSEC_PER_SEC);
+    dispatch_source_set_timer(_hotSetSaveTimer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)interval), interval, interval / 10);
+    __weak typeof(self) weakSelf = self;
+    dispatch_source_set_event_handler(_hotSetSaveTimer, ^{
+        [weakSelf.hotSet save];
+    });
+    dispatch_resume(_hotSetSaveTimer);
+}
+
+// 记录一次内存或者磁盘的命中
+- (void)recordCacheHitForKey:(nonnull NSString *)key {
+    [self.hotSet recordHitForKey:key];
+}
+
+- (void)preloadHotImagesWithCompletion:(nullable SDWebImageNoParamsBlock)completion {
+    SDImageCacheHotSet *hotSet = self.hotSet;
+    if (!hotSet || !self.config.shouldCacheImagesInMemory) {
+        if (completion) {
+            dispatch_async(dispatch_get_main_queue(), completion);
+        }
+        return;
+    }
+
+    SDImageCacheAsyncReadOperation *operation = [[SDImageCacheAsyncReadOperation alloc] initWithBlock:^(SDImageCacheAsyncReadOperation *readOperation) {
+        CFAbsoluteTime deadline = CFAbsoluteTimeGetCurrent() + self.config.maxHotImagePreloadDuration;
+        NSUInteger maxCost = self.config.maxHotImagePreloadCost;
+        __block NSUInteger totalCost = 0;
+        // handler可能在多个线程中同时调用，额度的统计需要加锁
+        dispatch_semaphore_t costLock = dispatch_semaphore_create(1);
+        BOOL (^admitImage)(NSString *, UIImage *) = ^BOOL(NSString *key, UIImage *image) {
+            NSUInteger cost = SDImageCacheMemoryCostForImage(image);
+            LOCK(costLock);
+            // 单张超过剩余额度的大图跳过，后面的小图仍然可以预加载
+            BOOL admitted = totalCost + cost <= maxCost;
+            if (admitted) {
+                totalCost += cost;
+            }
+            BOOL exhausted = totalCost >= maxCost;
+            UNLOCK(costLock);
+            if (admitted) {
+                [self.memCache setObject:image forKey:key cost:cost];
+            }
+            return !exhausted;
+        };
+
+        [self preloadHotKeys:[hotSet savedKeys] fromIndex:0 deadline:deadline admitImage:admitImage operation:readOperation completion:completion];
+    }];
+    // 排在所有查询之后，不和首屏的查询抢读取队列
+    operation.queuePriority = NSOperationQueuePriorityVeryLow;
+    operation.qualityOfService = NSQualityOfServiceUtility;
+    [self scheduleDiskReadOperation:operation forKeys:@[]];
+}
+
+// 在读取队列的operation中执行，从start开始提交一小批给IO后端，这一批读完（包括解码）之后结束operation，
+// 再把下一批排到读取队列中，批与批之间检查时间和额度；admitImage返回NO表示额度已经用完
+- (void)preloadHotKeys:(nonnull NSArray<NSString *> *)savedKeys
+             fromIndex:(NSUInteger)start
+              deadline:(CFAbsoluteTime)deadline
+            admitImage:(nonnull BOOL(^)(NSString * _Nonnull key, UIImage * _Nonnull image))admitImage
+             operation:(nonnull SDImageCacheAsyncReadOperation *)operation
+            completion:(nullable SDWebImageNoParamsBlock)completion {
+    const NSUInteger batchSize = 16;
+    BOOL exhausted = start >= savedKeys.count || CFAbsoluteTimeGetCurrent() >= deadline;
+    NSMutableArray<SDImageCacheKey *> *readKeys = [NSMutableArray array];
+    for (NSUInteger i = start; i < MIN(start + batchSize, savedKeys.count) && !exhausted; i++) {
+        @autoreleasepool {
+            SDImageCacheKey *key = [SDImageCacheKey keyWithString:savedKeys[i]];
+            if ([self.memCache objectForKey:key]) {
+                continue;
+            }
+            UIImage *image = [self decodedDiskImageForKey:key];
+            if (!image) {
+                [readKeys addObject:key];
+            } else if (!admitImage(key, image)) {
+                exhausted = YES;
+            }
+        }
+    }
+    if (exhausted) {
+        [operation finish];
+        if (completion) {
+            dispatch_async(dispatch_get_main_queue(), completion);
+        }
+        return;
+    }
+
+    // handler可能在多个线程中同时调用
+    dispatch_semaphore_t exhaustedLock = dispatch_semaphore_create(1);
+    __block BOOL batchExhausted = NO;
+    [self readDiskDataForKeys:readKeys handler:^(NSString *key, NSData *data, SDImageCacheDataSource source) {
+        if (!data) {
+            return;
+        }
+        LOCK(exhaustedLock);
+        BOOL skip = batchExhausted;
+        UNLOCK(exhaustedLock);
+        if (skip) {
+            return;
+        }
+        @autoreleasepool {
+            UIImage *image = [self diskImageForKey:key data:data];
+            if (image && !admitImage(key, image)) {
+                LOCK(exhaustedLock);
+                batchExhausted = YES;
+                UNLOCK(exhaustedLock);
+            }
+        }
+    } completion:^{
+        [operation finish];
+        if (batchExhausted) {
+            if (completion) {
+                dispatch_async(dispatch_get_main_queue(), completion);
+            }
+            return;
+        }
+        SDImageCacheAsyncReadOperation *nextOperation = [[SDImageCacheAsyncReadOperation alloc] initWithBlock:^(SDImageCacheAsyncReadOperation *readOperation) {
+            [self preloadHotKeys:savedKeys fromIndex:start + batchSize deadline:deadline admitImage:admitImage operation:readOperation completion:completion];
+        }];
+        nextOperation.queuePriority = NSOperationQueuePriorityVeryLow;
+        nextOperation.qualityOfService = NSQualityOfServiceUtility;
+        [self.readQueue addOperation:nextOperation];
+    }];
+}
+
+// 同步在内存中查询图片
+- (nullable UIImage *)imageFromMemoryCacheForKey:(nullable NSString *)key {
+    return [self.memCache objectForKey:key];
+}
+
+- (void)setMemoryCachePriority:(SDImageCacheMemoryPriority)priority forKey:(nullable NSString *)key {
+    if (!key) {
+        return;
+    }
+    [self.memCache setPriority:priority forKey:key];
+}
+
+// 预览数据常驻在磁盘索引中，只需要计算文件名和一次字典查找，不访问文件系统也不解码
+- (nullable UIImage *)previewImageForKey:(nullable NSString *)key {
+    if (!key) {
+        return nil;
+    }
+    NSData *previewData = [self.diskIndex previewDataForFileName:[self cachedFileNameForKey:key]];
+    if (!previewData) {
+        return nil;
+    }
+    return [SDImageCachePreview imageWithPreviewData:previewData];
+}
+
+// 同步在磁盘中查询图片
+- (nullable UIImage *)imageFromDiskCacheForKey:(nullable NSString *)key {
+    SDImageCacheDataSource source = SDImageCacheDataSourceNone;
+    UIImage *diskImage = [self diskImageForKey:key source:&source];
+    [self recordQueryResultForImage:diskImage source:source];
+    if (diskImage && self.config.shouldCacheImagesInMemory) {
+        NSUInteger cost = SDImageCacheMemoryCostForImage(diskImage);
+        // 缓存到内存中
+        [self.memCache setObject:diskImage forKey:key cost:cost];
+    }
+
+    return diskImage;
+}
+
+// 同步查询图片，先从内存中找，如果没找到再去磁盘中找
+- (nullable UIImage *)imageFromCacheForKey:(nullable NSString *)key {
+    // First check the in-memory cache...
+    UIImage *image = [self imageFromMemoryCacheForKey:key];
+    if (image) {
+        [self.statisticsRecorder incrementCounter:SDImageCacheStatisticsCounterMemoryHits by:1];
+    } else {
+        // Second check the disk cache...
+        image = [self imageFromDiskCacheForKey:key];
+    }
+    if (image) {
+        [self recordCacheHitForKey:key];
+    }
+    return image;
+}
+
+// 在Disk中获取数据跟在内存中获取不一样，内存中直接保存的是UIImage，而Disk中保存的是NSData，因此肯定需要一个NSData -> UIImage 的转换过程。接下来我们看看这个转换过程：
+- (nullable NSData *)diskImageDataBySearchingAllPathsForKey:(nullable NSString *)key
+{
+    return [self diskImageDataBySearchingAllPathsForKey:key source:NULL];
+}
+
+// source返回数据的来源，读取到数据时统计读取的时间和字节数
+- (nullable NSData *)diskImageDataBySearchingAllPathsForKey:(nullable NSString *)key source:(nullable SDImageCacheDataSource *)source
+{
+    CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+    SDImageCacheDataSource dataSource = SDImageCacheDataSourceNone;
+    NSData *data = [self searchDiskImageDataForKey:key source:&dataSource];
+    if (data) {
+        [self.statisticsRecorder recordDiskReadDuration:CFAbsoluteTimeGetCurrent() - startTime];
+        [self.statisticsRecorder incrementCounter:SDImageCacheStatisticsCounterBytesRead by:data.length];
+    }
+    if (source) {
+        *source = dataSource;
+    }
+    return data;
+}
+
+// 依次在磁盘缓存、旧文件名、只读缓存包和只读路径中查找
+- (nullable NSData *)searchDiskImageDataForKey:(nullable NSString *)key source:(nonnull SDImageCacheDataSource *)source
+{
+    // 文件名只计算一次（key是SDImageCacheKey时直接取缓存的文件名），之后所有路径都复用
+    NSString *fileName = [self cachedFileNameForKey:key];
+    [self recordDiskRequestForFileName:fileName];
+    *source = SDImageCacheDataSourceDisk;
+    NSData *data = [self diskCacheDataForFileName:fileName];
+    if (data) {
+        return data;
+    }
+
+    // 兼容旧版本用MD5命名的缓存文件，命中后在后台改成新的文件名
+    // 磁盘中已经没有旧文件时跳过，未命中时不需要计算MD5
+    NSString *legacyFileName = nil;
+    if ([self shouldSearchLegacyFileNames] && key) {
+        legacyFileName = [self legacyCachedFileNameForKey:key];
+        data = [self diskCacheDataForFileName:legacyFileName];
+        if (data) {
+            [self migrateLegacyFileName:legacyFileName forKey:key data:data];
+            return data;
+        }
+    }
+
+    // 再从只读缓存包中获取
+    *source = SDImageCacheDataSourceReadOnly;
+    if (key) {
+        data = [self readOnlyBundleDataForKey:key];
+        if (data) {
+            return data;
+        }
     }
 
     // 如果没有获取到，再从自定义的路径获取
+    // 只读路径不在索引中，可能是旧版本生成的，仍然按MD5文件名查找
     NSArray<NSString *> *customPaths = [self.customPaths copy];
     for (NSString *path in customPaths) {
-        NSString *filePath = [self cachePathForKey:key inPath:path];
-        NSData *imageData = [NSData dataWithContentsOfFile:filePath];
-        if (imageData) {
-            return imageData;
+        data = [self readOnlyCacheDataAtPath:path fileName:fileName];
+        if (!data && self.config.shouldReadLegacyFileNames && key) {
+            if (!legacyFileName) {
+                legacyFileName = [self legacyCachedFileNameForKey:key];
+            }
+            data = [self readOnlyCacheDataAtPath:path fileName:legacyFileName];
+        }
+        if (data) {
+            return data;
+        }
+    }
+
+    *source = SDImageCacheDataSourceNone;
+    return nil;
+}
+
+// 在读取队列中执行，一批key中单独存成文件的一起提交给IO后端，不等待读取完成，完成的顺序不确定，handler可能在多个线程中同时调用
+// 其它的（pack segment、只读路径、旧文件名等）以及IO后端没读到的，按原来的方式逐个查找
+// 所有key的handler都调用完毕之后在后台线程中调用completion，调用者所在的SDImageCacheAsyncReadOperation在这时才结束
+- (void)readDiskDataForKeys:(nonnull NSArray<NSString *> *)keys
+                    handler:(nonnull void(^)(NSString * _Nonnull key, NSData * _Nullable data, SDImageCacheDataSource source))handler
+                 completion:(nonnull dispatch_block_t)completion {
+    NSMutableArray<NSString *> *fileKeys = [NSMutableArray array];
+    NSMutableArray<NSString *> *filePaths = [NSMutableArray array];
+    NSMutableArray<NSString *> *otherKeys = [NSMutableArray array];
+    // 分片迁移期间文件可能还在旧路径，全部按原来的方式查找
+    BOOL migrating = self.migratingFlatLayout;
+    for (NSString *key in keys) {
+        NSString *fileName = [self cachedFileNameForKey:key];
+        SDImageCacheIndexEntry *entry = [self.diskIndex entryForFileName:fileName];
+        // 别名从它指向的内容中读取
+        SDImageCacheIndexEntry *contentEntry = entry.contentFileName ? [self.diskIndex entryForFileName:entry.contentFileName] : entry;
+        if (!migrating && contentEntry && contentEntry.segment == 0) {
+            [fileKeys addObject:key];
+            [filePaths addObject:[[self shardDirectoryForFileName:contentEntry.fileName] stringByAppendingPathComponent:contentEntry.fileName]];
+        } else {
+            [otherKeys addObject:key];
+        }
+    }
+
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_group_enter(group);
+    [self.ioBackend readFilesAtPaths:filePaths handler:^(NSUInteger index, NSData *data, NSTimeInterval duration) {
+        NSString *key = fileKeys[index];
+        SDImageCacheDataSource source = SDImageCacheDataSourceDisk;
+        if (data) {
+            // 每个文件从发起读取开始计时，不把排在它前面的文件的读取时间算进来
+            [self.statisticsRecorder recordDiskReadDuration:duration];
+            [self.statisticsRecorder incrementCounter:SDImageCacheStatisticsCounterBytesRead by:data.length];
+            NSString *fileName = [self cachedFileNameForKey:key];
+            [self recordDiskRequestForFileName:fileName];
+            [self.diskIndex accessEntryForFileName:fileName];
+            NSString *contentFileName = filePaths[index].lastPathComponent;
+            if (![contentFileName isEqualToString:fileName]) {
+                [self.diskIndex accessEntryForFileName:contentFileName];
+            }
+        } else {
+            // 文件可能刚好被淘汰或者覆盖了，按原来的方式再找一次
+            data = [self diskImageDataBySearchingAllPathsForKey:key source:&source];
+        }
+        handler(key, data, source);
+    } completion:^{
+        dispatch_group_leave(group);
+    }];
+
+    // IO后端的请求在后台进行的同时，处理剩下的key
+    for (NSString *key in otherKeys) {
+        @autoreleasepool {
+            SDImageCacheDataSource source = SDImageCacheDataSourceNone;
+            NSData *data = [self diskImageDataBySearchingAllPathsForKey:key source:&source];
+            handler(key, data, source);
+        }
+    }
+    dispatch_group_notify(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), completion);
+}
+
+// 从只读路径中读取，布隆过滤器判断一定不存在的话直接返回nil
+- (nullable NSData *)readOnlyCacheDataAtPath:(nonnull NSString *)path fileName:(nonnull NSString *)fileName {
+    if (![self readOnlyCachePath:path mayContainFileName:fileName]) {
+        return nil;
+    }
+    NSString *filePath = [path stringByAppendingPathComponent:fileName];
+    NSData *imageData = [self diskDataAtPath:filePath];
+    if (imageData) {
+        return imageData;
+    }
+
+    // fallback because of https://github.com/rs/SDWebImage/pull/976 that added the extension to the disk file name
+    // 要考虑没有pathExtention的情况
+    return [self diskDataAtPath:filePath.stringByDeletingPathExtension];
+}
+
+// 在自己的磁盘缓存中查找（pack segment、分片路径、迁移期间的平铺路径），不包括只读路径
+// 布隆过滤器判断一定不存在的话，不需要再访问文件系统
+- (nullable NSData *)diskCacheDataForFileName:(nonnull NSString *)fileName {
+    if (![self.diskIndex mayContainFileName:fileName]) {
+        return nil;
+    }
+
+    // 开启内容去重时写入的key只是一个别名，从它指向的内容中读取
+    NSString *contentFileName = [self.diskIndex entryForFileName:fileName].contentFileName;
+    if (contentFileName) {
+        NSData *data = [self diskCacheDataForFileName:contentFileName];
+        if (data) {
+            [self.diskIndex accessEntryForFileName:fileName];
+        }
+        return data;
+    }
+
+    // 先从pack segment中获取，命中时更新磁盘索引中的访问时间
+    NSData *data = [self packedDataForFileName:fileName];
+    if (data) {
+        [self.diskIndex accessEntryForFileName:fileName];
+        return data;
+    }
+
+    // 再从默认的路径获取
+    NSString *defaultPath = [[self shardDirectoryForFileName:fileName] stringByAppendingPathComponent:fileName];
+    data = [self diskDataAtPath:defaultPath];
+    if (data) {
+        [self.diskIndex accessEntryForFileName:defaultPath.lastPathComponent];
+        return data;
+    }
+
+    // fallback because of https://github.com/rs/SDWebImage/pull/976 that added the extension to the disk file name
+    // 要考虑没有pathExtention的情况
+    data = [self diskDataAtPath:defaultPath.stringByDeletingPathExtension];
+    if (data) {
+        [self.diskIndex accessEntryForFileName:defaultPath.stringByDeletingPathExtension.lastPathComponent];
+        return data;
+    }
+
+    // 分片迁移还没完成的话，再从旧的平铺路径获取
+    if (self.migratingFlatLayout) {
+        NSString *flatPath = [self.diskCachePath stringByAppendingPathComponent:fileName];
+        data = [self diskDataAtPath:flatPath];
+        if (data) {
+            [self.diskIndex accessEntryForFileName:flatPath.lastPathComponent];
+            return data;
+        }
+        data = [self diskDataAtPath:flatPath.stringByDeletingPathExtension];
+        if (data) {
+            [self.diskIndex accessEntryForFileName:flatPath.stringByDeletingPathExtension.lastPathComponent];
+            return data;
+        }
+    }
+
+    return nil;
+}
+
+// 旧版本的缓存文件命中后，在ioQueue中用新的文件名重新写入一次，然后删除旧文件
+// 作为这个key的一次写入，之后的读取会排在它后面
+- (void)migrateLegacyFileName:(nonnull NSString *)legacyFileName forKey:(nonnull NSString *)key data:(nonnull NSData *)data {
+    [self beginDiskWriteForKey:key];
+    dispatch_async(self.ioQueue, ^{
+        @autoreleasepool {
+            if (![self.diskIndex entryForFileName:[self cachedFileNameForKey:key]]) {
+                [self storeImageDataToDisk:data forKey:key];
+            }
+            // 淘汰策略可能拒绝写入，这时保留旧文件
+            if ([self.diskIndex entryForFileName:[self cachedFileNameForKey:key]]) {
+                [self removeDiskFileForFileName:legacyFileName];
+            }
         }
+        [self endDiskWriteForKey:key];
+    });
+}
+
+// 按照配置的读取选项读取缓存文件，开启映射时返回的NSData直接映射到文件上
+// 缓存文件只会被原子地替换（写入临时文件再rename）或者unlink，已经映射的旧文件不会被截断
+- (nullable NSData *)diskDataAtPath:(nonnull NSString *)path {
+    return [NSData dataWithContentsOfFile:path options:self.config.diskCacheReadingOptions error:nil];
+}
 
-        // fallback because of https://github.com/rs/SDWebImage/pull/976 that added the extension to the disk file name
-        // 要考虑没有pathExtention的情况
-        imageData = [NSData dataWithContentsOfFile:filePath.stringByDeletingPathExtension];
-        if (imageData) {
-            return imageData;
+// 从pack segment中读取数据，记录不在pack中时返回nil
+- (nullable NSData *)packedDataForFileName:(nonnull NSString *)fileName {
+    SDImageCacheIndexEntry *entry = [self.diskIndex entryForFileName:fileName];
+    if (!entry || entry.segment == 0) {
+        return nil;
+    }
+    NSData *data = [self.packStore dataForFileName:fileName segment:entry.segment offset:entry.offset length:entry.size];
+    if (!data) {
+        // 读取的同时segment可能刚好被压缩掉了，重新查一次位置
+        SDImageCacheIndexEntry *movedEntry = [self.diskIndex entryForFileName:fileName];
+        if (movedEntry.segment != 0 && (movedEntry.segment != entry.segment || movedEntry.offset != entry.offset)) {
+            data = [self.packStore dataForFileName:fileName segment:movedEntry.segment offset:movedEntry.offset length:movedEntry.size];
         }
     }
-
-    return nil;
+    return data;
 }
 
 // 根据NSData 获取 UIImage，需要scaled图片，根据配置文件的设置，是否解压图片
-- (nullable UIImage *)diskImageForKey:(nullable NSString *)key {
-    NSData *data = [self diskImageDataBySearchingAllPathsForKey:key];
+- (nullable UIImage *)diskImageForKey:(nullable NSString *)key source:(nonnull SDImageCacheDataSource *)source {
+    UIImage *image = [self decodedDiskImageForKey:key];
+    if (image) {
+        *source = SDImageCacheDataSourceDisk;
+        return image;
+    }
+    NSData *data = [self diskImageDataBySearchingAllPathsForKey:key source:source];
+    return [self diskImageForKey:key data:data];
+}
+
+// 用已经读取到的数据解码，避免同一个文件被读取两次
+- (nullable UIImage *)diskImageForKey:(nullable NSString *)key data:(nullable NSData *)data {
     if (data) {
+        CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
         UIImage *image = [UIImage sd_imageWithData:data];
         image = [self scaledImageForKey:key image:image];
         if (self.config.shouldDecompressImages) {
             image = [UIImage decodedImageWithImage:image];
         }
+        [self.statisticsRecorder recordDecodeDuration:CFAbsoluteTimeGetCurrent() - startTime];
+        if (image && key) {
+            [self storeDecodedImage:image forKey:key data:data];
+        }
         return image;
     }
     else {
@@ -397,9 +1950,53 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     return SDScaledImageForKey(key, image);
 }
 
+#pragma mark - Decoded bitmaps
+
+// 读取保存的像素数据，直接映射成图片，没有开启或者没有保存过时返回nil
+- (nullable UIImage *)decodedDiskImageForKey:(nullable NSString *)key {
+    if (!self.bitmapStore || !key) {
+        return nil;
+    }
+    return [self.bitmapStore imageForFileName:[self cachedFileNameForKey:key] pixelSize:CGSizeZero];
+}
+
+// 磁盘命中并解码之后把像素数据保存下来，下次命中就不需要再解码了
+// 像素拷贝在后台的并发队列中进行，只有写文件在ioQueue中
+// 只保存磁盘缓存中的图片，只读路径和缓存包中的不保存；GIF需要保留原始数据给动画使用，也不保存
+- (void)storeDecodedImage:(nonnull UIImage *)image forKey:(nonnull NSString *)key data:(nonnull NSData *)data {
+    if (!self.bitmapStore || image.images.count > 0 || [NSData sd_imageFormatForImageData:data] == SDImageFormatGIF) {
+        return;
+    }
+    NSString *fileName = [self cachedFileNameForKey:key];
+    SDImageCacheIndexEntry *entry = [self.diskIndex entryForFileName:fileName];
+    if (!entry) {
+        return;
+    }
+    NSTimeInterval storeDate = entry.storeDate;
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+        NSData *bitmapData = [self.bitmapStore bitmapDataForImage:image pixelSize:CGSizeZero];
+        if (!bitmapData) {
+            return;
+        }
+        dispatch_async(self.ioQueue, ^{
+            // 读取之后这个key又被覆盖或者删除了，解码的结果已经过时
+            if ([self.diskIndex entryForFileName:fileName].storeDate != storeDate) {
+                return;
+            }
+            [self.bitmapStore storeBitmapData:bitmapData forFileName:fileName pixelSize:CGSizeZero];
+        });
+    });
+}
+
 // 异步查询图片是否存在，这里返回了一个NSOperation,原因是在内存中获取耗时非常短，在disk中时间相对较长
 // 为什么要返回一个NSOperation对象呢？ 其实我们可以通过这个NSOperation对象取消获取任务
 - (nullable NSOperation *)queryCacheOperationForKey:(nullable NSString *)key done:(nullable SDCacheQueryCompletedBlock)doneBlock {
+    return [self queryCacheOperationForKey:key priority:SDImageCacheQueryPriorityNormal done:doneBlock];
+}
+
+- (nullable NSOperation *)queryCacheOperationForKey:(nullable NSString *)key
+                                           priority:(SDImageCacheQueryPriority)priority
+                                               done:(nullable SDCacheQueryCompletedBlock)doneBlock {
     // 1. 如果key为nil，说明url不对，因此不执行后面的操作了，直接返回Operaion为nil。
     if (!key) {
         if (doneBlock) {
@@ -411,6 +2008,10 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     // 2. 首先检查内存中key对应的缓存，返回图像
     UIImage *image = [self imageFromMemoryCacheForKey:key];
     if (image) {
+        // 内存命中也算一次请求，否则常用的图片在磁盘上会显得很冷门
+        [self recordDiskRequestForFileName:[self cachedFileNameForKey:key]];
+        [self recordCacheHitForKey:key];
+        [self.statisticsRecorder incrementCounter:SDImageCacheStatisticsCounterMemoryHits by:1];
         NSData *diskData = nil;
         // 如果在内存中获取到的图片是GIF，那么要去Disk中获取
         if ([image isGIF]) {
@@ -424,37 +2025,204 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     }
 
     // 3. 如果内存中没有，现在检查磁盘的缓存
-    NSOperation *operation = [NSOperation new];
-    // 新开一个串行队列 ioQueue，在里面执行下面的代码
-    dispatch_async(self.ioQueue, ^{
-        if (operation.isCancelled) {
+    // 放到读取队列中并发执行，取消这个operation时还没开始的读取就不会再执行了
+    NSBlockOperation *operation = [NSBlockOperation new];
+    __weak NSBlockOperation *weakOperation = operation;
+    [operation addExecutionBlock:^{
+        if (weakOperation.isCancelled) {
             // do not call the completion if cancelled
             return;
         }
 
         @autoreleasepool {
             // 搜索磁盘缓存，将磁盘缓存加入内存缓存
-            NSData *diskData = [self diskImageDataBySearchingAllPathsForKey:key];
-            UIImage *diskImage = [self diskImageForKey:key];
+            // 先找保存的像素数据，命中时不需要读取原始数据，也不需要解码
+            UIImage *diskImage = [self decodedDiskImageForKey:key];
+            NSData *diskData = nil;
+            SDImageCacheDataSource source = SDImageCacheDataSourceDisk;
+            if (!diskImage) {
+                // 只读取一次磁盘，解码和回调用的是同一份数据（开启映射时就是同一个文件映射）
+                diskData = [self diskImageDataBySearchingAllPathsForKey:key source:&source];
+                // 读取和解码之间检查一次，已经取消的查询不再浪费时间去解码
+                if (weakOperation.isCancelled) {
+                    return;
+                }
+                diskImage = [self diskImageForKey:key data:diskData];
+            }
+            if (weakOperation.isCancelled) {
+                return;
+            }
+            [self recordQueryResultForImage:diskImage source:source];
+            if (diskImage) {
+                [self recordCacheHitForKey:key];
+            }
             // 如果取到了磁盘图像，且图片缓存配置shouldCacheImagesInMemory=YES，那么执行下面的操作
             if (diskImage && self.config.shouldCacheImagesInMemory) {
                 // 计算将图片缓存到内存中需要的开销大小，并根据key和大小将图片缓存到内存中
-                NSUInteger cost = SDCacheCostForImage(diskImage);
+                NSUInteger cost = SDImageCacheMemoryCostForImage(diskImage);
                 [self.memCache setObject:diskImage forKey:key cost:cost];
             }
 
             // 在主线程执行对应的回调，这里的缓存类型是磁盘缓存
             if (doneBlock) {
                 dispatch_async(dispatch_get_main_queue(), ^{
+                    if (weakOperation.isCancelled) {
+                        return;
+                    }
                     doneBlock(diskImage, diskData, SDImageCacheTypeDisk);
                 });
             }
         }
-    });
+    }];
+    operation.queuePriority = SDOperationQueuePriorityForQueryPriority(priority);
+    [self scheduleDiskReadOperation:operation forKey:key];
+
+    return operation;
+}
+
+- (nullable NSOperation *)queryCacheForKeys:(nonnull NSArray<NSString *> *)keys
+                                  completed:(nullable SDCacheBatchQueryCompletedBlock)completedBlock {
+    return [self queryCacheForKeys:keys priority:SDImageCacheQueryPriorityNormal progress:nil completed:completedBlock];
+}
+
+- (nullable NSOperation *)queryCacheForKeys:(nonnull NSArray<NSString *> *)keys
+                                   priority:(SDImageCacheQueryPriority)priority
+                                   progress:(nullable SDCacheBatchQueryProgressBlock)progressBlock
+                                  completed:(nullable SDCacheBatchQueryCompletedBlock)completedBlock {
+    // 1. 内存命中的直接返回，重复的key只查一次
+    NSMutableDictionary<NSString *, UIImage *> *memoryImages = [NSMutableDictionary dictionary];
+    NSMutableOrderedSet<NSString *> *diskKeys = [NSMutableOrderedSet orderedSet];
+    for (NSString *key in keys) {
+        if (memoryImages[key] || [diskKeys containsObject:key]) {
+            continue;
+        }
+        UIImage *image = [self imageFromMemoryCacheForKey:key];
+        if (image) {
+            [self recordDiskRequestForFileName:[self cachedFileNameForKey:key]];
+            [self recordCacheHitForKey:key];
+            [self.statisticsRecorder incrementCounter:SDImageCacheStatisticsCounterMemoryHits by:1];
+            memoryImages[key] = image;
+            if (progressBlock) {
+                progressBlock(image, nil, SDImageCacheTypeMemory, key);
+            }
+        } else {
+            [diskKeys addObject:key];
+        }
+    }
+
+    if (diskKeys.count == 0) {
+        if (completedBlock) {
+            completedBlock(memoryImages);
+        }
+        return nil;
+    }
+
+    // 2. 剩下的key放在一个operation中按照磁盘上的位置一起提交读取，取消之后不再解码剩下的key
+    NSArray<NSString *> *diskKeyArray = diskKeys.array;
+    // 整批读取和解码完成之后operation才结束，读取队列的并发数和优先级对它一直有效
+    SDImageCacheAsyncReadOperation *operation = [[SDImageCacheAsyncReadOperation alloc] initWithBlock:^(SDImageCacheAsyncReadOperation *readOperation) {
+        __weak SDImageCacheAsyncReadOperation *weakOperation = readOperation;
+        NSMutableDictionary<NSString *, UIImage *> *diskImages = [NSMutableDictionary dictionary];
+        // 通过IO后端读取的图片在多个线程中同时解码，结果需要加锁
+        dispatch_semaphore_t diskImagesLock = dispatch_semaphore_create(1);
+        void (^didLoadDiskImage)(NSString *, UIImage *, NSData *, SDImageCacheDataSource) = ^(NSString *key, UIImage *diskImage, NSData *diskData, SDImageCacheDataSource source) {
+            [self recordQueryResultForImage:diskImage source:source];
+            [self recordCacheHitForKey:key];
+            if (self.config.shouldCacheImagesInMemory) {
+                NSUInteger cost = SDImageCacheMemoryCostForImage(diskImage);
+                [self.memCache setObject:diskImage forKey:key cost:cost];
+            }
+            LOCK(diskImagesLock);
+            diskImages[key] = diskImage;
+            UNLOCK(diskImagesLock);
+
+            if (progressBlock) {
+                dispatch_async(dispatch_get_main_queue(), ^{
+                    if (weakOperation.isCancelled) {
+                        return;
+                    }
+                    progressBlock(diskImage, diskData, SDImageCacheTypeDisk, key);
+                });
+            }
+        };
+
+        // 先找保存的像素数据，命中的不需要再读取原始数据
+        NSMutableArray<NSString *> *readKeys = [NSMutableArray array];
+        for (NSString *key in [self keysSortedByDiskLocation:diskKeyArray]) {
+            if (readOperation.isCancelled) {
+                [readOperation finish];
+                return;
+            }
+            @autoreleasepool {
+                UIImage *diskImage = [self decodedDiskImageForKey:key];
+                if (diskImage) {
+                    didLoadDiskImage(key, diskImage, nil, SDImageCacheDataSourceDisk);
+                } else {
+                    [readKeys addObject:key];
+                }
+            }
+        }
+
+        // 剩下的一起提交读取，按照完成的顺序解码，取消之后读到的数据不再解码
+        [self readDiskDataForKeys:readKeys handler:^(NSString *key, NSData *diskData, SDImageCacheDataSource source) {
+            if (weakOperation.isCancelled) {
+                return;
+            }
+            @autoreleasepool {
+                UIImage *diskImage = diskData ? [self diskImageForKey:key data:diskData] : nil;
+                if (diskImage) {
+                    didLoadDiskImage(key, diskImage, diskData, source);
+                } else {
+                    [self recordQueryResultForImage:nil source:SDImageCacheDataSourceNone];
+                }
+            }
+        } completion:^{
+            [readOperation finish];
+            if (readOperation.isCancelled || !completedBlock) {
+                return;
+            }
+            dispatch_async(dispatch_get_main_queue(), ^{
+                if (weakOperation.isCancelled) {
+                    return;
+                }
+                [diskImages addEntriesFromDictionary:memoryImages];
+                completedBlock(diskImages);
+            });
+        }];
+    }];
+    operation.queuePriority = SDOperationQueuePriorityForQueryPriority(priority);
+    [self scheduleDiskReadOperation:operation forKeys:diskKeyArray];
 
     return operation;
 }
 
+// 按照在磁盘上的位置排列：pack segment中的按segment和偏移排列，单独的文件按文件名（也就是分片子目录）排列，
+// 索引中没有的排在最后，这样一批读取在磁盘上尽量是顺序的
+- (nonnull NSArray<NSString *> *)keysSortedByDiskLocation:(nonnull NSArray<NSString *> *)keys {
+    NSMutableArray<NSDictionary *> *locations = [NSMutableArray arrayWithCapacity:keys.count];
+    for (NSString *key in keys) {
+        NSString *fileName = [self cachedFileNameForKey:key];
+        SDImageCacheIndexEntry *entry = [self.diskIndex entryForFileName:fileName];
+        // 别名按照它指向的内容的位置排列
+        if (entry.contentFileName) {
+            fileName = entry.contentFileName;
+            entry = [self.diskIndex entryForFileName:fileName];
+        }
+        [locations addObject:@{@"key": key,
+                               @"indexed": @(entry != nil),
+                               @"packed": @(entry.segment != 0),
+                               @"segment": @(entry.segment),
+                               @"offset": @(entry.offset),
+                               @"fileName": fileName}];
+    }
+    NSArray<NSSortDescriptor *> *sortDescriptors = @[[NSSortDescriptor sortDescriptorWithKey:@"indexed" ascending:NO],
+                                                     [NSSortDescriptor sortDescriptorWithKey:@"packed" ascending:NO],
+                                                     [NSSortDescriptor sortDescriptorWithKey:@"segment" ascending:YES],
+                                                     [NSSortDescriptor sortDescriptorWithKey:@"offset" ascending:YES],
+                                                     [NSSortDescriptor sortDescriptorWithKey:@"fileName" ascending:YES]];
+    return [[locations sortedArrayUsingDescriptors:sortDescriptors] valueForKey:@"key"];
+}
+
 #pragma mark - Remove Ops
 
 - (void)removeImageForKey:(nullable NSString *)key withCompletion:(nullable SDWebImageNoParamsBlock)completion {
@@ -471,8 +2239,18 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     }
 
     if (fromDisk) {
+        [self beginDiskWriteForKey:key];
+        // 还在写入缓冲中的写入不再需要写到磁盘了
+        SDImageCachePendingWrite *droppedWrite = [self takeBufferedWriteForKey:key];
         dispatch_async(self.ioQueue, ^{
-            [_fileManager removeItemAtPath:[self defaultCachePathForKey:key] error:nil];
+            [self removeDiskFileForFileName:[self cachedFileNameForKey:key]];
+            if ([self shouldSearchLegacyFileNames]) {
+                [self removeDiskFileForFileName:[self legacyCachedFileNameForKey:key]];
+            }
+            if (droppedWrite) {
+                [self finishBufferedWrites:@[droppedWrite] forKeys:@[key]];
+            }
+            [self endDiskWriteForKey:key];
             
             if (completion) {
                 dispatch_async(dispatch_get_main_queue(), ^{
@@ -505,19 +2283,53 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 }
 
 #pragma mark - Cache clean Ops
+// 内存压力升高时尽快把写入缓冲写到磁盘，释放其中持有的图片和数据
+- (void)memoryPressureDidChange:(NSNotification *)notification {
+    SDImageCacheMemoryPressureLevel level = [notification.userInfo[SDImageCacheMemoryPressureLevelKey] integerValue];
+    if (level == SDImageCacheMemoryPressureLevelNormal) {
+        return;
+    }
+    dispatch_async(self.ioQueue, ^{
+        [self flushBufferedWrites];
+    });
+}
+
 // 清空内存缓存数据
 - (void)clearMemory {
     [self.memCache removeAllObjects];
+    LOCK(_memoryTagsLock);
+    [_memoryTaggedKeys removeAllObjects];
+    UNLOCK(_memoryTagsLock);
 }
 
 // 异步清空Disk数据
 - (void)clearDiskOnCompletion:(nullable SDWebImageNoParamsBlock)completion {
     dispatch_async(self.ioQueue, ^{
-        [_fileManager removeItemAtPath:self.diskCachePath error:nil];
-        [_fileManager createDirectoryAtPath:self.diskCachePath
-                withIntermediateDirectories:YES
-                                 attributes:nil
-                                      error:NULL];
+        // 写入缓冲中还没写到磁盘的写入直接丢弃
+        NSDictionary<NSString *, SDImageCachePendingWrite *> *pendingWrites = nil;
+        NSArray<NSString *> *pendingKeys = [self takeAllBufferedWrites:&pendingWrites];
+        // 已经提交给IO后端的写入等它完成之后一起删除
+        [self waitForInFlightWritesToFileNames:nil];
+
+        [self.packStore removeAllSegments];
+        [self.bitmapStore removeAllImages];
+        if (self.coordinator) {
+            [self.coordinator performExclusively:^{
+                [self removeSharedDiskCacheContents];
+            }];
+        } else {
+            [_fileManager removeItemAtPath:self.diskCachePath error:nil];
+            [_fileManager createDirectoryAtPath:self.diskCachePath
+                    withIntermediateDirectories:YES
+                                     attributes:nil
+                                          error:NULL];
+        }
+        [_createdShardDirectories removeAllObjects];
+        _packDirectoryExcludedFromBackup = NO;
+        [self.diskIndex removeAllEntries];
+        [self.coordinator setNeedsNotifyChange];
+        [self.hotSet removeAllKeys];
+        [self finishBufferedWrites:[pendingWrites objectsForKeys:pendingKeys notFoundMarker:[NSNull null]] forKeys:pendingKeys];
 
         if (completion) {
             dispatch_async(dispatch_get_main_queue(), ^{
@@ -534,79 +2346,68 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 
 // 1. 首先要清空掉所有的过期的数据
 // 2. 过期的数据清空后，缓存的数据比我们设置的最大缓存量还大，我们要继续清空数据，直到满足我们的需求为止
+// 文件的大小和写入时间都从磁盘索引中获取，不再需要遍历整个缓存目录
 - (void)deleteOldFilesWithCompletionBlock:(nullable SDWebImageNoParamsBlock)completionBlock {
     dispatch_async(self.ioQueue, ^{
-        NSURL *diskCacheURL = [NSURL fileURLWithPath:self.diskCachePath isDirectory:YES];
-        // 是否是文件夹、最后修改时间、分配的尺寸
-        NSArray<NSString *> *resourceKeys = @[NSURLIsDirectoryKey, NSURLContentModificationDateKey, NSURLTotalFileAllocatedSizeKey];
-
-        // This enumerator prefetches useful properties for our cache files.
-        // options:NSDirectoryEnumerationSkipsHiddenFiles 是指忽略隐藏文件
-        NSDirectoryEnumerator *fileEnumerator = [_fileManager enumeratorAtURL:diskCacheURL
-                                                   includingPropertiesForKeys:resourceKeys
-                                                                      options:NSDirectoryEnumerationSkipsHiddenFiles
-                                                                 errorHandler:NULL];
-
-        NSDate *expirationDate = [NSDate dateWithTimeIntervalSinceNow:-self.config.maxCacheAge];
-        NSMutableDictionary<NSURL *, NSDictionary<NSString *, id> *> *cacheFiles = [NSMutableDictionary dictionary];
-        NSUInteger currentCacheSize = 0;
-
-        // Enumerate all of the files in the cache directory.  This loop has two purposes:
-        //
-        //  1. Removing files that are older than the expiration date.
-        //  2. Storing file attributes for the size-based cleanup pass.
-        NSMutableArray<NSURL *> *urlsToDelete = [[NSMutableArray alloc] init];
-        for (NSURL *fileURL in fileEnumerator) {
-            NSError *error;
-            NSDictionary<NSString *, id> *resourceValues = [fileURL resourceValuesForKeys:resourceKeys error:&error];
-
-            // Skip directories and errors.
-            if (error || !resourceValues || [resourceValues[NSURLIsDirectoryKey] boolValue]) {
-                continue;
-            }
+        // 进入后台、退出时都会清理，先把写入缓冲中的数据写到磁盘，清理时的大小统计也更准确
+        [self flushBufferedWrites];
 
-            // Remove files that are older than the expiration date;
-            NSDate *modificationDate = resourceValues[NSURLContentModificationDateKey];
-            if ([[modificationDate laterDate:expirationDate] isEqualToDate:expirationDate]) {
-                [urlsToDelete addObject:fileURL];
-                continue;
+        // 共享磁盘缓存时，其它进程正在清理或者刚清理过的话，不需要再清理一次
+        if (self.coordinator && ([NSDate timeIntervalSinceReferenceDate] - self.coordinator.lastCleanupDate < kSharedCleanupInterval
+                                 || ![self.coordinator tryBeginEviction])) {
+            [self.hotSet save];
+            if (completionBlock) {
+                dispatch_async(dispatch_get_main_queue(), ^{
+                    completionBlock();
+                });
             }
-
-            // Store a reference to this file and account for its total size.
-            NSNumber *totalAllocatedSize = resourceValues[NSURLTotalFileAllocatedSizeKey];
-            currentCacheSize += totalAllocatedSize.unsignedIntegerValue;
-            cacheFiles[fileURL] = resourceValues;
+            return;
         }
-        
-        for (NSURL *fileURL in urlsToDelete) {
-            [_fileManager removeItemAtURL:fileURL error:nil];
+        [self.diskIndex reloadChanges];
+
+        // Remove files that are older than the expiration date.
+        // 索引中的记录是按写入时间排好序的，这里只会访问到过期的那部分记录
+        NSTimeInterval expirationDate = [NSDate timeIntervalSinceReferenceDate] - self.config.maxCacheAge;
+        // 删除一个文件时别名和内容文件会一起删除，后面的记录可能已经不在索引中了，只统计真正删除的
+        NSUInteger expiredCount = 0;
+        for (SDImageCacheIndexEntry *entry in [self.diskIndex entriesStoredBefore:expirationDate]) {
+            if (![self.diskIndex entryForFileName:entry.fileName]) {
+                continue;
+            }
+            [self removeDiskFileForFileName:entry.fileName];
+            expiredCount += 1;
         }
+        [self.statisticsRecorder incrementCounter:SDImageCacheStatisticsCounterExpiredFiles by:expiredCount];
 
         // If our remaining disk cache exceeds a configured maximum size, perform a second
-        // size-based cleanup pass.  We delete the oldest files first.
-        if (self.config.maxCacheSize > 0 && currentCacheSize > self.config.maxCacheSize) {
-            // Target half of our maximum cache size for this cleanup pass.
-            const NSUInteger desiredCacheSize = self.config.maxCacheSize / 2;
-
-            // Sort the remaining cache files by their last modification time (oldest first).
-            NSArray<NSURL *> *sortedFiles = [cacheFiles keysSortedByValueWithOptions:NSSortConcurrent
-                                                                     usingComparator:^NSComparisonResult(id obj1, id obj2) {
-                                                                         return [obj1[NSURLContentModificationDateKey] compare:obj2[NSURLContentModificationDateKey]];
-                                                                     }];
+        // size-based cleanup pass.  按照淘汰策略给出的顺序删除（默认FIFO是最早写入的先删除）
+        // 平时写入时已经有增量淘汰，这里只是兜底，比如maxCacheSize被调小了
+        if (self.config.maxCacheSize > 0 && self.diskIndex.totalSize > self.config.maxCacheSize) {
+            // 降到低水位，而不是一次删掉一半的缓存
+            NSUInteger highWatermarkSize, desiredCacheSize;
+            [self getHighWatermarkSize:&highWatermarkSize lowWatermarkSize:&desiredCacheSize];
 
             // Delete files until we fall below our desired cache size.
-            for (NSURL *fileURL in sortedFiles) {
-                if ([_fileManager removeItemAtURL:fileURL error:nil]) {
-                    NSDictionary<NSString *, id> *resourceValues = cacheFiles[fileURL];
-                    NSNumber *totalAllocatedSize = resourceValues[NSURLTotalFileAllocatedSizeKey];
-                    currentCacheSize -= totalAllocatedSize.unsignedIntegerValue;
-
-                    if (currentCacheSize < desiredCacheSize) {
-                        break;
-                    }
+            NSArray<SDImageCacheIndexEntry *> *entries = [self.evictionPolicy entriesInEvictionOrder:[self.diskIndex allEntries]];
+            for (SDImageCacheIndexEntry *entry in entries) {
+                if (![self.diskIndex entryForFileName:entry.fileName]) {
+                    continue;
+                }
+                [self removeDiskFileForFileName:entry.fileName];
+                [self.statisticsRecorder incrementCounter:SDImageCacheStatisticsCounterDiskEvictions by:1];
+                if (self.diskIndex.totalSize <= desiredCacheSize) {
+                    break;
                 }
             }
         }
+
+        // 回收pack segment中被删除的记录占用的空间
+        [self compactPackSegments];
+        [self updateLegacyFileState];
+        [self.coordinator markCleanupFinished];
+        [self.coordinator endEviction];
+        // 进入后台、退出时顺便保存热点key
+        [self.hotSet save];
         if (completionBlock) {
             dispatch_async(dispatch_get_main_queue(), ^{
                 completionBlock();
@@ -615,6 +2416,79 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     });
 }
 
+// 在ioQueue中执行，删除某个缓存文件并更新磁盘索引
+// 保存在pack segment中的图片只需要从索引中删除，占用的空间在压缩segment时回收
+- (void)removeDiskFileForFileName:(nonnull NSString *)fileName {
+    [self waitForInFlightWritesToFileNames:@[fileName]];
+    [self.coordinator setNeedsNotifyChange];
+    SDImageCacheIndexEntry *entry = [self.diskIndex entryForFileName:fileName];
+    [self.bitmapStore removeImagesForFileName:fileName];
+    // 别名只需要从索引中删除，内容的最后一个引用被删除时再删除内容
+    if (entry.contentFileName) {
+        [self.diskIndex removeEntryForFileName:fileName];
+        if ([self.diskIndex aliasFileNamesForContentFileName:entry.contentFileName].count == 0) {
+            [self removeDiskFileForFileName:entry.contentFileName];
+        }
+        return;
+    }
+    // 内容本身被淘汰或者过期的话，指向它的别名也一起删除
+    for (NSString *aliasFileName in [self.diskIndex aliasFileNamesForContentFileName:fileName]) {
+        [self.bitmapStore removeImagesForFileName:aliasFileName];
+        [self.diskIndex removeEntryForFileName:aliasFileName];
+    }
+    if (!entry || entry.segment == 0) {
+        NSString *directory = [self shardDirectoryForFileName:fileName];
+        [_fileManager removeItemAtPath:[directory stringByAppendingPathComponent:fileName] error:nil];
+        if (self.migratingFlatLayout) {
+            [_fileManager removeItemAtPath:[self.diskCachePath stringByAppendingPathComponent:fileName] error:nil];
+        }
+    }
+    [self.diskIndex removeEntryForFileName:fileName];
+}
+
+// 在ioQueue中执行，回收pack segment中已经被删除或者被覆盖的记录占用的空间
+// 有效数据不到一半的segment，把其中有效的记录搬到当前的segment中，然后删除整个segment
+- (void)compactPackSegments {
+    NSMutableDictionary<NSNumber *, NSMutableArray<SDImageCacheIndexEntry *> *> *entriesBySegment = [NSMutableDictionary dictionary];
+    for (SDImageCacheIndexEntry *entry in [self.diskIndex packedEntries]) {
+        NSMutableArray<SDImageCacheIndexEntry *> *entries = entriesBySegment[@(entry.segment)];
+        if (!entries) {
+            entries = [NSMutableArray array];
+            entriesBySegment[@(entry.segment)] = entries;
+        }
+        [entries addObject:entry];
+    }
+
+    for (NSNumber *segment in [self.packStore sealedSegments]) {
+        NSArray<SDImageCacheIndexEntry *> *entries = entriesBySegment[segment];
+        unsigned long long liveBytes = 0;
+        for (SDImageCacheIndexEntry *entry in entries) {
+            liveBytes += entry.size + [SDImageCachePackStore recordOverheadForFileName:entry.fileName];
+        }
+        if (liveBytes * 2 >= [self.packStore sizeOfSegment:segment.unsignedIntValue]) {
+            continue;
+        }
+        // 共享时不再追加写入pack segment，开启共享之前留下的segment只在记录都删除之后整个删除
+        if (self.coordinator && entries.count > 0) {
+            continue;
+        }
+
+        @autoreleasepool {
+            for (SDImageCacheIndexEntry *entry in entries) {
+                NSData *data = [self.packStore dataForFileName:entry.fileName segment:entry.segment offset:entry.offset length:entry.size];
+                uint32_t newSegment = 0;
+                uint64_t newOffset = 0;
+                if (data && [self.packStore appendData:data forFileName:entry.fileName segment:&newSegment offset:&newOffset]) {
+                    [self.diskIndex moveEntryForFileName:entry.fileName toSegment:newSegment offset:newOffset];
+                } else {
+                    [self.diskIndex removeEntryForFileName:entry.fileName];
+                }
+            }
+        }
+        [self.packStore removeSegment:segment.unsignedIntValue];
+    }
+}
+
 #if SD_UIKIT
 // 申请一段时间在后台删除旧数据
 - (void)backgroundDeleteOldFiles {
@@ -638,17 +2512,321 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 }
 #endif
 
+#pragma mark - Tags
+
+- (void)removeImagesWithTag:(nonnull NSString *)tag completion:(nullable SDWebImageNoParamsBlock)completion {
+    LOCK(_memoryTagsLock);
+    NSSet<NSString *> *memoryKeys = [_memoryTaggedKeys[tag] copy];
+    [_memoryTaggedKeys removeObjectForKey:tag];
+    UNLOCK(_memoryTagsLock);
+
+    [self removeImagesWithMemoryKeys:memoryKeys
+                   bufferedWriteTest:^BOOL(NSString *key, SDImageCachePendingWrite *pendingWrite) {
+                       return [pendingWrite.tags containsObject:tag];
+                   }
+                         diskEntries:^NSArray<SDImageCacheIndexEntry *> *{
+                             return [self.diskIndex entriesWithTag:tag];
+                         }
+                          completion:completion];
+}
+
+- (void)removeImagesWithKeyPrefix:(nonnull NSString *)prefix completion:(nullable SDWebImageNoParamsBlock)completion {
+    // 只在内存中的带tag的图片一般很少，直接遍历
+    NSMutableSet<NSString *> *memoryKeys = [NSMutableSet set];
+    LOCK(_memoryTagsLock);
+    for (NSString *tag in _memoryTaggedKeys.allKeys) {
+        NSMutableSet<NSString *> *keys = _memoryTaggedKeys[tag];
+        for (NSString *key in [keys copy]) {
+            if ([key hasPrefix:prefix]) {
+                [memoryKeys addObject:key];
+                [keys removeObject:key];
+            }
+        }
+        if (keys.count == 0) {
+            [_memoryTaggedKeys removeObjectForKey:tag];
+        }
+    }
+    UNLOCK(_memoryTagsLock);
+
+    [self removeImagesWithMemoryKeys:memoryKeys
+                   bufferedWriteTest:^BOOL(NSString *key, SDImageCachePendingWrite *pendingWrite) {
+                       return [key hasPrefix:prefix];
+                   }
+                         diskEntries:^NSArray<SDImageCacheIndexEntry *> *{
+                             return [self.diskIndex entriesWithKeyPrefix:prefix];
+                         }
+                          completion:completion];
+}
+
+// 记录只保存在内存中的图片的tag
+- (void)addMemoryTags:(nonnull NSSet<NSString *> *)tags forKey:(nonnull NSString *)key {
+    LOCK(_memoryTagsLock);
+    for (NSString *tag in tags) {
+        NSMutableSet<NSString *> *keys = _memoryTaggedKeys[tag];
+        if (!keys) {
+            keys = [NSMutableSet set];
+            _memoryTaggedKeys[tag] = keys;
+        }
+        [keys addObject:key];
+    }
+    UNLOCK(_memoryTagsLock);
+}
+
+// 按tag或者前缀批量删除：只在内存中的图片立即删除，写入缓冲中匹配的写入不再写到磁盘，
+// 磁盘上匹配的记录在ioQueue中从索引里查出来删除，同时删除内存中对应的图片，只会访问到匹配的那部分记录
+- (void)removeImagesWithMemoryKeys:(nullable NSSet<NSString *> *)memoryKeys
+                 bufferedWriteTest:(nonnull BOOL (^)(NSString *key, SDImageCachePendingWrite *pendingWrite))bufferedWriteTest
+                       diskEntries:(nonnull NSArray<SDImageCacheIndexEntry *> * (^)(void))diskEntries
+                        completion:(nullable SDWebImageNoParamsBlock)completion {
+    for (NSString *key in memoryKeys) {
+        [self.memCache removeObjectForKey:key];
+    }
+
+    NSMutableArray<NSString *> *droppedKeys = [NSMutableArray array];
+    LOCK(_bufferedWritesLock);
+    for (NSString *key in _bufferedWriteOrder) {
+        if (bufferedWriteTest(key, _bufferedWrites[key])) {
+            [droppedKeys addObject:key];
+        }
+    }
+    UNLOCK(_bufferedWritesLock);
+    NSMutableArray<NSString *> *droppedWriteKeys = [NSMutableArray array];
+    NSMutableArray<SDImageCachePendingWrite *> *droppedWrites = [NSMutableArray array];
+    for (NSString *key in droppedKeys) {
+        [self.memCache removeObjectForKey:key];
+        SDImageCachePendingWrite *pendingWrite = [self takeBufferedWriteForKey:key];
+        if (pendingWrite) {
+            [droppedWriteKeys addObject:key];
+            [droppedWrites addObject:pendingWrite];
+        }
+    }
+
+    dispatch_async(self.ioQueue, ^{
+        for (SDImageCacheIndexEntry *entry in diskEntries()) {
+            if (entry.key) {
+                [self.memCache removeObjectForKey:entry.key];
+            }
+            [self removeDiskFileForFileName:entry.fileName];
+        }
+        [self finishBufferedWrites:droppedWrites forKeys:droppedWriteKeys];
+        if (completion) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                completion();
+            });
+        }
+    });
+}
+
+#pragma mark - Cache group
+
+// 请求同时记录到自己的淘汰策略和所在缓存组的淘汰策略中
+- (void)recordDiskRequestForFileName:(nonnull NSString *)fileName {
+    [self.evictionPolicy recordRequestForFileName:fileName];
+    [self.group.evictionPolicy recordRequestForFileName:fileName];
+}
+
+// 以下方法供SDImageCacheGroup调用
+
+- (NSUInteger)groupDiskSize {
+    return self.diskIndex.totalSize;
+}
+
+- (nonnull NSArray<SDImageCacheIndexEntry *> *)groupDiskEntries {
+    return [self.diskIndex allEntries];
+}
+
+- (void)removeGroupDiskEntries:(nonnull NSArray<SDImageCacheIndexEntry *> *)entries completion:(nonnull SDWebImageNoParamsBlock)completion {
+    dispatch_async(self.ioQueue, ^{
+        for (SDImageCacheIndexEntry *entry in entries) {
+            // 挑选之后记录可能已经被删除或者重新写入了
+            SDImageCacheIndexEntry *currentEntry = [self.diskIndex entryForFileName:entry.fileName];
+            if (currentEntry && currentEntry.storeDate == entry.storeDate) {
+                [self removeDiskFileForFileName:entry.fileName];
+                [self.statisticsRecorder incrementCounter:SDImageCacheStatisticsCounterDiskEvictions by:1];
+            }
+        }
+        completion();
+    });
+}
+
+#pragma mark - Sharing across processes
+
+// 在ioQueue中执行，收到其它进程的修改通知之后回放它们对磁盘索引的修改
+- (void)reloadSharedDiskChanges {
+    NSSet<NSString *> *changedFileNames = [self.diskIndex reloadChanges];
+    if (changedFileNames && changedFileNames.count == 0) {
+        // 自己发出的通知，或者其它进程没有修改索引
+        return;
+    }
+    if (!changedFileNames) {
+        // 其它进程压缩或者清空了索引，可能删除了分片子目录
+        [_createdShardDirectories removeAllObjects];
+    }
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [[NSNotificationCenter defaultCenter] postNotificationName:SDImageCacheDiskCacheDidChangeNotification object:self];
+    });
+}
+
+// 在ioQueue中执行，共享时清空磁盘缓存目录，保留协调用的锁文件，磁盘索引交给removeAllEntries清空
+// 其它进程还打开着这些文件，删除之后新打开的进程和它们就不再互斥了
+- (void)removeSharedDiskCacheContents {
+    for (NSString *fileName in [_fileManager contentsOfDirectoryAtPath:self.diskCachePath error:nil]) {
+        if ([self.coordinator isCoordinationFileName:fileName] || [fileName isEqualToString:kDiskIndexDirectoryName]) {
+            continue;
+        }
+        [_fileManager removeItemAtPath:[self.diskCachePath stringByAppendingPathComponent:fileName] error:nil];
+    }
+}
+
+#pragma mark - Disk index
+
+// 在ioQueue中执行，从快照和日志恢复磁盘索引
+// 索引不存在时（第一次使用或者从旧版本升级），扫描一次缓存目录来重建，之后就再也不需要遍历目录了
+// 去重的别名只记录在索引中，重建时没法恢复，去重的内容文件没有key能找到，也不会再被引用计数删除，直接删掉
+- (void)loadDiskIndex {
+    [self checkIfQueueIsIOQueue];
+
+    if ([self.diskIndex load]) {
+        return;
+    }
+
+    // pack segment中的记录只能通过索引找到，索引丢失时直接丢弃
+    [self.packStore removeAllSegments];
+
+    NSURL *diskCacheURL = [NSURL fileURLWithPath:self.diskCachePath isDirectory:YES];
+    NSArray<NSString *> *resourceKeys = @[NSURLIsDirectoryKey, NSURLContentModificationDateKey, NSURLFileSizeKey];
+    NSDirectoryEnumerator *fileEnumerator = [_fileManager enumeratorAtURL:diskCacheURL
+                                               includingPropertiesForKeys:resourceKeys
+                                                                  options:NSDirectoryEnumerationSkipsHiddenFiles
+                                                             errorHandler:NULL];
+    NSMutableArray<SDImageCacheIndexEntry *> *entries = [NSMutableArray array];
+    for (NSURL *fileURL in fileEnumerator) {
+        NSDictionary<NSString *, id> *resourceValues = [fileURL resourceValuesForKeys:resourceKeys error:nil];
+        if (!resourceValues || [resourceValues[NSURLIsDirectoryKey] boolValue]) {
+            continue;
+        }
+        if ([fileURL.pathExtension isEqualToString:kContentFileExtension]) {
+            [_fileManager removeItemAtURL:fileURL error:nil];
+            continue;
+        }
+        if (!SDIsCacheFileName(fileURL.lastPathComponent)) {
+            continue;
+        }
+        NSTimeInterval modificationDate = [resourceValues[NSURLContentModificationDateKey] timeIntervalSinceReferenceDate];
+        SDImageCacheIndexEntry *entry = [SDImageCacheIndexEntry new];
+        entry.fileName = fileURL.lastPathComponent;
+        entry.size = [resourceValues[NSURLFileSizeKey] unsignedIntegerValue];
+        entry.storeDate = modificationDate;
+        entry.accessDate = modificationDate;
+        entry.format = SDImageFormatUndefined;
+        [entries addObject:entry];
+    }
+
+    // 索引中的记录需要按写入时间从旧到新排列
+    [entries sortUsingComparator:^NSComparisonResult(SDImageCacheIndexEntry *entry1, SDImageCacheIndexEntry *entry2) {
+        if (entry1.storeDate < entry2.storeDate) {
+            return NSOrderedAscending;
+        }
+        return entry1.storeDate > entry2.storeDate ? NSOrderedDescending : NSOrderedSame;
+    }];
+    [self.diskIndex resetWithEntries:entries];
+}
+
+#pragma mark - Shard migration
+
+// 把旧版本留下来的平铺文件（diskCachePath/<md5>.<ext>）迁移到分片子目录中
+// 目录列表在后台队列中获取，真正的移动按批次在ioQueue中执行，这样迁移过程中读写操作仍然可以穿插进行
+- (void)migrateFlatLayoutIfNeeded {
+    if (_shardWidth == 0) {
+        return;
+    }
+    self.migratingFlatLayout = YES;
+
+    __weak __typeof(self) wself = self;
+    NSString *diskCachePath = self.diskCachePath;
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+        NSFileManager *fileManager = [NSFileManager new];
+        NSMutableArray<NSString *> *flatFileNames = [NSMutableArray array];
+        for (NSString *fileName in [fileManager contentsOfDirectoryAtPath:diskCachePath error:nil]) {
+            // 分片子目录的名字最多只有4位，不会被误认为是缓存文件
+            if (SDIsCacheFileName(fileName)) {
+                [flatFileNames addObject:fileName];
+            }
+        }
+
+        for (NSUInteger location = 0; location < flatFileNames.count; location += kShardMigrationBatchSize) {
+            __strong __typeof(wself) sself = wself;
+            if (!sself) {
+                return;
+            }
+            NSRange range = NSMakeRange(location, MIN(kShardMigrationBatchSize, flatFileNames.count - location));
+            NSArray<NSString *> *batch = [flatFileNames subarrayWithRange:range];
+            dispatch_sync(sself.ioQueue, ^{
+                @autoreleasepool {
+                    [sself moveFlatFilesToShards:batch];
+                }
+            });
+        }
+
+        __strong __typeof(wself) sself = wself;
+        if (sself) {
+            // 放到ioQueue中结束迁移，保证在此之前排队的读写操作仍然会检查旧路径
+            dispatch_async(sself.ioQueue, ^{
+                sself.migratingFlatLayout = NO;
+            });
+        }
+    });
+}
+
+// 在ioQueue中执行，把一批平铺文件移动到各自的分片子目录中
+- (void)moveFlatFilesToShards:(nonnull NSArray<NSString *> *)fileNames {
+    [self checkIfQueueIsIOQueue];
+
+    for (NSString *fileName in fileNames) {
+        NSString *sourcePath = [self.diskCachePath stringByAppendingPathComponent:fileName];
+        NSString *directory = [self shardDirectoryForFileName:fileName];
+        NSString *destinationPath = [directory stringByAppendingPathComponent:fileName];
+
+        if (![_createdShardDirectories containsObject:directory]) {
+            [_fileManager createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:NULL];
+            [_createdShardDirectories addObject:directory];
+        }
+
+        // 迁移期间同一个key可能已经写入过新数据了，这时旧文件已经没用，直接删除
+        if ([_fileManager fileExistsAtPath:destinationPath]) {
+            [_fileManager removeItemAtPath:sourcePath error:nil];
+        } else {
+            [_fileManager moveItemAtPath:sourcePath toPath:destinationPath error:nil];
+        }
+    }
+}
+
+#pragma mark - Statistics
+
+- (nonnull SDImageCacheStatistics *)statistics {
+    return [self.statisticsRecorder snapshot];
+}
+
+- (void)resetStatistics {
+    [self.statisticsRecorder reset];
+}
+
+// 记录一次磁盘查询的结果，image为nil时算作未命中
+- (void)recordQueryResultForImage:(nullable UIImage *)image source:(SDImageCacheDataSource)source {
+    SDImageCacheStatisticsCounter counter = SDImageCacheStatisticsCounterMisses;
+    if (image) {
+        counter = source == SDImageCacheDataSourceReadOnly ? SDImageCacheStatisticsCounterReadOnlyHits : SDImageCacheStatisticsCounterDiskHits;
+    }
+    [self.statisticsRecorder incrementCounter:counter by:1];
+}
+
 #pragma mark - Cache Info
 
+// 以下统计信息都直接从磁盘索引中获取，不再遍历缓存目录
 - (NSUInteger)getSize {
     __block NSUInteger size = 0;
     dispatch_sync(self.ioQueue, ^{
-        NSDirectoryEnumerator *fileEnumerator = [_fileManager enumeratorAtPath:self.diskCachePath];
-        for (NSString *fileName in fileEnumerator) {
-            NSString *filePath = [self.diskCachePath stringByAppendingPathComponent:fileName];
-            NSDictionary<NSString *, id> *attrs = [[NSFileManager defaultManager] attributesOfItemAtPath:filePath error:nil];
-            size += [attrs fileSize];
-        }
+        size = self.diskIndex.totalSize;
     });
     return size;
 }
@@ -656,30 +2834,15 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 - (NSUInteger)getDiskCount {
     __block NSUInteger count = 0;
     dispatch_sync(self.ioQueue, ^{
-        NSDirectoryEnumerator *fileEnumerator = [_fileManager enumeratorAtPath:self.diskCachePath];
-        count = fileEnumerator.allObjects.count;
+        count = self.diskIndex.count;
     });
     return count;
 }
 
 - (void)calculateSizeWithCompletionBlock:(nullable SDWebImageCalculateSizeBlock)completionBlock {
-    NSURL *diskCacheURL = [NSURL fileURLWithPath:self.diskCachePath isDirectory:YES];
-
     dispatch_async(self.ioQueue, ^{
-        NSUInteger fileCount = 0;
-        NSUInteger totalSize = 0;
-
-        NSDirectoryEnumerator *fileEnumerator = [_fileManager enumeratorAtURL:diskCacheURL
-                                                   includingPropertiesForKeys:@[NSFileSize]
-                                                                      options:NSDirectoryEnumerationSkipsHiddenFiles
-                                                                 errorHandler:NULL];
-
-        for (NSURL *fileURL in fileEnumerator) {
-            NSNumber *fileSize;
-            [fileURL getResourceValue:&fileSize forKey:NSURLFileSizeKey error:NULL];
-            totalSize += fileSize.unsignedIntegerValue;
-            fileCount += 1;
-        }
+        NSUInteger fileCount = self.diskIndex.count;
+        NSUInteger totalSize = self.diskIndex.totalSize;
 
         if (completionBlock) {
             dispatch_async(dispatch_get_main_queue(), ^{
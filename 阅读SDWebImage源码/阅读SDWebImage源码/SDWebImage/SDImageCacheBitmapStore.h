@@ -0,0 +1,91 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * SDImageCacheBitmapStore 把解码后的像素数据保存到磁盘上，命中时直接映射成图片，不需要再解码。
+ *
+ * 每张图片一个文件：64字节的文件头（尺寸、行字节数、像素格式、scale、方向）后面是按64字节对齐的像素行，
+ * 像素格式固定为32位BGRA（主机字节序，预乘alpha或者忽略alpha）。
+ * 没有压缩的文件通过mmap映射，图片直接引用映射的内存，显示时由系统按需换页；
+ * 开启压缩时用LZ4压缩，读取时解压到内存中，磁盘占用更小但多一次解压。
+ *
+ * 同一个key可以保存不同目标尺寸的多个版本，CGSizeZero表示原始尺寸。
+ * 总大小超过maxSize时按写入顺序删除最早的文件。
+ * 所有方法都是线程安全的，写入和删除应该在同一个串行队列中执行。
+ *
+ * @note 只支持UIKit和WatchKit，macOS上所有读取都返回nil
+ */
+@interface SDImageCacheBitmapStore : NSObject
+
+/** 磁盘占用的上限，单位为字节 */
+@property (assign, nonatomic, readonly) NSUInteger maxSize;
+
+/** 当前所有文件的总大小，单位为字节 */
+@property (assign, nonatomic, readonly) NSUInteger totalSize;
+
+/**
+ * @param directory  保存文件的目录，不存在时会在第一次写入时创建
+ * @param maxSize    磁盘占用的上限，单位为字节
+ * @param compressed 是否用LZ4压缩像素数据
+ */
+- (nonnull instancetype)initWithDirectory:(nonnull NSString *)directory
+                                  maxSize:(NSUInteger)maxSize
+                               compressed:(BOOL)compressed NS_DESIGNATED_INITIALIZER;
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+/**
+ * 在后台扫描目录，恢复已经保存的文件列表，立即返回，在第一次读写之前调用一次
+ * 扫描完成之前读取直接查找文件，删除时删除整个缓存文件名的目录，总大小中还不包括之前保存的文件
+ */
+- (void)load;
+
+/**
+ * 读取某个缓存文件名（SDImageCache中key对应的文件名）和目标尺寸对应的图片
+ *
+ * @param pixelSize 目标尺寸，单位为像素，CGSizeZero表示原始尺寸
+ * @return 没有保存过或者文件损坏时返回nil
+ */
+- (nullable UIImage *)imageForFileName:(nonnull NSString *)fileName pixelSize:(CGSize)pixelSize;
+
+/**
+ * 把图片渲染成保存的格式（文件头加上像素数据，开启压缩时已经压缩），不修改任何状态，可以在任意线程中同时调用
+ * 像素拷贝比较耗时，应该在后台的并发队列中调用，不要占用写入所在的串行队列
+ *
+ * @param pixelSize 目标尺寸，单位为像素，CGSizeZero表示按图片的原始尺寸保存
+ * @return 动画图片、没有CGImage的图片以及渲染之后超过maxSize的图片返回nil
+ */
+- (nullable NSData *)bitmapDataForImage:(nonnull UIImage *)image pixelSize:(CGSize)pixelSize;
+
+/**
+ * 保存bitmapDataForImage:pixelSize:生成的数据，已经存在的文件会被替换
+ *
+ * @param pixelSize 生成数据时使用的目标尺寸
+ * @return 是否保存成功
+ */
+- (BOOL)storeBitmapData:(nonnull NSData *)bitmapData forFileName:(nonnull NSString *)fileName pixelSize:(CGSize)pixelSize;
+
+/**
+ * 把图片渲染成像素数据并保存，已经存在的文件会被替换，相当于依次调用上面两个方法
+ * 动画图片和没有CGImage的图片不会被保存
+ *
+ * @param pixelSize 目标尺寸，单位为像素，CGSizeZero表示按图片的原始尺寸保存
+ * @return 是否保存成功
+ */
+- (BOOL)storeImage:(nonnull UIImage *)image forFileName:(nonnull NSString *)fileName pixelSize:(CGSize)pixelSize;
+
+/** 删除某个缓存文件名的所有尺寸的版本，比如原始数据被覆盖或者删除的时候 */
+- (void)removeImagesForFileName:(nonnull NSString *)fileName;
+
+/** 删除所有文件 */
+- (void)removeAllImages;
+
+@end
@@ -0,0 +1,435 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDImageCacheBitmapStore.h"
+#import <compression.h>
+#import <unistd.h>
+
+#define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+#define UNLOCK(lock) dispatch_semaphore_signal(lock);
+
+static const uint32_t kBitmapMagic = 0x5344424D; // 'SDBM'
+static const uint16_t kBitmapVersion = 1;
+// 每个像素4个字节，每个分量8位
+static const size_t kBitmapBytesPerPixel = 4;
+static const size_t kBitmapBitsPerComponent = 8;
+// 像素行按64字节对齐，Core Animation可以直接使用，不需要再拷贝一次
+static const size_t kBitmapRowAlignment = 64;
+// 文件名的扩展名，同时标明像素格式
+static NSString * const kBitmapPathExtension = @"bgra";
+
+typedef NS_ENUM(uint16_t, SDBitmapCompression) {
+    SDBitmapCompressionNone = 0,
+    SDBitmapCompressionLZ4 = 1
+};
+
+// 文件头，大小是64字节，像素数据紧跟在后面，也是64字节对齐的
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t compression;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytesPerRow;
+    uint32_t bitmapInfo;
+    uint32_t orientation;
+    uint32_t reserved;
+    double scale;
+    // 解压之后的像素数据长度，和文件中实际保存的长度
+    uint64_t pixelLength;
+    uint64_t payloadLength;
+    uint8_t padding[8];
+} SDBitmapHeader;
+
+_Static_assert(sizeof(SDBitmapHeader) == 64, "SDBitmapHeader must be 64 bytes");
+
+#if SD_UIKIT || SD_WATCH
+static CGColorSpaceRef SDBitmapColorSpace(void) {
+    static CGColorSpaceRef colorSpace;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        colorSpace = CGColorSpaceCreateWithName(kCGColorSpaceSRGB);
+    });
+    return colorSpace;
+}
+
+// 预乘alpha或者忽略alpha，字节序都是主机字节序（也就是BGRA），只接受这两种格式的文件
+static CGBitmapInfo SDBitmapInfoForAlpha(BOOL hasAlpha) {
+    return kCGBitmapByteOrder32Host | (hasAlpha ? kCGImageAlphaPremultipliedFirst : kCGImageAlphaNoneSkipFirst);
+}
+
+// 映射的文件在图片释放时才解除映射
+static void SDReleaseMappedData(void *info, const void *data, size_t size) {
+    CFRelease(info);
+}
+
+static void SDFreeBitmapData(void *info, const void *data, size_t size) {
+    free((void *)data);
+}
+#endif
+
+@implementation SDImageCacheBitmapStore {
+    NSString *_directory;
+    BOOL _compressed;
+    BOOL _loaded;
+    BOOL _directoryExcludedFromBackup;
+    // 相对路径（缓存文件名/尺寸.bgra） -> 文件大小，按写入顺序排列
+    NSMutableDictionary<NSString *, NSNumber *> *_fileSizes;
+    NSMutableOrderedSet<NSString *> *_fileOrder;
+    // 缓存文件名 -> 已经保存的各个尺寸的相对路径
+    NSMutableDictionary<NSString *, NSMutableSet<NSString *> *> *_variants;
+    NSUInteger _totalSize;
+    // 后台扫描期间删除过的缓存文件名，扫描结果中这些文件名下的文件不再加入列表
+    NSMutableSet<NSString *> *_removedWhileLoading;
+    // removeAllImages时加一，之前开始的扫描的结果直接丢弃
+    NSUInteger _generation;
+    dispatch_semaphore_t _lock;
+}
+
+- (nonnull instancetype)initWithDirectory:(nonnull NSString *)directory
+                                  maxSize:(NSUInteger)maxSize
+                               compressed:(BOOL)compressed {
+    if ((self = [super init])) {
+        _directory = [directory copy];
+        _maxSize = maxSize;
+        _compressed = compressed;
+        _fileSizes = [NSMutableDictionary new];
+        _fileOrder = [NSMutableOrderedSet new];
+        _variants = [NSMutableDictionary new];
+        _removedWhileLoading = [NSMutableSet new];
+        _lock = dispatch_semaphore_create(1);
+    }
+    return self;
+}
+
+- (NSUInteger)totalSize {
+    LOCK(_lock);
+    NSUInteger totalSize = _totalSize;
+    UNLOCK(_lock);
+    return totalSize;
+}
+
+- (nonnull NSString *)relativePathForFileName:(nonnull NSString *)fileName pixelSize:(CGSize)pixelSize {
+    NSString *variant = [NSString stringWithFormat:@"%.0fx%.0f.%@", MAX(pixelSize.width, 0), MAX(pixelSize.height, 0), kBitmapPathExtension];
+    return [fileName stringByAppendingPathComponent:variant];
+}
+
+#pragma mark - Registry
+
+- (void)load {
+    LOCK(_lock);
+    NSUInteger generation = _generation;
+    UNLOCK(_lock);
+    // 像素数据的文件可能有很多，不在启动的路径上扫描
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+        NSArray<NSDictionary *> *files = [self scanDirectory];
+        LOCK(self->_lock);
+        if (self->_generation == generation) {
+            [self mergeScannedFiles:files];
+        }
+        [self->_removedWhileLoading removeAllObjects];
+        self->_loaded = YES;
+        UNLOCK(self->_lock);
+    });
+}
+
+// 扫描目录中所有的文件，按修改时间从早到晚排列
+- (nonnull NSArray<NSDictionary *> *)scanDirectory {
+    NSURL *directoryURL = [NSURL fileURLWithPath:_directory isDirectory:YES];
+    NSArray<NSString *> *resourceKeys = @[NSURLIsDirectoryKey, NSURLContentModificationDateKey, NSURLFileSizeKey];
+    NSDirectoryEnumerator *fileEnumerator = [[NSFileManager defaultManager] enumeratorAtURL:directoryURL
+                                                                 includingPropertiesForKeys:resourceKeys
+                                                                                    options:NSDirectoryEnumerationSkipsHiddenFiles
+                                                                               errorHandler:NULL];
+    NSMutableArray<NSDictionary *> *files = [NSMutableArray array];
+    for (NSURL *fileURL in fileEnumerator) {
+        NSDictionary<NSString *, id> *resourceValues = [fileURL resourceValuesForKeys:resourceKeys error:nil];
+        if (!resourceValues || [resourceValues[NSURLIsDirectoryKey] boolValue]
+            || ![fileURL.pathExtension isEqualToString:kBitmapPathExtension]) {
+            continue;
+        }
+        NSString *fileName = fileURL.URLByDeletingLastPathComponent.lastPathComponent;
+        [files addObject:@{@"path": [fileName stringByAppendingPathComponent:fileURL.lastPathComponent],
+                           @"date": resourceValues[NSURLContentModificationDateKey] ?: [NSDate distantPast],
+                           @"size": resourceValues[NSURLFileSizeKey] ?: @0}];
+    }
+    [files sortUsingDescriptors:@[[NSSortDescriptor sortDescriptorWithKey:@"date" ascending:YES]]];
+    return files;
+}
+
+// 以下几个方法需要持有_lock
+// 扫描到的文件都比扫描期间写入的文件早，按顺序排在它们前面
+- (void)mergeScannedFiles:(NSArray<NSDictionary *> *)files {
+    NSUInteger orderIndex = 0;
+    for (NSDictionary *file in files) {
+        NSString *relativePath = file[@"path"];
+        // 扫描期间写入过的文件已经在列表中，删除过的不再加入
+        if (_fileSizes[relativePath] || [_removedWhileLoading containsObject:relativePath.stringByDeletingLastPathComponent]) {
+            continue;
+        }
+        [self addFileAtRelativePath:relativePath size:[file[@"size"] unsignedIntegerValue] orderIndex:orderIndex];
+        orderIndex++;
+    }
+}
+
+// orderIndex为NSNotFound时作为最新写入的文件
+- (void)addFileAtRelativePath:(NSString *)relativePath size:(NSUInteger)size orderIndex:(NSUInteger)orderIndex {
+    [self forgetFileAtRelativePath:relativePath];
+    NSString *fileName = relativePath.stringByDeletingLastPathComponent;
+    NSMutableSet<NSString *> *variants = _variants[fileName];
+    if (!variants) {
+        variants = [NSMutableSet set];
+        _variants[fileName] = variants;
+    }
+    [variants addObject:relativePath];
+    _fileSizes[relativePath] = @(size);
+    [_fileOrder insertObject:relativePath atIndex:MIN(orderIndex, _fileOrder.count)];
+    _totalSize += size;
+}
+
+- (void)forgetFileAtRelativePath:(NSString *)relativePath {
+    NSNumber *size = _fileSizes[relativePath];
+    if (!size) {
+        return;
+    }
+    _totalSize -= MIN(_totalSize, size.unsignedIntegerValue);
+    [_fileSizes removeObjectForKey:relativePath];
+    [_fileOrder removeObject:relativePath];
+    NSString *fileName = relativePath.stringByDeletingLastPathComponent;
+    NSMutableSet<NSString *> *variants = _variants[fileName];
+    [variants removeObject:relativePath];
+    if (variants.count == 0) {
+        [_variants removeObjectForKey:fileName];
+    }
+}
+
+// 按写入顺序删除最早的文件，直到总大小不超过上限，返回需要从磁盘上删除的相对路径
+- (NSArray<NSString *> *)trimToMaxSize {
+    NSMutableArray<NSString *> *removedPaths = [NSMutableArray array];
+    while (_totalSize > _maxSize && _fileOrder.count > 0) {
+        NSString *relativePath = _fileOrder.firstObject;
+        [self forgetFileAtRelativePath:relativePath];
+        [removedPaths addObject:relativePath];
+    }
+    return removedPaths;
+}
+
+- (void)removeFilesAtRelativePaths:(NSArray<NSString *> *)relativePaths {
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    for (NSString *relativePath in relativePaths) {
+        NSString *path = [_directory stringByAppendingPathComponent:relativePath];
+        [fileManager removeItemAtPath:path error:nil];
+        // 目录空了就一起删除，不为空时rmdir会失败，不影响
+        rmdir(path.stringByDeletingLastPathComponent.fileSystemRepresentation);
+    }
+}
+
+#pragma mark - Reading
+
+- (nullable UIImage *)imageForFileName:(nonnull NSString *)fileName pixelSize:(CGSize)pixelSize {
+#if SD_UIKIT || SD_WATCH
+    NSString *relativePath = [self relativePathForFileName:fileName pixelSize:pixelSize];
+    LOCK(_lock);
+    // 列表还没加载完时直接查找文件
+    BOOL mayExist = !_loaded || _fileSizes[relativePath] != nil;
+    UNLOCK(_lock);
+    if (!mayExist) {
+        return nil;
+    }
+
+    NSString *path = [_directory stringByAppendingPathComponent:relativePath];
+    NSData *fileData = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedAlways error:nil];
+    if (fileData.length < sizeof(SDBitmapHeader)) {
+        return nil;
+    }
+    SDBitmapHeader header;
+    memcpy(&header, fileData.bytes, sizeof(header));
+    const uint8_t *payload = (const uint8_t *)fileData.bytes + sizeof(header);
+    if (header.magic != kBitmapMagic || header.version != kBitmapVersion
+        || header.width == 0 || header.height == 0
+        || header.bytesPerRow < (uint64_t)header.width * kBitmapBytesPerPixel
+        || header.pixelLength != (uint64_t)header.bytesPerRow * header.height
+        || header.payloadLength != fileData.length - sizeof(header)
+        || (header.bitmapInfo != SDBitmapInfoForAlpha(YES) && header.bitmapInfo != SDBitmapInfoForAlpha(NO))
+        || header.scale <= 0) {
+        return nil;
+    }
+
+    CGDataProviderRef provider = NULL;
+    if (header.compression == SDBitmapCompressionNone && header.payloadLength == header.pixelLength) {
+        // 图片直接引用映射的内存，不需要读取和解码
+        provider = CGDataProviderCreateWithData((__bridge_retained void *)fileData, payload, (size_t)header.pixelLength, SDReleaseMappedData);
+    } else if (header.compression == SDBitmapCompressionLZ4) {
+        void *buffer = malloc((size_t)header.pixelLength);
+        if (!buffer) {
+            return nil;
+        }
+        size_t length = compression_decode_buffer(buffer, (size_t)header.pixelLength, payload, (size_t)header.payloadLength, NULL, COMPRESSION_LZ4_RAW);
+        if (length != header.pixelLength) {
+            free(buffer);
+            return nil;
+        }
+        provider = CGDataProviderCreateWithData(NULL, buffer, (size_t)header.pixelLength, SDFreeBitmapData);
+    }
+    if (!provider) {
+        return nil;
+    }
+
+    CGImageRef imageRef = CGImageCreate(header.width, header.height, kBitmapBitsPerComponent, kBitmapBitsPerComponent * kBitmapBytesPerPixel,
+                                        header.bytesPerRow, SDBitmapColorSpace(), header.bitmapInfo, provider, NULL, false, kCGRenderingIntentDefault);
+    CGDataProviderRelease(provider);
+    if (!imageRef) {
+        return nil;
+    }
+    UIImage *image = [UIImage imageWithCGImage:imageRef scale:header.scale orientation:(UIImageOrientation)header.orientation];
+    CGImageRelease(imageRef);
+    return image;
+#else
+    return nil;
+#endif
+}
+
+#pragma mark - Writing
+
+- (BOOL)storeImage:(nonnull UIImage *)image forFileName:(nonnull NSString *)fileName pixelSize:(CGSize)pixelSize {
+    NSData *bitmapData = [self bitmapDataForImage:image pixelSize:pixelSize];
+    if (!bitmapData) {
+        return NO;
+    }
+    return [self storeBitmapData:bitmapData forFileName:fileName pixelSize:pixelSize];
+}
+
+- (nullable NSData *)bitmapDataForImage:(nonnull UIImage *)image pixelSize:(CGSize)pixelSize {
+#if SD_UIKIT || SD_WATCH
+    CGImageRef imageRef = image.CGImage;
+    if (!imageRef || image.images.count > 0) {
+        return nil;
+    }
+    size_t width = pixelSize.width > 0 ? (size_t)pixelSize.width : CGImageGetWidth(imageRef);
+    size_t height = pixelSize.height > 0 ? (size_t)pixelSize.height : CGImageGetHeight(imageRef);
+    if (width == 0 || height == 0 || width > UINT16_MAX || height > UINT16_MAX) {
+        return nil;
+    }
+    size_t bytesPerRow = (width * kBitmapBytesPerPixel + kBitmapRowAlignment - 1) / kBitmapRowAlignment * kBitmapRowAlignment;
+    size_t pixelLength = bytesPerRow * height;
+    // 比整个上限还大的图片存进去也会马上被删除
+    if (pixelLength + sizeof(SDBitmapHeader) > _maxSize) {
+        return nil;
+    }
+
+    CGImageAlphaInfo alphaInfo = CGImageGetAlphaInfo(imageRef) & kCGBitmapAlphaInfoMask;
+    BOOL hasAlpha = !(alphaInfo == kCGImageAlphaNone || alphaInfo == kCGImageAlphaNoneSkipFirst || alphaInfo == kCGImageAlphaNoneSkipLast);
+    CGBitmapInfo bitmapInfo = SDBitmapInfoForAlpha(hasAlpha);
+
+    NSMutableData *fileData = [NSMutableData dataWithLength:sizeof(SDBitmapHeader) + pixelLength];
+    if (!fileData) {
+        return nil;
+    }
+    uint8_t *pixels = (uint8_t *)fileData.mutableBytes + sizeof(SDBitmapHeader);
+    CGContextRef context = CGBitmapContextCreate(pixels, width, height, kBitmapBitsPerComponent, bytesPerRow, SDBitmapColorSpace(), bitmapInfo);
+    if (!context) {
+        return nil;
+    }
+    CGContextSetInterpolationQuality(context, kCGInterpolationHigh);
+    CGContextDrawImage(context, CGRectMake(0, 0, width, height), imageRef);
+    CGContextRelease(context);
+
+    SDBitmapHeader header = {0};
+    header.magic = kBitmapMagic;
+    header.version = kBitmapVersion;
+    header.compression = SDBitmapCompressionNone;
+    header.width = (uint32_t)width;
+    header.height = (uint32_t)height;
+    header.bytesPerRow = (uint32_t)bytesPerRow;
+    header.bitmapInfo = bitmapInfo;
+    header.orientation = (uint32_t)image.imageOrientation;
+    // 按目标尺寸保存时，保持图片的显示大小（point）不变
+    header.scale = image.scale * ((double)width / CGImageGetWidth(imageRef));
+    header.pixelLength = pixelLength;
+    header.payloadLength = pixelLength;
+
+    if (_compressed) {
+        void *buffer = malloc(pixelLength);
+        size_t compressedLength = buffer ? compression_encode_buffer(buffer, pixelLength, pixels, pixelLength, NULL, COMPRESSION_LZ4_RAW) : 0;
+        // 压缩失败或者压缩之后没有变小时，按不压缩保存
+        if (compressedLength > 0 && compressedLength < pixelLength) {
+            header.compression = SDBitmapCompressionLZ4;
+            header.payloadLength = compressedLength;
+            fileData.length = sizeof(SDBitmapHeader);
+            [fileData appendBytes:buffer length:compressedLength];
+        }
+        free(buffer);
+    }
+    memcpy(fileData.mutableBytes, &header, sizeof(header));
+    return fileData;
+#else
+    return nil;
+#endif
+}
+
+- (BOOL)storeBitmapData:(nonnull NSData *)bitmapData forFileName:(nonnull NSString *)fileName pixelSize:(CGSize)pixelSize {
+#if SD_UIKIT || SD_WATCH
+    NSString *relativePath = [self relativePathForFileName:fileName pixelSize:pixelSize];
+    NSString *path = [_directory stringByAppendingPathComponent:relativePath];
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    [fileManager createDirectoryAtPath:path.stringByDeletingLastPathComponent withIntermediateDirectories:YES attributes:nil error:NULL];
+    if (!_directoryExcludedFromBackup) {
+        // 解码后的数据随时可以重新生成，不需要备份到iCloud
+        NSURL *directoryURL = [NSURL fileURLWithPath:_directory isDirectory:YES];
+        _directoryExcludedFromBackup = [directoryURL setResourceValue:@YES forKey:NSURLIsExcludedFromBackupKey error:nil];
+    }
+    // 先写到临时文件再替换，正在读取的映射不会看到写了一半的数据
+    if (![bitmapData writeToFile:path options:NSDataWritingAtomic error:nil]) {
+        return NO;
+    }
+
+    LOCK(_lock);
+    [self addFileAtRelativePath:relativePath size:bitmapData.length orderIndex:NSNotFound];
+    NSArray<NSString *> *removedPaths = [self trimToMaxSize];
+    UNLOCK(_lock);
+    [self removeFilesAtRelativePaths:removedPaths];
+    return YES;
+#else
+    return NO;
+#endif
+}
+
+#pragma mark - Removing
+
+- (void)removeImagesForFileName:(nonnull NSString *)fileName {
+    LOCK(_lock);
+    BOOL loaded = _loaded;
+    NSArray<NSString *> *relativePaths = _variants[fileName].allObjects;
+    for (NSString *relativePath in relativePaths) {
+        [self forgetFileAtRelativePath:relativePath];
+    }
+    if (!loaded) {
+        [_removedWhileLoading addObject:fileName];
+    }
+    UNLOCK(_lock);
+    if (!loaded) {
+        // 列表还没加载完，不知道保存了哪些尺寸，整个目录一起删除
+        [[NSFileManager defaultManager] removeItemAtPath:[_directory stringByAppendingPathComponent:fileName] error:nil];
+    } else if (relativePaths.count > 0) {
+        [self removeFilesAtRelativePaths:relativePaths];
+    }
+}
+
+- (void)removeAllImages {
+    LOCK(_lock);
+    [_fileSizes removeAllObjects];
+    [_fileOrder removeAllObjects];
+    [_variants removeAllObjects];
+    _totalSize = 0;
+    _directoryExcludedFromBackup = NO;
+    _generation += 1;
+    UNLOCK(_lock);
+    [[NSFileManager defaultManager] removeItemAtPath:_directory error:nil];
+}
+
+@end
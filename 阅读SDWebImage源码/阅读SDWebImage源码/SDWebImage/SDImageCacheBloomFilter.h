@@ -0,0 +1,43 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * SDImageCacheBloomFilter 是一个计数布隆过滤器，用来在不访问文件系统的情况下判断一个缓存文件一定不存在。
+ * containsString:返回NO时一定没有加入过，返回YES时大概率加入过（有很小的误判率）。
+ * 每个位置是一个8位的计数器，因此也支持删除；计数器饱和之后不再减少，只会增加误判，不会漏判。
+ *
+ * 不是线程安全的，由调用者负责加锁。
+ */
+@interface SDImageCacheBloomFilter : NSObject
+
+/** 创建时预计容纳的元素个数，超过之后误判率会逐渐升高 */
+@property (assign, nonatomic, readonly) NSUInteger capacity;
+
+/**
+ * 通过预计容纳的元素个数来初始化，按照约1%的误判率分配计数器
+ */
+- (nonnull instancetype)initWithCapacity:(NSUInteger)capacity NS_DESIGNATED_INITIALIZER;
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+/** 加入一个元素 */
+- (void)addString:(nonnull NSString *)string;
+
+/** 删除一个元素，只能删除之前加入过的元素，否则会造成漏判 */
+- (void)removeString:(nonnull NSString *)string;
+
+/** 元素是否可能加入过 */
+- (BOOL)containsString:(nonnull NSString *)string;
+
+/** 清空所有元素 */
+- (void)removeAllStrings;
+
+@end
@@ -0,0 +1,88 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDImageCacheBloomFilter.h"
+
+// 每个元素分配的计数器个数和哈希函数个数，对应约1%的误判率
+static const NSUInteger kCountersPerElement = 10;
+static const NSUInteger kHashCount = 7;
+static const NSUInteger kMinimumCapacity = 1024;
+
+// 64位的FNV-1a，再用splitmix64的混合函数派生出第二个哈希，用双重哈希模拟kHashCount个哈希函数
+static void SDBloomFilterHashes(NSString *string, uint64_t *h1, uint64_t *h2) {
+    const char *bytes = string.UTF8String;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const char *p = bytes; p && *p; p++) {
+        hash ^= (uint8_t)*p;
+        hash *= 0x100000001b3ULL;
+    }
+    uint64_t mixed = hash + 0x9e3779b97f4a7c15ULL;
+    mixed = (mixed ^ (mixed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    mixed = (mixed ^ (mixed >> 27)) * 0x94d049bb133111ebULL;
+    mixed = mixed ^ (mixed >> 31);
+    *h1 = hash;
+    *h2 = mixed | 1;
+}
+
+@implementation SDImageCacheBloomFilter {
+    uint8_t *_counters;
+    NSUInteger _counterCount;
+}
+
+- (nonnull instancetype)initWithCapacity:(NSUInteger)capacity {
+    if ((self = [super init])) {
+        _capacity = MAX(capacity, kMinimumCapacity);
+        _counterCount = _capacity * kCountersPerElement;
+        _counters = calloc(_counterCount, sizeof(uint8_t));
+    }
+    return self;
+}
+
+- (void)dealloc {
+    free(_counters);
+}
+
+- (void)addString:(nonnull NSString *)string {
+    uint64_t h1, h2;
+    SDBloomFilterHashes(string, &h1, &h2);
+    for (NSUInteger i = 0; i < kHashCount; i++) {
+        uint8_t *counter = &_counters[(h1 + i * h2) % _counterCount];
+        if (*counter < UINT8_MAX) {
+            *counter += 1;
+        }
+    }
+}
+
+- (void)removeString:(nonnull NSString *)string {
+    uint64_t h1, h2;
+    SDBloomFilterHashes(string, &h1, &h2);
+    for (NSUInteger i = 0; i < kHashCount; i++) {
+        uint8_t *counter = &_counters[(h1 + i * h2) % _counterCount];
+        // 饱和的计数器已经不知道真实的值了，不能再减少
+        if (*counter > 0 && *counter < UINT8_MAX) {
+            *counter -= 1;
+        }
+    }
+}
+
+- (BOOL)containsString:(nonnull NSString *)string {
+    uint64_t h1, h2;
+    SDBloomFilterHashes(string, &h1, &h2);
+    for (NSUInteger i = 0; i < kHashCount; i++) {
+        if (_counters[(h1 + i * h2) % _counterCount] == 0) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
+- (void)removeAllStrings {
+    memset(_counters, 0, _counterCount * sizeof(uint8_t));
+}
+
+@end
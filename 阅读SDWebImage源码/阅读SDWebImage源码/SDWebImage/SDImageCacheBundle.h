@@ -0,0 +1,90 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+#import "SDImageCacheKey.h"
+
+@class SDImageCache;
+
+/**
+ * SDImageCacheBundle 是一个预先生成的只读缓存包：所有图片数据打包在一个文件中，文件头后面是一个最小完美哈希索引。
+ * 整个文件通过mmap映射到内存，查找时只需要计算一次哈希、读两次内存，不需要访问文件系统，
+ * 适合随App一起发布的预置图片，比addReadOnlyCachePath:逐个目录查找文件要快得多。
+ *
+ * 缓存包通过SDImageCacheBundleBuilder生成，打开之后不可修改，所有方法都是线程安全的。
+ */
+@interface SDImageCacheBundle : NSObject
+
+/** 缓存包文件的路径 */
+@property (copy, nonatomic, readonly, nonnull) NSString *path;
+
+/** 缓存包中的图片数目 */
+@property (assign, nonatomic, readonly) NSUInteger count;
+
+/**
+ * 打开一个缓存包，文件不存在或者格式不正确时返回nil
+ */
++ (nullable instancetype)bundleWithContentsOfFile:(nonnull NSString *)path;
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+/**
+ * 获取某个key摘要对应的图片数据，返回的数据直接引用映射的内存，不会拷贝
+ *
+ * @return 缓存包中没有这个key时返回nil
+ */
+- (nullable NSData *)dataForDigest:(SDImageCacheKeyDigest)digest;
+
+/** 缓存包中是否有这个key摘要对应的图片 */
+- (BOOL)containsDigest:(SDImageCacheKeyDigest)digest;
+
+@end
+
+/**
+ * SDImageCacheBundleBuilder 把一组图片生成为SDImageCacheBundle，一般在构建App时运行一次，
+ * 图片可以来自SDImageCache的磁盘缓存、本地文件，或者一组url。
+ * 同一个key添加多次时以最后一次为准。
+ */
+@interface SDImageCacheBundleBuilder : NSObject
+
+/** 已经添加的图片数目 */
+@property (assign, nonatomic, readonly) NSUInteger count;
+
+/** 添加一张图片的数据 */
+- (void)addData:(nonnull NSData *)data forKey:(nonnull NSString *)key;
+
+/**
+ * 添加一个本地文件，文件内容在写入缓存包时才读取
+ */
+- (void)addFileAtPath:(nonnull NSString *)path forKey:(nonnull NSString *)key;
+
+/**
+ * 添加一个SDImageCache磁盘缓存中的所有图片，按照它的磁盘索引中记录的key添加，
+ * 单独的文件在写入缓存包时才读取，pack segment中的图片和去重之后的别名也会被添加。
+ * 索引中没有记录key的文件会被忽略（见enumerateDiskCacheKeysUsingBlock:）。这是一个同步方法，不要在主线程调用。
+ *
+ * @return 添加的图片数目
+ */
+- (NSUInteger)addContentsOfDiskCache:(nonnull SDImageCache *)imageCache;
+
+/**
+ * 下载（或者读取本地的file url）一组url对应的图片，以url的absoluteString作为key。
+ * 这是一个同步方法，不要在主线程调用。
+ * 如果SDWebImageManager设置了cacheKeyFilter，需要用addData:forKey:自行指定key。
+ *
+ * @return 添加的图片数目，读取失败的url会被忽略
+ */
+- (NSUInteger)addContentsOfURLs:(nonnull NSArray<NSURL *> *)urls;
+
+/**
+ * 生成缓存包并写入到path，已经存在的文件会被替换
+ */
+- (BOOL)writeToFile:(nonnull NSString *)path error:(NSError * _Nullable * _Nullable)error;
+
+@end
@@ -0,0 +1,372 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDImageCacheBundle.h"
+#import "SDImageCache.h"
+#import <fcntl.h>
+#import <unistd.h>
+
+// 文件格式：文件头 + 每个桶的偏移量(uint32) + 按槽位排列的记录 + 图片数据
+// 最小完美哈希使用hash and displace：key先按摘要的高64位分到桶中，桶中的key用
+// 摘要的低64位加上这个桶的偏移量计算槽位，构建时为每个桶找到一个让桶内所有key都落到空槽位的偏移量
+static const uint32_t kBundleMagic = 0x53444342; // 'SDCB'
+static const uint32_t kBundleVersion = 1;
+// 平均每个桶的key数目，越大偏移量表越小，构建越慢
+static const uint64_t kBundleAverageBucketSize = 4;
+// 一个桶最多尝试的偏移量，只有摘要冲突时才会超过
+static const uint32_t kBundleMaxDisplacement = 1 << 28;
+
+typedef struct SDImageCacheBundleHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;
+    uint64_t bucketCount;
+    uint64_t entriesOffset;
+    uint64_t dataOffset;
+    uint64_t dataLength;
+} SDImageCacheBundleHeader;
+
+typedef struct SDImageCacheBundleEntry {
+    uint64_t high;
+    uint64_t low;
+    // 相对于数据区的偏移
+    uint64_t offset;
+    uint64_t length;
+} SDImageCacheBundleEntry;
+
+static inline uint64_t SDBundleMix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+static inline uint64_t SDBundleBucket(SDImageCacheKeyDigest digest, uint64_t bucketCount) {
+    return digest.high % bucketCount;
+}
+
+static inline uint64_t SDBundleSlot(SDImageCacheKeyDigest digest, uint32_t displacement, uint64_t count) {
+    return SDBundleMix64(digest.low + displacement * 0x9E3779B97F4A7C15ULL) % count;
+}
+
+#pragma mark - SDImageCacheBundle
+
+@implementation SDImageCacheBundle {
+    // 整个文件的映射，返回的图片数据都引用它
+    NSData *_mappedData;
+    SDImageCacheBundleHeader _header;
+    const uint8_t *_displacements;
+    const uint8_t *_entries;
+    const uint8_t *_data;
+}
+
++ (nullable instancetype)bundleWithContentsOfFile:(nonnull NSString *)path {
+    NSData *mappedData = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedAlways error:nil];
+    if (mappedData.length < sizeof(SDImageCacheBundleHeader)) {
+        return nil;
+    }
+    SDImageCacheBundleHeader header;
+    memcpy(&header, mappedData.bytes, sizeof(header));
+    if (header.magic != kBundleMagic || header.version != kBundleVersion) {
+        return nil;
+    }
+
+    // 校验各个区域都在文件范围之内，之后查找时不需要再检查
+    uint64_t length = mappedData.length;
+    uint64_t displacementsEnd = sizeof(SDImageCacheBundleHeader) + header.bucketCount * sizeof(uint32_t);
+    BOOL valid = (header.count == 0 || header.bucketCount > 0)
+        && header.count <= length / sizeof(SDImageCacheBundleEntry)
+        && header.bucketCount <= length / sizeof(uint32_t)
+        && displacementsEnd <= header.entriesOffset
+        && header.entriesOffset + header.count * sizeof(SDImageCacheBundleEntry) <= header.dataOffset
+        && header.dataOffset <= length
+        && header.dataLength <= length - header.dataOffset;
+    if (!valid) {
+        return nil;
+    }
+
+    SDImageCacheBundle *bundle = [[self alloc] init];
+    bundle->_path = [path copy];
+    bundle->_mappedData = mappedData;
+    bundle->_header = header;
+    const uint8_t *bytes = mappedData.bytes;
+    bundle->_displacements = bytes + sizeof(SDImageCacheBundleHeader);
+    bundle->_entries = bytes + header.entriesOffset;
+    bundle->_data = bytes + header.dataOffset;
+    return bundle;
+}
+
+- (NSUInteger)count {
+    return (NSUInteger)_header.count;
+}
+
+// 查找摘要对应的记录，完美哈希对不在缓存包中的key也会给出一个槽位，所以需要比较完整的摘要
+- (BOOL)getEntry:(SDImageCacheBundleEntry *)entry forDigest:(SDImageCacheKeyDigest)digest {
+    if (_header.count == 0) {
+        return NO;
+    }
+    uint32_t displacement = 0;
+    memcpy(&displacement, _displacements + SDBundleBucket(digest, _header.bucketCount) * sizeof(uint32_t), sizeof(displacement));
+    uint64_t slot = SDBundleSlot(digest, displacement, _header.count);
+    memcpy(entry, _entries + slot * sizeof(SDImageCacheBundleEntry), sizeof(SDImageCacheBundleEntry));
+    return entry->high == digest.high && entry->low == digest.low
+        && entry->offset <= _header.dataLength && entry->length <= _header.dataLength - entry->offset;
+}
+
+- (BOOL)containsDigest:(SDImageCacheKeyDigest)digest {
+    SDImageCacheBundleEntry entry;
+    return [self getEntry:&entry forDigest:digest];
+}
+
+- (nullable NSData *)dataForDigest:(SDImageCacheKeyDigest)digest {
+    SDImageCacheBundleEntry entry;
+    if (![self getEntry:&entry forDigest:digest]) {
+        return nil;
+    }
+    if (entry.length == 0) {
+        return [NSData data];
+    }
+    // 返回的数据持有整个映射，缓存包对象释放之后数据仍然有效
+    NSData *mappedData = _mappedData;
+    return [[NSData alloc] initWithBytesNoCopy:(void *)(_data + entry.offset)
+                                        length:(NSUInteger)entry.length
+                                   deallocator:^(void *bytes, NSUInteger length) {
+        [mappedData length];
+    }];
+}
+
+@end
+
+#pragma mark - SDImageCacheBundleBuilder
+
+// 等待写入的一张图片，data和filePath只有一个不为nil
+@interface SDImageCacheBundleItem : NSObject
+@property (assign, nonatomic) SDImageCacheKeyDigest digest;
+@property (strong, nonatomic, nullable) NSData *data;
+@property (copy, nonatomic, nullable) NSString *filePath;
+@end
+
+@implementation SDImageCacheBundleItem
+@end
+
+@implementation SDImageCacheBundleBuilder {
+    // 以16字节的摘要为key，同一个key只保留最后一次添加的
+    NSMutableDictionary<NSData *, SDImageCacheBundleItem *> *_items;
+}
+
+- (instancetype)init {
+    if ((self = [super init])) {
+        _items = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+- (NSUInteger)count {
+    return _items.count;
+}
+
+- (void)addItemWithDigest:(SDImageCacheKeyDigest)digest data:(nullable NSData *)data filePath:(nullable NSString *)filePath {
+    SDImageCacheBundleItem *item = [SDImageCacheBundleItem new];
+    item.digest = digest;
+    item.data = data;
+    item.filePath = filePath;
+    _items[[NSData dataWithBytes:&digest length:sizeof(digest)]] = item;
+}
+
+- (void)addData:(nonnull NSData *)data forKey:(nonnull NSString *)key {
+    [self addItemWithDigest:SDImageCacheKeyDigestForString(key) data:[data copy] filePath:nil];
+}
+
+- (void)addFileAtPath:(nonnull NSString *)path forKey:(nonnull NSString *)key {
+    [self addItemWithDigest:SDImageCacheKeyDigestForString(key) data:nil filePath:path];
+}
+
+// 摘要从索引中记录的key计算，不从文件名猜测，别名和pack segment中的图片也能按它们的key添加
+- (NSUInteger)addContentsOfDiskCache:(nonnull SDImageCache *)imageCache {
+    __block NSUInteger added = 0;
+    [imageCache enumerateDiskCacheKeysUsingBlock:^(NSString *key, NSString *filePath, NSData *data) {
+        [self addItemWithDigest:SDImageCacheKeyDigestForString(key) data:data filePath:filePath];
+        added++;
+    }];
+    return added;
+}
+
+- (NSUInteger)addContentsOfURLs:(nonnull NSArray<NSURL *> *)urls {
+    NSUInteger added = 0;
+    for (NSURL *url in urls) {
+        NSData *data = [NSData dataWithContentsOfURL:url];
+        if (data && url.absoluteString) {
+            [self addData:data forKey:url.absoluteString];
+            added++;
+        }
+    }
+    return added;
+}
+
+#pragma mark Writing
+
+// 为每个桶找到偏移量，items[slots[i]]是第i个槽位的图片
+- (BOOL)buildPerfectHashForItems:(NSArray<SDImageCacheBundleItem *> *)items
+                     bucketCount:(uint64_t)bucketCount
+                   displacements:(uint32_t *)displacements
+                           slots:(NSUInteger *)slots {
+    uint64_t count = items.count;
+    SDImageCacheKeyDigest *digests = malloc(count * sizeof(SDImageCacheKeyDigest));
+    NSMutableArray<NSMutableArray<NSNumber *> *> *buckets = [NSMutableArray arrayWithCapacity:(NSUInteger)bucketCount];
+    for (uint64_t i = 0; i < bucketCount; i++) {
+        [buckets addObject:[NSMutableArray array]];
+    }
+    for (NSUInteger i = 0; i < count; i++) {
+        digests[i] = items[i].digest;
+        [buckets[(NSUInteger)SDBundleBucket(digests[i], bucketCount)] addObject:@(i)];
+    }
+    // 大的桶先放，空槽位多的时候更容易找到偏移量
+    NSArray<NSMutableArray<NSNumber *> *> *sortedBuckets = [buckets sortedArrayUsingComparator:^NSComparisonResult(NSArray *a, NSArray *b) {
+        return [@(b.count) compare:@(a.count)];
+    }];
+
+    BOOL *occupied = calloc(count, sizeof(BOOL));
+    uint64_t *bucketSlots = malloc(count * sizeof(uint64_t));
+    BOOL success = YES;
+    for (NSMutableArray<NSNumber *> *bucket in sortedBuckets) {
+        if (bucket.count == 0) {
+            break;
+        }
+        BOOL placed = NO;
+        for (uint32_t displacement = 0; displacement < kBundleMaxDisplacement && !placed; displacement++) {
+            placed = YES;
+            for (NSUInteger i = 0; i < bucket.count && placed; i++) {
+                uint64_t slot = SDBundleSlot(digests[bucket[i].unsignedIntegerValue], displacement, count);
+                if (occupied[slot]) {
+                    placed = NO;
+                }
+                for (NSUInteger j = 0; j < i && placed; j++) {
+                    if (bucketSlots[j] == slot) {
+                        placed = NO;
+                    }
+                }
+                bucketSlots[i] = slot;
+            }
+            if (placed) {
+                for (NSUInteger i = 0; i < bucket.count; i++) {
+                    occupied[bucketSlots[i]] = YES;
+                    slots[bucketSlots[i]] = bucket[i].unsignedIntegerValue;
+                }
+                displacements[SDBundleBucket(digests[bucket[0].unsignedIntegerValue], bucketCount)] = displacement;
+            }
+        }
+        if (!placed) {
+            success = NO;
+            break;
+        }
+    }
+    free(bucketSlots);
+    free(occupied);
+    free(digests);
+    return success;
+}
+
+static BOOL SDBundleWrite(int fd, const void *bytes, size_t length, off_t offset) {
+    const uint8_t *cursor = bytes;
+    while (length > 0) {
+        ssize_t written = pwrite(fd, cursor, length, offset);
+        if (written <= 0) {
+            return NO;
+        }
+        cursor += written;
+        offset += written;
+        length -= written;
+    }
+    return YES;
+}
+
+- (BOOL)writeToFile:(nonnull NSString *)path error:(NSError * _Nullable * _Nullable)error {
+    NSArray<SDImageCacheBundleItem *> *items = _items.allValues;
+    uint64_t count = items.count;
+    uint64_t bucketCount = (count + kBundleAverageBucketSize - 1) / kBundleAverageBucketSize;
+
+    uint32_t *displacements = calloc(MAX(bucketCount, 1), sizeof(uint32_t));
+    NSUInteger *slots = malloc(MAX(count, 1) * sizeof(NSUInteger));
+    if (![self buildPerfectHashForItems:items bucketCount:bucketCount displacements:displacements slots:slots]) {
+        free(displacements);
+        free(slots);
+        if (error) {
+            *error = [NSError errorWithDomain:SDWebImageErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey : @"Can't build the bundle index, two keys have the same digest"}];
+        }
+        return NO;
+    }
+
+    SDImageCacheBundleHeader header = {0};
+    header.magic = kBundleMagic;
+    header.version = kBundleVersion;
+    header.count = count;
+    header.bucketCount = bucketCount;
+    header.entriesOffset = sizeof(SDImageCacheBundleHeader) + bucketCount * sizeof(uint32_t);
+    header.entriesOffset = (header.entriesOffset + 7) & ~7ULL;
+    header.dataOffset = header.entriesOffset + count * sizeof(SDImageCacheBundleEntry);
+
+    // 先写到临时文件，完成之后再替换，正在使用旧缓存包的进程不会读到写了一半的文件
+    NSString *temporaryPath = [path stringByAppendingPathExtension:@"tmp"];
+    int fd = open(temporaryPath.fileSystemRepresentation, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    BOOL success = fd >= 0;
+    NSError *writeError = nil;
+
+    // 按槽位的顺序写入图片数据，记录每张图片的位置
+    SDImageCacheBundleEntry *entries = calloc(MAX(count, 1), sizeof(SDImageCacheBundleEntry));
+    uint64_t dataLength = 0;
+    for (uint64_t slot = 0; slot < count && success; slot++) {
+        @autoreleasepool {
+            SDImageCacheBundleItem *item = items[slots[slot]];
+            NSData *data = item.data;
+            if (!data) {
+                data = [NSData dataWithContentsOfFile:item.filePath options:NSDataReadingMappedIfSafe error:&writeError];
+            }
+            if (!data) {
+                success = NO;
+                break;
+            }
+            entries[slot].high = item.digest.high;
+            entries[slot].low = item.digest.low;
+            entries[slot].offset = dataLength;
+            entries[slot].length = data.length;
+            success = SDBundleWrite(fd, data.bytes, data.length, (off_t)(header.dataOffset + dataLength));
+            dataLength += data.length;
+        }
+    }
+    header.dataLength = dataLength;
+    success = success
+        && SDBundleWrite(fd, &header, sizeof(header), 0)
+        && SDBundleWrite(fd, displacements, (size_t)(bucketCount * sizeof(uint32_t)), sizeof(header))
+        && SDBundleWrite(fd, entries, (size_t)(count * sizeof(SDImageCacheBundleEntry)), (off_t)header.entriesOffset)
+        && fsync(fd) == 0;
+    if (!success && !writeError) {
+        writeError = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSFilePathErrorKey : temporaryPath}];
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(entries);
+    free(displacements);
+    free(slots);
+
+    if (success && rename(temporaryPath.fileSystemRepresentation, path.fileSystemRepresentation) != 0) {
+        success = NO;
+        writeError = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{NSFilePathErrorKey : path}];
+    }
+    if (!success) {
+        unlink(temporaryPath.fileSystemRepresentation);
+        if (error) {
+            *error = writeError;
+        }
+    }
+    return success;
+}
+
+@end
@@ -9,7 +9,27 @@
 #import <Foundation/Foundation.h>
 #import "SDWebImageCompat.h"
 
-@interface SDImageCacheConfig : NSObject
+@protocol SDImageCacheIOBackend;
+
+/**
+ * 磁盘缓存的淘汰策略
+ */
+typedef NS_ENUM(NSInteger, SDImageCacheEvictionPolicyType) {
+    /**
+     * 按照写入时间淘汰，最早写入的文件最先删除
+     */
+    SDImageCacheEvictionPolicyTypeFIFO = 0,
+    /**
+     * 按照最后访问时间淘汰，最久没有读取的文件最先删除
+     */
+    SDImageCacheEvictionPolicyTypeLRU,
+    /**
+     * 按照最近的请求频率淘汰，缓存已满时只写入比将被淘汰的文件更常用的新文件
+     */
+    SDImageCacheEvictionPolicyTypeTinyLFU
+};
+
+@interface SDImageCacheConfig : NSObject <NSCopying>
 
 /** 是否解压缩图片，默认为YES */
 @property (assign, nonatomic) BOOL shouldDecompressImages;
@@ -26,4 +46,144 @@
 /** 最大的缓存尺寸，单位为字节 */
 @property (assign, nonatomic) NSUInteger maxCacheSize;
 
+/**
+ * 磁盘缓存的分片宽度：取文件名（key的128位Murmur摘要）的前几位十六进制字符作为子目录名，避免单个目录下文件过多
+ * 1 -> 16个子目录，2 -> 256个子目录，以此类推，最大为4。设置为0则使用原来的平铺目录结构，默认为2
+ * @note 只在SDImageCache初始化时读取，旧的平铺文件会在后台迁移到对应的子目录中
+ */
+@property (assign, nonatomic) NSUInteger diskCacheShardWidth;
+
+/**
+ * 小于等于这个大小（单位为字节）的图片不再单独存成一个文件，而是追加写入到pack segment文件中，
+ * 适合大量的缩略图、头像这类小图片，可以节省文件系统块和inode，删除时也不需要逐个unlink。
+ * 默认为0，表示不使用pack存储
+ */
+@property (assign, nonatomic) NSUInteger maxPackedFileSize;
+
+/**
+ * 从磁盘读取缓存文件时使用的选项，默认为0，即把整个文件读到新分配的内存中
+ * 设置为NSDataReadingMappedIfSafe或者NSDataReadingMappedAlways时，读取到的NSData直接映射到文件上，
+ * 解码器读取的就是文件页，大图不会再多一次拷贝，内存峰值也更低。映射会一直保持到解码完成、NSData被释放
+ * @note pack segment中的小图片仍然直接读取到内存中
+ */
+@property (assign, nonatomic) NSDataReadingOptions diskCacheReadingOptions;
+
+/**
+ * 同时进行的磁盘读取（查询、判断是否存在）的最大数目，默认为4
+ * 读取不再和写入、清理排在同一个串行队列中，同一个key的读取会排在它还没完成的写入之后
+ * @note 只在SDImageCache初始化时读取，设置为0时使用默认值
+ */
+@property (assign, nonatomic) NSUInteger maxConcurrentDiskReads;
+
+/**
+ * 是否兼容旧版本用MD5命名的缓存文件，默认为YES
+ * 现在的缓存文件名是key的128位摘要，新文件名找不到时再按照MD5文件名查找，命中后会在后台改成新的文件名；
+ * 磁盘索引中已经没有旧文件时（加载索引和每次清理时检查）自动跳过这一步，未命中时不再计算MD5；只读路径仍然会按照MD5文件名查找
+ */
+@property (assign, nonatomic) BOOL shouldReadLegacyFileNames;
+
+/**
+ * 磁盘缓存超过maxCacheSize时使用的淘汰策略，默认为SDImageCacheEvictionPolicyTypeFIFO（和之前的行为一致）
+ * @note 只在SDImageCache初始化时读取
+ */
+@property (assign, nonatomic) SDImageCacheEvictionPolicyType diskCacheEvictionPolicy;
+
+/**
+ * 磁盘写入缓冲的大小，单位为字节，默认为4MB，设置为0则每次写入都立即在ioQueue中单独执行
+ * storeImage:...toDisk:YES 会先把数据放到缓冲中，同一个key的多次写入只写最后一次；
+ * 缓冲写满或者第一次写入之后稍等一会儿，再在ioQueue中一次性批量写到磁盘，避免大量下载完成时的写入把读取挤在后面
+ * @note 写到磁盘之后才会调用completion，可以用SDImageCache的flushDiskWritesWithCompletion:立即写入
+ */
+@property (assign, nonatomic) NSUInteger maxDiskWriteBufferSize;
+
+/**
+ * 增量淘汰的高水位，是maxCacheSize的倍数，默认为1.0
+ * 写入之后磁盘缓存超过这个大小时，开始在ioQueue中分成很多小步淘汰文件，每一步只删除少量文件，读写可以穿插执行
+ */
+@property (assign, nonatomic) double diskCacheHighWatermark;
+
+/**
+ * 增量淘汰的低水位，是maxCacheSize的倍数，默认为0.9，淘汰到这个大小以下时停止
+ * @note 不能高于diskCacheHighWatermark，否则按照高水位处理
+ */
+@property (assign, nonatomic) double diskCacheLowWatermark;
+
+/**
+ * 是否开启内容去重，默认为NO
+ * 开启之后图片数据按照内容的哈希值（SHA-256的前128位）只保存一份，每个key在磁盘索引中只是一个指向内容的别名，
+ * 同一张图片的不同url（签名url、尺寸别名、带时间戳的参数等）不再重复占用磁盘空间，读取时也会命中同一份数据。
+ * 内容在最后一个引用它的key被删除时才会被删除
+ * @note 只影响之后的写入，已经存在的缓存文件保持不变。别名只记录在磁盘索引中，索引丢失重建时所有别名都会丢失，
+ * 这些key之后都不会命中，去重的内容文件也会在重建时被删除
+ */
+@property (assign, nonatomic) BOOL shouldDeduplicateDiskContent;
+
+/**
+ * 记录的热点图片（命中次数最多的key）的最大数目，默认为0，表示不记录
+ * 热点key会在进入后台、退出以及每隔几分钟保存到磁盘缓存目录中，下次启动时可以用来预加载
+ * @note 只在SDImageCache初始化时读取
+ */
+@property (assign, nonatomic) NSUInteger maxHotImageCount;
+
+/**
+ * 是否在启动时把上次记录的热点图片预加载到内存中，默认为NO，只有maxHotImageCount大于0时才有效
+ * 预加载在读取队列中以最低的优先级执行，也可以设置为NO，在合适的时候手动调用SDImageCache的preloadHotImagesWithCompletion:
+ */
+@property (assign, nonatomic) BOOL shouldPreloadHotImages;
+
+/** 预加载的图片在内存中的总开销上限（和内存缓存的cost一样按解码后的字节数计算），默认为20MB，超过之后剩下的图片不再预加载 */
+@property (assign, nonatomic) NSUInteger maxHotImagePreloadCost;
+
+/** 预加载的最长时间，单位为秒，默认为0.5秒，超过之后剩下的图片不再预加载 */
+@property (assign, nonatomic) NSTimeInterval maxHotImagePreloadDuration;
+
+/**
+ * 解码后的像素数据在磁盘上占用的上限，单位为字节，默认为0，表示不保存
+ * 开启之后，从磁盘读取并解码过的图片会把像素数据另外保存一份，下次磁盘命中时直接映射成图片，不需要再解码；
+ * 原始数据被覆盖、删除或者过期时对应的像素数据也会被删除。这样命中时doneBlock的data为nil（动画图片和GIF不会保存像素数据）
+ * @note 只在SDImageCache初始化时读取，像素数据比原始数据大得多，需要按照解码后的大小设置
+ */
+@property (assign, nonatomic) NSUInteger maxDecodedDiskCacheSize;
+
+/**
+ * 是否用LZ4压缩保存的像素数据，默认为NO
+ * 压缩后磁盘占用一般能减少一半以上，但是命中时需要先解压到内存中，不能直接映射文件
+ * @note 只在SDImageCache初始化时读取
+ */
+@property (assign, nonatomic) BOOL shouldCompressDecodedDiskCache;
+
+/**
+ * 读写磁盘缓存文件使用的IO后端，默认为nil，这时diskCacheReadingOptions为0的话使用SDImageCacheDispatchIOBackend，
+ * 否则使用SDImageCacheBlockingIOBackend以保持文件映射
+ * 批量查询、热点预加载时一批文件一起提交给IO后端，写入缓冲的批量写入也是一样，提交之后不等待，在IO后端完成时再更新索引和回调；
+ * 单个key的查询仍然直接读取
+ * @note 只在SDImageCache初始化时读取，拷贝config时共享同一个后端
+ */
+@property (strong, nonatomic, nullable) id<SDImageCacheIOBackend> diskCacheIOBackend;
+
+/**
+ * 是否和其它进程（App扩展、后台进程等）共享同一个磁盘缓存目录，默认为NO
+ * 开启之后磁盘索引通过文件锁在进程之间共享，修改之后用darwin通知告诉其它进程；
+ * 同一时间只有一个进程执行淘汰和清理，其它进程刚清理过的话不再重复清理。
+ * 所有共享这个目录的进程都需要开启，并且使用相同的配置（maxCacheSize、maxCacheAge等）
+ * @note 只在SDImageCache初始化时读取。共享时不使用pack segment，maxPackedFileSize会被忽略；
+ * 其它进程覆盖的图片，本进程的内存缓存中已经存在的话仍然是旧的
+ */
+@property (assign, nonatomic) BOOL shouldShareDiskCacheAcrossProcesses;
+
+/**
+ * 预览图长边的像素数，默认为0，表示不生成预览图，一般设置为8，最大为64
+ * 开启之后，写入磁盘时把图片缩小成一张几百个字节的预览图，保存在磁盘索引中，
+ * 通过SDImageCache的previewImageForKey:同步获取，在完整的图片读取和解码完成之前先显示。
+ * 预览图随索引常驻内存，长边为8时每条记录大约多占用260个字节；只保存了二进制数据（没有UIImage）的写入不会生成预览图
+ */
+@property (assign, nonatomic) NSUInteger previewImageMaxPixelSize;
+
+/**
+ * 是否由SDImageCacheMemoryGovernor的sharedGovernor按照内存压力分级缩减内存缓存，默认为YES
+ * 设置为NO时和以前一样，收到内存警告时清空整个内存缓存
+ * @note 只在SDImageCache初始化时读取
+ */
+@property (assign, nonatomic) BOOL shouldUseMemoryGovernor;
+
 @end
@@ -9,6 +9,10 @@
 #import "SDImageCacheConfig.h"
 
 static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
+static const NSUInteger kDefaultMaxConcurrentDiskReads = 4;
+static const NSUInteger kDefaultMaxDiskWriteBufferSize = 4 * 1024 * 1024; // 4MB
+static const NSUInteger kDefaultMaxHotImagePreloadCost = 20 * 1024 * 1024; // 20MB
+static const NSTimeInterval kDefaultMaxHotImagePreloadDuration = 0.5;
 
 @implementation SDImageCacheConfig
 
@@ -19,8 +23,58 @@ static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
         _shouldCacheImagesInMemory = YES;
         _maxCacheAge = kDefaultCacheMaxCacheAge;
         _maxCacheSize = 0;
+        _diskCacheShardWidth = 2;
+        _maxPackedFileSize = 0;
+        _diskCacheReadingOptions = 0;
+        _maxConcurrentDiskReads = kDefaultMaxConcurrentDiskReads;
+        _shouldReadLegacyFileNames = YES;
+        _diskCacheEvictionPolicy = SDImageCacheEvictionPolicyTypeFIFO;
+        _maxDiskWriteBufferSize = kDefaultMaxDiskWriteBufferSize;
+        _diskCacheHighWatermark = 1.0;
+        _diskCacheLowWatermark = 0.9;
+        _shouldDeduplicateDiskContent = NO;
+        _maxHotImageCount = 0;
+        _shouldPreloadHotImages = NO;
+        _maxHotImagePreloadCost = kDefaultMaxHotImagePreloadCost;
+        _maxHotImagePreloadDuration = kDefaultMaxHotImagePreloadDuration;
+        _maxDecodedDiskCacheSize = 0;
+        _shouldCompressDecodedDiskCache = NO;
+        _diskCacheIOBackend = nil;
+        _shouldShareDiskCacheAcrossProcesses = NO;
+        _previewImageMaxPixelSize = 0;
+        _shouldUseMemoryGovernor = YES;
     }
     return self;
 }
 
+- (id)copyWithZone:(NSZone *)zone {
+    SDImageCacheConfig *config = [[[self class] allocWithZone:zone] init];
+    config.shouldDecompressImages = self.shouldDecompressImages;
+    config.shouldDisableiCloud = self.shouldDisableiCloud;
+    config.shouldCacheImagesInMemory = self.shouldCacheImagesInMemory;
+    config.maxCacheAge = self.maxCacheAge;
+    config.maxCacheSize = self.maxCacheSize;
+    config.diskCacheShardWidth = self.diskCacheShardWidth;
+    config.maxPackedFileSize = self.maxPackedFileSize;
+    config.diskCacheReadingOptions = self.diskCacheReadingOptions;
+    config.maxConcurrentDiskReads = self.maxConcurrentDiskReads;
+    config.shouldReadLegacyFileNames = self.shouldReadLegacyFileNames;
+    config.diskCacheEvictionPolicy = self.diskCacheEvictionPolicy;
+    config.maxDiskWriteBufferSize = self.maxDiskWriteBufferSize;
+    config.diskCacheHighWatermark = self.diskCacheHighWatermark;
+    config.diskCacheLowWatermark = self.diskCacheLowWatermark;
+    config.shouldDeduplicateDiskContent = self.shouldDeduplicateDiskContent;
+    config.maxHotImageCount = self.maxHotImageCount;
+    config.shouldPreloadHotImages = self.shouldPreloadHotImages;
+    config.maxHotImagePreloadCost = self.maxHotImagePreloadCost;
+    config.maxHotImagePreloadDuration = self.maxHotImagePreloadDuration;
+    config.maxDecodedDiskCacheSize = self.maxDecodedDiskCacheSize;
+    config.shouldCompressDecodedDiskCache = self.shouldCompressDecodedDiskCache;
+    config.diskCacheIOBackend = self.diskCacheIOBackend;
+    config.shouldShareDiskCacheAcrossProcesses = self.shouldShareDiskCacheAcrossProcesses;
+    config.previewImageMaxPixelSize = self.previewImageMaxPixelSize;
+    config.shouldUseMemoryGovernor = self.shouldUseMemoryGovernor;
+    return config;
+}
+
 @end
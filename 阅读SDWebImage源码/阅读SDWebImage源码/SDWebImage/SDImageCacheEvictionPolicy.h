@@ -0,0 +1,62 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+#import "SDImageCacheIndex.h"
+
+/**
+ * 磁盘缓存的淘汰策略，决定磁盘缓存超过maxCacheSize时先删除哪些文件，以及缓存已满时新文件是否值得写入
+ * 所有方法都需要是线程安全的，recordRequestForFileName:会在多个读取线程中同时调用
+ */
+@protocol SDImageCacheEvictionPolicy <NSObject>
+
+/** 记录一次对某个文件的请求，命中（包括内存命中）和未命中都算 */
+- (void)recordRequestForFileName:(nonnull NSString *)fileName;
+
+/** 把记录按照淘汰的先后顺序排列，排在前面的先删除 */
+- (nonnull NSArray<SDImageCacheIndexEntry *> *)entriesInEvictionOrder:(nonnull NSArray<SDImageCacheIndexEntry *> *)entries;
+
+/**
+ * 缓存已满时，是否写入一个新文件
+ *
+ * @param fileName   准备写入的文件
+ * @param candidates 最可能被淘汰的几条记录
+ */
+- (BOOL)shouldAdmitFileName:(nonnull NSString *)fileName evicting:(nonnull NSArray<SDImageCacheIndexEntry *> *)candidates;
+
+@optional
+
+/** 磁盘索引恢复之后告诉策略大概有多少条记录，用来调整内部数据结构的大小 */
+- (void)prepareForEntryCount:(NSUInteger)count;
+
+@end
+
+/**
+ * 先进先出：按照写入时间淘汰，读取不会影响顺序，所有文件都写入
+ */
+@interface SDImageCacheFIFOEvictionPolicy : NSObject <SDImageCacheEvictionPolicy>
+@end
+
+/**
+ * 最近最少使用：按照最后访问时间淘汰，所有文件都写入
+ */
+@interface SDImageCacheLRUEvictionPolicy : NSObject <SDImageCacheEvictionPolicy>
+@end
+
+/**
+ * TinyLFU：用一个会定期衰减的Count-Min Sketch估计每个文件最近被请求的频率，
+ * 按照频率从低到高（频率相同时按照最后访问时间）淘汰；缓存已满时，新文件的频率要高于将被淘汰的文件才会写入，
+ * 这样只访问一次的图片不会把经常访问的头像之类的图片挤出去
+ */
+@interface SDImageCacheTinyLFUEvictionPolicy : NSObject <SDImageCacheEvictionPolicy>
+
+/** 请求频率的估计值，最大为15 */
+- (NSUInteger)frequencyForFileName:(nonnull NSString *)fileName;
+
+@end
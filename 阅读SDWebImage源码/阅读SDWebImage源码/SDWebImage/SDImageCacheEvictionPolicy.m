@@ -0,0 +1,204 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDImageCacheEvictionPolicy.h"
+#import "SDImageCacheKey.h"
+
+#define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+#define UNLOCK(lock) dispatch_semaphore_signal(lock);
+
+#pragma mark - FIFO
+
+@implementation SDImageCacheFIFOEvictionPolicy
+
+- (void)recordRequestForFileName:(nonnull NSString *)fileName {
+}
+
+- (nonnull NSArray<SDImageCacheIndexEntry *> *)entriesInEvictionOrder:(nonnull NSArray<SDImageCacheIndexEntry *> *)entries {
+    return [entries sortedArrayWithOptions:NSSortStable usingComparator:^NSComparisonResult(SDImageCacheIndexEntry *obj1, SDImageCacheIndexEntry *obj2) {
+        if (obj1.storeDate == obj2.storeDate) {
+            return NSOrderedSame;
+        }
+        return obj1.storeDate < obj2.storeDate ? NSOrderedAscending : NSOrderedDescending;
+    }];
+}
+
+- (BOOL)shouldAdmitFileName:(nonnull NSString *)fileName evicting:(nonnull NSArray<SDImageCacheIndexEntry *> *)candidates {
+    return YES;
+}
+
+@end
+
+#pragma mark - LRU
+
+@implementation SDImageCacheLRUEvictionPolicy
+
+// 最后访问时间由磁盘索引在读取命中时更新
+- (void)recordRequestForFileName:(nonnull NSString *)fileName {
+}
+
+- (nonnull NSArray<SDImageCacheIndexEntry *> *)entriesInEvictionOrder:(nonnull NSArray<SDImageCacheIndexEntry *> *)entries {
+    return [entries sortedArrayWithOptions:NSSortStable usingComparator:^NSComparisonResult(SDImageCacheIndexEntry *obj1, SDImageCacheIndexEntry *obj2) {
+        if (obj1.accessDate == obj2.accessDate) {
+            return NSOrderedSame;
+        }
+        return obj1.accessDate < obj2.accessDate ? NSOrderedAscending : NSOrderedDescending;
+    }];
+}
+
+- (BOOL)shouldAdmitFileName:(nonnull NSString *)fileName evicting:(nonnull NSArray<SDImageCacheIndexEntry *> *)candidates {
+    return YES;
+}
+
+@end
+
+#pragma mark - TinyLFU
+
+// Count-Min Sketch的行数，每行一个独立的哈希位置
+static const NSUInteger kSketchDepth = 4;
+// 每个计数器的上限（相当于4位计数器）
+static const uint8_t kSketchMaxFrequency = 15;
+static const NSUInteger kSketchMinimumWidth = 1024;
+// 累计记录了宽度的这么多倍次请求之后，所有计数器减半，让频率反映的是最近的访问情况
+static const NSUInteger kSketchSampleFactor = 10;
+
+@implementation SDImageCacheTinyLFUEvictionPolicy {
+    uint8_t *_counters;
+    NSUInteger _width;
+    NSUInteger _additions;
+    dispatch_semaphore_t _lock;
+}
+
+- (instancetype)init {
+    if ((self = [super init])) {
+        _lock = dispatch_semaphore_create(1);
+        [self resizeToWidth:kSketchMinimumWidth];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    free(_counters);
+}
+
+// 需要持有锁，调整大小会丢弃已经统计的频率
+- (void)resizeToWidth:(NSUInteger)width {
+    free(_counters);
+    _width = width;
+    _counters = calloc(_width * kSketchDepth, sizeof(uint8_t));
+    _additions = 0;
+}
+
+- (void)prepareForEntryCount:(NSUInteger)count {
+    NSUInteger width = kSketchMinimumWidth;
+    while (width < count) {
+        width <<= 1;
+    }
+    LOCK(_lock);
+    if (width > _width) {
+        [self resizeToWidth:width];
+    }
+    UNLOCK(_lock);
+}
+
+// 用文件名的128位摘要在每一行中选出一个计数器
+static inline NSUInteger SDSketchIndex(SDImageCacheKeyDigest digest, NSUInteger row, NSUInteger width) {
+    uint64_t hash = digest.high + row * (digest.low | 1);
+    return row * width + (NSUInteger)(hash & (width - 1));
+}
+
+- (void)recordRequestForFileName:(nonnull NSString *)fileName {
+    SDImageCacheKeyDigest digest = SDImageCacheKeyDigestForString(fileName);
+    LOCK(_lock);
+    for (NSUInteger row = 0; row < kSketchDepth; row++) {
+        uint8_t *counter = &_counters[SDSketchIndex(digest, row, _width)];
+        if (*counter < kSketchMaxFrequency) {
+            *counter += 1;
+        }
+    }
+    _additions += 1;
+    if (_additions >= _width * kSketchSampleFactor) {
+        for (NSUInteger i = 0; i < _width * kSketchDepth; i++) {
+            _counters[i] >>= 1;
+        }
+        _additions /= 2;
+    }
+    UNLOCK(_lock);
+}
+
+// 需要持有锁
+- (NSUInteger)lockedFrequencyForDigest:(SDImageCacheKeyDigest)digest {
+    uint8_t frequency = kSketchMaxFrequency;
+    for (NSUInteger row = 0; row < kSketchDepth; row++) {
+        frequency = MIN(frequency, _counters[SDSketchIndex(digest, row, _width)]);
+    }
+    return frequency;
+}
+
+- (NSUInteger)frequencyForFileName:(nonnull NSString *)fileName {
+    SDImageCacheKeyDigest digest = SDImageCacheKeyDigestForString(fileName);
+    LOCK(_lock);
+    NSUInteger frequency = [self lockedFrequencyForDigest:digest];
+    UNLOCK(_lock);
+    return frequency;
+}
+
+- (nonnull NSArray<SDImageCacheIndexEntry *> *)entriesInEvictionOrder:(nonnull NSArray<SDImageCacheIndexEntry *> *)entries {
+    // 先一次性算出所有记录的频率，排序时不再反复加锁
+    NSUInteger count = entries.count;
+    SDImageCacheKeyDigest *digests = malloc(MAX(count, 1) * sizeof(SDImageCacheKeyDigest));
+    NSUInteger *frequencies = malloc(MAX(count, 1) * sizeof(NSUInteger));
+    for (NSUInteger i = 0; i < count; i++) {
+        digests[i] = SDImageCacheKeyDigestForString(entries[i].fileName);
+    }
+    LOCK(_lock);
+    for (NSUInteger i = 0; i < count; i++) {
+        frequencies[i] = [self lockedFrequencyForDigest:digests[i]];
+    }
+    UNLOCK(_lock);
+    free(digests);
+
+    NSMutableArray<NSNumber *> *order = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [order addObject:@(i)];
+    }
+    [order sortWithOptions:NSSortStable usingComparator:^NSComparisonResult(NSNumber *obj1, NSNumber *obj2) {
+        NSUInteger i1 = obj1.unsignedIntegerValue;
+        NSUInteger i2 = obj2.unsignedIntegerValue;
+        if (frequencies[i1] != frequencies[i2]) {
+            return frequencies[i1] < frequencies[i2] ? NSOrderedAscending : NSOrderedDescending;
+        }
+        NSTimeInterval date1 = entries[i1].accessDate;
+        NSTimeInterval date2 = entries[i2].accessDate;
+        if (date1 == date2) {
+            return NSOrderedSame;
+        }
+        return date1 < date2 ? NSOrderedAscending : NSOrderedDescending;
+    }];
+    free(frequencies);
+
+    NSMutableArray<SDImageCacheIndexEntry *> *sortedEntries = [NSMutableArray arrayWithCapacity:count];
+    for (NSNumber *index in order) {
+        [sortedEntries addObject:entries[index.unsignedIntegerValue]];
+    }
+    return sortedEntries;
+}
+
+- (BOOL)shouldAdmitFileName:(nonnull NSString *)fileName evicting:(nonnull NSArray<SDImageCacheIndexEntry *> *)candidates {
+    if (candidates.count == 0) {
+        return YES;
+    }
+    // 和候选记录中频率最低的那个（也就是真正会被淘汰的）比较
+    NSUInteger victimFrequency = kSketchMaxFrequency;
+    for (SDImageCacheIndexEntry *entry in candidates) {
+        victimFrequency = MIN(victimFrequency, [self frequencyForFileName:entry.fileName]);
+    }
+    return [self frequencyForFileName:fileName] > victimFrequency;
+}
+
+@end
@@ -0,0 +1,74 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+#import "SDImageCacheConfig.h"
+#import "SDImageCacheEvictionPolicy.h"
+
+@class SDImageCache;
+
+/**
+ * SDImageCacheGroup 让多个SDImageCache（一般是不同的namespace）共用一个磁盘预算。
+ * 成员的磁盘缓存总大小超过预算时，按照组的淘汰策略在所有成员之间统一挑选要删除的文件：
+ * 先从超出自己份额（按权重分配预算，但不低于最小值）的成员中淘汰，所有成员都在份额之内仍然超出预算时，
+ * 再从超出最小值的成员中淘汰。这样繁忙的namespace可以用掉空闲namespace让出来的空间，空闲的namespace也保留最小值。
+ *
+ * 成员的config.maxCacheSize仍然单独生效，一般设置为0，交给组来控制。
+ * 所有方法都是线程安全的。
+ */
+@interface SDImageCacheGroup : NSObject
+
+/** 所有成员磁盘缓存的总预算，单位为字节，为0时不限制 */
+@property (assign, atomic) NSUInteger maxTotalSize;
+
+/** 开始淘汰的高水位，是maxTotalSize的倍数，默认为1.0 */
+@property (assign, atomic) double highWatermark;
+
+/** 淘汰到这个低水位以下时停止，是maxTotalSize的倍数，默认为0.9 */
+@property (assign, atomic) double lowWatermark;
+
+/** 组的淘汰策略，成员的请求也会记录到这里 */
+@property (strong, nonatomic, readonly, nonnull) id<SDImageCacheEvictionPolicy> evictionPolicy;
+
+/** 所有成员，按照加入的顺序排列 */
+@property (copy, nonatomic, readonly, nonnull) NSArray<SDImageCache *> *caches;
+
+/**
+ * 通过总预算和淘汰策略来初始化
+ */
+- (nonnull instancetype)initWithMaxTotalSize:(NSUInteger)maxTotalSize
+                              evictionPolicy:(SDImageCacheEvictionPolicyType)evictionPolicy NS_DESIGNATED_INITIALIZER;
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+/**
+ * 加入一个成员，已经是其它组的成员时会先从那个组中移除；已经是这个组的成员时更新权重和最小值
+ *
+ * @param cache       成员
+ * @param weight      分配预算时的权重，按照权重的比例分配，小于等于0时只保留最小值
+ * @param minimumSize 这个成员至少保留的大小，单位为字节，不会因为其它成员而被淘汰到这个大小以下
+ */
+- (void)addCache:(nonnull SDImageCache *)cache weight:(double)weight minimumSize:(NSUInteger)minimumSize;
+
+/** 移除一个成员 */
+- (void)removeCache:(nonnull SDImageCache *)cache;
+
+/** 所有成员磁盘缓存的总大小，单位为字节 */
+- (NSUInteger)totalSize;
+
+/**
+ * 立即检查一次预算，超出时统一淘汰，完成之后在主线程调用completion
+ * 成员写入之后会自动检查，一般不需要手动调用，比如调小了maxTotalSize之后可以调用
+ */
+- (void)enforceBudgetWithCompletion:(nullable SDWebImageNoParamsBlock)completion;
+
+/** 安排一次预算检查，短时间内的多次调用会合并，成员写入之后调用 */
+- (void)setNeedsEnforceBudget;
+
+@end
@@ -0,0 +1,248 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDImageCacheGroup.h"
+#import "SDImageCache.h"
+
+#define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+#define UNLOCK(lock) dispatch_semaphore_signal(lock);
+
+// SDImageCache为缓存组提供的方法，实现在SDImageCache.m中
+@interface SDImageCache (SDImageCacheGroup)
+
+- (void)setGroup:(nullable SDImageCacheGroup *)group;
+
+/** 磁盘缓存的总大小，直接从磁盘索引中读取，不需要排到ioQueue中 */
+- (NSUInteger)groupDiskSize;
+
+/** 磁盘索引中的所有记录 */
+- (nonnull NSArray<SDImageCacheIndexEntry *> *)groupDiskEntries;
+
+/** 在ioQueue中删除这些记录对应的文件，记录在这期间被重新写入过的话跳过 */
+- (void)removeGroupDiskEntries:(nonnull NSArray<SDImageCacheIndexEntry *> *)entries completion:(nonnull SDWebImageNoParamsBlock)completion;
+
+@end
+
+// 组中的一个成员
+@interface SDImageCacheGroupMember : NSObject
+
+@property (strong, nonatomic, nonnull) SDImageCache *cache;
+@property (assign, nonatomic) double weight;
+@property (assign, nonatomic) NSUInteger minimumSize;
+// 以下字段只在淘汰时使用：当前大小（淘汰过程中扣除已经挑选的记录）和按权重分到的份额
+@property (assign, nonatomic) NSUInteger size;
+@property (assign, nonatomic) NSUInteger entitledSize;
+
+@end
+
+@implementation SDImageCacheGroupMember
+@end
+
+@implementation SDImageCacheGroup {
+    NSMutableArray<SDImageCacheGroupMember *> *_members;
+    dispatch_semaphore_t _lock;
+    // 淘汰在这个串行队列中执行，同一时间只有一轮
+    dispatch_queue_t _queue;
+    BOOL _enforceScheduled;
+}
+
+- (nonnull instancetype)initWithMaxTotalSize:(NSUInteger)maxTotalSize
+                              evictionPolicy:(SDImageCacheEvictionPolicyType)evictionPolicy {
+    if ((self = [super init])) {
+        _maxTotalSize = maxTotalSize;
+        _highWatermark = 1.0;
+        _lowWatermark = 0.9;
+        switch (evictionPolicy) {
+            case SDImageCacheEvictionPolicyTypeLRU:
+                _evictionPolicy = [SDImageCacheLRUEvictionPolicy new];
+                break;
+            case SDImageCacheEvictionPolicyTypeTinyLFU:
+                _evictionPolicy = [SDImageCacheTinyLFUEvictionPolicy new];
+                break;
+            default:
+                _evictionPolicy = [SDImageCacheFIFOEvictionPolicy new];
+                break;
+        }
+        _members = [NSMutableArray array];
+        _lock = dispatch_semaphore_create(1);
+        _queue = dispatch_queue_create("com.hackemist.SDImageCacheGroup", DISPATCH_QUEUE_SERIAL);
+    }
+    return self;
+}
+
+#pragma mark - Members
+
+- (nonnull NSArray<SDImageCache *> *)caches {
+    LOCK(_lock);
+    NSArray<SDImageCache *> *caches = [_members valueForKey:NSStringFromSelector(@selector(cache))];
+    UNLOCK(_lock);
+    return caches;
+}
+
+// 在锁中调用
+- (nullable SDImageCacheGroupMember *)memberForCache:(nonnull SDImageCache *)cache {
+    for (SDImageCacheGroupMember *member in _members) {
+        if (member.cache == cache) {
+            return member;
+        }
+    }
+    return nil;
+}
+
+- (void)addCache:(nonnull SDImageCache *)cache weight:(double)weight minimumSize:(NSUInteger)minimumSize {
+    SDImageCacheGroup *previousGroup = cache.group;
+    if (previousGroup && previousGroup != self) {
+        [previousGroup removeCache:cache];
+    }
+    LOCK(_lock);
+    SDImageCacheGroupMember *member = [self memberForCache:cache];
+    if (!member) {
+        member = [SDImageCacheGroupMember new];
+        member.cache = cache;
+        [_members addObject:member];
+    }
+    member.weight = MAX(weight, 0);
+    member.minimumSize = minimumSize;
+    UNLOCK(_lock);
+    [cache setGroup:self];
+    [self setNeedsEnforceBudget];
+}
+
+- (void)removeCache:(nonnull SDImageCache *)cache {
+    LOCK(_lock);
+    SDImageCacheGroupMember *member = [self memberForCache:cache];
+    if (member) {
+        [_members removeObject:member];
+    }
+    UNLOCK(_lock);
+    if (member && cache.group == self) {
+        [cache setGroup:nil];
+    }
+}
+
+- (NSUInteger)totalSize {
+    NSUInteger totalSize = 0;
+    for (SDImageCache *cache in self.caches) {
+        totalSize += [cache groupDiskSize];
+    }
+    return totalSize;
+}
+
+#pragma mark - Eviction
+
+- (void)setNeedsEnforceBudget {
+    if (self.maxTotalSize == 0) {
+        return;
+    }
+    LOCK(_lock);
+    if (_enforceScheduled) {
+        UNLOCK(_lock);
+        return;
+    }
+    _enforceScheduled = YES;
+    UNLOCK(_lock);
+    dispatch_async(_queue, ^{
+        LOCK(self->_lock);
+        self->_enforceScheduled = NO;
+        UNLOCK(self->_lock);
+        [self evictIfNeeded];
+    });
+}
+
+- (void)enforceBudgetWithCompletion:(nullable SDWebImageNoParamsBlock)completion {
+    dispatch_async(_queue, ^{
+        [self evictIfNeeded];
+        if (completion) {
+            dispatch_async(dispatch_get_main_queue(), completion);
+        }
+    });
+}
+
+// 在_queue中执行，总大小超过高水位时统一淘汰到低水位，等所有成员删除完成之后才返回
+- (void)evictIfNeeded {
+    NSUInteger maxTotalSize = self.maxTotalSize;
+    if (maxTotalSize == 0) {
+        return;
+    }
+    LOCK(_lock);
+    NSArray<SDImageCacheGroupMember *> *members = [_members copy];
+    UNLOCK(_lock);
+
+    NSUInteger totalSize = 0;
+    double totalWeight = 0;
+    for (SDImageCacheGroupMember *member in members) {
+        member.size = [member.cache groupDiskSize];
+        totalSize += member.size;
+        totalWeight += member.weight;
+    }
+    double high = MAX(self.highWatermark, 0);
+    double low = MIN(MAX(self.lowWatermark, 0), high);
+    if (totalSize <= (NSUInteger)(maxTotalSize * high)) {
+        return;
+    }
+    NSUInteger targetSize = (NSUInteger)(maxTotalSize * low);
+    for (SDImageCacheGroupMember *member in members) {
+        NSUInteger weightedSize = totalWeight > 0 ? (NSUInteger)(targetSize * (member.weight / totalWeight)) : 0;
+        member.entitledSize = MAX(member.minimumSize, weightedSize);
+    }
+
+    NSMapTable<SDImageCacheGroupMember *, NSMutableArray<SDImageCacheIndexEntry *> *> *removals = [NSMapTable strongToStrongObjectsMapTable];
+    // 第一轮只从超出份额的成员中淘汰，第二轮再从超出最小值的成员中淘汰
+    for (NSUInteger pass = 0; pass < 2 && totalSize > targetSize; pass++) {
+        // 记录 -> 所属的成员，按对象地址区分，不同成员中同名的文件是不同的记录
+        NSMapTable<SDImageCacheIndexEntry *, SDImageCacheGroupMember *> *owners = [NSMapTable mapTableWithKeyOptions:NSPointerFunctionsStrongMemory | NSPointerFunctionsObjectPointerPersonality
+                                                                                                         valueOptions:NSPointerFunctionsStrongMemory];
+        NSMutableArray<SDImageCacheIndexEntry *> *entries = [NSMutableArray array];
+        for (SDImageCacheGroupMember *member in members) {
+            NSUInteger floorSize = pass == 0 ? member.entitledSize : member.minimumSize;
+            if (member.size <= floorSize) {
+                continue;
+            }
+            // 上一轮已经挑选过的记录不再重复计算，每次取到的记录都是新的拷贝，按照文件名判断
+            NSSet<NSString *> *removedFileNames = [NSSet setWithArray:[[removals objectForKey:member] valueForKey:NSStringFromSelector(@selector(fileName))] ?: @[]];
+            for (SDImageCacheIndexEntry *entry in [member.cache groupDiskEntries]) {
+                if ([removedFileNames containsObject:entry.fileName]) {
+                    continue;
+                }
+                [owners setObject:member forKey:entry];
+                [entries addObject:entry];
+            }
+        }
+
+        for (SDImageCacheIndexEntry *entry in [self.evictionPolicy entriesInEvictionOrder:entries]) {
+            SDImageCacheGroupMember *member = [owners objectForKey:entry];
+            NSUInteger floorSize = pass == 0 ? member.entitledSize : member.minimumSize;
+            if (!member || member.size <= floorSize) {
+                continue;
+            }
+            NSMutableArray<SDImageCacheIndexEntry *> *memberRemovals = [removals objectForKey:member];
+            if (!memberRemovals) {
+                memberRemovals = [NSMutableArray array];
+                [removals setObject:memberRemovals forKey:member];
+            }
+            [memberRemovals addObject:entry];
+            member.size -= MIN(member.size, entry.size);
+            totalSize -= MIN(totalSize, entry.size);
+            if (totalSize <= targetSize) {
+                break;
+            }
+        }
+    }
+
+    // 各个成员在自己的ioQueue中并行删除
+    dispatch_group_t group = dispatch_group_create();
+    for (SDImageCacheGroupMember *member in removals) {
+        dispatch_group_enter(group);
+        [member.cache removeGroupDiskEntries:[removals objectForKey:member] completion:^{
+            dispatch_group_leave(group);
+        }];
+    }
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+}
+
+@end
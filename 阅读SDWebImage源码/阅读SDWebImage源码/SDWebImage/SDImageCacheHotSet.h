@@ -0,0 +1,49 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * SDImageCacheHotSet 统计每个key的缓存命中次数，把命中最多的一批key保存到文件中，
+ * 下次启动时SDImageCache可以先把这些图片预加载到内存里，首屏的图片就能直接在内存中命中。
+ *
+ * 统计的key数目有上限，超过之后只保留命中最多的一部分，并把次数减半，这样很久以前的热点会逐渐冷却。
+ * 所有方法都是线程安全的。
+ */
+@interface SDImageCacheHotSet : NSObject
+
+/** 保存和预加载的key的最大数目 */
+@property (assign, nonatomic, readonly) NSUInteger capacity;
+
+/**
+ * 通过保存热点key的文件路径来初始化
+ *
+ * @param path     热点key保存的文件路径
+ * @param capacity 保存的key的最大数目
+ */
+- (nonnull instancetype)initWithPath:(nonnull NSString *)path capacity:(NSUInteger)capacity NS_DESIGNATED_INITIALIZER;
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+/** 记录一次命中 */
+- (void)recordHitForKey:(nonnull NSString *)key;
+
+/** 上次保存的热点key，按照命中次数从多到少排列，文件不存在时返回空数组 */
+- (nonnull NSArray<NSString *> *)savedKeys;
+
+/**
+ * 把当前命中最多的key写到文件中，上次保存之后没有新的命中时什么都不做
+ * 会访问文件系统，需要在后台队列中调用
+ */
+- (void)save;
+
+/** 清空统计并删除文件 */
+- (void)removeAllKeys;
+
+@end
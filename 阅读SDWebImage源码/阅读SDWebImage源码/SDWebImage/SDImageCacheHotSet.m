@@ -0,0 +1,112 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDImageCacheHotSet.h"
+
+#define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+#define UNLOCK(lock) dispatch_semaphore_signal(lock);
+
+// 统计的key数目超过capacity的这个倍数时，只保留命中最多的一半，并把次数减半
+static const NSUInteger kHotSetTrackingFactor = 8;
+
+@implementation SDImageCacheHotSet {
+    NSString *_path;
+    // key -> 命中次数
+    NSMutableDictionary<NSString *, NSNumber *> *_hitCounts;
+    // 上次保存之后是否有新的命中
+    BOOL _dirty;
+    dispatch_semaphore_t _lock;
+}
+
+- (nonnull instancetype)initWithPath:(nonnull NSString *)path capacity:(NSUInteger)capacity {
+    if ((self = [super init])) {
+        _path = [path copy];
+        _capacity = capacity;
+        _hitCounts = [NSMutableDictionary dictionary];
+        _lock = dispatch_semaphore_create(1);
+    }
+    return self;
+}
+
+- (void)recordHitForKey:(nonnull NSString *)key {
+    if (_capacity == 0) {
+        return;
+    }
+    LOCK(_lock);
+    _hitCounts[key] = @(_hitCounts[key].unsignedIntegerValue + 1);
+    _dirty = YES;
+    if (_hitCounts.count > _capacity * kHotSetTrackingFactor) {
+        [self decayHitCounts];
+    }
+    UNLOCK(_lock);
+}
+
+// 在锁中调用：只保留命中最多的一半，次数减半，减到0的直接丢弃
+- (void)decayHitCounts {
+    NSArray<NSString *> *keys = [self hottestKeysWithLimit:_capacity * kHotSetTrackingFactor / 2];
+    NSMutableDictionary<NSString *, NSNumber *> *hitCounts = [NSMutableDictionary dictionaryWithCapacity:keys.count];
+    for (NSString *key in keys) {
+        NSUInteger count = _hitCounts[key].unsignedIntegerValue / 2;
+        if (count > 0) {
+            hitCounts[key] = @(count);
+        }
+    }
+    _hitCounts = hitCounts;
+}
+
+// 在锁中调用
+- (nonnull NSArray<NSString *> *)hottestKeysWithLimit:(NSUInteger)limit {
+    NSArray<NSString *> *keys = [_hitCounts keysSortedByValueUsingComparator:^NSComparisonResult(NSNumber *count1, NSNumber *count2) {
+        return [count2 compare:count1];
+    }];
+    return keys.count > limit ? [keys subarrayWithRange:NSMakeRange(0, limit)] : keys;
+}
+
+- (nonnull NSArray<NSString *> *)savedKeys {
+    NSArray *keys = [NSArray arrayWithContentsOfFile:_path];
+    NSMutableArray<NSString *> *savedKeys = [NSMutableArray arrayWithCapacity:MIN(keys.count, _capacity)];
+    for (id key in keys) {
+        if (savedKeys.count >= _capacity) {
+            break;
+        }
+        if ([key isKindOfClass:[NSString class]]) {
+            [savedKeys addObject:key];
+        }
+    }
+    return savedKeys;
+}
+
+- (void)save {
+    LOCK(_lock);
+    if (!_dirty) {
+        UNLOCK(_lock);
+        return;
+    }
+    NSArray<NSString *> *hottestKeys = [self hottestKeysWithLimit:_capacity];
+    _dirty = NO;
+    UNLOCK(_lock);
+
+    // key可能是SDImageCacheKey，写入plist之前转成普通的字符串
+    NSMutableArray<NSString *> *keys = [NSMutableArray arrayWithCapacity:hottestKeys.count];
+    for (NSString *key in hottestKeys) {
+        [keys addObject:[NSString stringWithString:key]];
+    }
+
+    [[NSFileManager defaultManager] createDirectoryAtPath:_path.stringByDeletingLastPathComponent withIntermediateDirectories:YES attributes:nil error:NULL];
+    [keys writeToFile:_path atomically:YES];
+}
+
+- (void)removeAllKeys {
+    LOCK(_lock);
+    [_hitCounts removeAllObjects];
+    _dirty = NO;
+    UNLOCK(_lock);
+    [[NSFileManager defaultManager] removeItemAtPath:_path error:nil];
+}
+
+@end
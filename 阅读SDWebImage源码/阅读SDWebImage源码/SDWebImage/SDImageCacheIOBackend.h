@@ -0,0 +1,83 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * 一个文件读取完成，index是paths中的位置，读取失败（比如文件不存在）时data为nil
+ * duration为从真正发起这个文件的读取到完成的时间，不包括在后端中排队等待的时间
+ */
+typedef void(^SDImageCacheIOReadHandler)(NSUInteger index, NSData * _Nullable data, NSTimeInterval duration);
+
+/** 一个文件写入完成，index是paths中的位置 */
+typedef void(^SDImageCacheIOWriteHandler)(NSUInteger index, BOOL success);
+
+/**
+ * SDImageCache读写磁盘缓存文件时使用的IO后端
+ * 一批文件一起提交，后端可以同时发起多个请求，按照完成的顺序（不一定是提交的顺序）回调，
+ * 预取和启动预热时一次读取很多图片，这样可以让存储设备的队列保持满载，而不是每次只有一个阻塞的系统调用。
+ *
+ * pack segment、只读路径等其它文件不经过IO后端。
+ */
+@protocol SDImageCacheIOBackend <NSObject>
+
+/**
+ * 读取一批文件
+ *
+ * @param handler    每个文件读取完成时调用，可能在任意线程中并发调用
+ * @param completion 所有文件都完成（所有handler都返回）之后调用一次，可能在任意线程中调用
+ */
+- (void)readFilesAtPaths:(nonnull NSArray<NSString *> *)paths
+                 handler:(nonnull SDImageCacheIOReadHandler)handler
+              completion:(nonnull dispatch_block_t)completion;
+
+/**
+ * 写入一批文件，data和paths一一对应
+ * 每个文件必须原子地替换（先写临时文件再rename），正在被映射读取的旧文件不能被截断；
+ * 失败时原来的文件保持不变。文件所在的目录由调用者保证已经存在
+ *
+ * @param handler    每个文件写入完成时调用，可能在任意线程中并发调用
+ * @param completion 所有文件都完成之后调用一次，可能在任意线程中调用
+ */
+- (void)writeData:(nonnull NSArray<NSData *> *)data
+          toPaths:(nonnull NSArray<NSString *> *)paths
+          handler:(nonnull SDImageCacheIOWriteHandler)handler
+       completion:(nonnull dispatch_block_t)completion;
+
+@end
+
+/**
+ * 基于dispatch_io的IO后端，每个文件一个channel，多个文件的读写同时进行，完成时在一个并发队列中回调
+ * 读写方法提交之后立即返回
+ * 读取的数据保存在内存中，不会映射文件
+ */
+@interface SDImageCacheDispatchIOBackend : NSObject <SDImageCacheIOBackend>
+
+/** 同时进行的读写的最大数目 */
+@property (assign, nonatomic, readonly) NSUInteger maxConcurrentOperations;
+
+/**
+ * @param maxConcurrentOperations 同时进行的读写的最大数目，超过之后剩下的文件在后端内部排队，不阻塞调用的线程，0表示使用默认值16
+ */
+- (nonnull instancetype)initWithMaxConcurrentOperations:(NSUInteger)maxConcurrentOperations NS_DESIGNATED_INITIALIZER;
+
+@end
+
+/**
+ * 逐个文件阻塞读写的IO后端，和之前直接使用NSData读写文件的行为一致，所有回调都在调用的线程中同步执行
+ * 需要映射文件（NSDataReadingMappedIfSafe）的时候使用
+ */
+@interface SDImageCacheBlockingIOBackend : NSObject <SDImageCacheIOBackend>
+
+/** 读取文件时使用的选项 */
+@property (assign, nonatomic, readonly) NSDataReadingOptions readingOptions;
+
+- (nonnull instancetype)initWithReadingOptions:(NSDataReadingOptions)readingOptions NS_DESIGNATED_INITIALIZER;
+
+@end
@@ -0,0 +1,168 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDImageCacheIOBackend.h"
+#import <fcntl.h>
+#import <unistd.h>
+
+static const NSUInteger kDefaultMaxConcurrentIOOperations = 16;
+
+// 写入时的临时文件，以点开头，重建索引和迁移时都不会被当做缓存文件
+static NSString *SDTemporaryPathForPath(NSString *path) {
+    NSString *fileName = [NSString stringWithFormat:@".%@.%@.tmp", path.lastPathComponent, [NSUUID UUID].UUIDString];
+    return [path.stringByDeletingLastPathComponent stringByAppendingPathComponent:fileName];
+}
+
+@implementation SDImageCacheDispatchIOBackend {
+    dispatch_queue_t _queue;
+    // 按提交的顺序发起读写，等待并发名额只阻塞这个队列
+    dispatch_queue_t _submitQueue;
+    dispatch_semaphore_t _slots;
+}
+
+- (instancetype)init {
+    return [self initWithMaxConcurrentOperations:0];
+}
+
+- (nonnull instancetype)initWithMaxConcurrentOperations:(NSUInteger)maxConcurrentOperations {
+    if ((self = [super init])) {
+        _maxConcurrentOperations = maxConcurrentOperations > 0 ? maxConcurrentOperations : kDefaultMaxConcurrentIOOperations;
+        _queue = dispatch_queue_create("com.hackemist.SDImageCacheDispatchIOBackend", DISPATCH_QUEUE_CONCURRENT);
+        _submitQueue = dispatch_queue_create("com.hackemist.SDImageCacheDispatchIOBackend.submit", DISPATCH_QUEUE_SERIAL);
+        _slots = dispatch_semaphore_create((long)_maxConcurrentOperations);
+    }
+    return self;
+}
+
+- (void)readFilesAtPaths:(nonnull NSArray<NSString *> *)paths
+                 handler:(nonnull SDImageCacheIOReadHandler)handler
+              completion:(nonnull dispatch_block_t)completion {
+    // 在串行的提交队列中等待并发名额，调用的线程提交之后立即返回
+    dispatch_semaphore_t slots = _slots;
+    dispatch_queue_t queue = _queue;
+    dispatch_async(_submitQueue, ^{
+        dispatch_group_t group = dispatch_group_create();
+        for (NSUInteger i = 0; i < paths.count; i++) {
+            dispatch_semaphore_wait(slots, DISPATCH_TIME_FOREVER);
+            dispatch_group_enter(group);
+            // 拿到并发名额之后才真正发起读取，从这里开始计时
+            CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+            dispatch_io_t channel = dispatch_io_create_with_path(DISPATCH_IO_RANDOM, paths[i].fileSystemRepresentation, O_RDONLY, 0, queue, ^(int error) {});
+            if (!channel) {
+                handler(i, nil, CFAbsoluteTimeGetCurrent() - startTime);
+                dispatch_semaphore_signal(slots);
+                dispatch_group_leave(group);
+                continue;
+            }
+            // 文件可能分成多块读到，拼接起来之后转成NSData，dispatch_data_t本身就是NSData，不需要拷贝
+            __block dispatch_data_t result = dispatch_data_empty;
+            dispatch_io_read(channel, 0, SIZE_MAX, queue, ^(bool done, dispatch_data_t data, int error) {
+                if (data && error == 0) {
+                    result = dispatch_data_create_concat(result, data);
+                }
+                if (done) {
+                    dispatch_io_close(channel, 0);
+                    BOOL success = error == 0 && dispatch_data_get_size(result) > 0;
+                    handler(i, success ? (NSData *)result : nil, CFAbsoluteTimeGetCurrent() - startTime);
+                    dispatch_semaphore_signal(slots);
+                    dispatch_group_leave(group);
+                }
+            });
+        }
+        dispatch_group_notify(group, queue, completion);
+    });
+}
+
+- (void)writeData:(nonnull NSArray<NSData *> *)data
+          toPaths:(nonnull NSArray<NSString *> *)paths
+          handler:(nonnull SDImageCacheIOWriteHandler)handler
+       completion:(nonnull dispatch_block_t)completion {
+    // 在串行的提交队列中等待并发名额，调用的线程提交之后立即返回
+    dispatch_semaphore_t slots = _slots;
+    dispatch_queue_t queue = _queue;
+    dispatch_async(_submitQueue, ^{
+        dispatch_group_t group = dispatch_group_create();
+        for (NSUInteger i = 0; i < paths.count; i++) {
+            dispatch_semaphore_wait(slots, DISPATCH_TIME_FOREVER);
+            dispatch_group_enter(group);
+            NSString *path = paths[i];
+            NSString *temporaryPath = SDTemporaryPathForPath(path);
+            __block int writeError = 0;
+            // 文件描述符关闭之后才rename，这时数据已经全部交给文件系统
+            dispatch_io_t channel = dispatch_io_create_with_path(DISPATCH_IO_STREAM, temporaryPath.fileSystemRepresentation,
+                                                                 O_WRONLY | O_CREAT | O_TRUNC, 0644, queue, ^(int error) {
+                BOOL success = error == 0 && writeError == 0
+                    && rename(temporaryPath.fileSystemRepresentation, path.fileSystemRepresentation) == 0;
+                if (!success) {
+                    unlink(temporaryPath.fileSystemRepresentation);
+                }
+                handler(i, success);
+                dispatch_semaphore_signal(slots);
+                dispatch_group_leave(group);
+            });
+            if (!channel) {
+                handler(i, NO);
+                dispatch_semaphore_signal(slots);
+                dispatch_group_leave(group);
+                continue;
+            }
+            NSData *fileData = data[i];
+            dispatch_data_t dispatchData = dispatch_data_create(fileData.bytes, fileData.length, queue, ^{
+                // 写入完成之前保持fileData不被释放，不需要拷贝一份
+                (void)fileData;
+            });
+            dispatch_io_write(channel, 0, dispatchData, queue, ^(bool done, dispatch_data_t remaining, int error) {
+                if (done) {
+                    writeError = error;
+                    dispatch_io_close(channel, 0);
+                }
+            });
+        }
+        dispatch_group_notify(group, queue, completion);
+    });
+}
+
+@end
+
+@implementation SDImageCacheBlockingIOBackend
+
+- (instancetype)init {
+    return [self initWithReadingOptions:0];
+}
+
+- (nonnull instancetype)initWithReadingOptions:(NSDataReadingOptions)readingOptions {
+    if ((self = [super init])) {
+        _readingOptions = readingOptions;
+    }
+    return self;
+}
+
+- (void)readFilesAtPaths:(nonnull NSArray<NSString *> *)paths
+                 handler:(nonnull SDImageCacheIOReadHandler)handler
+              completion:(nonnull dispatch_block_t)completion {
+    for (NSUInteger i = 0; i < paths.count; i++) {
+        @autoreleasepool {
+            CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+            NSData *data = [NSData dataWithContentsOfFile:paths[i] options:self.readingOptions error:nil];
+            handler(i, data, CFAbsoluteTimeGetCurrent() - startTime);
+        }
+    }
+    completion();
+}
+
+- (void)writeData:(nonnull NSArray<NSData *> *)data
+          toPaths:(nonnull NSArray<NSString *> *)paths
+          handler:(nonnull SDImageCacheIOWriteHandler)handler
+       completion:(nonnull dispatch_block_t)completion {
+    for (NSUInteger i = 0; i < paths.count; i++) {
+        handler(i, [data[i] writeToFile:paths[i] options:NSDataWritingAtomic error:nil]);
+    }
+    completion();
+}
+
+@end
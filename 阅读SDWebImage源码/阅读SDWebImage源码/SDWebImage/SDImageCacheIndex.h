@@ -0,0 +1,205 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+#import "NSData+ImageContentType.h"
+
+/**
+ * 磁盘索引中的一条记录，对应磁盘上的一个缓存文件
+ */
+@interface SDImageCacheIndexEntry : NSObject <NSCopying>
+
+/** 缓存文件名（key的摘要加扩展名），也是索引中的唯一标识 */
+@property (copy, nonatomic, nonnull) NSString *fileName;
+
+/** 文件大小，单位为字节 */
+@property (assign, nonatomic) NSUInteger size;
+
+/** 写入时间（timeIntervalSinceReferenceDate） */
+@property (assign, nonatomic) NSTimeInterval storeDate;
+
+/** 最后访问时间（timeIntervalSinceReferenceDate），读取命中时更新 */
+@property (assign, nonatomic) NSTimeInterval accessDate;
+
+/**
+ * HTTP新鲜期的截止时间（timeIntervalSinceReferenceDate），0表示没有单独指定，需要重新验证
+ * 只用于决定是否需要向服务器重新验证，磁盘上的过期清理仍然只受maxCacheAge控制
+ */
+@property (assign, nonatomic) NSTimeInterval expirationDate;
+
+/** 图片格式 */
+@property (assign, nonatomic) SDImageFormat format;
+
+/** 数据所在的pack segment编号，0表示是一个单独的文件 */
+@property (assign, nonatomic) uint32_t segment;
+
+/** 数据在pack segment中的偏移，只有segment不为0时才有意义 */
+@property (assign, nonatomic) uint64_t offset;
+
+/**
+ * 开启内容去重时，这条记录只是一个别名，数据保存在contentFileName对应的记录中，自身的size为0
+ * 普通的记录为nil
+ */
+@property (copy, nonatomic, nullable) NSString *contentFileName;
+
+/** 下载时响应头中的ETag，没有时为nil */
+@property (copy, nonatomic, nullable) NSString *entityTag;
+
+/** 下载时响应头中的Last-Modified，没有时为nil */
+@property (copy, nonatomic, nullable) NSString *lastModified;
+
+/** 写入时的key，用于按前缀删除，之前版本写入的记录为nil */
+@property (copy, nonatomic, nullable) NSString *key;
+
+/** 写入时指定的tag，用于按tag删除，没有时为nil */
+@property (copy, nonatomic, nullable) NSSet<NSString *> *tags;
+
+/** 写入时生成的预览图数据（见SDImageCachePreview），几百个字节，没有时为nil */
+@property (copy, nonatomic, nullable) NSData *previewData;
+
+@end
+
+/**
+ * SDImageCacheIndex 维护磁盘缓存的索引（文件名、大小、访问时间、过期时间、格式）
+ * 索引由一个快照文件和一个只追加的日志文件组成，每次写入、删除、读取都只追加一条日志记录，
+ * 启动时读取快照并回放日志来恢复，日志过长时再压缩成新的快照。
+ * 有了索引之后，统计大小、数量以及清理过期文件都不需要再遍历整个缓存目录。
+ *
+ * 所有方法都是线程安全的。
+ */
+@interface SDImageCacheIndex : NSObject
+
+/**
+ * 是否和其它进程共享同一个索引，默认为NO，需要在load之前设置
+ * 共享时每次修改都持有索引目录中的文件锁，并先回放其它进程追加的日志，追加的记录不会交错；
+ * 查询只读取内存中的索引，其它进程的修改在下一次修改或者调用reloadChanges时才会看到
+ */
+@property (assign, nonatomic, getter=isShared) BOOL shared;
+
+/** 缓存文件的总大小，单位为字节 */
+@property (assign, nonatomic, readonly) NSUInteger totalSize;
+
+/** 缓存文件的数目 */
+@property (assign, nonatomic, readonly) NSUInteger count;
+
+/**
+ * 通过索引文件所在的目录来初始化，目录不存在时会在第一次写入时创建
+ */
+- (nonnull instancetype)initWithDirectory:(nonnull NSString *)directory NS_DESIGNATED_INITIALIZER;
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+/**
+ * 从快照和日志中恢复索引
+ *
+ * @return 如果快照和日志都不存在（比如第一次使用，或者是旧版本留下的缓存），返回NO，这时需要调用者扫描一次目录来重建
+ */
+- (BOOL)load;
+
+/**
+ * 用扫描得到的记录重建索引，并立即写入新的快照
+ */
+- (void)resetWithEntries:(nonnull NSArray<SDImageCacheIndexEntry *> *)entries;
+
+/** 记录一次写入，已经存在的记录会被替换 */
+- (void)storeEntryForFileName:(nonnull NSString *)fileName size:(NSUInteger)size format:(SDImageFormat)format;
+
+/** 记录一次写入到pack segment中的数据，已经存在的记录会被替换 */
+- (void)storeEntryForFileName:(nonnull NSString *)fileName
+                         size:(NSUInteger)size
+                       format:(SDImageFormat)format
+                      segment:(uint32_t)segment
+                       offset:(uint64_t)offset;
+
+/**
+ * 记录一个指向contentFileName的别名，已经存在的记录会被替换
+ * 别名不占用大小，被引用的内容记录需要已经存在
+ */
+- (void)storeAliasEntryForFileName:(nonnull NSString *)fileName
+                   contentFileName:(nonnull NSString *)contentFileName
+                            format:(SDImageFormat)format;
+
+/** 把一条记录的写入时间更新为现在，并移到写入顺序的最后，其它字段保持不变 */
+- (void)renewEntryForFileName:(nonnull NSString *)fileName;
+
+/** pack segment压缩时数据被搬到了新的位置，只更新位置，保留其它字段 */
+- (void)moveEntryForFileName:(nonnull NSString *)fileName toSegment:(uint32_t)segment offset:(uint64_t)offset;
+
+/** 更新一条记录的HTTP验证信息和新鲜期，保留其它字段和在写入顺序中的位置 */
+- (void)updateValidatorsForFileName:(nonnull NSString *)fileName
+                         entityTag:(nullable NSString *)entityTag
+                      lastModified:(nullable NSString *)lastModified
+                    expirationDate:(NSTimeInterval)expirationDate;
+
+/**
+ * 记录一条记录对应的key和tag，保留其它字段和在写入顺序中的位置
+ * 之后按tag或者key的前缀查找时，只会访问到匹配的那部分记录
+ */
+- (void)labelEntryForFileName:(nonnull NSString *)fileName key:(nullable NSString *)key tags:(nullable NSSet<NSString *> *)tags;
+
+/** 保存一条记录的预览图数据，保留其它字段和在写入顺序中的位置，超过65535字节的数据不保存 */
+- (void)setPreviewData:(nullable NSData *)previewData forFileName:(nonnull NSString *)fileName;
+
+/** 获取某个文件的预览图数据，只查询内存中的索引，不拷贝整条记录 */
+- (nullable NSData *)previewDataForFileName:(nonnull NSString *)fileName;
+
+/** 记录一次读取命中，更新最后访问时间 */
+- (void)accessEntryForFileName:(nonnull NSString *)fileName;
+
+/** 记录一次删除 */
+- (void)removeEntryForFileName:(nonnull NSString *)fileName;
+
+/** 清空索引 */
+- (void)removeAllEntries;
+
+/** 获取某个文件对应的记录（返回的是一份拷贝） */
+- (nullable SDImageCacheIndexEntry *)entryForFileName:(nonnull NSString *)fileName;
+
+/**
+ * 按写入时间从旧到新返回早于date的记录，只会访问到过期的那部分记录
+ */
+- (nonnull NSArray<SDImageCacheIndexEntry *> *)entriesStoredBefore:(NSTimeInterval)date;
+
+/**
+ * 用布隆过滤器判断某个文件是否可能在索引中，不需要访问文件系统
+ * 同一个摘要带扩展名和不带扩展名的文件名被当做同一个元素，返回NO时两者都一定不存在
+ *
+ * @note 索引恢复或者重建完成之前总是返回YES
+ */
+- (BOOL)mayContainFileName:(nonnull NSString *)fileName;
+
+/** 所有记录，顺序不确定 */
+- (nonnull NSArray<SDImageCacheIndexEntry *> *)allEntries;
+
+/** 写入时间最早的几条记录，按写入时间从旧到新排列 */
+- (nonnull NSArray<SDImageCacheIndexEntry *> *)oldestEntriesWithLimit:(NSUInteger)limit;
+
+/** 指向某个内容记录的所有别名，也就是这份内容的引用 */
+- (nonnull NSArray<NSString *> *)aliasFileNamesForContentFileName:(nonnull NSString *)contentFileName;
+
+/** 带有某个tag的所有记录 */
+- (nonnull NSArray<SDImageCacheIndexEntry *> *)entriesWithTag:(nonnull NSString *)tag;
+
+/** key以prefix开头的所有记录，没有记录key的旧记录不会被找到 */
+- (nonnull NSArray<SDImageCacheIndexEntry *> *)entriesWithKeyPrefix:(nonnull NSString *)prefix;
+
+/** 所有保存在pack segment中的记录 */
+- (nonnull NSArray<SDImageCacheIndexEntry *> *)packedEntries;
+
+/** 把日志压缩成新的快照 */
+- (void)synchronize;
+
+/**
+ * 共享时回放其它进程追加的日志，一般在收到其它进程的修改通知时调用
+ *
+ * @return 被其它进程修改或者删除的文件名；其它进程重写了快照（压缩或者清空）时重新读取了整个索引，这时返回nil
+ */
+- (nullable NSSet<NSString *> *)reloadChanges;
+
+@end
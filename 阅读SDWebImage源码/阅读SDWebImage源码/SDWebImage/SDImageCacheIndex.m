@@ -0,0 +1,1091 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDImageCacheIndex.h"
+#import "SDImageCacheBloomFilter.h"
+#import <fcntl.h>
+#import <unistd.h>
+#import <sys/stat.h>
+#import <sys/file.h>
+
+#define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+#define UNLOCK(lock) dispatch_semaphore_signal(lock);
+
+// 快照和日志文件头部的魔数和版本号，不匹配时认为索引不可用，需要重建
+static const uint32_t kSnapshotMagic = 0x53444958; // 'SDIX'
+static const uint32_t kJournalMagic = 0x5344494A;  // 'SDIJ'
+static const uint32_t kIndexVersion = 6;
+// 还能读取的最旧版本，读取之后会立即重写成当前版本的快照
+static const uint32_t kMinimumIndexVersion = 2;
+
+// 两次访问时间相差不到这个值时只更新内存，不写日志，避免读多写少的时候日志膨胀
+static const NSTimeInterval kAccessJournalGranularity = 60;
+// 日志记录数超过这个值（并且超过索引中的记录数）时，压缩成新的快照
+static const NSUInteger kJournalCompactionThreshold = 4096;
+
+static NSString * const kSnapshotFileName = @"snapshot";
+static NSString * const kJournalFileName = @"journal";
+// 多个进程共享索引时，修改索引需要持有这个文件的锁
+static NSString * const kLockFileName = @"lock";
+
+// 日志记录的类型
+typedef NS_ENUM(uint8_t, SDImageCacheIndexOperation) {
+    SDImageCacheIndexOperationStore = 1,
+    SDImageCacheIndexOperationAccess = 2,
+    SDImageCacheIndexOperationRemove = 3
+};
+
+#pragma mark - Record encoding
+
+// 每条记录的格式：操作类型(1字节) + 文件名长度(2字节) + 文件名，store记录后面再跟上完整的字段，access记录后面跟上访问时间
+// 版本3开始store记录的最后是内容文件名长度(2字节) + 内容文件名，不是别名时长度为0
+// 版本4开始再跟上ETag和Last-Modified，格式和内容文件名一样
+// 版本5开始再跟上key、tag个数(2字节)和每个tag，格式都和内容文件名一样
+// 版本6开始再跟上预览数据长度(2字节) + 预览数据，没有时长度为0
+static void SDIndexEncodeBytes(NSMutableData *data, NSData *bytes) {
+    uint16_t length = (uint16_t)MIN(bytes.length, UINT16_MAX);
+    [data appendBytes:&length length:sizeof(length)];
+    [data appendBytes:bytes.bytes length:length];
+}
+
+static void SDIndexEncodeString(NSMutableData *data, NSString *string) {
+    SDIndexEncodeBytes(data, [string dataUsingEncoding:NSUTF8StringEncoding]);
+}
+
+static void SDIndexEncodeHeader(NSMutableData *data, SDImageCacheIndexOperation operation, NSString *fileName) {
+    NSData *nameData = [fileName dataUsingEncoding:NSUTF8StringEncoding];
+    uint8_t op = operation;
+    uint16_t nameLength = (uint16_t)MIN(nameData.length, UINT16_MAX);
+    [data appendBytes:&op length:sizeof(op)];
+    [data appendBytes:&nameLength length:sizeof(nameLength)];
+    [data appendBytes:nameData.bytes length:nameLength];
+}
+
+static void SDIndexEncodeStore(NSMutableData *data, SDImageCacheIndexEntry *entry) {
+    SDIndexEncodeHeader(data, SDImageCacheIndexOperationStore, entry.fileName);
+    uint64_t size = entry.size;
+    double storeDate = entry.storeDate;
+    double accessDate = entry.accessDate;
+    double expirationDate = entry.expirationDate;
+    int8_t format = (int8_t)entry.format;
+    uint32_t segment = entry.segment;
+    uint64_t offset = entry.offset;
+    [data appendBytes:&size length:sizeof(size)];
+    [data appendBytes:&storeDate length:sizeof(storeDate)];
+    [data appendBytes:&accessDate length:sizeof(accessDate)];
+    [data appendBytes:&expirationDate length:sizeof(expirationDate)];
+    [data appendBytes:&format length:sizeof(format)];
+    [data appendBytes:&segment length:sizeof(segment)];
+    [data appendBytes:&offset length:sizeof(offset)];
+    SDIndexEncodeString(data, entry.contentFileName);
+    SDIndexEncodeString(data, entry.entityTag);
+    SDIndexEncodeString(data, entry.lastModified);
+    SDIndexEncodeString(data, entry.key);
+    uint16_t tagCount = (uint16_t)MIN(entry.tags.count, UINT16_MAX);
+    [data appendBytes:&tagCount length:sizeof(tagCount)];
+    NSUInteger index = 0;
+    for (NSString *tag in entry.tags) {
+        if (index++ >= tagCount) {
+            break;
+        }
+        SDIndexEncodeString(data, tag);
+    }
+    SDIndexEncodeBytes(data, entry.previewData);
+}
+
+static void SDIndexEncodeFileHeader(NSMutableData *data, uint32_t magic) {
+    uint32_t version = kIndexVersion;
+    [data appendBytes:&magic length:sizeof(magic)];
+    [data appendBytes:&version length:sizeof(version)];
+}
+
+typedef struct {
+    const uint8_t *bytes;
+    NSUInteger length;
+    NSUInteger offset;
+} SDIndexReader;
+
+static BOOL SDIndexRead(SDIndexReader *reader, void *buffer, NSUInteger length) {
+    if (reader->length - reader->offset < length) {
+        return NO;
+    }
+    memcpy(buffer, reader->bytes + reader->offset, length);
+    reader->offset += length;
+    return YES;
+}
+
+// 读取一个长度(2字节) + UTF8内容的字符串，长度为0时string为nil
+static BOOL SDIndexReadString(SDIndexReader *reader, NSString **string) {
+    uint16_t length = 0;
+    if (!SDIndexRead(reader, &length, sizeof(length)) || reader->length - reader->offset < length) {
+        return NO;
+    }
+    *string = nil;
+    if (length > 0) {
+        *string = [[NSString alloc] initWithBytes:reader->bytes + reader->offset length:length encoding:NSUTF8StringEncoding];
+        if (!*string) {
+            return NO;
+        }
+    }
+    reader->offset += length;
+    return YES;
+}
+
+// 读取一个长度(2字节) + 内容的二进制数据，长度为0时bytes为nil
+static BOOL SDIndexReadBytes(SDIndexReader *reader, NSData **bytes) {
+    uint16_t length = 0;
+    if (!SDIndexRead(reader, &length, sizeof(length)) || reader->length - reader->offset < length) {
+        return NO;
+    }
+    *bytes = length > 0 ? [NSData dataWithBytes:reader->bytes + reader->offset length:length] : nil;
+    reader->offset += length;
+    return YES;
+}
+
+@implementation SDImageCacheIndexEntry
+
+- (id)copyWithZone:(NSZone *)zone {
+    SDImageCacheIndexEntry *entry = [[[self class] allocWithZone:zone] init];
+    entry.fileName = self.fileName;
+    entry.size = self.size;
+    entry.storeDate = self.storeDate;
+    entry.accessDate = self.accessDate;
+    entry.expirationDate = self.expirationDate;
+    entry.format = self.format;
+    entry.segment = self.segment;
+    entry.offset = self.offset;
+    entry.contentFileName = self.contentFileName;
+    entry.entityTag = self.entityTag;
+    entry.lastModified = self.lastModified;
+    entry.key = self.key;
+    entry.tags = self.tags;
+    entry.previewData = self.previewData;
+    return entry;
+}
+
+@end
+
+@implementation SDImageCacheIndex {
+    NSString *_directory;
+    // 文件名 -> 记录
+    NSMutableDictionary<NSString *, SDImageCacheIndexEntry *> *_entries;
+    // 按写入时间从旧到新排列的文件名，重新写入的文件会移到最后，清理过期文件时只需要从头开始遍历
+    NSMutableOrderedSet<NSString *> *_storeOrder;
+    NSUInteger _totalSize;
+    // 日志文件的描述符，-1表示还没有打开
+    int _journalFileDescriptor;
+    NSUInteger _journalRecordCount;
+    // 内容文件名 -> 指向它的别名，别名都删除之后内容才可以删除
+    NSMutableDictionary<NSString *, NSMutableSet<NSString *> *> *_contentReferences;
+    // 索引中所有文件名（去掉扩展名）的布隆过滤器，用来快速判断未命中
+    SDImageCacheBloomFilter *_filter;
+    // 索引是否已经恢复或者重建完成，在此之前过滤器还不完整，不能用来判断未命中
+    BOOL _filterReady;
+    dispatch_semaphore_t _lock;
+    // 共享时锁文件的描述符，-1表示还没有打开
+    int _lockFileDescriptor;
+    // 上次读取时快照文件的标识，其它进程重写快照（压缩或者清空）后会变化
+    ino_t _snapshotInode;
+    off_t _snapshotSize;
+    struct timespec _snapshotModificationDate;
+    // 已经回放到的日志文件和位置，其它进程追加的记录从这里开始回放
+    ino_t _journalInode;
+    off_t _journalReadOffset;
+    // 回放其它进程的日志时收集涉及到的文件名，其它时候为nil
+    NSMutableSet<NSString *> *_replayedFileNames;
+    // tag -> 带有这个tag的文件名
+    NSMutableDictionary<NSString *, NSMutableSet<NSString *> *> *_tagReferences;
+    // 所有记录了key的key，按字典序排列，按前缀查找时二分找到起点；以及key -> 文件名
+    NSMutableArray<NSString *> *_sortedKeys;
+    NSMutableDictionary<NSString *, NSString *> *_keyFileNames;
+}
+
+- (nonnull instancetype)initWithDirectory:(nonnull NSString *)directory {
+    if ((self = [super init])) {
+        _directory = [directory copy];
+        _entries = [NSMutableDictionary new];
+        _storeOrder = [NSMutableOrderedSet new];
+        _contentReferences = [NSMutableDictionary new];
+        _tagReferences = [NSMutableDictionary new];
+        _sortedKeys = [NSMutableArray new];
+        _keyFileNames = [NSMutableDictionary new];
+        _journalFileDescriptor = -1;
+        _filter = [[SDImageCacheBloomFilter alloc] initWithCapacity:0];
+        _lock = dispatch_semaphore_create(1);
+        _lockFileDescriptor = -1;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self closeJournal];
+    if (_lockFileDescriptor >= 0) {
+        close(_lockFileDescriptor);
+    }
+}
+
+- (NSString *)snapshotPath {
+    return [_directory stringByAppendingPathComponent:kSnapshotFileName];
+}
+
+- (NSString *)journalPath {
+    return [_directory stringByAppendingPathComponent:kJournalFileName];
+}
+
+- (NSUInteger)totalSize {
+    LOCK(_lock);
+    NSUInteger totalSize = _totalSize;
+    UNLOCK(_lock);
+    return totalSize;
+}
+
+- (NSUInteger)count {
+    LOCK(_lock);
+    NSUInteger count = _entries.count;
+    UNLOCK(_lock);
+    return count;
+}
+
+#pragma mark - Load
+
+- (BOOL)load {
+    LOCK(_lock);
+    [self lockSharedFile];
+    BOOL loaded = [self loadFromDisk];
+    [self unlockSharedFile];
+    UNLOCK(_lock);
+    return loaded;
+}
+
+// 在持有锁的情况下调用，丢弃内存中的索引，重新读取快照和日志
+- (BOOL)loadFromDisk {
+    [self resetInMemory];
+
+    NSData *snapshot = [NSData dataWithContentsOfFile:self.snapshotPath options:NSDataReadingMappedIfSafe error:nil];
+    NSData *journal = [NSData dataWithContentsOfFile:self.journalPath options:NSDataReadingMappedIfSafe error:nil];
+    [self recordFileIdentities];
+    if (!snapshot && !journal) {
+        return NO;
+    }
+
+    BOOL complete = YES;
+    BOOL outdated = NO;
+    NSUInteger journalRecordCount = 0;
+    BOOL valid = (!snapshot || [self replayData:snapshot magic:kSnapshotMagic complete:&complete outdated:&outdated recordCount:NULL])
+              && (!journal || [self replayData:journal magic:kJournalMagic complete:&complete outdated:&outdated recordCount:&journalRecordCount]);
+    if (!valid) {
+        // 文件损坏或者版本不对，交给调用者扫描目录重建
+        [self resetInMemory];
+        return NO;
+    }
+    _journalRecordCount = journalRecordCount;
+    _filterReady = YES;
+
+    // 日志末尾有残缺的记录（比如写入过程中进程被杀），立即压缩，否则之后追加的记录在下次回放时都会被丢弃
+    // 旧版本的文件也立即重写，之后追加的记录不能和旧格式混在一起
+    if (!complete || outdated) {
+        [self writeSnapshot];
+    }
+    return YES;
+}
+
+// 回放快照或者日志中的记录，返回NO表示文件头不对；complete表示是否完整地读到了文件末尾，outdated表示是否是旧版本的文件
+- (BOOL)replayData:(NSData *)data
+             magic:(uint32_t)expectedMagic
+          complete:(BOOL *)complete
+          outdated:(BOOL *)outdated
+       recordCount:(NSUInteger *)recordCount {
+    SDIndexReader reader = {data.bytes, data.length, 0};
+    uint32_t magic = 0, version = 0;
+    if (!SDIndexRead(&reader, &magic, sizeof(magic)) || !SDIndexRead(&reader, &version, sizeof(version))
+        || magic != expectedMagic || version < kMinimumIndexVersion || version > kIndexVersion) {
+        return NO;
+    }
+    if (version != kIndexVersion) {
+        *outdated = YES;
+    }
+    NSUInteger count = 0;
+    while (reader.offset < reader.length) {
+        if (![self applyRecordFromReader:&reader version:version]) {
+            *complete = NO;
+            break;
+        }
+        count += 1;
+    }
+    if (recordCount) {
+        *recordCount = count;
+    }
+    return YES;
+}
+
+- (BOOL)applyRecordFromReader:(SDIndexReader *)reader version:(uint32_t)version {
+    uint8_t op = 0;
+    uint16_t nameLength = 0;
+    if (!SDIndexRead(reader, &op, sizeof(op)) || !SDIndexRead(reader, &nameLength, sizeof(nameLength))) {
+        return NO;
+    }
+    if (reader->length - reader->offset < nameLength) {
+        return NO;
+    }
+    NSString *fileName = [[NSString alloc] initWithBytes:reader->bytes + reader->offset length:nameLength encoding:NSUTF8StringEncoding];
+    reader->offset += nameLength;
+    if (!fileName) {
+        return NO;
+    }
+    [_replayedFileNames addObject:fileName];
+
+    switch (op) {
+        case SDImageCacheIndexOperationStore: {
+            uint64_t size = 0;
+            double storeDate = 0, accessDate = 0, expirationDate = 0;
+            int8_t format = 0;
+            uint32_t segment = 0;
+            uint64_t offset = 0;
+            if (!SDIndexRead(reader, &size, sizeof(size))
+                || !SDIndexRead(reader, &storeDate, sizeof(storeDate))
+                || !SDIndexRead(reader, &accessDate, sizeof(accessDate))
+                || !SDIndexRead(reader, &expirationDate, sizeof(expirationDate))
+                || !SDIndexRead(reader, &format, sizeof(format))
+                || !SDIndexRead(reader, &segment, sizeof(segment))
+                || !SDIndexRead(reader, &offset, sizeof(offset))) {
+                return NO;
+            }
+            NSString *contentFileName = nil, *entityTag = nil, *lastModified = nil;
+            if (version >= 3 && !SDIndexReadString(reader, &contentFileName)) {
+                return NO;
+            }
+            if (version >= 4 && (!SDIndexReadString(reader, &entityTag) || !SDIndexReadString(reader, &lastModified))) {
+                return NO;
+            }
+            NSString *key = nil;
+            NSMutableSet<NSString *> *tags = nil;
+            if (version >= 5) {
+                uint16_t tagCount = 0;
+                if (!SDIndexReadString(reader, &key) || !SDIndexRead(reader, &tagCount, sizeof(tagCount))) {
+                    return NO;
+                }
+                for (uint16_t i = 0; i < tagCount; i++) {
+                    NSString *tag = nil;
+                    if (!SDIndexReadString(reader, &tag)) {
+                        return NO;
+                    }
+                    if (tag) {
+                        tags = tags ?: [NSMutableSet set];
+                        [tags addObject:tag];
+                    }
+                }
+            }
+            NSData *previewData = nil;
+            if (version >= 6 && !SDIndexReadBytes(reader, &previewData)) {
+                return NO;
+            }
+            SDImageCacheIndexEntry *entry = [SDImageCacheIndexEntry new];
+            entry.fileName = fileName;
+            entry.size = (NSUInteger)size;
+            entry.storeDate = storeDate;
+            entry.accessDate = accessDate;
+            entry.expirationDate = expirationDate;
+            entry.format = format;
+            entry.segment = segment;
+            entry.offset = offset;
+            entry.contentFileName = contentFileName;
+            entry.entityTag = entityTag;
+            entry.lastModified = lastModified;
+            entry.key = key;
+            entry.tags = tags;
+            entry.previewData = previewData;
+            SDImageCacheIndexEntry *existingEntry = _entries[fileName];
+            if (existingEntry && existingEntry.storeDate == storeDate) {
+                // 写入时间没有变，说明只是位置、访问时间或者标签的更新，保持记录在写入顺序中的位置
+                _totalSize = _totalSize - MIN(_totalSize, existingEntry.size) + entry.size;
+                [self removeContentReferenceForEntry:existingEntry];
+                [self removeLabelsForEntry:existingEntry];
+                _entries[fileName] = entry;
+                [self addContentReferenceForEntry:entry];
+                [self addLabelsForEntry:entry];
+            } else {
+                [self setEntry:entry];
+            }
+            return YES;
+        }
+        case SDImageCacheIndexOperationAccess: {
+            double accessDate = 0;
+            if (!SDIndexRead(reader, &accessDate, sizeof(accessDate))) {
+                return NO;
+            }
+            _entries[fileName].accessDate = accessDate;
+            return YES;
+        }
+        case SDImageCacheIndexOperationRemove:
+            [self unsetEntryForFileName:fileName];
+            return YES;
+        default:
+            return NO;
+    }
+}
+
+#pragma mark - In-memory state
+
+// 以下方法都需要在持有锁的情况下调用
+
+- (void)resetInMemory {
+    [_entries removeAllObjects];
+    [_storeOrder removeAllObjects];
+    [_contentReferences removeAllObjects];
+    [_tagReferences removeAllObjects];
+    [_sortedKeys removeAllObjects];
+    [_keyFileNames removeAllObjects];
+    [_filter removeAllStrings];
+    _totalSize = 0;
+    _journalRecordCount = 0;
+}
+
+- (void)setEntry:(SDImageCacheIndexEntry *)entry {
+    [self unsetEntryForFileName:entry.fileName];
+    _entries[entry.fileName] = entry;
+    [_storeOrder addObject:entry.fileName];
+    _totalSize += entry.size;
+    [self addContentReferenceForEntry:entry];
+    [self addLabelsForEntry:entry];
+    [self addEntryToFilter:entry.fileName];
+}
+
+- (void)addContentReferenceForEntry:(SDImageCacheIndexEntry *)entry {
+    if (!entry.contentFileName) {
+        return;
+    }
+    NSMutableSet<NSString *> *aliases = _contentReferences[entry.contentFileName];
+    if (!aliases) {
+        aliases = [NSMutableSet set];
+        _contentReferences[entry.contentFileName] = aliases;
+    }
+    [aliases addObject:entry.fileName];
+}
+
+- (void)removeContentReferenceForEntry:(SDImageCacheIndexEntry *)entry {
+    if (!entry.contentFileName) {
+        return;
+    }
+    NSMutableSet<NSString *> *aliases = _contentReferences[entry.contentFileName];
+    [aliases removeObject:entry.fileName];
+    if (aliases.count == 0) {
+        [_contentReferences removeObjectForKey:entry.contentFileName];
+    }
+}
+
+// 按字典序比较key，和按前缀查找时的顺序一致
+static NSComparisonResult SDIndexCompareKeys(NSString *key1, NSString *key2) {
+    return [key1 compare:key2 options:NSLiteralSearch];
+}
+
+- (void)addLabelsForEntry:(SDImageCacheIndexEntry *)entry {
+    for (NSString *tag in entry.tags) {
+        NSMutableSet<NSString *> *fileNames = _tagReferences[tag];
+        if (!fileNames) {
+            fileNames = [NSMutableSet set];
+            _tagReferences[tag] = fileNames;
+        }
+        [fileNames addObject:entry.fileName];
+    }
+    NSString *key = entry.key;
+    if (!key) {
+        return;
+    }
+    if (!_keyFileNames[key]) {
+        NSUInteger index = [_sortedKeys indexOfObject:key
+                                        inSortedRange:NSMakeRange(0, _sortedKeys.count)
+                                              options:NSBinarySearchingInsertionIndex
+                                      usingComparator:^NSComparisonResult(NSString *key1, NSString *key2) {
+                                          return SDIndexCompareKeys(key1, key2);
+                                      }];
+        [_sortedKeys insertObject:key atIndex:index];
+    }
+    _keyFileNames[key] = entry.fileName;
+}
+
+- (void)removeLabelsForEntry:(SDImageCacheIndexEntry *)entry {
+    for (NSString *tag in entry.tags) {
+        NSMutableSet<NSString *> *fileNames = _tagReferences[tag];
+        [fileNames removeObject:entry.fileName];
+        if (fileNames.count == 0) {
+            [_tagReferences removeObjectForKey:tag];
+        }
+    }
+    NSString *key = entry.key;
+    // 同一个key可能被另一个文件名（比如旧的MD5文件名迁移之后）占用了，只删除指向自己的
+    if (!key || ![_keyFileNames[key] isEqualToString:entry.fileName]) {
+        return;
+    }
+    [_keyFileNames removeObjectForKey:key];
+    NSUInteger index = [_sortedKeys indexOfObject:key
+                                    inSortedRange:NSMakeRange(0, _sortedKeys.count)
+                                          options:NSBinarySearchingFirstEqual
+                                  usingComparator:^NSComparisonResult(NSString *key1, NSString *key2) {
+                                      return SDIndexCompareKeys(key1, key2);
+                                  }];
+    if (index != NSNotFound) {
+        [_sortedKeys removeObjectAtIndex:index];
+    }
+}
+
+// 记录数超过过滤器的容量后误判率会升高，按照两倍的记录数重新创建过滤器
+- (void)addEntryToFilter:(NSString *)fileName {
+    if (_entries.count <= _filter.capacity) {
+        [_filter addString:fileName.stringByDeletingPathExtension];
+        return;
+    }
+    _filter = [[SDImageCacheBloomFilter alloc] initWithCapacity:_entries.count * 2];
+    for (NSString *name in _entries) {
+        [_filter addString:name.stringByDeletingPathExtension];
+    }
+}
+
+- (void)unsetEntryForFileName:(NSString *)fileName {
+    SDImageCacheIndexEntry *entry = _entries[fileName];
+    if (!entry) {
+        return;
+    }
+    _totalSize -= MIN(_totalSize, entry.size);
+    [self removeContentReferenceForEntry:entry];
+    [self removeLabelsForEntry:entry];
+    [_entries removeObjectForKey:fileName];
+    [_storeOrder removeObject:fileName];
+    [_filter removeString:fileName.stringByDeletingPathExtension];
+}
+
+#pragma mark - Journal
+
+- (BOOL)openJournalIfNeeded {
+    if (_journalFileDescriptor >= 0) {
+        return YES;
+    }
+    [[NSFileManager defaultManager] createDirectoryAtPath:_directory withIntermediateDirectories:YES attributes:nil error:NULL];
+    int fd = open(self.journalPath.fileSystemRepresentation, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0) {
+        return NO;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size == 0) {
+        NSMutableData *header = [NSMutableData data];
+        SDIndexEncodeFileHeader(header, kJournalMagic);
+        write(fd, header.bytes, header.length);
+    }
+    _journalFileDescriptor = fd;
+    if (fstat(fd, &info) == 0) {
+        _journalInode = info.st_ino;
+        _journalReadOffset = info.st_size;
+    }
+    return YES;
+}
+
+- (void)closeJournal {
+    if (_journalFileDescriptor >= 0) {
+        close(_journalFileDescriptor);
+        _journalFileDescriptor = -1;
+    }
+}
+
+- (void)appendJournalRecord:(NSData *)record {
+    if (![self openJournalIfNeeded]) {
+        return;
+    }
+    write(_journalFileDescriptor, record.bytes, record.length);
+    _journalRecordCount += 1;
+    // 修改索引时持有共享锁，日志的末尾就是自己刚写的记录，之后回放其它进程的记录时跳过
+    _journalReadOffset = lseek(_journalFileDescriptor, 0, SEEK_CUR);
+
+    if (_journalRecordCount > kJournalCompactionThreshold && _journalRecordCount > _entries.count) {
+        [self writeSnapshot];
+    }
+}
+
+// 把内存中的索引写成新的快照，然后丢弃日志
+- (void)writeSnapshot {
+    NSMutableData *data = [NSMutableData data];
+    SDIndexEncodeFileHeader(data, kSnapshotMagic);
+    for (NSString *fileName in _storeOrder) {
+        SDIndexEncodeStore(data, _entries[fileName]);
+    }
+    [[NSFileManager defaultManager] createDirectoryAtPath:_directory withIntermediateDirectories:YES attributes:nil error:NULL];
+    if (![data writeToFile:self.snapshotPath atomically:YES]) {
+        return;
+    }
+    // 快照已经包含了日志中的所有修改。即使在删除日志之前进程被杀，回放旧日志也只会得到同样的结果
+    [self closeJournal];
+    unlink(self.journalPath.fileSystemRepresentation);
+    _journalRecordCount = 0;
+    [self recordFileIdentities];
+}
+
+#pragma mark - Sharing
+
+// 以下方法都需要在持有锁的情况下调用，不共享时什么都不做
+
+// 记录当前快照和日志文件的标识，之后用来判断其它进程是否修改过
+- (void)recordFileIdentities {
+    struct stat info;
+    if (stat(self.snapshotPath.fileSystemRepresentation, &info) == 0) {
+        _snapshotInode = info.st_ino;
+        _snapshotSize = info.st_size;
+        _snapshotModificationDate = info.st_mtimespec;
+    } else {
+        _snapshotInode = 0;
+        _snapshotSize = 0;
+        _snapshotModificationDate = (struct timespec){0, 0};
+    }
+    if (stat(self.journalPath.fileSystemRepresentation, &info) == 0) {
+        _journalInode = info.st_ino;
+        _journalReadOffset = info.st_size;
+    } else {
+        _journalInode = 0;
+        _journalReadOffset = 0;
+    }
+}
+
+// 获取跨进程的文件锁，阻塞等待其它进程
+- (void)lockSharedFile {
+    if (!_shared) {
+        return;
+    }
+    if (_lockFileDescriptor < 0) {
+        [[NSFileManager defaultManager] createDirectoryAtPath:_directory withIntermediateDirectories:YES attributes:nil error:NULL];
+        _lockFileDescriptor = open([_directory stringByAppendingPathComponent:kLockFileName].fileSystemRepresentation, O_RDWR | O_CREAT, 0644);
+    }
+    if (_lockFileDescriptor >= 0) {
+        flock(_lockFileDescriptor, LOCK_EX);
+    }
+}
+
+- (void)unlockSharedFile {
+    if (_shared && _lockFileDescriptor >= 0) {
+        flock(_lockFileDescriptor, LOCK_UN);
+    }
+}
+
+// 修改索引之前调用：获取文件锁，并先回放其它进程的修改，保证追加的记录基于最新的状态
+- (void)beginSharedUpdate {
+    if (!_shared) {
+        return;
+    }
+    [self lockSharedFile];
+    [self catchUp];
+}
+
+- (void)endSharedUpdate {
+    [self unlockSharedFile];
+}
+
+// 回放其它进程追加的日志；快照被其它进程重写过（压缩或者清空）的话，重新读取整个索引并返回NO
+- (BOOL)catchUp {
+    struct stat info;
+    BOOL snapshotChanged;
+    if (stat(self.snapshotPath.fileSystemRepresentation, &info) == 0) {
+        snapshotChanged = info.st_ino != _snapshotInode || info.st_size != _snapshotSize
+                       || info.st_mtimespec.tv_sec != _snapshotModificationDate.tv_sec
+                       || info.st_mtimespec.tv_nsec != _snapshotModificationDate.tv_nsec;
+    } else {
+        snapshotChanged = _snapshotInode != 0;
+    }
+    ino_t journalInode = 0;
+    off_t journalSize = 0;
+    if (stat(self.journalPath.fileSystemRepresentation, &info) == 0) {
+        journalInode = info.st_ino;
+        journalSize = info.st_size;
+    }
+    // 日志被换掉了或者变短了，说明其它进程压缩过，只能重新读取
+    BOOL journalReplaced = (_journalInode != 0 && journalInode != _journalInode) || journalSize < _journalReadOffset;
+    if (snapshotChanged || journalReplaced) {
+        [self closeJournal];
+        [self loadFromDisk];
+        _filterReady = YES;
+        return NO;
+    }
+    if (journalInode == 0 || journalSize == _journalReadOffset) {
+        return YES;
+    }
+
+    NSData *journal = [NSData dataWithContentsOfFile:self.journalPath options:NSDataReadingMappedIfSafe error:nil];
+    BOOL complete = YES;
+    if (_journalInode == 0) {
+        // 其它进程新建的日志，从头开始回放
+        BOOL outdated = NO;
+        NSUInteger recordCount = 0;
+        if (journal && [self replayData:journal magic:kJournalMagic complete:&complete outdated:&outdated recordCount:&recordCount]) {
+            _journalRecordCount += recordCount;
+        }
+    } else {
+        // 只回放上次之后追加的记录，这些记录一定是当前版本的格式
+        SDIndexReader reader = {journal.bytes, journal.length, (NSUInteger)_journalReadOffset};
+        while (reader.offset < reader.length) {
+            if (![self applyRecordFromReader:&reader version:kIndexVersion]) {
+                complete = NO;
+                break;
+            }
+            _journalRecordCount += 1;
+        }
+    }
+    _journalInode = journalInode;
+    _journalReadOffset = journalSize;
+    if (!complete) {
+        // 末尾有残缺的记录（写入过程中进程被杀），和load一样立即压缩
+        [self writeSnapshot];
+    }
+    return YES;
+}
+
+- (nullable NSSet<NSString *> *)reloadChanges {
+    LOCK(_lock);
+    if (!_shared) {
+        UNLOCK(_lock);
+        return [NSSet set];
+    }
+    _replayedFileNames = [NSMutableSet set];
+    [self lockSharedFile];
+    BOOL incremental = [self catchUp];
+    [self unlockSharedFile];
+    NSSet<NSString *> *fileNames = incremental ? [_replayedFileNames copy] : nil;
+    _replayedFileNames = nil;
+    UNLOCK(_lock);
+    return fileNames;
+}
+
+#pragma mark - Updates
+
+- (void)resetWithEntries:(nonnull NSArray<SDImageCacheIndexEntry *> *)entries {
+    LOCK(_lock);
+    [self lockSharedFile];
+    [self resetInMemory];
+    for (SDImageCacheIndexEntry *entry in entries) {
+        [self setEntry:[entry copy]];
+    }
+    [self writeSnapshot];
+    _filterReady = YES;
+    [self unlockSharedFile];
+    UNLOCK(_lock);
+}
+
+- (void)storeEntryForFileName:(nonnull NSString *)fileName size:(NSUInteger)size format:(SDImageFormat)format {
+    [self storeEntryForFileName:fileName size:size format:format segment:0 offset:0];
+}
+
+- (void)storeEntryForFileName:(nonnull NSString *)fileName
+                         size:(NSUInteger)size
+                       format:(SDImageFormat)format
+                      segment:(uint32_t)segment
+                       offset:(uint64_t)offset {
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    SDImageCacheIndexEntry *entry = [SDImageCacheIndexEntry new];
+    entry.fileName = fileName;
+    entry.size = size;
+    entry.storeDate = now;
+    entry.accessDate = now;
+    entry.format = format;
+    entry.segment = segment;
+    entry.offset = offset;
+
+    NSMutableData *record = [NSMutableData data];
+    SDIndexEncodeStore(record, entry);
+
+    LOCK(_lock);
+    [self beginSharedUpdate];
+    [self setEntry:entry];
+    [self appendJournalRecord:record];
+    [self endSharedUpdate];
+    UNLOCK(_lock);
+}
+
+- (void)storeAliasEntryForFileName:(nonnull NSString *)fileName
+                   contentFileName:(nonnull NSString *)contentFileName
+                            format:(SDImageFormat)format {
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    SDImageCacheIndexEntry *entry = [SDImageCacheIndexEntry new];
+    entry.fileName = fileName;
+    entry.size = 0;
+    entry.storeDate = now;
+    entry.accessDate = now;
+    entry.format = format;
+    entry.contentFileName = contentFileName;
+
+    NSMutableData *record = [NSMutableData data];
+    SDIndexEncodeStore(record, entry);
+
+    LOCK(_lock);
+    [self beginSharedUpdate];
+    [self setEntry:entry];
+    [self appendJournalRecord:record];
+    [self endSharedUpdate];
+    UNLOCK(_lock);
+}
+
+- (void)renewEntryForFileName:(nonnull NSString *)fileName {
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    LOCK(_lock);
+    [self beginSharedUpdate];
+    SDImageCacheIndexEntry *entry = [_entries[fileName] copy];
+    if (entry) {
+        // 写入时间变了，回放时会当做一次新的写入，移到写入顺序的最后
+        entry.storeDate = now;
+        entry.accessDate = now;
+        [self setEntry:entry];
+        NSMutableData *record = [NSMutableData data];
+        SDIndexEncodeStore(record, entry);
+        [self appendJournalRecord:record];
+    }
+    [self endSharedUpdate];
+    UNLOCK(_lock);
+}
+
+- (void)moveEntryForFileName:(nonnull NSString *)fileName toSegment:(uint32_t)segment offset:(uint64_t)offset {
+    LOCK(_lock);
+    [self beginSharedUpdate];
+    SDImageCacheIndexEntry *entry = _entries[fileName];
+    if (entry) {
+        // 不能调用setEntry:，否则会改变记录在写入顺序中的位置
+        entry.segment = segment;
+        entry.offset = offset;
+        NSMutableData *record = [NSMutableData data];
+        SDIndexEncodeStore(record, entry);
+        [self appendJournalRecord:record];
+    }
+    [self endSharedUpdate];
+    UNLOCK(_lock);
+}
+
+- (void)updateValidatorsForFileName:(nonnull NSString *)fileName
+                         entityTag:(nullable NSString *)entityTag
+                      lastModified:(nullable NSString *)lastModified
+                    expirationDate:(NSTimeInterval)expirationDate {
+    LOCK(_lock);
+    [self beginSharedUpdate];
+    SDImageCacheIndexEntry *entry = _entries[fileName];
+    if (entry) {
+        // 和moveEntryForFileName:一样，写入时间不变，回放时保持记录在写入顺序中的位置
+        entry.entityTag = entityTag;
+        entry.lastModified = lastModified;
+        entry.expirationDate = expirationDate;
+        NSMutableData *record = [NSMutableData data];
+        SDIndexEncodeStore(record, entry);
+        [self appendJournalRecord:record];
+    }
+    [self endSharedUpdate];
+    UNLOCK(_lock);
+}
+
+- (void)labelEntryForFileName:(nonnull NSString *)fileName key:(nullable NSString *)key tags:(nullable NSSet<NSString *> *)tags {
+    // 超过长度上限的key编码时会被截断，回放时可能得到不完整的UTF8，这样的key不记录
+    if ([key lengthOfBytesUsingEncoding:NSUTF8StringEncoding] > UINT16_MAX) {
+        key = nil;
+    }
+    LOCK(_lock);
+    [self beginSharedUpdate];
+    SDImageCacheIndexEntry *entry = _entries[fileName];
+    if (entry) {
+        // 和moveEntryForFileName:一样，写入时间不变，回放时保持记录在写入顺序中的位置
+        [self removeLabelsForEntry:entry];
+        entry.key = [key copy];
+        entry.tags = tags.count > 0 ? [tags copy] : nil;
+        [self addLabelsForEntry:entry];
+        NSMutableData *record = [NSMutableData data];
+        SDIndexEncodeStore(record, entry);
+        [self appendJournalRecord:record];
+    }
+    [self endSharedUpdate];
+    UNLOCK(_lock);
+}
+
+- (void)setPreviewData:(nullable NSData *)previewData forFileName:(nonnull NSString *)fileName {
+    if (previewData.length > UINT16_MAX) {
+        return;
+    }
+    LOCK(_lock);
+    [self beginSharedUpdate];
+    SDImageCacheIndexEntry *entry = _entries[fileName];
+    if (entry) {
+        // 和moveEntryForFileName:一样，写入时间不变，回放时保持记录在写入顺序中的位置
+        entry.previewData = [previewData copy];
+        NSMutableData *record = [NSMutableData data];
+        SDIndexEncodeStore(record, entry);
+        [self appendJournalRecord:record];
+    }
+    [self endSharedUpdate];
+    UNLOCK(_lock);
+}
+
+- (void)accessEntryForFileName:(nonnull NSString *)fileName {
+    NSTimeInterval now = [NSDate timeIntervalSinceReferenceDate];
+    LOCK(_lock);
+    SDImageCacheIndexEntry *entry = _entries[fileName];
+    if (entry) {
+        BOOL shouldJournal = (now - entry.accessDate >= kAccessJournalGranularity);
+        entry.accessDate = now;
+        if (shouldJournal) {
+            // 只有需要写日志时才获取共享锁，大部分命中只更新内存
+            [self beginSharedUpdate];
+            NSMutableData *record = [NSMutableData data];
+            SDIndexEncodeHeader(record, SDImageCacheIndexOperationAccess, fileName);
+            double accessDate = now;
+            [record appendBytes:&accessDate length:sizeof(accessDate)];
+            [self appendJournalRecord:record];
+            [self endSharedUpdate];
+        }
+    }
+    UNLOCK(_lock);
+}
+
+- (void)removeEntryForFileName:(nonnull NSString *)fileName {
+    LOCK(_lock);
+    [self beginSharedUpdate];
+    if (_entries[fileName]) {
+        [self unsetEntryForFileName:fileName];
+        NSMutableData *record = [NSMutableData data];
+        SDIndexEncodeHeader(record, SDImageCacheIndexOperationRemove, fileName);
+        [self appendJournalRecord:record];
+    }
+    [self endSharedUpdate];
+    UNLOCK(_lock);
+}
+
+- (void)removeAllEntries {
+    LOCK(_lock);
+    [self lockSharedFile];
+    [self resetInMemory];
+    [self closeJournal];
+    unlink(self.journalPath.fileSystemRepresentation);
+    unlink(self.snapshotPath.fileSystemRepresentation);
+    [self recordFileIdentities];
+    _filterReady = YES;
+    [self unlockSharedFile];
+    UNLOCK(_lock);
+}
+
+- (void)synchronize {
+    LOCK(_lock);
+    // 共享时先回放其它进程的修改，否则写出的快照会丢掉它们
+    [self beginSharedUpdate];
+    if (_journalRecordCount > 0) {
+        [self writeSnapshot];
+    }
+    [self endSharedUpdate];
+    UNLOCK(_lock);
+}
+
+#pragma mark - Queries
+
+- (nullable SDImageCacheIndexEntry *)entryForFileName:(nonnull NSString *)fileName {
+    LOCK(_lock);
+    SDImageCacheIndexEntry *entry = [_entries[fileName] copy];
+    UNLOCK(_lock);
+    return entry;
+}
+
+- (nullable NSData *)previewDataForFileName:(nonnull NSString *)fileName {
+    LOCK(_lock);
+    NSData *previewData = _entries[fileName].previewData;
+    UNLOCK(_lock);
+    return previewData;
+}
+
+- (BOOL)mayContainFileName:(nonnull NSString *)fileName {
+    NSString *name = fileName.stringByDeletingPathExtension;
+    LOCK(_lock);
+    BOOL contains = !_filterReady || [_filter containsString:name];
+    UNLOCK(_lock);
+    return contains;
+}
+
+- (nonnull NSArray<SDImageCacheIndexEntry *> *)allEntries {
+    NSMutableArray<SDImageCacheIndexEntry *> *entries = [NSMutableArray array];
+    LOCK(_lock);
+    for (SDImageCacheIndexEntry *entry in _entries.objectEnumerator) {
+        [entries addObject:[entry copy]];
+    }
+    UNLOCK(_lock);
+    return entries;
+}
+
+- (nonnull NSArray<SDImageCacheIndexEntry *> *)oldestEntriesWithLimit:(NSUInteger)limit {
+    NSMutableArray<SDImageCacheIndexEntry *> *entries = [NSMutableArray array];
+    LOCK(_lock);
+    for (NSString *fileName in _storeOrder) {
+        if (entries.count >= limit) {
+            break;
+        }
+        [entries addObject:[_entries[fileName] copy]];
+    }
+    UNLOCK(_lock);
+    return entries;
+}
+
+- (nonnull NSArray<NSString *> *)aliasFileNamesForContentFileName:(nonnull NSString *)contentFileName {
+    LOCK(_lock);
+    NSArray<NSString *> *aliases = _contentReferences[contentFileName].allObjects ?: @[];
+    UNLOCK(_lock);
+    return aliases;
+}
+
+- (nonnull NSArray<SDImageCacheIndexEntry *> *)entriesWithTag:(nonnull NSString *)tag {
+    NSMutableArray<SDImageCacheIndexEntry *> *entries = [NSMutableArray array];
+    LOCK(_lock);
+    for (NSString *fileName in _tagReferences[tag]) {
+        [entries addObject:[_entries[fileName] copy]];
+    }
+    UNLOCK(_lock);
+    return entries;
+}
+
+- (nonnull NSArray<SDImageCacheIndexEntry *> *)entriesWithKeyPrefix:(nonnull NSString *)prefix {
+    NSMutableArray<SDImageCacheIndexEntry *> *entries = [NSMutableArray array];
+    LOCK(_lock);
+    // 有这个前缀的key在排序之后是连续的一段，从第一个不小于前缀的位置开始
+    NSUInteger index = [_sortedKeys indexOfObject:prefix
+                                    inSortedRange:NSMakeRange(0, _sortedKeys.count)
+                                          options:NSBinarySearchingInsertionIndex | NSBinarySearchingFirstEqual
+                                  usingComparator:^NSComparisonResult(NSString *key1, NSString *key2) {
+                                      return SDIndexCompareKeys(key1, key2);
+                                  }];
+    for (; index < _sortedKeys.count; index++) {
+        NSString *key = _sortedKeys[index];
+        if (![key hasPrefix:prefix]) {
+            break;
+        }
+        SDImageCacheIndexEntry *entry = _entries[_keyFileNames[key]];
+        if (entry) {
+            [entries addObject:[entry copy]];
+        }
+    }
+    UNLOCK(_lock);
+    return entries;
+}
+
+- (nonnull NSArray<SDImageCacheIndexEntry *> *)packedEntries {
+    NSMutableArray<SDImageCacheIndexEntry *> *entries = [NSMutableArray array];
+    LOCK(_lock);
+    for (SDImageCacheIndexEntry *entry in _entries.objectEnumerator) {
+        if (entry.segment != 0) {
+            [entries addObject:[entry copy]];
+        }
+    }
+    UNLOCK(_lock);
+    return entries;
+}
+
+- (nonnull NSArray<SDImageCacheIndexEntry *> *)entriesStoredBefore:(NSTimeInterval)date {
+    NSMutableArray<SDImageCacheIndexEntry *> *entries = [NSMutableArray array];
+    LOCK(_lock);
+    for (NSString *fileName in _storeOrder) {
+        SDImageCacheIndexEntry *entry = _entries[fileName];
+        if (entry.storeDate >= date) {
+            break;
+        }
+        [entries addObject:[entry copy]];
+    }
+    UNLOCK(_lock);
+    return entries;
+}
+
+@end
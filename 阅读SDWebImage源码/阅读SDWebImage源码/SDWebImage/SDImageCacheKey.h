@@ -0,0 +1,49 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * 128位的key摘要
+ */
+typedef struct SDImageCacheKeyDigest {
+    uint64_t high;
+    uint64_t low;
+} SDImageCacheKeyDigest;
+
+/**
+ * 计算一个字符串（UTF-8）的128位摘要，使用的是非加密的MurmurHash3 x64_128，比MD5快得多
+ */
+FOUNDATION_EXPORT SDImageCacheKeyDigest SDImageCacheKeyDigestForString(NSString * _Nullable string);
+
+/**
+ * 根据key计算磁盘缓存文件名：摘要的32位十六进制字符，后面跟上key的扩展名
+ */
+FOUNDATION_EXPORT NSString * _Nonnull SDImageCacheFileNameForKey(NSString * _Nullable key);
+
+/**
+ * SDImageCacheKey 是一个不可变的缓存key，在SDWebImageManager的cacheKeyForURL:中创建一次，之后在整个流程中传递。
+ * 它本身就是一个NSString，可以在任何需要key的地方使用，和内容相同的普通NSString相等、哈希值也相同；
+ * 不同的是哈希值、128位摘要和磁盘缓存文件名都只计算一次，内存缓存、磁盘索引、文件名以及下载去重都直接复用，
+ * 不会在每次查找时重新计算。
+ */
+@interface SDImageCacheKey : NSString
+
+/** 128位摘要 */
+@property (assign, nonatomic, readonly) SDImageCacheKeyDigest digest;
+
+/** 磁盘缓存文件名，等同于SDImageCacheFileNameForKey(self)，第一次使用时计算 */
+@property (copy, atomic, readonly, nonnull) NSString *fileName;
+
+/**
+ * 用一个字符串创建key，string本身就是SDImageCacheKey时直接返回
+ */
++ (nonnull instancetype)keyWithString:(nonnull NSString *)string;
+
+@end
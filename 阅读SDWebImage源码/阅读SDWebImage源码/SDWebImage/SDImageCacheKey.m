@@ -0,0 +1,185 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDImageCacheKey.h"
+
+#pragma mark - MurmurHash3
+
+// MurmurHash3 x64_128，来自 https://github.com/aappleby/smhasher （public domain）
+static inline uint64_t SDRotateLeft64(uint64_t x, int8_t r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t SDFinalMix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+static SDImageCacheKeyDigest SDMurmurHash3_x64_128(const uint8_t *data, size_t length, uint32_t seed) {
+    const size_t blockCount = length / 16;
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = seed;
+    uint64_t h2 = seed;
+
+    for (size_t i = 0; i < blockCount; i++) {
+        uint64_t k1, k2;
+        memcpy(&k1, data + i * 16, sizeof(k1));
+        memcpy(&k2, data + i * 16 + 8, sizeof(k2));
+
+        k1 *= c1; k1 = SDRotateLeft64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = SDRotateLeft64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2; k2 = SDRotateLeft64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = SDRotateLeft64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    const uint8_t *tail = data + blockCount * 16;
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    switch (length & 15) {
+        case 15: k2 ^= ((uint64_t)tail[14]) << 48;
+        case 14: k2 ^= ((uint64_t)tail[13]) << 40;
+        case 13: k2 ^= ((uint64_t)tail[12]) << 32;
+        case 12: k2 ^= ((uint64_t)tail[11]) << 24;
+        case 11: k2 ^= ((uint64_t)tail[10]) << 16;
+        case 10: k2 ^= ((uint64_t)tail[9]) << 8;
+        case 9:  k2 ^= ((uint64_t)tail[8]);
+            k2 *= c2; k2 = SDRotateLeft64(k2, 33); k2 *= c1; h2 ^= k2;
+        case 8:  k1 ^= ((uint64_t)tail[7]) << 56;
+        case 7:  k1 ^= ((uint64_t)tail[6]) << 48;
+        case 6:  k1 ^= ((uint64_t)tail[5]) << 40;
+        case 5:  k1 ^= ((uint64_t)tail[4]) << 32;
+        case 4:  k1 ^= ((uint64_t)tail[3]) << 24;
+        case 3:  k1 ^= ((uint64_t)tail[2]) << 16;
+        case 2:  k1 ^= ((uint64_t)tail[1]) << 8;
+        case 1:  k1 ^= ((uint64_t)tail[0]);
+            k1 *= c1; k1 = SDRotateLeft64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= length;
+    h2 ^= length;
+    h1 += h2;
+    h2 += h1;
+    h1 = SDFinalMix64(h1);
+    h2 = SDFinalMix64(h2);
+    h1 += h2;
+    h2 += h1;
+
+    SDImageCacheKeyDigest digest = {h1, h2};
+    return digest;
+}
+
+SDImageCacheKeyDigest SDImageCacheKeyDigestForString(NSString * _Nullable string) {
+    const char *str = string.UTF8String;
+    if (str == NULL) {
+        str = "";
+    }
+    return SDMurmurHash3_x64_128((const uint8_t *)str, strlen(str), 0);
+}
+
+static NSString *SDImageCacheFileNameForDigest(SDImageCacheKeyDigest digest, NSString *key) {
+    NSString *extension = key.pathExtension;
+    return [NSString stringWithFormat:@"%016llx%016llx%@",
+            digest.high, digest.low, extension.length == 0 ? @"" : [@"." stringByAppendingString:extension]];
+}
+
+NSString * _Nonnull SDImageCacheFileNameForKey(NSString * _Nullable key) {
+    if ([key isKindOfClass:[SDImageCacheKey class]]) {
+        return ((SDImageCacheKey *)key).fileName;
+    }
+    return SDImageCacheFileNameForDigest(SDImageCacheKeyDigestForString(key), key);
+}
+
+#pragma mark - SDImageCacheKey
+
+@implementation SDImageCacheKey {
+    // 实际的字符串内容，NSString的基本方法都转发给它
+    NSString *_string;
+    NSUInteger _hash;
+    NSString *_fileName;
+}
+
++ (nonnull instancetype)keyWithString:(nonnull NSString *)string {
+    if ([string isKindOfClass:[SDImageCacheKey class]]) {
+        return (SDImageCacheKey *)string;
+    }
+    SDImageCacheKey *key = [[self alloc] init];
+    key->_string = [string copy];
+    // 和普通NSString的哈希值保持一致，这样在NSCache、NSDictionary中可以和同样内容的字符串互换使用
+    key->_hash = key->_string.hash;
+    key->_digest = SDImageCacheKeyDigestForString(key->_string);
+    return key;
+}
+
+- (NSString *)fileName {
+    @synchronized (self) {
+        if (!_fileName) {
+            _fileName = SDImageCacheFileNameForDigest(_digest, _string);
+        }
+        return _fileName;
+    }
+}
+
+#pragma mark NSString primitives
+
+- (NSUInteger)length {
+    return _string.length;
+}
+
+- (unichar)characterAtIndex:(NSUInteger)index {
+    return [_string characterAtIndex:index];
+}
+
+- (void)getCharacters:(unichar *)buffer range:(NSRange)range {
+    [_string getCharacters:buffer range:range];
+}
+
+- (const char *)UTF8String {
+    return _string.UTF8String;
+}
+
+#pragma mark Equality
+
+- (NSUInteger)hash {
+    return _hash;
+}
+
+- (BOOL)isEqual:(id)object {
+    if (self == object) {
+        return YES;
+    }
+    if (![object isKindOfClass:[NSString class]]) {
+        return NO;
+    }
+    return [self isEqualToString:object];
+}
+
+- (BOOL)isEqualToString:(NSString *)string {
+    if ([string isKindOfClass:[SDImageCacheKey class]]) {
+        // 两个key之间先比较摘要，绝大多数不相等的情况不需要比较字符串
+        SDImageCacheKey *other = (SDImageCacheKey *)string;
+        if (_digest.high != other->_digest.high || _digest.low != other->_digest.low) {
+            return NO;
+        }
+        return [_string isEqualToString:other->_string];
+    }
+    return [_string isEqualToString:string];
+}
+
+#pragma mark NSCopying
+
+// 不可变对象，拷贝时直接返回自身，作为NSDictionary的key时也能保留缓存的摘要
+- (id)copyWithZone:(NSZone *)zone {
+    return self;
+}
+
+@end
@@ -0,0 +1,114 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * 内存压力的级别
+ */
+typedef NS_ENUM(NSInteger, SDImageCacheMemoryPressureLevel) {
+    /**
+     * 没有压力，内存缓存使用完整的预算
+     */
+    SDImageCacheMemoryPressureLevelNormal = 0,
+    /**
+     * 内存紧张，按moderateRatio缩减预算，并淘汰最冷的对象
+     */
+    SDImageCacheMemoryPressureLevelModerate,
+    /**
+     * 内存严重不足，按criticalRatio缩减预算，只保留固定的和正在显示的对象（和剩余预算允许的部分）
+     */
+    SDImageCacheMemoryPressureLevelCritical
+};
+
+/**
+ * 内存压力级别改变之后在主线程发出，object为SDImageCacheMemoryGovernor，
+ * userInfo中SDImageCacheMemoryPressureLevelKey对应新的级别（NSNumber）
+ */
+extern NSString * _Nonnull const SDImageCacheMemoryPressureDidChangeNotification;
+extern NSString * _Nonnull const SDImageCacheMemoryPressureLevelKey;
+
+/**
+ * 可以被SDImageCacheMemoryGovernor缩减的内存层，SDImageCacheMemoryStore实现了这个协议
+ */
+@protocol SDImageCacheMemoryTier <NSObject>
+
+/** 当前占用的总cost */
+@property (assign, nonatomic, readonly) NSUInteger totalCost;
+
+/** 预算的缩放比例，实际的上限是设置的上限乘以这个比例，1.0为不缩放 */
+@property (assign, atomic) double budgetScale;
+
+/**
+ * 从最冷的对象开始淘汰，直到总cost不超过cost，最近interval秒内使用过的对象和固定的对象不会被淘汰
+ */
+- (void)trimToCost:(NSUInteger)cost protectingObjectsUsedWithin:(NSTimeInterval)interval;
+
+@end
+
+/**
+ * SDImageCacheMemoryGovernor 根据内存压力分级缩减所有注册的内存层，代替收到内存警告时清空整个内存缓存：
+ * 每一层按照相同的比例缩减（而不是清空），从最冷的对象开始淘汰，保留固定的和正在显示的对象，
+ * 这样内存警告之后下一帧不需要从磁盘重新读取和解码所有可见的图片。
+ * 压力持续期间每一层的预算也按同样的比例缩小，压力解除或者recoveryInterval内没有新的信号时恢复。
+ * App进入后台时同样按backgroundRatio缩减并缩小预算，回到前台时恢复，和压力同时存在时取较小的比例。
+ *
+ * 默认监听系统的内存压力事件（dispatch memory pressure source）、UIKit的内存警告和前后台切换，
+ * 其它的压力信号（比如Linux上cgroup的memory.events、自己统计的内存占用）可以通过reportMemoryPressure:报告。
+ * 缩减在后台的串行队列中执行，所有方法都是线程安全的。
+ */
+@interface SDImageCacheMemoryGovernor : NSObject
+
+/** SDImageCache默认使用的实例，监听系统的压力信号 */
++ (nonnull instancetype)sharedGovernor;
+
+/** 当前的压力级别 */
+@property (assign, atomic, readonly) SDImageCacheMemoryPressureLevel pressureLevel;
+
+/** Moderate级别时保留的比例，默认为0.5 */
+@property (assign, atomic) double moderateRatio;
+
+/** Critical级别时保留的比例，默认为0.2 */
+@property (assign, atomic) double criticalRatio;
+
+/** App在后台时保留的比例，默认为0.5，为1时进入后台不缩减 */
+@property (assign, atomic) double backgroundRatio;
+
+/** 最近多少秒内使用过的对象视为正在显示，缩减时不会被淘汰，默认为1秒，为0时不保护 */
+@property (assign, atomic) NSTimeInterval visibleInterval;
+
+/**
+ * 最后一次压力信号之后多少秒自动恢复到Normal，默认为30秒，为0时只在报告Normal时恢复
+ * UIKit的内存警告和大部分自定义信号都没有对应的解除事件
+ */
+@property (assign, atomic) NSTimeInterval recoveryInterval;
+
+/**
+ * 创建一个不监听任何系统信号的实例，只响应reportMemoryPressure:和reportApplicationInBackground:
+ */
+- (nonnull instancetype)init;
+
+/** 注册一个内存层，弱引用，当前有压力时立即按照当前级别缩减 */
+- (void)addMemoryTier:(nonnull id<SDImageCacheMemoryTier>)tier;
+
+- (void)removeMemoryTier:(nonnull id<SDImageCacheMemoryTier>)tier;
+
+/**
+ * 报告一次内存压力，自定义压力信号的入口。缩减的目标按照每一层进入压力状态时的占用计算，
+ * 同一个级别重复报告只会把这期间新增的对象缩减到同样的目标，不会越缩越小；报告Normal时恢复完整的预算
+ */
+- (void)reportMemoryPressure:(SDImageCacheMemoryPressureLevel)level;
+
+/**
+ * 报告App进入后台或者回到前台，sharedGovernor在UIKit上会自动监听对应的通知
+ * 进入后台时按backgroundRatio缩减，回到前台时恢复到当前压力级别对应的预算
+ */
+- (void)reportApplicationInBackground:(BOOL)inBackground;
+
+@end
@@ -0,0 +1,247 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDImageCacheMemoryGovernor.h"
+
+#define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+#define UNLOCK(lock) dispatch_semaphore_signal(lock);
+
+NSString *const SDImageCacheMemoryPressureDidChangeNotification = @"SDImageCacheMemoryPressureDidChangeNotification";
+NSString *const SDImageCacheMemoryPressureLevelKey = @"SDImageCacheMemoryPressureLevelKey";
+
+@interface SDImageCacheMemoryGovernor ()
+
+@property (assign, atomic, readwrite) SDImageCacheMemoryPressureLevel pressureLevel;
+
+@end
+
+@implementation SDImageCacheMemoryGovernor {
+    NSHashTable<id<SDImageCacheMemoryTier>> *_tiers;
+    // 每一层进入压力状态时的总cost，缩减的目标按它计算，只在_queue中访问，恢复到Normal时清除
+    NSMapTable<id<SDImageCacheMemoryTier>, NSNumber *> *_baselineCosts;
+    dispatch_semaphore_t _lock;
+    // 缩减在这个串行队列中执行
+    dispatch_queue_t _queue;
+    // 每次收到压力信号加一，自动恢复时用来判断期间有没有新的信号
+    NSUInteger _signalGeneration;
+    // App是否在后台，只在_queue中访问
+    BOOL _inBackground;
+    dispatch_source_t _pressureSource;
+}
+
++ (nonnull instancetype)sharedGovernor {
+    static dispatch_once_t once;
+    static SDImageCacheMemoryGovernor *instance;
+    dispatch_once(&once, ^{
+        instance = [self new];
+        [instance startObservingSystemPressure];
+    });
+    return instance;
+}
+
+- (nonnull instancetype)init {
+    if ((self = [super init])) {
+        _moderateRatio = 0.5;
+        _criticalRatio = 0.2;
+        _backgroundRatio = 0.5;
+        _visibleInterval = 1;
+        _recoveryInterval = 30;
+        _tiers = [NSHashTable weakObjectsHashTable];
+        _baselineCosts = [NSMapTable weakToStrongObjectsMapTable];
+        _lock = dispatch_semaphore_create(1);
+        _queue = dispatch_queue_create("com.hackemist.SDImageCacheMemoryGovernor", dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0));
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    if (_pressureSource) {
+        dispatch_source_cancel(_pressureSource);
+    }
+}
+
+// 只有sharedGovernor监听系统信号，避免同一个内存层被多个实例重复缩减
+- (void)startObservingSystemPressure {
+#ifdef DISPATCH_SOURCE_TYPE_MEMORYPRESSURE
+    _pressureSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_MEMORYPRESSURE, 0,
+                                             DISPATCH_MEMORYPRESSURE_NORMAL | DISPATCH_MEMORYPRESSURE_WARN | DISPATCH_MEMORYPRESSURE_CRITICAL,
+                                             _queue);
+    __weak __typeof(self) wself = self;
+    dispatch_source_set_event_handler(_pressureSource, ^{
+        __strong __typeof(wself) sself = wself;
+        if (!sself) {
+            return;
+        }
+        unsigned long status = dispatch_source_get_data(sself->_pressureSource);
+        if (status & DISPATCH_MEMORYPRESSURE_CRITICAL) {
+            [sself applyPressureLevel:SDImageCacheMemoryPressureLevelCritical];
+        } else if (status & DISPATCH_MEMORYPRESSURE_WARN) {
+            [sself applyPressureLevel:SDImageCacheMemoryPressureLevelModerate];
+        } else {
+            [sself applyPressureLevel:SDImageCacheMemoryPressureLevelNormal];
+        }
+    });
+    dispatch_resume(_pressureSource);
+#endif
+#if SD_UIKIT
+    // UIKit的内存警告一般在进程快要被终止时才发出，按Critical处理
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(didReceiveMemoryWarning:)
+                                                 name:UIApplicationDidReceiveMemoryWarningNotification
+                                               object:nil];
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(applicationDidEnterBackground:)
+                                                 name:UIApplicationDidEnterBackgroundNotification
+                                               object:nil];
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(applicationWillEnterForeground:)
+                                                 name:UIApplicationWillEnterForegroundNotification
+                                               object:nil];
+#endif
+}
+
+- (void)didReceiveMemoryWarning:(NSNotification *)notification {
+    [self reportMemoryPressure:SDImageCacheMemoryPressureLevelCritical];
+}
+
+- (void)applicationDidEnterBackground:(NSNotification *)notification {
+    [self reportApplicationInBackground:YES];
+}
+
+- (void)applicationWillEnterForeground:(NSNotification *)notification {
+    [self reportApplicationInBackground:NO];
+}
+
+#pragma mark - Tiers
+
+- (nonnull NSArray<id<SDImageCacheMemoryTier>> *)tiers {
+    LOCK(_lock);
+    NSArray<id<SDImageCacheMemoryTier>> *tiers = _tiers.allObjects;
+    UNLOCK(_lock);
+    return tiers;
+}
+
+- (void)addMemoryTier:(nonnull id<SDImageCacheMemoryTier>)tier {
+    LOCK(_lock);
+    [_tiers addObject:tier];
+    UNLOCK(_lock);
+    dispatch_async(_queue, ^{
+        double ratio = [self currentRatio];
+        if (ratio < 1) {
+            [self trimTier:tier toRatio:ratio];
+        }
+    });
+}
+
+- (void)removeMemoryTier:(nonnull id<SDImageCacheMemoryTier>)tier {
+    LOCK(_lock);
+    [_tiers removeObject:tier];
+    UNLOCK(_lock);
+    tier.budgetScale = 1;
+    dispatch_async(_queue, ^{
+        [self->_baselineCosts removeObjectForKey:tier];
+    });
+}
+
+#pragma mark - Pressure
+
+- (void)reportMemoryPressure:(SDImageCacheMemoryPressureLevel)level {
+    dispatch_async(_queue, ^{
+        [self applyPressureLevel:level];
+    });
+}
+
+- (void)reportApplicationInBackground:(BOOL)inBackground {
+    dispatch_async(_queue, ^{
+        if (self->_inBackground == inBackground) {
+            return;
+        }
+        self->_inBackground = inBackground;
+        // 回到前台时恢复到当前压力级别对应的预算
+        double ratio = [self currentRatio];
+        for (id<SDImageCacheMemoryTier> tier in [self tiers]) {
+            @autoreleasepool {
+                [self trimTier:tier toRatio:ratio];
+            }
+        }
+    });
+}
+
+- (double)ratioForLevel:(SDImageCacheMemoryPressureLevel)level {
+    switch (level) {
+        case SDImageCacheMemoryPressureLevelNormal:
+            return 1;
+        case SDImageCacheMemoryPressureLevelModerate:
+            return MIN(MAX(self.moderateRatio, 0), 1);
+        default:
+            return MIN(MAX(self.criticalRatio, 0), 1);
+    }
+}
+
+// 在_queue中执行，当前的压力级别和前后台状态对应的比例，两者都有时取较小的
+- (double)currentRatio {
+    double ratio = [self ratioForLevel:self.pressureLevel];
+    if (_inBackground) {
+        ratio = MIN(ratio, MIN(MAX(self.backgroundRatio, 0), 1));
+    }
+    return ratio;
+}
+
+// 在_queue中执行，按照进入压力状态（或者进入后台）时的占用缩减到ratio，同时把预算缩小到ratio
+// 目标不按当前的占用计算，压力持续期间重复的信号不会越缩越小
+- (void)trimTier:(nonnull id<SDImageCacheMemoryTier>)tier toRatio:(double)ratio {
+    tier.budgetScale = ratio;
+    if (ratio >= 1) {
+        [_baselineCosts removeObjectForKey:tier];
+        return;
+    }
+    NSNumber *baselineCost = [_baselineCosts objectForKey:tier];
+    if (!baselineCost) {
+        baselineCost = @(tier.totalCost);
+        [_baselineCosts setObject:baselineCost forKey:tier];
+    }
+    [tier trimToCost:(NSUInteger)(baselineCost.unsignedIntegerValue * ratio) protectingObjectsUsedWithin:self.visibleInterval];
+}
+
+// 在_queue中执行
+- (void)applyPressureLevel:(SDImageCacheMemoryPressureLevel)level {
+    level = MIN(MAX(level, SDImageCacheMemoryPressureLevelNormal), SDImageCacheMemoryPressureLevelCritical);
+    SDImageCacheMemoryPressureLevel previousLevel = self.pressureLevel;
+    _signalGeneration += 1;
+    self.pressureLevel = level;
+
+    double ratio = [self currentRatio];
+    for (id<SDImageCacheMemoryTier> tier in [self tiers]) {
+        @autoreleasepool {
+            [self trimTier:tier toRatio:ratio];
+        }
+    }
+
+    NSTimeInterval recoveryInterval = self.recoveryInterval;
+    if (level != SDImageCacheMemoryPressureLevelNormal && recoveryInterval > 0) {
+        NSUInteger generation = _signalGeneration;
+        __weak __typeof(self) wself = self;
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(recoveryInterval * NSEC_PER_SEC)), _queue, ^{
+            __strong __typeof(wself) sself = wself;
+            if (sself && sself->_signalGeneration == generation) {
+                [sself applyPressureLevel:SDImageCacheMemoryPressureLevelNormal];
+            }
+        });
+    }
+
+    if (level != previousLevel) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [[NSNotificationCenter defaultCenter] postNotificationName:SDImageCacheMemoryPressureDidChangeNotification
+                                                                object:self
+                                                              userInfo:@{SDImageCacheMemoryPressureLevelKey : @(level)}];
+        });
+    }
+}
+
+@end
@@ -0,0 +1,110 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+#import "SDImageCacheMemoryGovernor.h"
+
+/**
+ * 内存缓存中对象的优先级，决定淘汰的顺序
+ */
+typedef NS_ENUM(NSInteger, SDImageCacheMemoryPriority) {
+    /**
+     * 默认的优先级，按LRU淘汰
+     */
+    SDImageCacheMemoryPriorityNormal = 0,
+    /**
+     * 同一个分片中所有普通优先级的对象都淘汰完之后才会淘汰，比如头像、界面元素，不会被快速滑动的列表挤出去
+     */
+    SDImageCacheMemoryPriorityHigh,
+    /**
+     * 固定在内存中，不会因为超过上限或者内存压力被淘汰，只能显式删除
+     * 仍然计入totalCost和count，固定的对象太多时其它对象会被全部淘汰
+     */
+    SDImageCacheMemoryPriorityPinned
+};
+
+/**
+ * 图片解码后实际占用的字节数：每一帧的行字节数乘以高度（包括行对齐的填充），同一个CGImage只算一次
+ * 没有CGImage时按照每个像素4个字节估算
+ */
+FOUNDATION_EXPORT NSUInteger SDImageCacheMemoryCostForImage(UIImage * _Nullable image);
+
+/**
+ * SDImageCacheMemoryStore 是SDImageCache的内存缓存，接口和NSCache相似，但是淘汰是确定的：
+ * key按照哈希值分到多个分片中，每个分片有自己的锁和LRU链表，并发的读写只在同一个分片中竞争；
+ * totalCostLimit和countLimit对所有分片一起生效，每次写入之后在所有分片中淘汰到上限以内（固定的对象超过上限时除外）。
+ * 每个分片中按优先级维护各自的LRU链表，淘汰时比较各个分片，先淘汰普通优先级中最久没用的对象，再淘汰高优先级的对象，固定的对象不会被淘汰。
+ * 单个对象的cost超过totalCostLimit时不会保存（固定的对象除外）。
+ *
+ * 被淘汰的对象在后台队列中释放，不会在调用者的线程中触发图片的dealloc。
+ * 内存压力由SDImageCacheMemoryGovernor处理，这个类不监听内存警告。
+ * 所有方法都是线程安全的。
+ */
+@interface SDImageCacheMemoryStore : NSObject <SDImageCacheMemoryTier>
+
+/** 名字，用于调试 */
+@property (copy, nonatomic, nullable) NSString *name;
+
+/** 所有对象的cost上限，为0时不限制 */
+@property (assign, atomic) NSUInteger totalCostLimit;
+
+/** 对象个数的上限，为0时不限制 */
+@property (assign, atomic) NSUInteger countLimit;
+
+/** 预算的缩放比例，默认为1.0，SDImageCacheMemoryGovernor在内存压力期间缩小这个比例，totalCostLimit和countLimit保持不变 */
+@property (assign, atomic) double budgetScale;
+
+/** 因为超过上限被淘汰时调用，count和cost是这一次淘汰的对象个数和总cost，在淘汰的线程中调用，不持有锁 */
+@property (copy, atomic, nullable) void (^evictionHandler)(NSUInteger count, NSUInteger cost);
+
+/** 当前所有对象的总cost */
+@property (assign, nonatomic, readonly) NSUInteger totalCost;
+
+/** 当前的对象个数 */
+@property (assign, nonatomic, readonly) NSUInteger count;
+
+/**
+ * @param shardCount 分片个数，会向上取整为2的幂，为0时使用默认值8。分片只影响锁的竞争，不影响上限
+ */
+- (nonnull instancetype)initWithShardCount:(NSUInteger)shardCount NS_DESIGNATED_INITIALIZER;
+
+/** 查询并把对象移到LRU链表的最前面 */
+- (nullable id)objectForKey:(nonnull id)key;
+
+/** 按照key当前的优先级（见setPriority:forKey:）保存，已经存在的对象会被替换 */
+- (void)setObject:(nullable id)object forKey:(nonnull id)key cost:(NSUInteger)cost;
+
+/** 按照指定的优先级保存，同时更新key的优先级 */
+- (void)setObject:(nullable id)object forKey:(nonnull id)key cost:(NSUInteger)cost priority:(SDImageCacheMemoryPriority)priority;
+
+- (void)removeObjectForKey:(nonnull id)key;
+
+- (void)removeAllObjects;
+
+/**
+ * 设置key的优先级，之后写入这个key时都使用这个优先级，对象不在缓存中时也会记住，
+ * 设置为SDImageCacheMemoryPriorityNormal时清除记录。对象被淘汰或者删除时记录一起清除（固定的除外），
+ * removeAllObjects清除所有记录
+ */
+- (void)setPriority:(SDImageCacheMemoryPriority)priority forKey:(nonnull id)key;
+
+/** key当前的优先级，没有设置过时为SDImageCacheMemoryPriorityNormal */
+- (SDImageCacheMemoryPriority)priorityForKey:(nonnull id)key;
+
+/**
+ * 按照淘汰顺序删除对象，直到总cost不超过cost，固定的对象不会被删除
+ */
+- (void)trimToCost:(NSUInteger)cost;
+
+/**
+ * 和trimToCost:一样，但是最近interval秒内读取或者写入过的对象也不会被删除
+ */
+- (void)trimToCost:(NSUInteger)cost protectingObjectsUsedWithin:(NSTimeInterval)interval;
+
+@end
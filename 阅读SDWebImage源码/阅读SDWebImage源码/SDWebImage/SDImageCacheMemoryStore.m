@@ -0,0 +1,440 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDImageCacheMemoryStore.h"
+#import "NSImage+WebCache.h"
+#import <stdatomic.h>
+
+#define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+#define UNLOCK(lock) dispatch_semaphore_signal(lock);
+
+static const NSUInteger kDefaultShardCount = 8;
+// 优先级的个数，每个优先级一条LRU链表
+static const NSUInteger kPriorityCount = SDImageCacheMemoryPriorityPinned + 1;
+
+NSUInteger SDImageCacheMemoryCostForImage(UIImage * _Nullable image) {
+    if (!image) {
+        return 0;
+    }
+    NSArray<UIImage *> *frames = image.images.count > 0 ? image.images : @[image];
+    NSUInteger cost = 0;
+    // 动画图片的帧可能共用同一个CGImage
+    CFMutableSetRef countedImages = frames.count > 1 ? CFSetCreateMutable(kCFAllocatorDefault, 0, NULL) : NULL;
+    for (UIImage *frame in frames) {
+        CGImageRef imageRef = frame.CGImage;
+        if (imageRef) {
+            if (countedImages) {
+                if (CFSetContainsValue(countedImages, imageRef)) {
+                    continue;
+                }
+                CFSetAddValue(countedImages, imageRef);
+            }
+            cost += CGImageGetBytesPerRow(imageRef) * CGImageGetHeight(imageRef);
+        } else {
+#if SD_MAC
+            cost += frame.size.width * frame.size.height * 4;
+#else
+            cost += frame.size.width * frame.size.height * frame.scale * frame.scale * 4;
+#endif
+        }
+    }
+    if (countedImages) {
+        CFRelease(countedImages);
+    }
+    return cost;
+}
+
+// 链表中的一个节点，由分片的字典持有，链表的指针不持有
+@interface SDImageCacheMemoryNode : NSObject {
+    @package
+    __unsafe_unretained SDImageCacheMemoryNode *_prev;
+    __unsafe_unretained SDImageCacheMemoryNode *_next;
+    id _key;
+    id _value;
+    NSUInteger _cost;
+    SDImageCacheMemoryPriority _priority;
+    // 最后一次读取或者写入的时间，内存压力下用来保护正在显示的对象
+    CFAbsoluteTime _accessTime;
+}
+@end
+
+@implementation SDImageCacheMemoryNode
+@end
+
+// 一个分片：字典加上每个优先级一条LRU链表，头部是最近使用的
+// 总cost和个数记在SDImageCacheMemoryStore上，上限对所有分片一起生效
+@interface SDImageCacheMemoryShard : NSObject {
+    @package
+    dispatch_semaphore_t _lock;
+    CFMutableDictionaryRef _nodes;
+    // 设置过优先级的key，只记录不是普通优先级的
+    NSMutableDictionary<id, NSNumber *> *_priorities;
+    __unsafe_unretained SDImageCacheMemoryNode *_heads[kPriorityCount];
+    __unsafe_unretained SDImageCacheMemoryNode *_tails[kPriorityCount];
+    _Atomic(NSUInteger) *_totalCost;
+    _Atomic(NSUInteger) *_count;
+}
+@end
+
+@implementation SDImageCacheMemoryShard
+
+- (nonnull instancetype)initWithTotalCost:(_Atomic(NSUInteger) *)totalCost count:(_Atomic(NSUInteger) *)count {
+    if ((self = [super init])) {
+        _totalCost = totalCost;
+        _count = count;
+        _lock = dispatch_semaphore_create(1);
+        _nodes = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+        _priorities = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    CFRelease(_nodes);
+}
+
+// 以下方法都需要在持有锁的情况下调用
+
+- (void)insertNodeAtHead:(SDImageCacheMemoryNode *)node {
+    NSInteger priority = node->_priority;
+    node->_prev = nil;
+    node->_next = _heads[priority];
+    node->_accessTime = CFAbsoluteTimeGetCurrent();
+    if (_heads[priority]) {
+        _heads[priority]->_prev = node;
+    } else {
+        _tails[priority] = node;
+    }
+    _heads[priority] = node;
+    atomic_fetch_add_explicit(_totalCost, node->_cost, memory_order_relaxed);
+    atomic_fetch_add_explicit(_count, 1, memory_order_relaxed);
+}
+
+- (void)unlinkNode:(SDImageCacheMemoryNode *)node {
+    NSInteger priority = node->_priority;
+    if (node->_prev) {
+        node->_prev->_next = node->_next;
+    } else {
+        _heads[priority] = node->_next;
+    }
+    if (node->_next) {
+        node->_next->_prev = node->_prev;
+    } else {
+        _tails[priority] = node->_prev;
+    }
+    node->_prev = nil;
+    node->_next = nil;
+    atomic_fetch_sub_explicit(_totalCost, node->_cost, memory_order_relaxed);
+    atomic_fetch_sub_explicit(_count, 1, memory_order_relaxed);
+}
+
+// 从字典和链表中删除，返回的节点由调用者持有，在锁外释放
+- (nullable SDImageCacheMemoryNode *)removeNodeForKey:(id)key {
+    SDImageCacheMemoryNode *node = (__bridge SDImageCacheMemoryNode *)CFDictionaryGetValue(_nodes, (__bridge const void *)key);
+    if (!node) {
+        return nil;
+    }
+    [self unlinkNode:node];
+    // 先持有再从字典中删除，否则字典释放之后node就没有了
+    SDImageCacheMemoryNode *removedNode = node;
+    CFDictionaryRemoveValue(_nodes, (__bridge const void *)key);
+    return removedNode;
+}
+
+// 对象被淘汰或者删除时调用，除了固定的key，优先级的记录和对象一起清除
+- (nullable SDImageCacheMemoryNode *)discardNodeForKey:(id)key {
+    SDImageCacheMemoryNode *node = [self removeNodeForKey:key];
+    if (node && node->_priority != SDImageCacheMemoryPriorityPinned) {
+        [_priorities removeObjectForKey:key];
+    }
+    return node;
+}
+
+// 这个分片中下一个应该淘汰的对象：优先级最低的链表中最久没用的，固定的对象不淘汰
+// protectedSince之后使用过的对象也不淘汰，链表按使用时间排序，尾部被保护时整条链表都被保护
+- (nullable SDImageCacheMemoryNode *)coldestNodeUsedBefore:(CFAbsoluteTime)protectedSince {
+    for (NSInteger priority = SDImageCacheMemoryPriorityNormal; priority < SDImageCacheMemoryPriorityPinned; priority++) {
+        SDImageCacheMemoryNode *tail = _tails[priority];
+        if (tail && tail->_accessTime < protectedSince) {
+            return tail;
+        }
+    }
+    return nil;
+}
+
+@end
+
+@implementation SDImageCacheMemoryStore {
+    NSArray<SDImageCacheMemoryShard *> *_shards;
+    // 分片个数是2的幂，用哈希值的高几位选择分片
+    unsigned _shardBits;
+    // 所有分片的总cost和个数，在分片的锁中修改
+    _Atomic(NSUInteger) _totalCost;
+    _Atomic(NSUInteger) _count;
+}
+
+- (nonnull instancetype)init {
+    return [self initWithShardCount:kDefaultShardCount];
+}
+
+- (nonnull instancetype)initWithShardCount:(NSUInteger)shardCount {
+    if ((self = [super init])) {
+        shardCount = shardCount > 0 ? shardCount : kDefaultShardCount;
+        _shardBits = 0;
+        while ((1UL << _shardBits) < shardCount && _shardBits < 8) {
+            _shardBits++;
+        }
+        NSMutableArray<SDImageCacheMemoryShard *> *shards = [NSMutableArray arrayWithCapacity:1UL << _shardBits];
+        for (NSUInteger i = 0; i < (1UL << _shardBits); i++) {
+            [shards addObject:[[SDImageCacheMemoryShard alloc] initWithTotalCost:&_totalCost count:&_count]];
+        }
+        _shards = [shards copy];
+        _budgetScale = 1;
+    }
+    return self;
+}
+
+- (nonnull SDImageCacheMemoryShard *)shardForKey:(nonnull id)key {
+    if (_shardBits == 0) {
+        return _shards[0];
+    }
+    // 乘以黄金分割常数打散哈希值，NSString的哈希值低位分布不均匀
+    uint64_t hash = (uint64_t)[key hash] * 0x9E3779B97F4A7C15ULL;
+    return _shards[(NSUInteger)(hash >> (64 - _shardBits))];
+}
+
+// 按budgetScale缩放之后的上限，为0时不限制
+- (NSUInteger)effectiveLimitForLimit:(NSUInteger)limit {
+    if (limit == 0) {
+        return NSUIntegerMax;
+    }
+    double scale = MIN(MAX(self.budgetScale, 0), 1);
+    return (NSUInteger)(limit * scale);
+}
+
+// 在所有分片中淘汰，直到总cost和个数都满足上限。每次比较各个分片的候选对象，
+// 淘汰优先级最低、最久没用的一个，所以比单个分片的上限大的对象也能保留，只要总量放得下。
+// 同一时间只持有一个分片的锁
+- (void)evictToCost:(NSUInteger)costLimit count:(NSUInteger)countLimit protectingSince:(CFAbsoluteTime)protectedSince into:(nonnull NSMutableArray<SDImageCacheMemoryNode *> *)evicted {
+    while (atomic_load_explicit(&_totalCost, memory_order_relaxed) > costLimit || atomic_load_explicit(&_count, memory_order_relaxed) > countLimit) {
+        SDImageCacheMemoryShard *victimShard = nil;
+        SDImageCacheMemoryPriority victimPriority = SDImageCacheMemoryPriorityPinned;
+        CFAbsoluteTime victimAccessTime = DBL_MAX;
+        for (SDImageCacheMemoryShard *shard in _shards) {
+            LOCK(shard->_lock);
+            SDImageCacheMemoryNode *node = [shard coldestNodeUsedBefore:protectedSince];
+            if (node && (node->_priority < victimPriority || (node->_priority == victimPriority && node->_accessTime < victimAccessTime))) {
+                victimShard = shard;
+                victimPriority = node->_priority;
+                victimAccessTime = node->_accessTime;
+            }
+            UNLOCK(shard->_lock);
+        }
+        if (!victimShard) {
+            // 剩下的都是固定的或者被保护的对象
+            break;
+        }
+        // 比较之后分片可能被修改过，重新取这个分片的候选对象
+        LOCK(victimShard->_lock);
+        SDImageCacheMemoryNode *node = [victimShard coldestNodeUsedBefore:protectedSince];
+        if (node) {
+            [evicted addObject:[victimShard discardNodeForKey:node->_key]];
+        }
+        UNLOCK(victimShard->_lock);
+    }
+}
+
+// 在后台释放被淘汰或者删除的对象，并通知evictionHandler
+- (void)releaseNodes:(nonnull NSArray<SDImageCacheMemoryNode *> *)nodes evicted:(BOOL)evicted {
+    if (nodes.count == 0) {
+        return;
+    }
+    if (evicted) {
+        void (^evictionHandler)(NSUInteger, NSUInteger) = self.evictionHandler;
+        if (evictionHandler) {
+            NSUInteger cost = 0;
+            for (SDImageCacheMemoryNode *node in nodes) {
+                cost += node->_cost;
+            }
+            evictionHandler(nodes.count, cost);
+        }
+    }
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+        // 在这里持有到最后，block释放时数组和对象一起释放
+        [nodes count];
+    });
+}
+
+#pragma mark - Access
+
+- (nullable id)objectForKey:(nonnull id)key {
+    if (!key) {
+        return nil;
+    }
+    SDImageCacheMemoryShard *shard = [self shardForKey:key];
+    LOCK(shard->_lock);
+    SDImageCacheMemoryNode *node = (__bridge SDImageCacheMemoryNode *)CFDictionaryGetValue(shard->_nodes, (__bridge const void *)key);
+    id value = nil;
+    if (node) {
+        value = node->_value;
+        if (shard->_heads[node->_priority] != node) {
+            [shard unlinkNode:node];
+            [shard insertNodeAtHead:node];
+        } else {
+            node->_accessTime = CFAbsoluteTimeGetCurrent();
+        }
+    }
+    UNLOCK(shard->_lock);
+    return value;
+}
+
+- (void)setObject:(nullable id)object forKey:(nonnull id)key cost:(NSUInteger)cost {
+    [self setObject:object forKey:key cost:cost priority:[self priorityForKey:key]];
+}
+
+- (void)setObject:(nullable id)object forKey:(nonnull id)key cost:(NSUInteger)cost priority:(SDImageCacheMemoryPriority)priority {
+    if (!key) {
+        return;
+    }
+    if (!object) {
+        [self removeObjectForKey:key];
+        return;
+    }
+    priority = MIN(MAX(priority, SDImageCacheMemoryPriorityNormal), SDImageCacheMemoryPriorityPinned);
+    if (priority != SDImageCacheMemoryPriorityPinned && cost > [self effectiveLimitForLimit:self.totalCostLimit]) {
+        // 单个对象就超过了整个上限，保存之后也会马上被淘汰，不要为了它把其它对象都挤出去
+        [self removeObjectForKey:key];
+        [self setPriority:priority forKey:key];
+        return;
+    }
+    SDImageCacheMemoryNode *node = [SDImageCacheMemoryNode new];
+    node->_key = key;
+    node->_value = object;
+    node->_cost = cost;
+    node->_priority = priority;
+
+    SDImageCacheMemoryShard *shard = [self shardForKey:key];
+    LOCK(shard->_lock);
+    SDImageCacheMemoryNode *previousNode = [shard removeNodeForKey:key];
+    CFDictionarySetValue(shard->_nodes, (__bridge const void *)key, (__bridge const void *)node);
+    [shard insertNodeAtHead:node];
+    if (priority == SDImageCacheMemoryPriorityNormal) {
+        [shard->_priorities removeObjectForKey:key];
+    } else {
+        shard->_priorities[key] = @(priority);
+    }
+    UNLOCK(shard->_lock);
+
+    if (previousNode) {
+        [self releaseNodes:@[previousNode] evicted:NO];
+    }
+    [self evictToLimits];
+}
+
+- (void)removeObjectForKey:(nonnull id)key {
+    if (!key) {
+        return;
+    }
+    SDImageCacheMemoryShard *shard = [self shardForKey:key];
+    LOCK(shard->_lock);
+    SDImageCacheMemoryNode *node = [shard discardNodeForKey:key];
+    UNLOCK(shard->_lock);
+    if (node) {
+        [self releaseNodes:@[node] evicted:NO];
+    }
+}
+
+- (void)removeAllObjects {
+    NSMutableArray<SDImageCacheMemoryNode *> *removed = [NSMutableArray array];
+    for (SDImageCacheMemoryShard *shard in _shards) {
+        LOCK(shard->_lock);
+        for (NSInteger priority = SDImageCacheMemoryPriorityNormal; priority < (NSInteger)kPriorityCount; priority++) {
+            while (shard->_tails[priority]) {
+                [removed addObject:[shard removeNodeForKey:shard->_tails[priority]->_key]];
+            }
+        }
+        [shard->_priorities removeAllObjects];
+        UNLOCK(shard->_lock);
+    }
+    [self releaseNodes:removed evicted:NO];
+}
+
+- (void)trimToCost:(NSUInteger)cost {
+    [self trimToCost:cost protectingObjectsUsedWithin:0];
+}
+
+- (void)trimToCost:(NSUInteger)cost protectingObjectsUsedWithin:(NSTimeInterval)interval {
+    CFAbsoluteTime protectedSince = interval > 0 ? CFAbsoluteTimeGetCurrent() - interval : DBL_MAX;
+    NSMutableArray<SDImageCacheMemoryNode *> *evicted = [NSMutableArray array];
+    [self evictToCost:cost count:NSUIntegerMax protectingSince:protectedSince into:evicted];
+    [self releaseNodes:evicted evicted:YES];
+}
+
+// 写入或者修改优先级之后淘汰到上限以内
+- (void)evictToLimits {
+    NSUInteger costLimit = [self effectiveLimitForLimit:self.totalCostLimit];
+    NSUInteger countLimit = [self effectiveLimitForLimit:self.countLimit];
+    if (atomic_load_explicit(&_totalCost, memory_order_relaxed) <= costLimit && atomic_load_explicit(&_count, memory_order_relaxed) <= countLimit) {
+        return;
+    }
+    NSMutableArray<SDImageCacheMemoryNode *> *evicted = [NSMutableArray array];
+    [self evictToCost:costLimit count:countLimit protectingSince:DBL_MAX into:evicted];
+    [self releaseNodes:evicted evicted:YES];
+}
+
+#pragma mark - Priority
+
+- (void)setPriority:(SDImageCacheMemoryPriority)priority forKey:(nonnull id)key {
+    if (!key) {
+        return;
+    }
+    priority = MIN(MAX(priority, SDImageCacheMemoryPriorityNormal), SDImageCacheMemoryPriorityPinned);
+    BOOL moved = NO;
+    SDImageCacheMemoryShard *shard = [self shardForKey:key];
+    LOCK(shard->_lock);
+    if (priority == SDImageCacheMemoryPriorityNormal) {
+        [shard->_priorities removeObjectForKey:key];
+    } else {
+        shard->_priorities[key] = @(priority);
+    }
+    // 已经在缓存中的对象移到新优先级的链表中，降级之后可能需要淘汰
+    SDImageCacheMemoryNode *node = (__bridge SDImageCacheMemoryNode *)CFDictionaryGetValue(shard->_nodes, (__bridge const void *)key);
+    if (node && node->_priority != priority) {
+        [shard unlinkNode:node];
+        node->_priority = priority;
+        [shard insertNodeAtHead:node];
+        moved = YES;
+    }
+    UNLOCK(shard->_lock);
+    if (moved) {
+        [self evictToLimits];
+    }
+}
+
+- (SDImageCacheMemoryPriority)priorityForKey:(nonnull id)key {
+    if (!key) {
+        return SDImageCacheMemoryPriorityNormal;
+    }
+    SDImageCacheMemoryShard *shard = [self shardForKey:key];
+    LOCK(shard->_lock);
+    SDImageCacheMemoryPriority priority = (SDImageCacheMemoryPriority)shard->_priorities[key].integerValue;
+    UNLOCK(shard->_lock);
+    return priority;
+}
+
+#pragma mark - Info
+
+- (NSUInteger)totalCost {
+    return atomic_load_explicit(&_totalCost, memory_order_relaxed);
+}
+
+- (NSUInteger)count {
+    return atomic_load_explicit(&_count, memory_order_relaxed);
+}
+
+@end
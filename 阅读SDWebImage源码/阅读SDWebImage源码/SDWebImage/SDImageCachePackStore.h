@@ -0,0 +1,69 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * SDImageCachePackStore 把小图片追加写入到只追加的segment文件中，而不是每张图片一个文件，
+ * 这样可以省掉每张小图片占用的文件系统块和inode，删除时也不需要逐个unlink。
+ *
+ * 每条记录的位置（segment编号和偏移）保存在磁盘索引中，这里只负责segment文件的读写。
+ * 写入和segment的管理需要在SDImageCache的ioQueue中调用，读取是线程安全的。
+ */
+@interface SDImageCachePackStore : NSObject
+
+/**
+ * 通过segment文件所在的目录来初始化
+ *
+ * @param directory      segment文件所在的目录
+ * @param maxSegmentSize 单个segment文件的最大尺寸，超过后会开始写入新的segment
+ */
+- (nonnull instancetype)initWithDirectory:(nonnull NSString *)directory maxSegmentSize:(NSUInteger)maxSegmentSize NS_DESIGNATED_INITIALIZER;
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+/**
+ * 追加写入一条记录
+ *
+ * @param data     图片数据
+ * @param fileName 缓存文件名，读取时用来校验记录
+ * @param segment  写入的segment编号
+ * @param offset   记录在segment中的偏移
+ *
+ * @return 是否写入成功
+ */
+- (BOOL)appendData:(nonnull NSData *)data
+       forFileName:(nonnull NSString *)fileName
+           segment:(nonnull uint32_t *)segment
+            offset:(nonnull uint64_t *)offset;
+
+/**
+ * 读取一条记录的数据，记录不存在或者校验失败时返回nil
+ */
+- (nullable NSData *)dataForFileName:(nonnull NSString *)fileName
+                             segment:(uint32_t)segment
+                              offset:(uint64_t)offset
+                              length:(NSUInteger)length;
+
+/** 已经写满、不会再追加的segment编号 */
+- (nonnull NSArray<NSNumber *> *)sealedSegments;
+
+/** segment文件的大小 */
+- (unsigned long long)sizeOfSegment:(uint32_t)segment;
+
+/** 删除一个segment文件 */
+- (void)removeSegment:(uint32_t)segment;
+
+/** 删除所有segment文件 */
+- (void)removeAllSegments;
+
+/** 一条记录除了图片数据之外额外占用的字节数 */
++ (NSUInteger)recordOverheadForFileName:(nonnull NSString *)fileName;
+
+@end
@@ -0,0 +1,206 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDImageCachePackStore.h"
+#import <fcntl.h>
+#import <unistd.h>
+#import <sys/stat.h>
+
+// 每条记录的格式：魔数(4字节) + 文件名长度(2字节) + 数据长度(4字节) + 文件名 + 数据
+static const uint32_t kPackRecordMagic = 0x53445052; // 'SDPR'
+static const NSUInteger kPackRecordHeaderLength = sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint32_t);
+static NSString * const kPackSegmentExtension = @"pack";
+
+@implementation SDImageCachePackStore {
+    NSString *_directory;
+    NSUInteger _maxSegmentSize;
+    // 当前正在追加写入的segment，0表示还没有准备好
+    uint32_t _activeSegment;
+    int _activeFileDescriptor;
+    unsigned long long _activeSize;
+}
+
+- (nonnull instancetype)initWithDirectory:(nonnull NSString *)directory maxSegmentSize:(NSUInteger)maxSegmentSize {
+    if ((self = [super init])) {
+        _directory = [directory copy];
+        _maxSegmentSize = maxSegmentSize;
+        _activeFileDescriptor = -1;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self closeActiveSegment];
+}
+
++ (NSUInteger)recordOverheadForFileName:(nonnull NSString *)fileName {
+    return kPackRecordHeaderLength + [fileName lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+}
+
+- (nonnull NSString *)pathForSegment:(uint32_t)segment {
+    NSString *fileName = [NSString stringWithFormat:@"%u.%@", segment, kPackSegmentExtension];
+    return [_directory stringByAppendingPathComponent:fileName];
+}
+
+// 目录中所有的segment编号，从小到大排列
+- (nonnull NSArray<NSNumber *> *)allSegments {
+    NSMutableArray<NSNumber *> *segments = [NSMutableArray array];
+    for (NSString *fileName in [[NSFileManager defaultManager] contentsOfDirectoryAtPath:_directory error:nil]) {
+        if (![fileName.pathExtension isEqualToString:kPackSegmentExtension]) {
+            continue;
+        }
+        long long segment = fileName.stringByDeletingPathExtension.longLongValue;
+        if (segment > 0 && segment <= UINT32_MAX) {
+            [segments addObject:@(segment)];
+        }
+    }
+    [segments sortUsingSelector:@selector(compare:)];
+    return segments;
+}
+
+#pragma mark - Writing
+
+- (void)closeActiveSegment {
+    if (_activeFileDescriptor >= 0) {
+        close(_activeFileDescriptor);
+        _activeFileDescriptor = -1;
+    }
+}
+
+// 打开当前的segment，最后一个segment已经写满时开始一个新的
+- (BOOL)prepareActiveSegmentIfNeeded {
+    if (_activeFileDescriptor >= 0 && _activeSize < _maxSegmentSize) {
+        return YES;
+    }
+
+    uint32_t segment = 0;
+    if (_activeSegment == 0) {
+        segment = [self allSegments].lastObject.unsignedIntValue;
+        if (segment == 0 || [self sizeOfSegment:segment] >= _maxSegmentSize) {
+            segment += 1;
+        }
+    } else {
+        segment = _activeSegment + 1;
+    }
+    [self closeActiveSegment];
+
+    [[NSFileManager defaultManager] createDirectoryAtPath:_directory withIntermediateDirectories:YES attributes:nil error:NULL];
+    int fd = open([self pathForSegment:segment].fileSystemRepresentation, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0) {
+        return NO;
+    }
+    struct stat info;
+    _activeSize = (fstat(fd, &info) == 0) ? (unsigned long long)info.st_size : 0;
+    _activeSegment = segment;
+    _activeFileDescriptor = fd;
+    return YES;
+}
+
+- (BOOL)appendData:(nonnull NSData *)data
+       forFileName:(nonnull NSString *)fileName
+           segment:(nonnull uint32_t *)segment
+            offset:(nonnull uint64_t *)offset {
+    NSData *nameData = [fileName dataUsingEncoding:NSUTF8StringEncoding];
+    if (data.length > UINT32_MAX || nameData.length > UINT16_MAX || ![self prepareActiveSegmentIfNeeded]) {
+        return NO;
+    }
+
+    uint32_t magic = kPackRecordMagic;
+    uint16_t nameLength = (uint16_t)nameData.length;
+    uint32_t dataLength = (uint32_t)data.length;
+    NSMutableData *record = [NSMutableData dataWithCapacity:kPackRecordHeaderLength + nameLength + dataLength];
+    [record appendBytes:&magic length:sizeof(magic)];
+    [record appendBytes:&nameLength length:sizeof(nameLength)];
+    [record appendBytes:&dataLength length:sizeof(dataLength)];
+    [record appendData:nameData];
+    [record appendData:data];
+
+    ssize_t written = write(_activeFileDescriptor, record.bytes, record.length);
+    if (written != (ssize_t)record.length) {
+        // 写了一半的记录会被当做垃圾留在segment中，不会被索引引用，压缩时会被清理掉
+        if (written > 0) {
+            _activeSize += written;
+        }
+        return NO;
+    }
+
+    *segment = _activeSegment;
+    *offset = _activeSize;
+    _activeSize += record.length;
+    return YES;
+}
+
+#pragma mark - Reading
+
+- (nullable NSData *)dataForFileName:(nonnull NSString *)fileName
+                             segment:(uint32_t)segment
+                              offset:(uint64_t)offset
+                              length:(NSUInteger)length {
+    int fd = open([self pathForSegment:segment].fileSystemRepresentation, O_RDONLY);
+    if (fd < 0) {
+        return nil;
+    }
+
+    NSData *nameData = [fileName dataUsingEncoding:NSUTF8StringEncoding];
+    NSUInteger headerLength = kPackRecordHeaderLength + nameData.length;
+    NSMutableData *headerData = [NSMutableData dataWithLength:headerLength];
+    uint8_t *header = headerData.mutableBytes;
+    NSData *data = nil;
+    if (pread(fd, header, headerLength, (off_t)offset) == (ssize_t)headerLength) {
+        uint32_t magic = 0;
+        uint16_t nameLength = 0;
+        uint32_t dataLength = 0;
+        memcpy(&magic, header, sizeof(magic));
+        memcpy(&nameLength, header + sizeof(magic), sizeof(nameLength));
+        memcpy(&dataLength, header + sizeof(magic) + sizeof(nameLength), sizeof(dataLength));
+        // 校验记录是否就是我们要找的那一条
+        if (magic == kPackRecordMagic && nameLength == nameData.length && dataLength == length
+            && memcmp(header + kPackRecordHeaderLength, nameData.bytes, nameLength) == 0) {
+            void *buffer = malloc(length);
+            if (buffer && pread(fd, buffer, length, (off_t)(offset + headerLength)) == (ssize_t)length) {
+                data = [NSData dataWithBytesNoCopy:buffer length:length freeWhenDone:YES];
+            } else {
+                free(buffer);
+            }
+        }
+    }
+    close(fd);
+    return data;
+}
+
+#pragma mark - Segments
+
+- (nonnull NSArray<NSNumber *> *)sealedSegments {
+    NSMutableArray<NSNumber *> *segments = [[self allSegments] mutableCopy];
+    [segments removeObject:@(_activeSegment)];
+    return segments;
+}
+
+- (unsigned long long)sizeOfSegment:(uint32_t)segment {
+    struct stat info;
+    if (stat([self pathForSegment:segment].fileSystemRepresentation, &info) != 0) {
+        return 0;
+    }
+    return (unsigned long long)info.st_size;
+}
+
+- (void)removeSegment:(uint32_t)segment {
+    if (segment == _activeSegment) {
+        [self closeActiveSegment];
+        _activeSegment = 0;
+    }
+    unlink([self pathForSegment:segment].fileSystemRepresentation);
+}
+
+- (void)removeAllSegments {
+    [self closeActiveSegment];
+    _activeSegment = 0;
+    [[NSFileManager defaultManager] removeItemAtPath:_directory error:nil];
+}
+
+@end
@@ -0,0 +1,38 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * SDImageCachePreview 负责生成和还原缓存图片的预览图（LQIP）：一张只有几个像素宽的缩略图，
+ * 以未压缩的像素保存，几百个字节，可以直接放在磁盘索引中。
+ * 还原时不需要解码，只是用这些像素创建一张图片，完整的图片还在读取和解码时可以先显示预览图。
+ *
+ * 格式：版本(1字节) + 宽(1字节) + 高(1字节) + 方向(1字节) + 原图以point为单位的宽和高(各2字节) + RGBA像素（预乘alpha）
+ *
+ * @note 只支持UIKit和WatchKit，macOS上总是返回nil
+ */
+@interface SDImageCachePreview : NSObject
+
+/**
+ * 把图片缩小成长边不超过maxPixelSize个像素的预览图
+ *
+ * @param maxPixelSize 预览图长边的像素数，不能超过64
+ * @return 动画图片、没有CGImage的图片或者maxPixelSize为0时返回nil
+ */
++ (nullable NSData *)previewDataForImage:(nonnull UIImage *)image maxPixelSize:(NSUInteger)maxPixelSize;
+
+/**
+ * 用预览数据创建图片，图片的size（point）和原图一样，显示时按照相同的contentMode拉伸
+ *
+ * @return 数据格式不正确时返回nil
+ */
++ (nullable UIImage *)imageWithPreviewData:(nonnull NSData *)data;
+
+@end
@@ -0,0 +1,120 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDImageCachePreview.h"
+
+static const uint8_t kPreviewVersion = 1;
+// 长边的像素数上限，保证预览数据能放进磁盘索引的一个字段中（64 * 64 * 4 = 16KB）
+static const NSUInteger kPreviewMaxPixelSize = 64;
+static const size_t kPreviewBytesPerPixel = 4;
+
+// 预览数据的头部，像素数据紧跟在后面
+typedef struct __attribute__((packed)) {
+    uint8_t version;
+    uint8_t width;
+    uint8_t height;
+    uint8_t orientation;
+    uint16_t pointWidth;
+    uint16_t pointHeight;
+} SDPreviewHeader;
+
+_Static_assert(sizeof(SDPreviewHeader) == 8, "SDPreviewHeader must be 8 bytes");
+
+#if SD_UIKIT || SD_WATCH
+static CGColorSpaceRef SDPreviewColorSpace(void) {
+    static CGColorSpaceRef colorSpace;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        colorSpace = CGColorSpaceCreateWithName(kCGColorSpaceSRGB);
+    });
+    return colorSpace;
+}
+
+static const CGBitmapInfo kPreviewBitmapInfo = kCGBitmapByteOrderDefault | kCGImageAlphaPremultipliedLast;
+#endif
+
+@implementation SDImageCachePreview
+
++ (nullable NSData *)previewDataForImage:(nonnull UIImage *)image maxPixelSize:(NSUInteger)maxPixelSize {
+#if SD_UIKIT || SD_WATCH
+    CGImageRef imageRef = image.CGImage;
+    if (!imageRef || image.images.count > 0 || maxPixelSize == 0) {
+        return nil;
+    }
+    size_t imageWidth = CGImageGetWidth(imageRef);
+    size_t imageHeight = CGImageGetHeight(imageRef);
+    if (imageWidth == 0 || imageHeight == 0) {
+        return nil;
+    }
+    // 保持宽高比，长边为maxPixelSize，短边至少1个像素，比原图还大的话保持原图大小
+    size_t longSide = MIN(MIN(maxPixelSize, kPreviewMaxPixelSize), MAX(imageWidth, imageHeight));
+    size_t width = MAX((size_t)1, (size_t)round((double)imageWidth * longSide / MAX(imageWidth, imageHeight)));
+    size_t height = MAX((size_t)1, (size_t)round((double)imageHeight * longSide / MAX(imageWidth, imageHeight)));
+
+    NSMutableData *data = [NSMutableData dataWithLength:sizeof(SDPreviewHeader) + width * height * kPreviewBytesPerPixel];
+    uint8_t *pixels = (uint8_t *)data.mutableBytes + sizeof(SDPreviewHeader);
+    CGContextRef context = CGBitmapContextCreate(pixels, width, height, 8, width * kPreviewBytesPerPixel, SDPreviewColorSpace(), kPreviewBitmapInfo);
+    if (!context) {
+        return nil;
+    }
+    // 预览图本身就是模糊的，中等质量的插值足够了，比高质量快得多
+    CGContextSetInterpolationQuality(context, kCGInterpolationMedium);
+    CGContextDrawImage(context, CGRectMake(0, 0, width, height), imageRef);
+    CGContextRelease(context);
+
+    SDPreviewHeader header = {0};
+    header.version = kPreviewVersion;
+    header.width = (uint8_t)width;
+    header.height = (uint8_t)height;
+    header.orientation = (uint8_t)image.imageOrientation;
+    header.pointWidth = (uint16_t)MIN(ceil(image.size.width), UINT16_MAX);
+    header.pointHeight = (uint16_t)MIN(ceil(image.size.height), UINT16_MAX);
+    memcpy(data.mutableBytes, &header, sizeof(header));
+    return data;
+#else
+    return nil;
+#endif
+}
+
++ (nullable UIImage *)imageWithPreviewData:(nonnull NSData *)data {
+#if SD_UIKIT || SD_WATCH
+    SDPreviewHeader header;
+    if (data.length < sizeof(header)) {
+        return nil;
+    }
+    memcpy(&header, data.bytes, sizeof(header));
+    size_t pixelLength = (size_t)header.width * header.height * kPreviewBytesPerPixel;
+    if (header.version != kPreviewVersion || header.width == 0 || header.height == 0
+        || data.length != sizeof(header) + pixelLength) {
+        return nil;
+    }
+    CGDataProviderRef provider = CGDataProviderCreateWithCFData((__bridge CFDataRef)[data subdataWithRange:NSMakeRange(sizeof(header), pixelLength)]);
+    if (!provider) {
+        return nil;
+    }
+    CGImageRef imageRef = CGImageCreate(header.width, header.height, 8, 8 * kPreviewBytesPerPixel, header.width * kPreviewBytesPerPixel,
+                                        SDPreviewColorSpace(), kPreviewBitmapInfo, provider, NULL, true, kCGRenderingIntentDefault);
+    CGDataProviderRelease(provider);
+    if (!imageRef) {
+        return nil;
+    }
+    // 方向旋转了90度时，point的宽高和像素的宽高是对调的
+    UIImageOrientation orientation = (UIImageOrientation)header.orientation;
+    BOOL rotated = orientation == UIImageOrientationLeft || orientation == UIImageOrientationRight
+                || orientation == UIImageOrientationLeftMirrored || orientation == UIImageOrientationRightMirrored;
+    CGFloat pointLength = rotated ? header.pointHeight : header.pointWidth;
+    CGFloat scale = pointLength > 0 ? header.width / pointLength : 1;
+    UIImage *image = [UIImage imageWithCGImage:imageRef scale:scale orientation:orientation];
+    CGImageRelease(imageRef);
+    return image;
+#else
+    return nil;
+#endif
+}
+
+@end
@@ -0,0 +1,59 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * SDImageCacheProcessCoordinator 协调共享同一个磁盘缓存目录的多个进程（主App、扩展、后台进程等）：
+ * 通过文件锁保证同一时间只有一个进程在淘汰和清理，通过darwin通知告诉其它进程磁盘缓存被修改了。
+ *
+ * 文件锁只在执行期间持有，不会在App挂起之后还占着（在App Group目录中持有文件锁挂起会被系统杀掉）。
+ * 所有方法都是线程安全的。
+ */
+@interface SDImageCacheProcessCoordinator : NSObject
+
+/**
+ * 其它进程修改了磁盘缓存时调用，在一个后台的串行队列中执行
+ * 自己发出的通知也会收到，处理需要是可以重复执行的
+ */
+@property (copy, nonatomic, nullable) SDWebImageNoParamsBlock changeHandler;
+
+/**
+ * 通过磁盘缓存目录来初始化，锁文件保存在这个目录中，目录不存在时会创建
+ */
+- (nonnull instancetype)initWithDirectory:(nonnull NSString *)directory NS_DESIGNATED_INITIALIZER;
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+/** 某个文件名是不是协调使用的锁文件，清空磁盘缓存时需要保留 */
+- (BOOL)isCoordinationFileName:(nonnull NSString *)fileName;
+
+/**
+ * 在持有跨进程的互斥锁时执行block，会阻塞等待其它进程，比如重建索引、清空磁盘缓存
+ */
+- (void)performExclusively:(nonnull SDWebImageNoParamsBlock)block;
+
+/**
+ * 尝试开始淘汰或者清理，不会阻塞，其它进程正在淘汰或者清理时返回NO
+ * 返回YES时，完成之后需要调用endEviction
+ */
+- (BOOL)tryBeginEviction;
+
+- (void)endEviction;
+
+/** 任意一个进程上次完成清理的时间（timeIntervalSinceReferenceDate），没有清理过时为0 */
+- (NSTimeInterval)lastCleanupDate;
+
+/** 记录清理完成的时间，需要在tryBeginEviction和endEviction之间调用 */
+- (void)markCleanupFinished;
+
+/** 通知其它进程磁盘缓存被修改了，短时间内的多次调用会合并成一个通知 */
+- (void)setNeedsNotifyChange;
+
+@end
@@ -0,0 +1,170 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDImageCacheProcessCoordinator.h"
+#import "SDImageCacheKey.h"
+#import <fcntl.h>
+#import <unistd.h>
+#import <notify.h>
+#import <sys/file.h>
+#import <sys/stat.h>
+#import <sys/time.h>
+
+#define LOCK(lock) dispatch_semaphore_wait(lock, DISPATCH_TIME_FOREVER);
+#define UNLOCK(lock) dispatch_semaphore_signal(lock);
+
+// 互斥锁文件，以点开头，遍历缓存目录时会被当做隐藏文件跳过
+static NSString * const kExclusiveLockFileName = @".coordination";
+// 淘汰锁文件，文件的修改时间就是上次完成清理的时间
+static NSString * const kEvictionLockFileName = @".eviction";
+// 修改通知的名字前缀，后面跟上缓存目录的摘要，不同目录的缓存互不影响
+static NSString * const kChangeNotificationPrefix = @"com.hackemist.SDWebImageCache.didChange.";
+// 修改之后等待这么久再发通知，期间的修改合并成一个通知
+static const NSTimeInterval kChangeNotificationCoalescingInterval = 0.05;
+
+@implementation SDImageCacheProcessCoordinator {
+    NSString *_directory;
+    int _exclusiveFileDescriptor;
+    int _evictionFileDescriptor;
+    // 文件锁是按打开的文件来算的，同一个进程的多个线程之间还需要自己互斥
+    dispatch_semaphore_t _exclusiveLock;
+    dispatch_semaphore_t _lock;
+    BOOL _evicting;
+    BOOL _notifyScheduled;
+    // 通知的名字、注册得到的token以及接收通知的队列
+    NSString *_notificationName;
+    int _notifyToken;
+    dispatch_queue_t _queue;
+}
+
+- (nonnull instancetype)initWithDirectory:(nonnull NSString *)directory {
+    if ((self = [super init])) {
+        _directory = [directory copy];
+        _exclusiveLock = dispatch_semaphore_create(1);
+        _lock = dispatch_semaphore_create(1);
+        _queue = dispatch_queue_create("com.hackemist.SDImageCacheProcessCoordinator", DISPATCH_QUEUE_SERIAL);
+
+        [[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:NULL];
+        _exclusiveFileDescriptor = open([directory stringByAppendingPathComponent:kExclusiveLockFileName].fileSystemRepresentation, O_RDWR | O_CREAT, 0644);
+        _evictionFileDescriptor = open([directory stringByAppendingPathComponent:kEvictionLockFileName].fileSystemRepresentation, O_RDWR | O_CREAT, 0644);
+
+        _notificationName = [kChangeNotificationPrefix stringByAppendingString:SDImageCacheFileNameForKey(directory)];
+        _notifyToken = NOTIFY_TOKEN_INVALID;
+        __weak __typeof(self) wself = self;
+        notify_register_dispatch(_notificationName.UTF8String, &_notifyToken, _queue, ^(int token) {
+            SDWebImageNoParamsBlock changeHandler = wself.changeHandler;
+            if (changeHandler) {
+                changeHandler();
+            }
+        });
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_notifyToken != NOTIFY_TOKEN_INVALID) {
+        notify_cancel(_notifyToken);
+    }
+    if (_exclusiveFileDescriptor >= 0) {
+        close(_exclusiveFileDescriptor);
+    }
+    if (_evictionFileDescriptor >= 0) {
+        close(_evictionFileDescriptor);
+    }
+}
+
+- (BOOL)isCoordinationFileName:(nonnull NSString *)fileName {
+    return [fileName isEqualToString:kExclusiveLockFileName] || [fileName isEqualToString:kEvictionLockFileName];
+}
+
+#pragma mark - Locks
+
+- (void)performExclusively:(nonnull SDWebImageNoParamsBlock)block {
+    LOCK(_exclusiveLock);
+    // 锁文件打不开（比如磁盘已满）时退化为只在进程内互斥
+    if (_exclusiveFileDescriptor >= 0) {
+        flock(_exclusiveFileDescriptor, LOCK_EX);
+    }
+    block();
+    if (_exclusiveFileDescriptor >= 0) {
+        flock(_exclusiveFileDescriptor, LOCK_UN);
+    }
+    UNLOCK(_exclusiveLock);
+}
+
+- (BOOL)tryBeginEviction {
+    LOCK(_lock);
+    if (_evicting) {
+        UNLOCK(_lock);
+        return NO;
+    }
+    if (_evictionFileDescriptor >= 0 && flock(_evictionFileDescriptor, LOCK_EX | LOCK_NB) != 0) {
+        UNLOCK(_lock);
+        return NO;
+    }
+    _evicting = YES;
+    UNLOCK(_lock);
+    return YES;
+}
+
+- (void)endEviction {
+    LOCK(_lock);
+    if (_evicting) {
+        if (_evictionFileDescriptor >= 0) {
+            flock(_evictionFileDescriptor, LOCK_UN);
+        }
+        _evicting = NO;
+    }
+    UNLOCK(_lock);
+}
+
+- (NSTimeInterval)lastCleanupDate {
+    struct stat info;
+    if (_evictionFileDescriptor < 0 || fstat(_evictionFileDescriptor, &info) != 0 || info.st_size == 0) {
+        return 0;
+    }
+    return info.st_mtimespec.tv_sec + info.st_mtimespec.tv_nsec / 1e9 - NSTimeIntervalSince1970;
+}
+
+- (void)markCleanupFinished {
+    if (_evictionFileDescriptor < 0) {
+        return;
+    }
+    // 写入一个字节，新建的空文件表示还没有清理过；修改时间更新为现在
+    if (lseek(_evictionFileDescriptor, 0, SEEK_END) == 0) {
+        uint8_t marker = 1;
+        write(_evictionFileDescriptor, &marker, sizeof(marker));
+    }
+    futimes(_evictionFileDescriptor, NULL);
+}
+
+#pragma mark - Notification
+
+- (void)setNeedsNotifyChange {
+    LOCK(_lock);
+    if (_notifyScheduled) {
+        UNLOCK(_lock);
+        return;
+    }
+    _notifyScheduled = YES;
+    UNLOCK(_lock);
+
+    __weak __typeof(self) wself = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kChangeNotificationCoalescingInterval * NSEC_PER_SEC)), _queue, ^{
+        __strong __typeof(wself) sself = wself;
+        if (!sself) {
+            return;
+        }
+        LOCK(sself->_lock);
+        sself->_notifyScheduled = NO;
+        UNLOCK(sself->_lock);
+        notify_post(sself->_notificationName.UTF8String);
+    });
+}
+
+@end
@@ -0,0 +1,129 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * 延迟分布的快照，由SDImageCacheLatencyRecorder生成，不会再改变
+ */
+@interface SDImageCacheLatencyHistogram : NSObject
+
+/** 记录的次数 */
+@property (assign, nonatomic, readonly) NSUInteger count;
+
+/** 所有记录的总时间，单位为秒 */
+@property (assign, nonatomic, readonly) NSTimeInterval totalDuration;
+
+/** 最短、最长和平均的时间，单位为秒，没有记录时都为0 */
+@property (assign, nonatomic, readonly) NSTimeInterval minimumDuration;
+@property (assign, nonatomic, readonly) NSTimeInterval maximumDuration;
+@property (assign, nonatomic, readonly) NSTimeInterval averageDuration;
+
+/**
+ * 某个百分位的时间，单位为秒，比如99返回P99，相对误差不超过1/16
+ *
+ * @param percentile 0到100之间
+ */
+- (NSTimeInterval)durationAtPercentile:(double)percentile;
+
+@end
+
+/**
+ * SDImageCacheLatencyRecorder 用HDR风格的直方图记录延迟：以微秒为单位，按2的幂分段，每段再线性分成16个桶，
+ * 只需要几KB的固定内存就能覆盖从1微秒到几天的范围，相对误差不超过1/16。
+ * 记录只是几次原子加法，不加锁，可以在任意线程中高频调用。
+ */
+@interface SDImageCacheLatencyRecorder : NSObject
+
+/** 记录一次时间，单位为秒，负数按0记录 */
+- (void)recordDuration:(NSTimeInterval)duration;
+
+/** 当前分布的快照，和并发的记录之间不是严格一致的 */
+- (nonnull SDImageCacheLatencyHistogram *)histogram;
+
+/** 清空所有记录 */
+- (void)reset;
+
+@end
+
+/**
+ * SDImageCache统计的计数器
+ */
+typedef NS_ENUM(NSUInteger, SDImageCacheStatisticsCounter) {
+    /** 内存命中的查询 */
+    SDImageCacheStatisticsCounterMemoryHits = 0,
+    /** 磁盘缓存（包括pack segment和保存的像素数据）命中的查询 */
+    SDImageCacheStatisticsCounterDiskHits,
+    /** 只读路径和只读缓存包命中的查询 */
+    SDImageCacheStatisticsCounterReadOnlyHits,
+    /** 所有缓存都没有命中的查询 */
+    SDImageCacheStatisticsCounterMisses,
+    /** 从磁盘读取的字节数 */
+    SDImageCacheStatisticsCounterBytesRead,
+    /** 写到磁盘的字节数 */
+    SDImageCacheStatisticsCounterBytesWritten,
+    /** 因为超过maxCacheSize（或者缓存组的预算）被淘汰的文件数 */
+    SDImageCacheStatisticsCounterDiskEvictions,
+    /** 因为超过maxCacheAge被清理的文件数 */
+    SDImageCacheStatisticsCounterExpiredFiles,
+    /** 因为超过maxMemoryCost或者maxMemoryCountLimit被淘汰出内存缓存的图片数 */
+    SDImageCacheStatisticsCounterMemoryEvictions
+};
+
+/**
+ * SDImageCache的统计信息快照，通过SDImageCache的statistics获取，不会再改变
+ * 命中和未命中只统计查询接口（queryCacheOperationForKey:、批量查询、imageFromCacheForKey:等），热点预加载不计入
+ */
+@interface SDImageCacheStatistics : NSObject
+
+@property (assign, nonatomic, readonly) NSUInteger memoryHits;
+@property (assign, nonatomic, readonly) NSUInteger diskHits;
+@property (assign, nonatomic, readonly) NSUInteger readOnlyHits;
+@property (assign, nonatomic, readonly) NSUInteger misses;
+
+/** 命中（内存、磁盘和只读）占所有查询的比例，没有查询时为0 */
+@property (assign, nonatomic, readonly) double hitRate;
+
+@property (assign, nonatomic, readonly) unsigned long long bytesRead;
+@property (assign, nonatomic, readonly) unsigned long long bytesWritten;
+
+@property (assign, nonatomic, readonly) NSUInteger diskEvictions;
+@property (assign, nonatomic, readonly) NSUInteger expiredFiles;
+@property (assign, nonatomic, readonly) NSUInteger memoryEvictions;
+
+/** 从发起磁盘读取到拿到数据的时间（批量读取时包括在IO后端中排队的时间） */
+@property (strong, nonatomic, readonly, nonnull) SDImageCacheLatencyHistogram *diskReadLatency;
+
+/** 把磁盘数据解码成图片的时间（包括shouldDecompressImages时的解压） */
+@property (strong, nonatomic, readonly, nonnull) SDImageCacheLatencyHistogram *decodeLatency;
+
+@end
+
+/**
+ * SDImageCacheStatisticsRecorder 收集SDImageCache的统计信息，所有计数都是原子操作，不加锁
+ * SDImageCache内部使用，自定义的缓存也可以用它来提供同样格式的统计
+ */
+@interface SDImageCacheStatisticsRecorder : NSObject
+
+/** 给某个计数器加上amount */
+- (void)incrementCounter:(SDImageCacheStatisticsCounter)counter by:(uint64_t)amount;
+
+/** 记录一次磁盘读取的时间，单位为秒 */
+- (void)recordDiskReadDuration:(NSTimeInterval)duration;
+
+/** 记录一次解码的时间，单位为秒 */
+- (void)recordDecodeDuration:(NSTimeInterval)duration;
+
+/** 当前统计信息的快照 */
+- (nonnull SDImageCacheStatistics *)snapshot;
+
+/** 清空所有统计，和并发的记录之间不是严格一致的 */
+- (void)reset;
+
+@end
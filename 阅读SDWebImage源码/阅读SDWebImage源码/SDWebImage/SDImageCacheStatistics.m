@@ -0,0 +1,240 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDImageCacheStatistics.h"
+#import <stdatomic.h>
+
+// 用作数组长度，需要是编译期常量
+enum {
+    // 每个2的幂的区间分成2^kSubBucketBits个桶，相对误差不超过1/16
+    kSubBucketBits = 4,
+    kSubBucketCount = 1 << kSubBucketBits,
+    // 最大能区分的值是2^(kMaxExponent+1)微秒（大约25天），更大的都放在最后一个桶中
+    kMaxExponent = 40,
+    kHistogramBucketCount = (kMaxExponent - kSubBucketBits + 2) * kSubBucketCount,
+    kStatisticsCounterCount = SDImageCacheStatisticsCounterMemoryEvictions + 1
+};
+
+// 小于kSubBucketCount的值一个值一个桶，更大的值按最高位分段，再按接下来的kSubBucketBits位分桶
+static NSUInteger SDHistogramBucketIndex(uint64_t value) {
+    if (value < kSubBucketCount) {
+        return (NSUInteger)value;
+    }
+    unsigned exponent = 63 - __builtin_clzll(value);
+    if (exponent > kMaxExponent) {
+        return kHistogramBucketCount - 1;
+    }
+    uint64_t mantissa = (value >> (exponent - kSubBucketBits)) & (kSubBucketCount - 1);
+    return (exponent - kSubBucketBits + 1) * kSubBucketCount + (NSUInteger)mantissa;
+}
+
+// 桶中间的值，用来估计百分位
+static uint64_t SDHistogramBucketValue(NSUInteger index) {
+    if (index < kSubBucketCount) {
+        return index;
+    }
+    NSUInteger block = index / kSubBucketCount;
+    uint64_t mantissa = index % kSubBucketCount;
+    uint64_t width = 1ULL << (block - 1);
+    return (((uint64_t)kSubBucketCount + mantissa) << (block - 1)) + width / 2;
+}
+
+@interface SDImageCacheLatencyHistogram ()
+
+@property (assign, nonatomic, readwrite) NSUInteger count;
+@property (assign, nonatomic, readwrite) NSTimeInterval totalDuration;
+@property (assign, nonatomic, readwrite) NSTimeInterval minimumDuration;
+@property (assign, nonatomic, readwrite) NSTimeInterval maximumDuration;
+
+// 拷贝kHistogramBucketCount个桶的计数，count取桶中计数的总和，保证百分位的计算和count一致
+- (nonnull instancetype)initWithBuckets:(const uint64_t *)buckets;
+
+@end
+
+@implementation SDImageCacheLatencyHistogram {
+    uint64_t _buckets[kHistogramBucketCount];
+}
+
+- (nonnull instancetype)initWithBuckets:(const uint64_t *)buckets {
+    if ((self = [super init])) {
+        uint64_t count = 0;
+        for (NSUInteger i = 0; i < kHistogramBucketCount; i++) {
+            _buckets[i] = buckets[i];
+            count += buckets[i];
+        }
+        _count = (NSUInteger)count;
+    }
+    return self;
+}
+
+- (NSTimeInterval)averageDuration {
+    return self.count > 0 ? self.totalDuration / self.count : 0;
+}
+
+- (NSTimeInterval)durationAtPercentile:(double)percentile {
+    if (self.count == 0) {
+        return 0;
+    }
+    percentile = MIN(MAX(percentile, 0), 100);
+    uint64_t target = MAX((uint64_t)ceil(percentile / 100 * self.count), 1);
+    uint64_t seen = 0;
+    for (NSUInteger i = 0; i < kHistogramBucketCount; i++) {
+        seen += _buckets[i];
+        if (seen >= target) {
+            NSTimeInterval duration = SDHistogramBucketValue(i) / 1e6;
+            return MIN(MAX(duration, self.minimumDuration), self.maximumDuration);
+        }
+    }
+    return self.maximumDuration;
+}
+
+@end
+
+@implementation SDImageCacheLatencyRecorder {
+    _Atomic uint64_t _buckets[kHistogramBucketCount];
+    _Atomic uint64_t _total;
+    _Atomic uint64_t _minimum;
+    _Atomic uint64_t _maximum;
+}
+
+- (nonnull instancetype)init {
+    if ((self = [super init])) {
+        [self reset];
+    }
+    return self;
+}
+
+- (void)recordDuration:(NSTimeInterval)duration {
+    uint64_t value = duration > 0 ? (uint64_t)(duration * 1e6) : 0;
+    atomic_fetch_add_explicit(&_buckets[SDHistogramBucketIndex(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&_total, value, memory_order_relaxed);
+    uint64_t minimum = atomic_load_explicit(&_minimum, memory_order_relaxed);
+    while (value < minimum && !atomic_compare_exchange_weak_explicit(&_minimum, &minimum, value, memory_order_relaxed, memory_order_relaxed)) {
+    }
+    uint64_t maximum = atomic_load_explicit(&_maximum, memory_order_relaxed);
+    while (value > maximum && !atomic_compare_exchange_weak_explicit(&_maximum, &maximum, value, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+- (nonnull SDImageCacheLatencyHistogram *)histogram {
+    uint64_t buckets[kHistogramBucketCount];
+    for (NSUInteger i = 0; i < kHistogramBucketCount; i++) {
+        buckets[i] = atomic_load_explicit(&_buckets[i], memory_order_relaxed);
+    }
+    SDImageCacheLatencyHistogram *histogram = [[SDImageCacheLatencyHistogram alloc] initWithBuckets:buckets];
+    if (histogram.count > 0) {
+        histogram.totalDuration = atomic_load_explicit(&_total, memory_order_relaxed) / 1e6;
+        histogram.minimumDuration = atomic_load_explicit(&_minimum, memory_order_relaxed) / 1e6;
+        histogram.maximumDuration = atomic_load_explicit(&_maximum, memory_order_relaxed) / 1e6;
+    }
+    return histogram;
+}
+
+- (void)reset {
+    for (NSUInteger i = 0; i < kHistogramBucketCount; i++) {
+        atomic_store_explicit(&_buckets[i], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&_total, 0, memory_order_relaxed);
+    atomic_store_explicit(&_minimum, UINT64_MAX, memory_order_relaxed);
+    atomic_store_explicit(&_maximum, 0, memory_order_relaxed);
+}
+
+@end
+
+@interface SDImageCacheStatistics ()
+
+@property (assign, nonatomic, readwrite) NSUInteger memoryHits;
+@property (assign, nonatomic, readwrite) NSUInteger diskHits;
+@property (assign, nonatomic, readwrite) NSUInteger readOnlyHits;
+@property (assign, nonatomic, readwrite) NSUInteger misses;
+@property (assign, nonatomic, readwrite) unsigned long long bytesRead;
+@property (assign, nonatomic, readwrite) unsigned long long bytesWritten;
+@property (assign, nonatomic, readwrite) NSUInteger diskEvictions;
+@property (assign, nonatomic, readwrite) NSUInteger expiredFiles;
+@property (assign, nonatomic, readwrite) NSUInteger memoryEvictions;
+@property (strong, nonatomic, readwrite, nonnull) SDImageCacheLatencyHistogram *diskReadLatency;
+@property (strong, nonatomic, readwrite, nonnull) SDImageCacheLatencyHistogram *decodeLatency;
+
+@end
+
+@implementation SDImageCacheStatistics
+
+- (double)hitRate {
+    NSUInteger hits = self.memoryHits + self.diskHits + self.readOnlyHits;
+    NSUInteger total = hits + self.misses;
+    return total > 0 ? (double)hits / total : 0;
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@: %p; memoryHits = %lu; diskHits = %lu; readOnlyHits = %lu; misses = %lu; bytesRead = %llu; bytesWritten = %llu; diskEvictions = %lu; expiredFiles = %lu; memoryEvictions = %lu; diskReadP99 = %.3fms; decodeP99 = %.3fms>",
+            NSStringFromClass([self class]), self,
+            (unsigned long)self.memoryHits, (unsigned long)self.diskHits, (unsigned long)self.readOnlyHits, (unsigned long)self.misses,
+            self.bytesRead, self.bytesWritten, (unsigned long)self.diskEvictions, (unsigned long)self.expiredFiles, (unsigned long)self.memoryEvictions,
+            [self.diskReadLatency durationAtPercentile:99] * 1000, [self.decodeLatency durationAtPercentile:99] * 1000];
+}
+
+@end
+
+@implementation SDImageCacheStatisticsRecorder {
+    _Atomic uint64_t _counters[kStatisticsCounterCount];
+    SDImageCacheLatencyRecorder *_diskReadLatency;
+    SDImageCacheLatencyRecorder *_decodeLatency;
+}
+
+- (nonnull instancetype)init {
+    if ((self = [super init])) {
+        _diskReadLatency = [SDImageCacheLatencyRecorder new];
+        _decodeLatency = [SDImageCacheLatencyRecorder new];
+    }
+    return self;
+}
+
+- (void)incrementCounter:(SDImageCacheStatisticsCounter)counter by:(uint64_t)amount {
+    if (counter >= kStatisticsCounterCount) {
+        return;
+    }
+    atomic_fetch_add_explicit(&_counters[counter], amount, memory_order_relaxed);
+}
+
+- (void)recordDiskReadDuration:(NSTimeInterval)duration {
+    [_diskReadLatency recordDuration:duration];
+}
+
+- (void)recordDecodeDuration:(NSTimeInterval)duration {
+    [_decodeLatency recordDuration:duration];
+}
+
+- (uint64_t)valueForCounter:(SDImageCacheStatisticsCounter)counter {
+    return atomic_load_explicit(&_counters[counter], memory_order_relaxed);
+}
+
+- (nonnull SDImageCacheStatistics *)snapshot {
+    SDImageCacheStatistics *statistics = [SDImageCacheStatistics new];
+    statistics.memoryHits = (NSUInteger)[self valueForCounter:SDImageCacheStatisticsCounterMemoryHits];
+    statistics.diskHits = (NSUInteger)[self valueForCounter:SDImageCacheStatisticsCounterDiskHits];
+    statistics.readOnlyHits = (NSUInteger)[self valueForCounter:SDImageCacheStatisticsCounterReadOnlyHits];
+    statistics.misses = (NSUInteger)[self valueForCounter:SDImageCacheStatisticsCounterMisses];
+    statistics.bytesRead = [self valueForCounter:SDImageCacheStatisticsCounterBytesRead];
+    statistics.bytesWritten = [self valueForCounter:SDImageCacheStatisticsCounterBytesWritten];
+    statistics.diskEvictions = (NSUInteger)[self valueForCounter:SDImageCacheStatisticsCounterDiskEvictions];
+    statistics.expiredFiles = (NSUInteger)[self valueForCounter:SDImageCacheStatisticsCounterExpiredFiles];
+    statistics.memoryEvictions = (NSUInteger)[self valueForCounter:SDImageCacheStatisticsCounterMemoryEvictions];
+    statistics.diskReadLatency = [_diskReadLatency histogram];
+    statistics.decodeLatency = [_decodeLatency histogram];
+    return statistics;
+}
+
+- (void)reset {
+    for (NSUInteger i = 0; i < kStatisticsCounterCount; i++) {
+        atomic_store_explicit(&_counters[i], 0, memory_order_relaxed);
+    }
+    [_diskReadLatency reset];
+    [_decodeLatency reset];
+}
+
+@end
@@ -0,0 +1,47 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * SDImageCacheValidators 保存一张缓存图片的HTTP验证信息（ETag、Last-Modified）和新鲜度（过期时间），
+ * 保存在磁盘索引中对应的记录上。有了它们，刷新缓存时可以发送条件请求，服务器返回304时只需要传输响应头。
+ */
+@interface SDImageCacheValidators : NSObject <NSCopying>
+
+/** 响应头中的ETag，用于If-None-Match */
+@property (copy, nonatomic, nullable) NSString *entityTag;
+
+/** 响应头中的Last-Modified，用于If-Modified-Since */
+@property (copy, nonatomic, nullable) NSString *lastModified;
+
+/** 在这个时间之前缓存的图片是新鲜的，不需要重新验证，nil表示总是需要重新验证 */
+@property (strong, nonatomic, nullable) NSDate *expirationDate;
+
+/** 是否还在新鲜期内 */
+@property (assign, nonatomic, readonly, getter=isFresh) BOOL fresh;
+
+/**
+ * 从响应中解析验证信息和新鲜度
+ * 新鲜度按照Cache-Control的max-age、Expires的顺序计算，都没有的话按照Last-Modified做启发式估计（距今时间的10%），
+ * Cache-Control中有no-cache或者no-store时总是需要重新验证
+ *
+ * @return 不是HTTP响应，或者响应中没有ETag、Last-Modified和过期时间时返回nil
+ */
++ (nullable instancetype)validatorsWithResponse:(nullable NSURLResponse *)response;
+
+/**
+ * 收到304之后更新：响应中新的验证信息和新鲜度覆盖旧的，响应中没有的验证信息保留旧的
+ */
+- (nonnull instancetype)validatorsByUpdatingWithResponse:(nullable NSURLResponse *)response;
+
+/** 条件请求需要带上的请求头（If-None-Match、If-Modified-Since），没有验证信息时返回空字典 */
+- (nonnull NSDictionary<NSString *, NSString *> *)conditionalRequestHeaders;
+
+@end
@@ -0,0 +1,135 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDImageCacheValidators.h"
+
+// 没有明确的过期时间时，启发式的新鲜期是Last-Modified距今时间的这个比例（RFC 7234 4.2.2）
+static const double kHeuristicFreshnessFactor = 0.1;
+
+// HTTP响应头的名字不区分大小写
+static NSString *SDHTTPHeaderValue(NSHTTPURLResponse *response, NSString *field) {
+    NSDictionary *headers = response.allHeaderFields;
+    NSString *value = headers[field];
+    if (value) {
+        return value;
+    }
+    for (NSString *name in headers) {
+        if ([name caseInsensitiveCompare:field] == NSOrderedSame) {
+            return headers[name];
+        }
+    }
+    return nil;
+}
+
+// 解析HTTP日期（RFC 1123格式），NSDateFormatter在iOS 7之后是线程安全的
+static NSDate *SDHTTPDate(NSString *string) {
+    if (!string) {
+        return nil;
+    }
+    static NSDateFormatter *formatter;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        formatter = [NSDateFormatter new];
+        formatter.locale = [NSLocale localeWithLocaleIdentifier:@"en_US_POSIX"];
+        formatter.timeZone = [NSTimeZone timeZoneWithAbbreviation:@"GMT"];
+        formatter.dateFormat = @"EEE, dd MMM yyyy HH:mm:ss zzz";
+    });
+    return [formatter dateFromString:string];
+}
+
+@implementation SDImageCacheValidators
+
++ (nullable instancetype)validatorsWithResponse:(nullable NSURLResponse *)response {
+    if (![response isKindOfClass:[NSHTTPURLResponse class]]) {
+        return nil;
+    }
+    SDImageCacheValidators *validators = [self new];
+    [validators updateWithResponse:(NSHTTPURLResponse *)response];
+    // 没有任何验证信息和新鲜度的响应不需要保存
+    if (!validators.entityTag && !validators.lastModified && !validators.expirationDate) {
+        return nil;
+    }
+    return validators;
+}
+
+- (nonnull instancetype)validatorsByUpdatingWithResponse:(nullable NSURLResponse *)response {
+    SDImageCacheValidators *validators = [self copy];
+    if ([response isKindOfClass:[NSHTTPURLResponse class]]) {
+        [validators updateWithResponse:(NSHTTPURLResponse *)response];
+    }
+    return validators;
+}
+
+- (void)updateWithResponse:(NSHTTPURLResponse *)response {
+    NSString *entityTag = SDHTTPHeaderValue(response, @"ETag");
+    if (entityTag) {
+        self.entityTag = entityTag;
+    }
+    NSString *lastModified = SDHTTPHeaderValue(response, @"Last-Modified");
+    if (lastModified) {
+        self.lastModified = lastModified;
+    }
+    self.expirationDate = [self expirationDateForResponse:response];
+}
+
+- (nullable NSDate *)expirationDateForResponse:(NSHTTPURLResponse *)response {
+    NSDate *now = [NSDate date];
+    NSDate *responseDate = SDHTTPDate(SDHTTPHeaderValue(response, @"Date")) ?: now;
+
+    NSString *cacheControl = SDHTTPHeaderValue(response, @"Cache-Control").lowercaseString;
+    for (NSString *component in [cacheControl componentsSeparatedByString:@","]) {
+        NSString *directive = [component stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+        if ([directive isEqualToString:@"no-cache"] || [directive isEqualToString:@"no-store"]) {
+            return nil;
+        }
+    }
+    for (NSString *component in [cacheControl componentsSeparatedByString:@","]) {
+        NSString *directive = [component stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+        if ([directive hasPrefix:@"max-age="]) {
+            return [now dateByAddingTimeInterval:MAX([directive substringFromIndex:8].doubleValue, 0)];
+        }
+    }
+
+    // Expires是服务器的时间，按照和Date的差值换算成本地时间
+    NSDate *expires = SDHTTPDate(SDHTTPHeaderValue(response, @"Expires"));
+    if (expires) {
+        return [now dateByAddingTimeInterval:MAX([expires timeIntervalSinceDate:responseDate], 0)];
+    }
+
+    NSDate *lastModified = SDHTTPDate(self.lastModified);
+    if (lastModified) {
+        NSTimeInterval age = MAX([responseDate timeIntervalSinceDate:lastModified], 0);
+        return [now dateByAddingTimeInterval:age * kHeuristicFreshnessFactor];
+    }
+    return nil;
+}
+
+- (BOOL)isFresh {
+    return self.expirationDate && self.expirationDate.timeIntervalSinceNow > 0;
+}
+
+- (nonnull NSDictionary<NSString *, NSString *> *)conditionalRequestHeaders {
+    NSMutableDictionary<NSString *, NSString *> *headers = [NSMutableDictionary dictionary];
+    if (self.entityTag) {
+        headers[@"If-None-Match"] = self.entityTag;
+    }
+    if (self.lastModified) {
+        headers[@"If-Modified-Since"] = self.lastModified;
+    }
+    return headers;
+}
+
+- (id)copyWithZone:(NSZone *)zone {
+    SDImageCacheValidators *validators = [[[self class] allocWithZone:zone] init];
+    validators.entityTag = self.entityTag;
+    validators.lastModified = self.lastModified;
+    validators.expirationDate = self.expirationDate;
+    return validators;
+}
+
+@end
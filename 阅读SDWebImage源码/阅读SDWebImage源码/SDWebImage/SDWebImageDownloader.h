@@ -74,6 +74,12 @@ typedef void(^SDWebImageDownloaderProgressBlock)(NSInteger receivedSize, NSInteg
 
 typedef void(^SDWebImageDownloaderCompletedBlock)(UIImage * _Nullable image, NSData * _Nullable data, NSError * _Nullable error, BOOL finished);
 
+/**
+ * 和SDWebImageDownloaderCompletedBlock一样，另外带上服务器的响应，可以从中取得状态码和缓存相关的响应头
+ * 条件请求收到304时image、data和error都为nil，response的状态码为304
+ */
+typedef void(^SDWebImageDownloaderResponseCompletedBlock)(UIImage * _Nullable image, NSData * _Nullable data, NSURLResponse * _Nullable response, NSError * _Nullable error, BOOL finished);
+
 typedef NSDictionary<NSString *, NSString *> SDHTTPHeadersDictionary;
 typedef NSMutableDictionary<NSString *, NSString *> SDHTTPHeadersMutableDictionary;
 
@@ -212,6 +218,35 @@ typedef SDHTTPHeadersDictionary * _Nullable (^SDWebImageDownloaderHeadersFilterB
                                                   progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
                                                  completed:(nullable SDWebImageDownloaderCompletedBlock)completedBlock;
 
+/**
+ * 下载图片，可以附加条件请求头（If-None-Match、If-Modified-Since）来重新验证已经缓存的图片
+ * 带条件请求头时不使用NSURLCache，服务器返回304时completedBlock的image、data和error都为nil，
+ * 可以通过response的状态码区分，这时应该继续使用缓存中的图片
+ *
+ * @param conditionalHeaders 条件请求头，一般来自SDImageCacheValidators的conditionalRequestHeaders，nil表示普通请求
+ * @param completedBlock     下载完成时调用，比SDWebImageDownloaderCompletedBlock多一个response参数
+ *
+ * @see downloadImageWithURL:options:progress:completed:
+ */
+- (nullable SDWebImageDownloadToken *)downloadImageWithURL:(nullable NSURL *)url
+                                                   options:(SDWebImageDownloaderOptions)options
+                                        conditionalHeaders:(nullable SDHTTPHeadersDictionary *)conditionalHeaders
+                                                  progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
+                                                 completed:(nullable SDWebImageDownloaderResponseCompletedBlock)completedBlock;
+
+/**
+ * 和downloadImageWithURL:options:conditionalHeaders:progress:completed:一样，另外指定合并下载用的key
+ * SDWebImageManager没有cacheKeyFilter时传入它为这个url创建的SDImageCacheKey，哈希值和摘要不需要再计算一次
+ *
+ * @param operationKey 同一个operationKey的请求合并成一个下载，必须和url.absoluteString相同，nil时由url生成
+ */
+- (nullable SDWebImageDownloadToken *)downloadImageWithURL:(nullable NSURL *)url
+                                                   options:(SDWebImageDownloaderOptions)options
+                                              operationKey:(nullable NSString *)operationKey
+                                        conditionalHeaders:(nullable SDHTTPHeadersDictionary *)conditionalHeaders
+                                                  progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
+                                                 completed:(nullable SDWebImageDownloaderResponseCompletedBlock)completedBlock;
+
 /**
  * Cancels a download that was previously queued using -downloadImageWithURL:options:progress:completed:
  *
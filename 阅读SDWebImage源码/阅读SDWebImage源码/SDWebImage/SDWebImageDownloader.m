@@ -8,8 +8,18 @@
 
 #import "SDWebImageDownloader.h"
 #import "SDWebImageDownloaderOperation.h"
+#import "SDImageCacheKey.h"
 #import <ImageIO/ImageIO.h>
 
+@interface SDWebImageDownloadToken ()
+
+// token对应的operation和它在URLOperations中的key，取消时直接使用，
+// 同一个URL的普通请求和条件请求是两个operation，不能再按URL查找
+@property (weak, nonatomic, nullable) SDWebImageDownloaderOperation *downloadOperation;
+@property (strong, nonatomic, nullable) SDImageCacheKey *operationKey;
+
+@end
+
 @implementation SDWebImageDownloadToken
 @end
 
@@ -19,7 +29,8 @@
 @property (strong, nonatomic, nonnull) NSOperationQueue *downloadQueue;
 @property (weak, nonatomic, nullable) NSOperation *lastAddedOperation;
 @property (assign, nonatomic, nullable) Class operationClass;
-@property (strong, nonatomic, nonnull) NSMutableDictionary<NSURL *, SDWebImageDownloaderOperation *> *URLOperations;
+// 用url.absoluteString对应的SDImageCacheKey作为去重的key，哈希值只计算一次，比较时先比较摘要
+@property (strong, nonatomic, nonnull) NSMutableDictionary<SDImageCacheKey *, SDWebImageDownloaderOperation *> *URLOperations;
 @property (strong, nonatomic, nullable) SDHTTPHeadersMutableDictionary *HTTPHeaders;
 // This queue is used to serialize the handling of the network responses of all the download operation in a single queue
 @property (SDDispatchQueueSetterSementics, nonatomic, nullable) dispatch_queue_t barrierQueue;
@@ -143,9 +154,33 @@
                                                    options:(SDWebImageDownloaderOptions)options
                                                   progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
                                                  completed:(nullable SDWebImageDownloaderCompletedBlock)completedBlock {
+    SDWebImageDownloaderResponseCompletedBlock responseCompletedBlock = nil;
+    if (completedBlock) {
+        responseCompletedBlock = ^(UIImage *image, NSData *data, NSURLResponse *response, NSError *error, BOOL finished) {
+            completedBlock(image, data, error, finished);
+        };
+    }
+    return [self downloadImageWithURL:url options:options conditionalHeaders:nil progress:progressBlock completed:responseCompletedBlock];
+}
+
+- (nullable SDWebImageDownloadToken *)downloadImageWithURL:(nullable NSURL *)url
+                                                   options:(SDWebImageDownloaderOptions)options
+                                        conditionalHeaders:(nullable SDHTTPHeadersDictionary *)conditionalHeaders
+                                                  progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
+                                                 completed:(nullable SDWebImageDownloaderResponseCompletedBlock)completedBlock {
+    return [self downloadImageWithURL:url options:options operationKey:nil conditionalHeaders:conditionalHeaders progress:progressBlock completed:completedBlock];
+}
+
+- (nullable SDWebImageDownloadToken *)downloadImageWithURL:(nullable NSURL *)url
+                                                   options:(SDWebImageDownloaderOptions)options
+                                              operationKey:(nullable NSString *)operationKey
+                                        conditionalHeaders:(nullable SDHTTPHeadersDictionary *)conditionalHeaders
+                                                  progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
+                                                 completed:(nullable SDWebImageDownloaderResponseCompletedBlock)completedBlock {
     __weak SDWebImageDownloader *wself = self;
+    BOOL conditional = conditionalHeaders.count > 0;
 
-    return [self addProgressCallback:progressBlock completedBlock:completedBlock forURL:url createCallback:^SDWebImageDownloaderOperation *{
+    return [self addProgressCallback:progressBlock completedBlock:completedBlock forURL:url operationKey:operationKey conditional:conditional createCallback:^SDWebImageDownloaderOperation *{
         __strong __typeof (wself) sself = wself;
         NSTimeInterval timeoutInterval = sself.downloadTimeout;
         if (timeoutInterval == 0.0) {
@@ -153,8 +188,9 @@
         }
 
         // In order to prevent from potential duplicate caching (NSURLCache + SDImageCache) we disable the cache for image requests if told otherwise
+        // 条件请求需要由服务器来判断，不能被NSURLCache拦截
         NSURLRequestCachePolicy cachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
-        if (options & SDWebImageDownloaderUseNSURLCache) {
+        if ((options & SDWebImageDownloaderUseNSURLCache) && !conditional) {
             if (options & SDWebImageDownloaderIgnoreCachedResponse) {
                 cachePolicy = NSURLRequestReturnCacheDataDontLoad;
             } else {
@@ -172,6 +208,9 @@
         else {
             request.allHTTPHeaderFields = sself.HTTPHeaders;
         }
+        [conditionalHeaders enumerateKeysAndObjectsUsingBlock:^(NSString *field, NSString *value, BOOL *stop) {
+            [request setValue:value forHTTPHeaderField:field];
+        }];
         SDWebImageDownloaderOperation *operation = [[sself.operationClass alloc] initWithRequest:request inSession:sself.session options:options];
         operation.shouldDecompressImages = sself.shouldDecompressImages;
         
@@ -200,48 +239,70 @@
 
 - (void)cancel:(nullable SDWebImageDownloadToken *)token {
     dispatch_barrier_async(self.barrierQueue, ^{
-        SDWebImageDownloaderOperation *operation = self.URLOperations[token.url];
+        SDWebImageDownloaderOperation *operation = token.downloadOperation;
+        if (!operation) {
+            return;
+        }
         BOOL canceled = [operation cancel:token.downloadOperationCancelToken];
-        if (canceled) {
-            [self.URLOperations removeObjectForKey:token.url];
+        // URLOperations中的可能已经是同一个URL的另一个operation
+        if (canceled && token.operationKey && self.URLOperations[token.operationKey] == operation) {
+            [self.URLOperations removeObjectForKey:token.operationKey];
         }
     });
 }
 
 - (nullable SDWebImageDownloadToken *)addProgressCallback:(SDWebImageDownloaderProgressBlock)progressBlock
-                                           completedBlock:(SDWebImageDownloaderCompletedBlock)completedBlock
+                                           completedBlock:(SDWebImageDownloaderResponseCompletedBlock)completedBlock
                                                    forURL:(nullable NSURL *)url
+                                             operationKey:(nullable NSString *)key
+                                              conditional:(BOOL)conditional
                                            createCallback:(SDWebImageDownloaderOperation *(^)())createCallback {
     // The URL will be used as the key to the callbacks dictionary so it cannot be nil. If it is nil immediately call the completed block with no image or data.
     if (url == nil) {
         if (completedBlock != nil) {
-            completedBlock(nil, nil, nil, NO);
+            completedBlock(nil, nil, nil, nil, NO);
         }
         return nil;
     }
 
     __block SDWebImageDownloadToken *token = nil;
+    // 已经是SDImageCacheKey时直接使用，否则从url生成一次，之后取消时使用token上保存的key
+    SDImageCacheKey *operationKey = [SDImageCacheKey keyWithString:key ?: url.absoluteString];
 
     dispatch_barrier_sync(self.barrierQueue, ^{
-        SDWebImageDownloaderOperation *operation = self.URLOperations[url];
+        SDWebImageDownloaderOperation *operation = self.URLOperations[operationKey];
+        // 条件请求可能只会得到304，不能满足需要完整图片的普通请求，这时单独再发一个请求
+        if (operation && !conditional && [operation respondsToSelector:@selector(isConditionalRequest)] && operation.isConditionalRequest) {
+            operation = nil;
+        }
         if (!operation) {
             operation = createCallback();
-            self.URLOperations[url] = operation;
+            self.URLOperations[operationKey] = operation;
 
             __weak SDWebImageDownloaderOperation *woperation = operation;
             operation.completionBlock = ^{
               SDWebImageDownloaderOperation *soperation = woperation;
               if (!soperation) return;
-              if (self.URLOperations[url] == soperation) {
-                  [self.URLOperations removeObjectForKey:url];
+              if (self.URLOperations[operationKey] == soperation) {
+                  [self.URLOperations removeObjectForKey:operationKey];
               };
             };
         }
-        id downloadOperationCancelToken = [operation addHandlersForProgress:progressBlock completed:completedBlock];
+        SDWebImageDownloaderCompletedBlock operationCompletedBlock = nil;
+        if (completedBlock) {
+            // operation结束时（reset）会清空回调，这里对operation的强引用不会一直存在
+            operationCompletedBlock = ^(UIImage *image, NSData *data, NSError *error, BOOL finished) {
+                NSURLResponse *response = [operation respondsToSelector:@selector(response)] ? operation.response : nil;
+                completedBlock(image, data, response, error, finished);
+            };
+        }
+        id downloadOperationCancelToken = [operation addHandlersForProgress:progressBlock completed:operationCompletedBlock];
 
         token = [SDWebImageDownloadToken new];
         token.url = url;
         token.downloadOperationCancelToken = downloadOperationCancelToken;
+        token.downloadOperation = operation;
+        token.operationKey = operationKey;
     });
 
     return token;
@@ -81,6 +81,17 @@ extern NSString * _Nonnull const SDWebImageDownloadFinishNotification;
  */
 @property (strong, nonatomic, nullable) NSURLResponse *response;
 
+/**
+ * 请求中是否带有If-None-Match或者If-Modified-Since，也就是是否是一个重新验证缓存的条件请求
+ */
+@property (assign, nonatomic, readonly, getter = isConditionalRequest) BOOL conditionalRequest;
+
+/**
+ * 条件请求收到了'304 Not Modified'，这时completed block的image、imageData和error都为nil，finished为YES
+ * 不是条件请求时，304仍然被当做错误
+ */
+@property (assign, nonatomic, readonly, getter = isNotModified) BOOL notModified;
+
 /**
  *  Initializes a `SDWebImageDownloaderOperation` object
  *
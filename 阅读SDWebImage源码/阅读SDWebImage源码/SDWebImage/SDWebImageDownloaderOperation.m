@@ -30,6 +30,7 @@ typedef NSMutableDictionary<NSString *, id> SDCallbacksDictionary;
 @property (assign, nonatomic, getter = isExecuting) BOOL executing;
 @property (assign, nonatomic, getter = isFinished) BOOL finished;
 @property (strong, nonatomic, nullable) NSMutableData *imageData;
+@property (assign, nonatomic, readwrite, getter = isNotModified) BOOL notModified;
 
 // This is weak because it is injected by whoever manages this session. If this gets nil-ed out, we won't be able to run
 // the task associated with this operation
@@ -72,6 +73,8 @@ typedef NSMutableDictionary<NSString *, id> SDCallbacksDictionary;
         _executing = NO;
         _finished = NO;
         _expectedSize = 0;
+        _conditionalRequest = ([request valueForHTTPHeaderField:@"If-None-Match"] != nil
+                               || [request valueForHTTPHeaderField:@"If-Modified-Since"] != nil);
         _unownedSession = session;
         _barrierQueue = dispatch_queue_create("com.hackemist.SDWebImageDownloaderOperationBarrierQueue", DISPATCH_QUEUE_CONCURRENT);
     }
@@ -270,6 +273,14 @@ didReceiveResponse:(NSURLResponse *)response
             [[NSNotificationCenter defaultCenter] postNotificationName:SDWebImageDownloadReceiveResponseNotification object:self];
         });
     }
+    else if (((NSHTTPURLResponse *)response).statusCode == 304 && self.isConditionalRequest) {
+        // 条件请求的304说明缓存中的图片仍然有效，不是错误，让请求正常结束，在didCompleteWithError中回调
+        self.response = response;
+        self.notModified = YES;
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [[NSNotificationCenter defaultCenter] postNotificationName:SDWebImageDownloadReceiveResponseNotification object:self];
+        });
+    }
     else {
         NSUInteger code = ((NSHTTPURLResponse *)response).statusCode;
         
@@ -412,6 +423,9 @@ didReceiveResponse:(NSURLResponse *)response
     
     if (error) {
         [self callCompletionBlocksWithError:error];
+    } else if (self.isNotModified) {
+        // 没有新的图片数据，调用者通过response的状态码知道是304，继续使用缓存中的图片
+        [self callCompletionBlocksWithImage:nil imageData:nil error:nil finished:YES];
     } else {
         if ([self callbacksForKey:kCompletedCallbackKey].count > 0) {
             /**
@@ -10,6 +10,7 @@
 #import "SDWebImageOperation.h"
 #import "SDWebImageDownloader.h"
 #import "SDImageCache.h"
+#import "SDImageCacheStatistics.h"
 
 typedef NS_OPTIONS(NSUInteger, SDWebImageOptions) {
     /**
@@ -35,10 +36,11 @@ typedef NS_OPTIONS(NSUInteger, SDWebImageOptions) {
 
     /**
      * 这个选项帮助处理在同样的网络请求地址下图片的改变（处理图像地址没变，但是实际图片变了的情况）
-     * 即使图像缓存，也要遵守HTTP响应缓存控制，如果需要，可以从远程位置刷新图像
-     * 磁盘缓存将由NSURLCache而不是SDWebImage处理，导致轻微的性能降低。
+     * 即使图像缓存，也要从远程位置刷新图像
      * 如果刷新缓存的图像，完成的block会在使用缓存图像的时候调用，还会在最后的图像被调用
      * 当你不能使你的URL静态与嵌入式缓存
+     * 如果磁盘缓存中保存了下载时的ETag或者Last-Modified，会发送条件请求，服务器返回304时继续使用缓存；
+     * 没有验证信息时重新下载完整的图片。两种情况都不使用NSURLCache，响应只保存在SDImageCache中
      */
     SDWebImageRefreshCached = 1 << 4,
 
@@ -84,7 +86,15 @@ typedef NS_OPTIONS(NSUInteger, SDWebImageOptions) {
     /**
      * 图像将根据其原始大小进行解码。 在iOS上，此标记会将图片缩小到与设备的受限内存兼容的大小。
      */
-    SDWebImageScaleDownLargeImages = 1 << 12
+    SDWebImageScaleDownLargeImages = 1 << 12,
+
+    /**
+     * stale-while-revalidate：先返回缓存的图片，如果缓存已经过了HTTP新鲜期（Cache-Control、Expires或者按Last-Modified估计），
+     * 再用保存的ETag、Last-Modified发送条件请求重新验证。服务器返回304时只更新新鲜期，不会再次调用完成的block，
+     * 图片有变化时和SDWebImageRefreshCached一样用新的图片再调用一次。还在新鲜期内或者没有验证信息时直接使用缓存。
+     * 和SDWebImageRefreshCached不同，不需要NSURLCache，磁盘缓存仍然由SDImageCache处理
+     */
+    SDWebImageRevalidateStaleCached = 1 << 13
 };
 
 typedef void(^SDExternalCompletionBlock)(UIImage * _Nullable image, NSError * _Nullable error, SDImageCacheType cacheType, NSURL * _Nullable imageURL);
@@ -93,9 +103,44 @@ typedef void(^SDInternalCompletionBlock)(UIImage * _Nullable image, NSData * _Nu
 
 typedef NSString * _Nullable (^SDWebImageCacheKeyFilterBlock)(NSURL * _Nullable url);
 
+typedef void(^SDWebImageBatchCacheProgressBlock)(UIImage * _Nonnull image, NSData * _Nullable data, SDImageCacheType cacheType, NSURL * _Nonnull imageURL);
+
+typedef void(^SDWebImageBatchCacheCompletionBlock)(NSDictionary<NSURL *, UIImage *> * _Nonnull images);
+
 
 @class SDWebImageManager;
 
+/**
+ * SDWebImageManager的统计信息快照，通过statistics获取，不会再改变
+ */
+@interface SDWebImageManagerStatistics : NSObject
+
+/** loadImageWithURL:发起的缓存查询数 */
+@property (assign, nonatomic, readonly) NSUInteger requests;
+
+/** 缓存中找到了图片的请求，按照缓存类型区分（需要重新验证的请求也会计入，同时计入downloads） */
+@property (assign, nonatomic, readonly) NSUInteger memoryHits;
+@property (assign, nonatomic, readonly) NSUInteger diskHits;
+
+/** 发起的下载数（包括重新验证），失败的下载数（不包括取消），重新验证时服务器返回304的次数 */
+@property (assign, nonatomic, readonly) NSUInteger downloads;
+@property (assign, nonatomic, readonly) NSUInteger failedDownloads;
+@property (assign, nonatomic, readonly) NSUInteger notModifiedResponses;
+
+/** 下载完成的图片数据的总字节数 */
+@property (assign, nonatomic, readonly) unsigned long long bytesDownloaded;
+
+/** 从发起请求到缓存查询返回结果的时间 */
+@property (strong, nonatomic, readonly, nonnull) SDImageCacheLatencyHistogram *cacheQueryLatency;
+
+/** 从发起下载到下载完成（包括304）的时间，失败的下载不计入 */
+@property (strong, nonatomic, readonly, nonnull) SDImageCacheLatencyHistogram *downloadLatency;
+
+/** imageCache的统计信息，包括各级缓存的命中、读写字节数、解码时间和淘汰数 */
+@property (strong, nonatomic, readonly, nonnull) SDImageCacheStatistics *cacheStatistics;
+
+@end
+
 @protocol SDWebImageManagerDelegate <NSObject>
 
 @optional
@@ -257,9 +302,37 @@ SDWebImageManager *manager = [SDWebImageManager sharedManager];
                    completion:(nullable SDWebImageCheckCacheCompletionBlock)completionBlock;
 
 
+/**
+ * 批量查询一组url对应的缓存图片（只查缓存，不会下载），适合列表、网格一次要显示很多图片的场景
+ *
+ * @param urls            要查询的url
+ * @param options         SDWebImageHighPriority、SDWebImageLowPriority会影响磁盘查询的优先级
+ * @param progressBlock   每找到一张图片调用一次，内存命中时同步调用，磁盘命中时在主线程调用
+ * @param completedBlock  全部查询完成后调用一次，images中只包含找到的图片
+ *
+ * @return 有磁盘查询时返回对应的operation，可以用来取消
+ * @see -[SDImageCache queryCacheForKeys:priority:progress:completed:]
+ */
+- (nullable NSOperation *)queryCachedImagesForURLs:(nonnull NSArray<NSURL *> *)urls
+                                           options:(SDWebImageOptions)options
+                                          progress:(nullable SDWebImageBatchCacheProgressBlock)progressBlock
+                                         completed:(nullable SDWebImageBatchCacheCompletionBlock)completedBlock;
+
 /**
  *Return the cache key for a given URL
+ *
+ * @note 返回的是一个SDImageCacheKey，同一次请求中应该复用这个对象，不要重复调用
  */
 - (nullable NSString *)cacheKeyForURL:(nullable NSURL *)url;
 
+/**
+ * 当前统计信息的快照，计数都是原子操作，不加锁
+ */
+- (nonnull SDWebImageManagerStatistics *)statistics;
+
+/**
+ * 清空管理器自己的统计信息，imageCache的统计需要通过它的resetStatistics单独清空（可能被多个管理器共用）
+ */
+- (void)resetStatistics;
+
 @end
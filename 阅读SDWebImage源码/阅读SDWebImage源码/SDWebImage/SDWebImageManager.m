@@ -9,6 +9,9 @@
 #import "SDWebImageManager.h"
 #import <objc/message.h>
 #import "NSImage+WebCache.h"
+#import "SDImageCacheKey.h"
+#import "SDImageCacheValidators.h"
+#import <stdatomic.h>
 
 // 实现了 SDWebImageOperation 协议的一个简单对象(该协议中只有一个cancel方法)
 // SDWebImageCombinedOperation的作用就是关联缓存和下载的对象，每当有新的图片地址需要下载的时候，就会产生一个新的SDWebImageCombinedOperation实例
@@ -20,6 +23,24 @@
 
 @end
 
+@interface SDWebImageManagerStatistics ()
+
+@property (assign, nonatomic, readwrite) NSUInteger requests;
+@property (assign, nonatomic, readwrite) NSUInteger memoryHits;
+@property (assign, nonatomic, readwrite) NSUInteger diskHits;
+@property (assign, nonatomic, readwrite) NSUInteger downloads;
+@property (assign, nonatomic, readwrite) NSUInteger failedDownloads;
+@property (assign, nonatomic, readwrite) NSUInteger notModifiedResponses;
+@property (assign, nonatomic, readwrite) unsigned long long bytesDownloaded;
+@property (strong, nonatomic, readwrite, nonnull) SDImageCacheLatencyHistogram *cacheQueryLatency;
+@property (strong, nonatomic, readwrite, nonnull) SDImageCacheLatencyHistogram *downloadLatency;
+@property (strong, nonatomic, readwrite, nonnull) SDImageCacheStatistics *cacheStatistics;
+
+@end
+
+@implementation SDWebImageManagerStatistics
+@end
+
 @interface SDWebImageManager ()
 
 // 负责图片缓存相关操作
@@ -36,7 +57,18 @@
 
 @end
 
-@implementation SDWebImageManager
+@implementation SDWebImageManager {
+    // 统计信息，都是原子操作
+    _Atomic uint64_t _requestCount;
+    _Atomic uint64_t _memoryHitCount;
+    _Atomic uint64_t _diskHitCount;
+    _Atomic uint64_t _downloadCount;
+    _Atomic uint64_t _failedDownloadCount;
+    _Atomic uint64_t _notModifiedCount;
+    _Atomic uint64_t _bytesDownloaded;
+    SDImageCacheLatencyRecorder *_cacheQueryLatency;
+    SDImageCacheLatencyRecorder *_downloadLatency;
+}
 
 + (nonnull instancetype)sharedManager {
     static dispatch_once_t once;
@@ -59,6 +91,8 @@
         _imageDownloader = downloader;
         _failedURLs = [NSMutableSet new];
         _runningOperations = [NSMutableArray new];
+        _cacheQueryLatency = [SDImageCacheLatencyRecorder new];
+        _downloadLatency = [SDImageCacheLatencyRecorder new];
     }
     return self;
 }
@@ -70,13 +104,10 @@
         return @"";
     }
 
-    // 如果设置了缓存key的过滤器，过滤一下url
-    if (self.cacheKeyFilter) {
-        return self.cacheKeyFilter(url);
-    } else {
-        // 否则直接使用url
-        return url.absoluteString;
-    }
+    // 如果设置了缓存key的过滤器，过滤一下url，否则直接使用url
+    // 包装成SDImageCacheKey，哈希值和磁盘文件名只计算一次，之后内存缓存、磁盘缓存都直接复用
+    NSString *key = self.cacheKeyFilter ? self.cacheKeyFilter(url) : url.absoluteString;
+    return key ? [SDImageCacheKey keyWithString:key] : nil;
 }
 
 - (void)cachedImageExistsForURL:(nullable NSURL *)url
@@ -166,23 +197,36 @@
     // 通过url来获取到对应的cacheKey
     NSString *key = [self cacheKeyForURL:url];
 
-    // 通过SDWebImageManager的SDImageCache实例调用 queryCacheOperationForKey: done: 方法来返回所需要的这个NSOperation实例。
-    operation.cacheOperation = [self.imageCache queryCacheOperationForKey:key done:^(UIImage *cachedImage, NSData *cachedData, SDImageCacheType cacheType) {
+    // 高优先级的请求在磁盘查询时也排在前面，低优先级的（比如预取）排在最后
+    SDImageCacheQueryPriority queryPriority = [self cacheQueryPriorityForOptions:options];
+
+    atomic_fetch_add_explicit(&_requestCount, 1, memory_order_relaxed);
+    CFAbsoluteTime queryStartTime = CFAbsoluteTimeGetCurrent();
+
+    // 通过SDWebImageManager的SDImageCache实例调用 queryCacheOperationForKey: priority: done: 方法来返回所需要的这个NSOperation实例。
+    operation.cacheOperation = [self.imageCache queryCacheOperationForKey:key priority:queryPriority done:^(UIImage *cachedImage, NSData *cachedData, SDImageCacheType cacheType) {
         // 如果对当前operation进行了取消标记，在SDWebImageManager的runningOperations移除operation
         if (operation.isCancelled) {
             [self safelyRemoveOperationFromRunning:operation];
             return;
         }
+        [self recordCacheQueryResultForImage:cachedImage cacheType:cacheType startTime:queryStartTime];
         
         // 以下四个方法会通过if条件判断中
         // 1. 如果现在下载的图片没有缓存，且没有实现代理方法（这个代理方法是我们自己来实现的）
         // 2. 如果现在下载的图片没有缓存，我们实现了代理方法，但是代理方法返回的是YES
         // 3. 如果下载的方法的options为SDWebImageRefreshCached，且没有实现代理方法（这个代理方法是我们自己来实现的）
         // 4. 如果下载的方法的options为SDWebImageRefreshCached，且我们实现了代理方法，代理方法返回的是YES
-        if ((!cachedImage || options & SDWebImageRefreshCached) && (![self.delegate respondsToSelector:@selector(imageManager:shouldDownloadImageForURL:)] || [self.delegate imageManager:self shouldDownloadImageForURL:url]))
+        // SDWebImageRevalidateStaleCached时，只有缓存保存了验证信息并且过了新鲜期才需要重新验证，和SDWebImageRefreshCached一样处理
+        // 查询验证信息需要读取磁盘索引中的记录，只有需要重新验证的请求才查询，内存命中时不会在主线程多做一次
+        BOOL mayRevalidate = cachedImage && (options & (SDWebImageRefreshCached | SDWebImageRevalidateStaleCached));
+        SDImageCacheValidators *validators = mayRevalidate ? [self.imageCache validatorsForKey:key] : nil;
+        BOOL shouldRevalidate = cachedImage && ((options & SDWebImageRefreshCached)
+                                                || ((options & SDWebImageRevalidateStaleCached) && validators && !validators.isFresh));
+        if ((!cachedImage || shouldRevalidate) && (![self.delegate respondsToSelector:@selector(imageManager:shouldDownloadImageForURL:)] || [self.delegate imageManager:self shouldDownloadImageForURL:url]))
         {
-            if (cachedImage && options & SDWebImageRefreshCached) {
-                // 如果可以找到缓存，且options为SDWebImageRefreshCached，那么就先把缓存的图像数据传递出去
+            if (shouldRevalidate) {
+                // 如果可以找到缓存，且需要重新验证，那么就先把缓存的图像数据传递出去
                 [self callCompletionBlockForOperation:weakOperation completion:completedBlock image:cachedImage data:cachedData error:nil cacheType:cacheType finished:YES url:url];
             }
 
@@ -193,23 +237,32 @@
             // A &= B A与B按位与操作后把值赋给A
             if (options & SDWebImageLowPriority) downloaderOptions |= SDWebImageDownloaderLowPriority;
             if (options & SDWebImageProgressiveDownload) downloaderOptions |= SDWebImageDownloaderProgressiveDownload;
-            if (options & SDWebImageRefreshCached) downloaderOptions |= SDWebImageDownloaderUseNSURLCache;
             if (options & SDWebImageContinueInBackground) downloaderOptions |= SDWebImageDownloaderContinueInBackground;
             if (options & SDWebImageHandleCookies) downloaderOptions |= SDWebImageDownloaderHandleCookies;
             if (options & SDWebImageAllowInvalidSSLCertificates) downloaderOptions |= SDWebImageDownloaderAllowInvalidSSLCertificates;
             if (options & SDWebImageHighPriority) downloaderOptions |= SDWebImageDownloaderHighPriority;
             if (options & SDWebImageScaleDownLargeImages) downloaderOptions |= SDWebImageDownloaderScaleDownLargeImages;
             
-            // 如果可以找到缓存，且options为SDWebImageRefreshCached
-            if (cachedImage && options & SDWebImageRefreshCached) {
+            // 如果可以找到缓存，且需要重新验证
+            if (shouldRevalidate) {
                 // 不让 downloaderOptions 包含 SDWebImageDownloaderProgressiveDownload(渐进式下载)
                 downloaderOptions &= ~SDWebImageDownloaderProgressiveDownload;
                 // 让 downloaderOptions 里必须包含 SDWebImageDownloaderIgnoreCachedResponse(忽略缓存)
                 downloaderOptions |= SDWebImageDownloaderIgnoreCachedResponse;
             }
             
-            SDWebImageDownloadToken *subOperationToken = [self.imageDownloader downloadImageWithURL:url options:downloaderOptions progress:progressBlock completed:^(UIImage *downloadedImage, NSData *downloadedData, NSError *error, BOOL finished)
+            // 有验证信息时发送条件请求，图片没有变化时服务器只返回304
+            // 没有验证信息时直接重新下载，不使用NSURLCache，避免响应在NSURLCache和磁盘缓存中各存一份
+            SDHTTPHeadersDictionary *conditionalHeaders = shouldRevalidate ? [validators conditionalRequestHeaders] : nil;
+
+            atomic_fetch_add_explicit(&self->_downloadCount, 1, memory_order_relaxed);
+            CFAbsoluteTime downloadStartTime = CFAbsoluteTimeGetCurrent();
+
+            // 没有cacheKeyFilter时缓存的key就是url.absoluteString，直接给下载器合并请求用
+            NSString *operationKey = self.cacheKeyFilter ? nil : key;
+            SDWebImageDownloadToken *subOperationToken = [self.imageDownloader downloadImageWithURL:url options:downloaderOptions operationKey:operationKey conditionalHeaders:conditionalHeaders progress:progressBlock completed:^(UIImage *downloadedImage, NSData *downloadedData, NSURLResponse *response, NSError *error, BOOL finished)
             {
+                [self recordDownloadResultWithData:downloadedData response:response error:error finished:finished startTime:downloadStartTime];
                 // block中的__strong 关键字--->防止对象提前释放
                 __strong __typeof(weakOperation) strongOperation = weakOperation;
                 if (!strongOperation || strongOperation.isCancelled) {
@@ -245,9 +298,14 @@
                     // 如果不设定options里包含SDWebImageCacheMemoryOnly，那么cacheOnDisk为YES，表示会把图片缓存到磁盘
                     BOOL cacheOnDisk = !(options & SDWebImageCacheMemoryOnly);
 
-                    if (options & SDWebImageRefreshCached && cachedImage && !downloadedImage) {
-                        // 如果options包含SDWebImageRefreshCached，cachedImage有值，但是下载图像downloadedImage为nil，不调用完成的回调completion block
+                    if (shouldRevalidate && !downloadedImage) {
+                        // 如果需要重新验证，cachedImage有值，但是下载图像downloadedImage为nil，不调用完成的回调completion block
                         // 这里的意思就是虽然现在有缓存图片，但是要强制刷新图片，但是没有下载到图片，那么现在就什么都不做，还是使用原来的缓存图片
+                        // 条件请求收到304时，服务器确认缓存仍然有效，更新验证信息和新鲜期
+                        BOOL notModified = [response isKindOfClass:[NSHTTPURLResponse class]] && ((NSHTTPURLResponse *)response).statusCode == 304;
+                        if (notModified && validators && cacheOnDisk) {
+                            [self.imageCache storeValidators:[validators validatorsByUpdatingWithResponse:response] forKey:key];
+                        }
                     }
                     else if (downloadedImage && (!downloadedImage.images || (options & SDWebImageTransformAnimatedImage)) && [self.delegate respondsToSelector:@selector(imageManager:transformDownloadedImage:withURL:)]) {
                         /*
@@ -263,6 +321,9 @@
                                 BOOL imageWasTransformed = ![transformedImage isEqual:downloadedImage];
                                 // 如果图像被转换，则给imageData传入nil，因此我们可以从图像重新计算数据
                                 [self.imageCache storeImage:transformedImage imageData:(imageWasTransformed ? nil : downloadedData) forKey:key toDisk:cacheOnDisk completion:nil];
+                                if (cacheOnDisk) {
+                                    [self.imageCache storeValidators:[SDImageCacheValidators validatorsWithResponse:response] forKey:key];
+                                }
                             }
                             
                             // 将对应转换后的图片通过block传出去
@@ -273,6 +334,10 @@
                         // 下载好了图片且完成了，存到内存和磁盘，将对应的图片通过block传出去
                         if (downloadedImage && finished) {
                             [self.imageCache storeImage:downloadedImage imageData:downloadedData forKey:key toDisk:cacheOnDisk completion:nil];
+                            // 保存响应中的验证信息，之后可以用条件请求重新验证
+                            if (cacheOnDisk) {
+                                [self.imageCache storeValidators:[SDImageCacheValidators validatorsWithResponse:response] forKey:key];
+                            }
                         }
                         [self callCompletionBlockForOperation:strongOperation completion:completedBlock image:downloadedImage data:downloadedData error:nil cacheType:SDImageCacheTypeNone finished:finished url:url];
                     }
@@ -306,6 +371,58 @@
     return operation;
 }
 
+- (SDImageCacheQueryPriority)cacheQueryPriorityForOptions:(SDWebImageOptions)options {
+    if (options & SDWebImageHighPriority) return SDImageCacheQueryPriorityUserVisible;
+    if (options & SDWebImageLowPriority) return SDImageCacheQueryPriorityPrefetch;
+    return SDImageCacheQueryPriorityNormal;
+}
+
+- (nullable NSOperation *)queryCachedImagesForURLs:(nonnull NSArray<NSURL *> *)urls
+                                           options:(SDWebImageOptions)options
+                                          progress:(nullable SDWebImageBatchCacheProgressBlock)progressBlock
+                                         completed:(nullable SDWebImageBatchCacheCompletionBlock)completedBlock {
+    // 不同的url可能对应同一个key（比如设置了cacheKeyFilter），记录每个key对应的所有url
+    NSMutableDictionary<NSString *, NSMutableArray<NSURL *> *> *urlsForKey = [NSMutableDictionary dictionary];
+    NSMutableArray<NSString *> *keys = [NSMutableArray arrayWithCapacity:urls.count];
+    for (NSURL *url in urls) {
+        NSString *key = [self cacheKeyForURL:url];
+        if (!key) {
+            continue;
+        }
+        NSMutableArray<NSURL *> *keyURLs = urlsForKey[key];
+        if (!keyURLs) {
+            keyURLs = [NSMutableArray array];
+            urlsForKey[key] = keyURLs;
+            [keys addObject:key];
+        }
+        [keyURLs addObject:url];
+    }
+
+    SDCacheBatchQueryProgressBlock keyProgressBlock = nil;
+    if (progressBlock) {
+        keyProgressBlock = ^(UIImage *image, NSData *data, SDImageCacheType cacheType, NSString *key) {
+            for (NSURL *url in urlsForKey[key]) {
+                progressBlock(image, data, cacheType, url);
+            }
+        };
+    }
+    return [self.imageCache queryCacheForKeys:keys
+                                     priority:[self cacheQueryPriorityForOptions:options]
+                                     progress:keyProgressBlock
+                                    completed:^(NSDictionary<NSString *, UIImage *> *images) {
+        if (!completedBlock) {
+            return;
+        }
+        NSMutableDictionary<NSURL *, UIImage *> *urlImages = [NSMutableDictionary dictionaryWithCapacity:images.count];
+        [images enumerateKeysAndObjectsUsingBlock:^(NSString *key, UIImage *image, BOOL *stop) {
+            for (NSURL *url in urlsForKey[key]) {
+                urlImages[url] = image;
+            }
+        }];
+        completedBlock(urlImages);
+    }];
+}
+
 - (void)saveImageToCache:(nullable UIImage *)image forURL:(nullable NSURL *)url {
     if (image && url) {
         NSString *key = [self cacheKeyForURL:url];
@@ -329,6 +446,69 @@
     return isRunning;
 }
 
+#pragma mark - Statistics
+
+- (nonnull SDWebImageManagerStatistics *)statistics {
+    SDWebImageManagerStatistics *statistics = [SDWebImageManagerStatistics new];
+    statistics.requests = (NSUInteger)atomic_load_explicit(&_requestCount, memory_order_relaxed);
+    statistics.memoryHits = (NSUInteger)atomic_load_explicit(&_memoryHitCount, memory_order_relaxed);
+    statistics.diskHits = (NSUInteger)atomic_load_explicit(&_diskHitCount, memory_order_relaxed);
+    statistics.downloads = (NSUInteger)atomic_load_explicit(&_downloadCount, memory_order_relaxed);
+    statistics.failedDownloads = (NSUInteger)atomic_load_explicit(&_failedDownloadCount, memory_order_relaxed);
+    statistics.notModifiedResponses = (NSUInteger)atomic_load_explicit(&_notModifiedCount, memory_order_relaxed);
+    statistics.bytesDownloaded = atomic_load_explicit(&_bytesDownloaded, memory_order_relaxed);
+    statistics.cacheQueryLatency = [_cacheQueryLatency histogram];
+    statistics.downloadLatency = [_downloadLatency histogram];
+    statistics.cacheStatistics = [self.imageCache statistics];
+    return statistics;
+}
+
+- (void)resetStatistics {
+    atomic_store_explicit(&_requestCount, 0, memory_order_relaxed);
+    atomic_store_explicit(&_memoryHitCount, 0, memory_order_relaxed);
+    atomic_store_explicit(&_diskHitCount, 0, memory_order_relaxed);
+    atomic_store_explicit(&_downloadCount, 0, memory_order_relaxed);
+    atomic_store_explicit(&_failedDownloadCount, 0, memory_order_relaxed);
+    atomic_store_explicit(&_notModifiedCount, 0, memory_order_relaxed);
+    atomic_store_explicit(&_bytesDownloaded, 0, memory_order_relaxed);
+    [_cacheQueryLatency reset];
+    [_downloadLatency reset];
+}
+
+- (void)recordCacheQueryResultForImage:(nullable UIImage *)cachedImage cacheType:(SDImageCacheType)cacheType startTime:(CFAbsoluteTime)startTime {
+    [_cacheQueryLatency recordDuration:CFAbsoluteTimeGetCurrent() - startTime];
+    if (!cachedImage) {
+        return;
+    }
+    if (cacheType == SDImageCacheTypeMemory) {
+        atomic_fetch_add_explicit(&_memoryHitCount, 1, memory_order_relaxed);
+    } else if (cacheType == SDImageCacheTypeDisk) {
+        atomic_fetch_add_explicit(&_diskHitCount, 1, memory_order_relaxed);
+    }
+}
+
+// 渐进式下载时回调会调用多次，只在出错或者完成时记录一次
+- (void)recordDownloadResultWithData:(nullable NSData *)data
+                            response:(nullable NSURLResponse *)response
+                               error:(nullable NSError *)error
+                            finished:(BOOL)finished
+                           startTime:(CFAbsoluteTime)startTime {
+    if (error) {
+        if (error.code != NSURLErrorCancelled) {
+            atomic_fetch_add_explicit(&_failedDownloadCount, 1, memory_order_relaxed);
+        }
+        return;
+    }
+    if (!finished) {
+        return;
+    }
+    [_downloadLatency recordDuration:CFAbsoluteTimeGetCurrent() - startTime];
+    atomic_fetch_add_explicit(&_bytesDownloaded, data.length, memory_order_relaxed);
+    if ([response isKindOfClass:[NSHTTPURLResponse class]] && ((NSHTTPURLResponse *)response).statusCode == 304) {
+        atomic_fetch_add_explicit(&_notModifiedCount, 1, memory_order_relaxed);
+    }
+}
+
 - (void)safelyRemoveOperationFromRunning:(nullable SDWebImageCombinedOperation*)operation {
     // 创建一个互斥锁防止现在有别的线程修改 runningOperations
     @synchronized (self.runningOperations) {